@@ -0,0 +1,451 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "drm_atomic.h"
+
+/* ============ Property cache =========== */
+
+static const struct {
+	uint32_t obj_type;
+	const char *name;
+} prop_names[ATOMIC_PROP_MAX] = {
+	[PROP_CONN_CRTC_ID] = { DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID" },
+	[PROP_CRTC_ACTIVE] = { DRM_MODE_OBJECT_CRTC, "ACTIVE" },
+	[PROP_CRTC_MODE_ID] = { DRM_MODE_OBJECT_CRTC, "MODE_ID" },
+	[PROP_PLANE_TYPE] = { DRM_MODE_OBJECT_PLANE, "type" },
+	[PROP_PLANE_FB_ID] = { DRM_MODE_OBJECT_PLANE, "FB_ID" },
+	[PROP_PLANE_CRTC_ID] = { DRM_MODE_OBJECT_PLANE, "CRTC_ID" },
+	[PROP_PLANE_SRC_X] = { DRM_MODE_OBJECT_PLANE, "SRC_X" },
+	[PROP_PLANE_SRC_Y] = { DRM_MODE_OBJECT_PLANE, "SRC_Y" },
+	[PROP_PLANE_SRC_W] = { DRM_MODE_OBJECT_PLANE, "SRC_W" },
+	[PROP_PLANE_SRC_H] = { DRM_MODE_OBJECT_PLANE, "SRC_H" },
+	[PROP_PLANE_CRTC_X] = { DRM_MODE_OBJECT_PLANE, "CRTC_X" },
+	[PROP_PLANE_CRTC_Y] = { DRM_MODE_OBJECT_PLANE, "CRTC_Y" },
+	[PROP_PLANE_CRTC_W] = { DRM_MODE_OBJECT_PLANE, "CRTC_W" },
+	[PROP_PLANE_CRTC_H] = { DRM_MODE_OBJECT_PLANE, "CRTC_H" },
+	[PROP_PLANE_FB_DAMAGE_CLIPS] = { DRM_MODE_OBJECT_PLANE, "FB_DAMAGE_CLIPS" },
+};
+
+/*
+ * The only place drmModeGetProperty gets called: once per property of the
+ * object, to match the names. value is set to the value of 'want', if any.
+ */
+static int cache_props(int drm_fd, struct atomic_object *obj, uint32_t id, uint32_t type,
+		enum atomic_prop want, uint64_t *value)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyPtr prop;
+	int i, p;
+
+	memset(obj, 0, sizeof(*obj));
+	obj->id = id;
+	obj->type = type;
+
+	props = drmModeObjectGetProperties(drm_fd, id, type);
+	if (!props) {
+		printf("Failed to get properties of object %u\n", id);
+		return -1;
+	}
+
+	for (i = 0; i < props->count_props; i++) {
+		prop = drmModeGetProperty(drm_fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		for (p = 0; p < ATOMIC_PROP_MAX; p++) {
+			if (prop_names[p].obj_type == type && !strcmp(prop->name, prop_names[p].name)) {
+				obj->props[p] = prop->prop_id;
+				if (p == want && value)
+					*value = props->prop_values[i];
+			}
+		}
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+	return 0;
+}
+
+static int add_prop(drmModeAtomicReqPtr req, struct atomic_object *obj,
+		enum atomic_prop prop, uint64_t value)
+{
+	if (!obj->props[prop]) {
+		printf("Object %u has no %s property\n", obj->id, prop_names[prop].name);
+		return -EINVAL;
+	}
+
+	return drmModeAtomicAddProperty(req, obj->id, obj->props[prop], value) < 0 ? -EINVAL : 0;
+}
+
+/* ============ Setup =========== */
+
+static int find_planes(struct drm_atomic *atomic)
+{
+	drmModePlaneResPtr res;
+	struct atomic_plane *plane;
+	drmModePlanePtr info;
+	int i;
+
+	res = drmModeGetPlaneResources(atomic->drm_fd);
+	if (!res) {
+		printf("Failed to get plane resources\n");
+		return -1;
+	}
+
+	atomic->primary = -1;
+	for (i = 0; i < res->count_planes && atomic->num_planes < ATOMIC_MAX_PLANES; i++) {
+		info = drmModeGetPlane(atomic->drm_fd, res->planes[i]);
+		if (!info)
+			continue;
+
+		if (!(info->possible_crtcs & atomic->crtc_mask)) {
+			drmModeFreePlane(info);
+			continue;
+		}
+
+		plane = &atomic->planes[atomic->num_planes];
+		if (cache_props(atomic->drm_fd, &plane->obj, info->plane_id, DRM_MODE_OBJECT_PLANE,
+				PROP_PLANE_TYPE, &plane->type)) {
+			drmModeFreePlane(info);
+			continue;
+		}
+
+		plane->info = info;
+
+		/* The first primary which can go on the CRTC, prefer the one already on it */
+		if (plane->type == DRM_PLANE_TYPE_PRIMARY &&
+			(atomic->primary < 0 || info->crtc_id == atomic->crtc.id))
+			atomic->primary = atomic->num_planes;
+
+		atomic->num_planes++;
+	}
+
+	drmModeFreePlaneResources(res);
+
+	if (atomic->primary < 0) {
+		printf("No primary plane for CRTC %u\n", atomic->crtc.id);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int crtc_mask(int drm_fd, uint32_t crtc_id)
+{
+	drmModeResPtr res = drmModeGetResources(drm_fd);
+	int i, mask = 0;
+
+	if (!res)
+		return 0;
+
+	for (i = 0; i < res->count_crtcs; i++) {
+		if (res->crtcs[i] == crtc_id)
+			mask = 1 << i;
+	}
+
+	drmModeFreeResources(res);
+	return mask;
+}
+
+int atomic_init(struct drm_atomic *atomic, int drm_fd, struct drm_display *display)
+{
+	memset(atomic, 0, sizeof(*atomic));
+	atomic->drm_fd = drm_fd;
+	atomic->display = display;
+
+	if (drmSetClientCap(drm_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) ||
+		drmSetClientCap(drm_fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+		printf("Driver doesn't support atomic modesetting\n");
+		return -1;
+	}
+
+	atomic->crtc_mask = crtc_mask(drm_fd, display->crtc_id);
+	if (!atomic->crtc_mask) {
+		printf("CRTC %u not found\n", display->crtc_id);
+		goto fail;
+	}
+
+	if (cache_props(drm_fd, &atomic->conn, display->conn_id, DRM_MODE_OBJECT_CONNECTOR, 0, NULL) ||
+		cache_props(drm_fd, &atomic->crtc, display->crtc_id, DRM_MODE_OBJECT_CRTC, 0, NULL) ||
+		find_planes(atomic))
+		goto fail;
+
+	if (drmModeCreatePropertyBlob(drm_fd, &display->mode, sizeof(display->mode),
+			&atomic->mode_blob)) {
+		printf("Failed to create mode blob\n");
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	atomic_fini(atomic);
+	drmSetClientCap(drm_fd, DRM_CLIENT_CAP_ATOMIC, 0);
+	return -1;
+}
+
+void atomic_fini(struct drm_atomic *atomic)
+{
+	int i;
+
+	for (i = 0; i < atomic->num_planes; i++)
+		drmModeFreePlane(atomic->planes[i].info);
+	atomic->num_planes = 0;
+
+	if (atomic->mode_blob)
+		drmModeDestroyPropertyBlob(atomic->drm_fd, atomic->mode_blob);
+	atomic->mode_blob = 0;
+}
+
+void atomic_plane_set(struct drm_atomic *atomic, int plane, const struct atomic_plane_state *state)
+{
+	atomic->planes[plane].state = *state;
+	atomic->planes[plane].changed = 1;
+}
+
+/*
+ * Shown by someone else when we started: on another CRTC, or with an fb
+ * which can't be ours as none was committed yet. info is from then, what
+ * this tool put on a plane since is in its state.
+ */
+static int plane_foreign(struct drm_atomic *atomic, struct atomic_plane *plane)
+{
+	return plane->info->fb_id ||
+		(plane->info->crtc_id && plane->info->crtc_id != atomic->crtc.id);
+}
+
+int atomic_find_overlay(struct drm_atomic *atomic, uint32_t format)
+{
+	struct atomic_plane *plane;
+	int i, f;
+
+	for (i = 0; i < atomic->num_planes; i++) {
+		plane = &atomic->planes[i];
+		if (plane->type != DRM_PLANE_TYPE_OVERLAY || plane->state.fb_id ||
+			plane_foreign(atomic, plane))
+			continue;
+
+		for (f = 0; f < plane->info->count_formats; f++) {
+			if (plane->info->formats[f] == format)
+				return i;
+		}
+	}
+
+	return -1;
+}
+
+/* ============ Commits =========== */
+
+static int add_plane(struct drm_atomic *atomic, drmModeAtomicReqPtr req, struct atomic_plane *plane)
+{
+	struct atomic_object *obj = &plane->obj;
+	struct atomic_plane_state *st = &plane->state;
+	int ret;
+
+	if (!st->fb_id)
+		return add_prop(req, obj, PROP_PLANE_FB_ID, 0) |
+			add_prop(req, obj, PROP_PLANE_CRTC_ID, 0);
+
+	ret = add_prop(req, obj, PROP_PLANE_FB_ID, st->fb_id);
+	ret |= add_prop(req, obj, PROP_PLANE_CRTC_ID, atomic->crtc.id);
+	ret |= add_prop(req, obj, PROP_PLANE_SRC_X, (uint64_t)st->src_x << 16);
+	ret |= add_prop(req, obj, PROP_PLANE_SRC_Y, (uint64_t)st->src_y << 16);
+	ret |= add_prop(req, obj, PROP_PLANE_SRC_W, (uint64_t)st->src_w << 16);
+	ret |= add_prop(req, obj, PROP_PLANE_SRC_H, (uint64_t)st->src_h << 16);
+	ret |= add_prop(req, obj, PROP_PLANE_CRTC_X, st->crtc_x);
+	ret |= add_prop(req, obj, PROP_PLANE_CRTC_Y, st->crtc_y);
+	ret |= add_prop(req, obj, PROP_PLANE_CRTC_W, st->crtc_w);
+	ret |= add_prop(req, obj, PROP_PLANE_CRTC_H, st->crtc_h);
+	return ret;
+}
+
+/* The primary plane showing all of fb, full screen */
+static void primary_state(struct drm_atomic *atomic, struct fb *fb)
+{
+	struct atomic_plane_state st = {
+		.fb_id = fb->fb_fd,
+		.src_w = fb->x,
+		.src_h = fb->y,
+		.crtc_w = atomic->display->mode.hdisplay,
+		.crtc_h = atomic->display->mode.vdisplay,
+	};
+
+	atomic_plane_set(atomic, atomic->primary, &st);
+}
+
+/* The clips as an FB_DAMAGE_CLIPS blob, 0 if that fails */
+static uint32_t damage_blob(struct drm_atomic *atomic, drmModeClipPtr clips, int num_clips)
+{
+	struct drm_mode_rect rects[PAINT_DAMAGE_MAX];
+	uint32_t blob = 0;
+	int i;
+
+	if (num_clips > PAINT_DAMAGE_MAX)
+		return 0;
+
+	for (i = 0; i < num_clips; i++) {
+		rects[i].x1 = clips[i].x1;
+		rects[i].y1 = clips[i].y1;
+		rects[i].x2 = clips[i].x2;
+		rects[i].y2 = clips[i].y2;
+	}
+
+	if (drmModeCreatePropertyBlob(atomic->drm_fd, rects, sizeof(rects[0]) * num_clips, &blob))
+		return 0;
+
+	return blob;
+}
+
+/*
+ * Commit the changed planes, and the modeset if asked for. Anything other
+ * than a plain flip of the primary gets a TEST_ONLY check first, so that a
+ * setup the hardware can't do fails without touching the screen.
+ */
+static int atomic_commit(struct drm_atomic *atomic, uint32_t flags, uint32_t damage, void *data)
+{
+	struct atomic_plane *primary = &atomic->planes[atomic->primary];
+	int modeset = flags & DRM_MODE_ATOMIC_ALLOW_MODESET;
+	drmModeAtomicReqPtr req;
+	int test = modeset;
+	int i, ret;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	if (modeset) {
+		ret = add_prop(req, &atomic->conn, PROP_CONN_CRTC_ID, atomic->crtc.id);
+		ret |= add_prop(req, &atomic->crtc, PROP_CRTC_MODE_ID, atomic->mode_blob);
+		ret |= add_prop(req, &atomic->crtc, PROP_CRTC_ACTIVE, 1);
+		if (ret)
+			goto out;
+	}
+
+	for (i = 0; i < atomic->num_planes; i++) {
+		if (!atomic->planes[i].changed)
+			continue;
+
+		/* A new FB on the primary is just a flip, anything else is a new setup */
+		if (i != atomic->primary)
+			test = 1;
+
+		ret = add_plane(atomic, req, &atomic->planes[i]);
+		if (ret)
+			goto out;
+	}
+
+	if (damage) {
+		ret = add_prop(req, &primary->obj, PROP_PLANE_FB_ID, primary->state.fb_id);
+		ret |= add_prop(req, &primary->obj, PROP_PLANE_FB_DAMAGE_CLIPS, damage);
+		if (ret)
+			goto out;
+	}
+
+	if (test) {
+		ret = drmModeAtomicCommit(atomic->drm_fd, req,
+				DRM_MODE_ATOMIC_TEST_ONLY | (flags & DRM_MODE_ATOMIC_ALLOW_MODESET), NULL);
+		if (ret) {
+			printf("Atomic check failed, ret=%d\n", ret);
+			goto out;
+		}
+	}
+
+	ret = drmModeAtomicCommit(atomic->drm_fd, req, flags, data);
+	if (ret) {
+		printf("Atomic commit failed, ret=%d\n", ret);
+		goto out;
+	}
+
+out:
+	for (i = 0; i < atomic->num_planes; i++) {
+		if (!atomic->planes[i].changed)
+			continue;
+
+		if (ret)
+			atomic->planes[i].state = atomic->planes[i].committed;
+		else
+			atomic->planes[i].committed = atomic->planes[i].state;
+		atomic->planes[i].changed = 0;
+	}
+
+	drmModeAtomicFree(req);
+	return ret;
+}
+
+int atomic_commit_planes(struct drm_atomic *atomic)
+{
+	return atomic_commit(atomic, 0, 0, NULL);
+}
+
+/* ============ Swapchain ops =========== */
+
+static int atomic_set_crtc(struct swapchain *sc, struct fb *fb)
+{
+	struct drm_atomic *atomic = sc->priv;
+
+	primary_state(atomic, fb);
+	return atomic_commit(atomic, DRM_MODE_ATOMIC_ALLOW_MODESET, 0, NULL);
+}
+
+static int atomic_page_flip(struct swapchain *sc, struct fb *fb)
+{
+	struct drm_atomic *atomic = sc->priv;
+
+	primary_state(atomic, fb);
+	return atomic_commit(atomic, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, 0, sc);
+}
+
+/*
+ * An update of the buffer on screen: the same FB again, with the damage.
+ * A flip carries none, the damage would have to be against the frame it
+ * replaces and not against what was last painted in its own buffer.
+ */
+static int atomic_dirty_fb(struct swapchain *sc, struct fb *fb, drmModeClipPtr clips, int num_clips)
+{
+	struct drm_atomic *atomic = sc->priv;
+	uint32_t blob = 0;
+	int ret;
+
+	if (atomic->planes[atomic->primary].obj.props[PROP_PLANE_FB_DAMAGE_CLIPS])
+		blob = damage_blob(atomic, clips, num_clips);
+
+	if (!blob)
+		return swapchain_drm_dirty_fb(sc, fb, clips, num_clips);
+
+	ret = atomic_commit(atomic, 0, blob, NULL);
+	drmModeDestroyPropertyBlob(atomic->drm_fd, blob);
+	return ret;
+}
+
+const struct swapchain_ops swapchain_atomic_ops = {
+	.set_crtc = atomic_set_crtc,
+	.page_flip = atomic_page_flip,
+	.wait_event = swapchain_drm_wait_event,
+	.handle_event = swapchain_drm_handle_event,
+	.dirty_fb = atomic_dirty_fb,
+};
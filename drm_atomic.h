@@ -0,0 +1,123 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Atomic modesetting: the connector, CRTC and plane state of a frame goes
+ * in one drmModeAtomicReq, checked with TEST_ONLY first when the setup
+ * changed, and committed non-blocking. The property IDs of each object get
+ * looked up once, at init.
+ */
+#ifndef __DRM_ATOMIC_H__
+#define __DRM_ATOMIC_H__
+
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "drm_display.h"
+#include "drm_swapchain.h"
+
+#define ATOMIC_MAX_PLANES 16
+
+/* The properties the commits use, each object has some of them */
+enum atomic_prop {
+	PROP_CONN_CRTC_ID,
+	PROP_CRTC_ACTIVE,
+	PROP_CRTC_MODE_ID,
+	PROP_PLANE_TYPE,
+	PROP_PLANE_FB_ID,
+	PROP_PLANE_CRTC_ID,
+	PROP_PLANE_SRC_X,
+	PROP_PLANE_SRC_Y,
+	PROP_PLANE_SRC_W,
+	PROP_PLANE_SRC_H,
+	PROP_PLANE_CRTC_X,
+	PROP_PLANE_CRTC_Y,
+	PROP_PLANE_CRTC_W,
+	PROP_PLANE_CRTC_H,
+	PROP_PLANE_FB_DAMAGE_CLIPS,
+	ATOMIC_PROP_MAX,
+};
+
+struct atomic_object {
+	uint32_t id;
+	uint32_t type;
+	/* 0 where the object doesn't have the property */
+	uint32_t props[ATOMIC_PROP_MAX];
+};
+
+/* Where a plane scans out from, and to: src in pixels, not 16.16 */
+struct atomic_plane_state {
+	uint32_t fb_id;
+	int src_x, src_y, src_w, src_h;
+	int crtc_x, crtc_y, crtc_w, crtc_h;
+};
+
+struct atomic_plane {
+	struct atomic_object obj;
+	/* DRM_PLANE_TYPE_* */
+	uint64_t type;
+	drmModePlanePtr info;
+	struct atomic_plane_state state;
+	/* What the last commit put on screen, state goes back to it if one fails */
+	struct atomic_plane_state committed;
+	/* state goes in the next commit */
+	int changed;
+};
+
+struct drm_atomic {
+	int drm_fd;
+	struct drm_display *display;
+	struct atomic_object conn;
+	struct atomic_object crtc;
+	/* Bit of the CRTC in the planes' possible_crtcs */
+	uint32_t crtc_mask;
+	uint32_t mode_blob;
+
+	int num_planes;
+	struct atomic_plane planes[ATOMIC_MAX_PLANES];
+	/* Index of the primary plane of the CRTC */
+	int primary;
+};
+
+/* Swapchain ops doing the modeset and flips atomically, priv is a drm_atomic */
+extern const struct swapchain_ops swapchain_atomic_ops;
+
+/* Fails if the driver can't do atomic, the caller can fall back to legacy then */
+int atomic_init(struct drm_atomic *atomic, int drm_fd, struct drm_display *display);
+void atomic_fini(struct drm_atomic *atomic);
+
+/*
+ * Stage a plane for the next commit, together with the primary plane's
+ * flip. fb_id 0 turns the plane off.
+ */
+void atomic_plane_set(struct drm_atomic *atomic, int plane, const struct atomic_plane_state *state);
+
+/*
+ * An overlay plane of the CRTC which is off and can scan out format, -1 if
+ * none. Planes another CRTC or client was using at atomic_init are left alone.
+ */
+int atomic_find_overlay(struct drm_atomic *atomic, uint32_t format);
+
+/* Commit the staged planes now, without a flip of the primary */
+int atomic_commit_planes(struct drm_atomic *atomic);
+
+#endif
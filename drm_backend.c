@@ -0,0 +1,221 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "drm_backend.h"
+#include "drm_buffer_pool.h"
+
+/* ============ KMS device =========== */
+
+static void dump_videomodes(drmModeConnector *conn)
+{
+	int i;
+	drmModeModeInfo *mode;
+
+	printf("\n\t================================\n");
+	for (i = 0; i < conn->count_modes; i ++) {
+		mode = &conn->modes[i];
+		printf("\tMode:%s %dx%d clock %d\n", mode->name, mode->hdisplay, mode->vdisplay, mode->clock);
+	}
+	printf("\t================================\n");
+}
+
+static void dump_props(int fd, uint32_t *props, int prop_count)
+{
+	int i;
+	drmModePropertyPtr prop;
+
+	if (!prop_count || !props)
+	return;
+
+	printf("\n\t================================\n");
+	for (i = 0; i < prop_count; i++) {
+		prop = drmModeGetProperty(fd, props[i]);
+		if (prop) {
+			printf("\t %s:id %d\n", prop->name, prop->prop_id);
+			drmModeFreeProperty(prop);
+		}
+	}
+	printf("\t================================\n");
+}
+
+static int drm_get_display(struct backend *be, struct drm_display *display)
+{
+	int drm_fd = be->drm_fd;
+	int i, ret = 0;
+	uint32_t active_crtc;
+	drmModeRes *res;
+	drmModeCrtc *crtc;
+	drmModeEncoder *enc;
+	drmModeModeInfo *mode;
+	drmModeConnector *conn;
+
+	res = drmModeGetResources(drm_fd);
+	if (!res) {
+		printf("Failed to get resources\n");
+		ret = -1;
+		goto fail_res;
+	}
+
+	if (be->verbose) {
+		printf("Resources of card: CRTCs:%d Connectors:%d Encoders:%d FBs: %d\n",
+			res->count_crtcs, res->count_connectors, res->count_encoders,
+			res->count_fbs);
+	}
+
+	/* Get the first connected connector */
+	for (i = 0; i < res->count_connectors; i++) {
+		conn = drmModeGetConnector(drm_fd, res->connectors[i]);
+
+		if (be->verbose) {
+			printf("Connector %d: properties: %d\n", conn->connector_id, conn->count_props);
+			dump_props(drm_fd, conn->props, conn->count_props);
+		}
+
+		if (conn->connection == DRM_MODE_CONNECTED)
+			break;
+
+		drmModeFreeConnector(conn);
+		conn = NULL;
+	}
+
+	if (!conn) {
+		printf("No connected connector found\n");
+		ret = -1;
+		goto fail_conn;
+	}
+
+	printf("Picking Connector: id:%d \n", conn->connector_id);
+
+	if (be->verbose && conn->count_modes) {
+		printf("Supported Videomodes on connector:%d\n", conn->count_modes);
+		dump_videomodes(conn);
+	}
+
+	/* Get the preferred resolution */
+	for (i = 0; i < conn->count_modes; i++) {
+		mode = &conn->modes[i];
+
+		if (mode->type & DRM_MODE_TYPE_PREFERRED)
+			break;
+		mode = NULL;
+	}
+
+	if (!mode) {
+		printf("No preferred mode found\n");
+		ret = -1;
+		goto fail_conn;
+	}
+
+	printf("Picking Mode: %dx%d clk %d\n", mode->hdisplay, mode->vdisplay, mode->clock);
+
+	/* Get the enc coupled with connector */
+	enc = drmModeGetEncoder(drm_fd, conn->encoder_id);
+	if (!enc) {
+		printf("No encoder found\n");
+		ret = -1;
+		goto fail_enc;
+	}
+
+	printf("Picking encoder:%d\n", enc->encoder_id);
+
+	/* Get the CRTC on which encoder is active */
+	active_crtc = enc->crtc_id;
+	crtc = drmModeGetCrtc(drm_fd, active_crtc);
+	if (!crtc) {
+		printf("No CRTC found\n");
+		ret = -1;
+		goto fail_crtc;
+	}
+
+	printf("Found CRTC: %d\n", crtc->crtc_id);
+
+	/* Steal required info */
+	display->crtc_id = crtc->crtc_id;
+	display->conn_id = conn->connector_id;
+	display->enc_id = enc->encoder_id;
+	memcpy(&display->mode, mode, sizeof(*mode));
+	ret = 0;
+
+fail_crtc:
+	drmModeFreeEncoder(enc);
+
+fail_enc:
+	drmModeFreeConnector(conn);
+
+fail_conn:
+	drmModeFreeResources(res);
+
+fail_res:
+	return ret;
+}
+
+static int drm_create_buffer(struct backend *be, struct fb *fb)
+{
+	return create_drm_buffer(be->drm_fd, fb);
+}
+
+static void drm_release_buffer(struct backend *be, struct fb *fb)
+{
+	release_drm_buffer(be->drm_fd, fb);
+}
+
+static void drm_fini(struct backend *be)
+{
+	close(be->drm_fd);
+}
+
+static const struct backend_ops drm_backend_ops = {
+	.get_display = drm_get_display,
+	.create_buffer = drm_create_buffer,
+	.release_buffer = drm_release_buffer,
+	.fini = drm_fini,
+};
+
+int backend_drm_init(struct backend *be, const char *device, int verbose)
+{
+	memset(be, 0, sizeof(*be));
+
+	be->drm_fd = open(device, O_RDWR | O_CLOEXEC);
+	if (be->drm_fd < 0) {
+		printf("Failed to open graphic card %s: %m\n", device);
+		return -1;
+	}
+
+	be->ops = &drm_backend_ops;
+	be->kms = 1;
+	be->verbose = verbose;
+	return 0;
+}
+
+void backend_fini(struct backend *be)
+{
+	if (be->ops)
+		be->ops->fini(be);
+	memset(be, 0, sizeof(*be));
+}
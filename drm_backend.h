@@ -0,0 +1,73 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Where drm_draw_pixels draws: a KMS device, or a headless one which only
+ * lives in memory. A backend finds the display, creates and releases the
+ * framebuffers, and brings the swapchain ops to present them with.
+ */
+#ifndef __DRM_BACKEND_H__
+#define __DRM_BACKEND_H__
+
+#include <stdint.h>
+#include "drm_display.h"
+#include "drm_swapchain.h"
+
+struct backend;
+
+struct backend_ops {
+	/* The connector, CRTC and mode to draw on */
+	int (*get_display)(struct backend *be, struct drm_display *display);
+	/* fb->x, fb->y and fb->format say what to create, mapped and cleared */
+	int (*create_buffer)(struct backend *be, struct fb *fb);
+	void (*release_buffer)(struct backend *be, struct fb *fb);
+	void (*fini)(struct backend *be);
+};
+
+struct backend {
+	const struct backend_ops *ops;
+	/* How frames get presented, NULL for the legacy libdrm ops */
+	const struct swapchain_ops *sc_ops;
+	/* What the swapchain waits for events on */
+	int drm_fd;
+	/* A real KMS device, which can do atomic and overlay planes */
+	int kms;
+	int verbose;
+	void *priv;
+};
+
+int backend_drm_init(struct backend *be, const char *device, int verbose);
+
+struct headless_config {
+	int width;
+	int height;
+	/* Simulated vblanks per second, 0 completes every flip right away */
+	int refresh;
+	/* Every frame put on screen is written here as a PPM, if set */
+	const char *dump_dir;
+};
+
+int backend_headless_init(struct backend *be, const struct headless_config *cfg, int verbose);
+
+void backend_fini(struct backend *be);
+
+#endif
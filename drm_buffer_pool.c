@@ -0,0 +1,264 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "drm_buffer_pool.h"
+
+/* ============ Dumb buffers =========== */
+
+int create_drm_buffer(int drm_fd, struct fb *fb)
+{
+	struct drm_mode_create_dumb creq;
+	struct drm_mode_map_dumb mreq;
+	struct drm_mode_destroy_dumb dreq;
+	uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+	int ret;
+
+	if (!paint_format_cpp(fb->format)) {
+		printf("Can't create buffer, format 0x%x not supported\n", fb->format);
+		return -EINVAL;
+	}
+
+	/* create dumb buffer */
+	memset(&creq, 0, sizeof(creq));
+	creq.width = fb->x;
+	creq.height = fb->y;
+	creq.bpp = paint_format_cpp(fb->format) * 8;
+	ret = drmIoctl(drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
+	if (ret < 0) {
+		printf("cannot create dumb buffer (%d): %m\n", errno);
+		return -errno;
+	}
+
+	fb->stride = creq.pitch;
+	fb->size = creq.size;
+	fb->handle = creq.handle;
+
+	/* create framebuffer object for the dumb-buffer */
+	handles[0] = fb->handle;
+	pitches[0] = fb->stride;
+	ret = drmModeAddFB2(drm_fd, fb->x, fb->y, fb->format, handles, pitches, offsets,
+			(uint32_t *)&fb->fb_fd, 0);
+	if (ret) {
+		printf("cannot create framebuffer (%d): %m\n", errno);
+		ret = -errno;
+		goto err_destroy;
+	}
+
+	/* prepare buffer for memory mapping */
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.handle = fb->handle;
+	ret = drmIoctl(drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
+	if (ret) {
+		printf("cannot map dumb buffer (%d): %m\n", errno);
+		ret = -errno;
+		goto err_fb;
+	}
+
+	/* perform actual memory mapping */
+	/* Fault all of it in now, and not while painting the first frame */
+	fb->mapped_fb = mmap(0, fb->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			drm_fd, mreq.offset);
+	if (fb->mapped_fb == MAP_FAILED) {
+		printf("cannot mmap dumb buffer (%d): %m\n", errno);
+		ret = -errno;
+		goto err_fb;
+	}
+
+	/* clear the framebuffer to 0 */
+	memset(fb->mapped_fb, 0, fb->size);
+	return 0;
+
+err_fb:
+	drmModeRmFB(drm_fd, fb->fb_fd);
+
+err_destroy:
+	memset(&dreq, 0, sizeof(dreq));
+	dreq.handle = fb->handle;
+	drmIoctl(drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+	return ret;
+}
+
+void release_drm_buffer(int drm_fd, struct fb *fb)
+{
+	struct drm_mode_destroy_dumb dreq;
+
+	munmap(fb->mapped_fb, fb->size);
+	drmModeRmFB(drm_fd, fb->fb_fd);
+
+	memset(&dreq, 0, sizeof(dreq));
+	dreq.handle = fb->handle;
+
+	drmIoctl(drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+}
+
+/* ============ Buffer pool =========== */
+
+int buffer_pool_init(struct buffer_pool *pool, struct backend *be, int max_idle)
+{
+	if (max_idle < 0 || max_idle > BUFFER_POOL_MAX) {
+		printf("Pool can keep 0 to %d idle buffers\n", BUFFER_POOL_MAX);
+		return -1;
+	}
+
+	memset(pool, 0, sizeof(*pool));
+	pool->be = be;
+	pool->max_idle = max_idle;
+	return 0;
+}
+
+static int entry_used(struct buffer_pool_entry *e)
+{
+	return e->fb.mapped_fb != NULL;
+}
+
+/* The shadow is the tool's, but it goes with the buffer */
+static void release_buffer(struct buffer_pool *pool, struct fb *fb)
+{
+	if (fb->shadow) {
+		paint_shadow_fini(fb->shadow);
+		free(fb->shadow);
+		fb->shadow = NULL;
+	}
+
+	pool->be->ops->release_buffer(pool->be, fb);
+}
+
+static void evict(struct buffer_pool *pool, struct buffer_pool_entry *e)
+{
+	release_buffer(pool, &e->fb);
+	memset(e, 0, sizeof(*e));
+	pool->evictions++;
+}
+
+/* The least recently put idle buffer, NULL if all are in use */
+static struct buffer_pool_entry *lru_idle(struct buffer_pool *pool)
+{
+	struct buffer_pool_entry *lru = NULL, *e;
+	int i;
+
+	for (i = 0; i < BUFFER_POOL_MAX; i++) {
+		e = &pool->entries[i];
+		if (entry_used(e) && !e->in_use && (!lru || e->last_used < lru->last_used))
+			lru = e;
+	}
+
+	return lru;
+}
+
+struct fb *buffer_pool_get(struct buffer_pool *pool, int width, int height, uint32_t format)
+{
+	struct buffer_pool_entry *e, *hit = NULL, *slot = NULL;
+	int i;
+
+	for (i = 0; i < BUFFER_POOL_MAX; i++) {
+		e = &pool->entries[i];
+		if (!entry_used(e)) {
+			if (!slot)
+				slot = e;
+			continue;
+		}
+
+		/* The most recent match, it's the likeliest to still be in cache */
+		if (!e->in_use && e->fb.x == width && e->fb.y == height &&
+			e->fb.format == format && (!hit || e->last_used > hit->last_used))
+			hit = e;
+	}
+
+	if (hit) {
+		pool->hits++;
+		hit->in_use = 1;
+		return &hit->fb;
+	}
+
+	pool->misses++;
+
+	/* All slots taken, make room by dropping the LRU idle buffer */
+	if (!slot) {
+		slot = lru_idle(pool);
+		if (!slot) {
+			printf("Buffer pool full, %d buffers in use\n", BUFFER_POOL_MAX);
+			return NULL;
+		}
+		evict(pool, slot);
+	}
+
+	slot->fb.x = width;
+	slot->fb.y = height;
+	slot->fb.format = format;
+	slot->fb.d = paint_format_cpp(format);
+	if (pool->be->ops->create_buffer(pool->be, &slot->fb)) {
+		memset(slot, 0, sizeof(*slot));
+		return NULL;
+	}
+
+	slot->in_use = 1;
+	return &slot->fb;
+}
+
+void buffer_pool_put(struct buffer_pool *pool, struct fb *fb)
+{
+	struct buffer_pool_entry *e = (struct buffer_pool_entry *)fb;
+	int idle = 0;
+	int i;
+
+	if (e < pool->entries || e >= pool->entries + BUFFER_POOL_MAX || !e->in_use) {
+		printf("Buffer not from this pool\n");
+		return;
+	}
+
+	e->in_use = 0;
+	e->last_used = ++pool->tick;
+
+	for (i = 0; i < BUFFER_POOL_MAX; i++) {
+		if (entry_used(&pool->entries[i]) && !pool->entries[i].in_use)
+			idle++;
+	}
+
+	for (; idle > pool->max_idle; idle--)
+		evict(pool, lru_idle(pool));
+}
+
+void buffer_pool_fini(struct buffer_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < BUFFER_POOL_MAX; i++) {
+		if (entry_used(&pool->entries[i]))
+			release_buffer(pool, &pool->entries[i].fb);
+	}
+
+	memset(pool->entries, 0, sizeof(pool->entries));
+}
+
+void buffer_pool_dump_stats(struct buffer_pool *pool)
+{
+	printf("Buffer pool: %lu hits, %lu misses, %lu evictions\n",
+		pool->hits, pool->misses, pool->evictions);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Dumb buffers: creating one takes CREATE_DUMB, ADDFB, MAP_DUMB and an
+ * mmap, and releasing it undoes all four. The pool keeps released buffers
+ * mapped, and hands them out again for the same width, height and format.
+ */
+#ifndef __DRM_BUFFER_POOL_H__
+#define __DRM_BUFFER_POOL_H__
+
+#include <stdint.h>
+#include "drm_display.h"
+#include "drm_backend.h"
+
+#define BUFFER_POOL_MAX 8
+
+struct buffer_pool_entry {
+	/* First, so that a put can go from the fb back to its entry */
+	struct fb fb;
+	int in_use;
+	/* Pool tick of the last put, the smallest one is the LRU */
+	uint64_t last_used;
+};
+
+struct buffer_pool {
+	/* Creates and releases the buffers */
+	struct backend *be;
+	/* Buffers kept around while not in use, the LRU ones beyond get released */
+	int max_idle;
+	uint64_t tick;
+	struct buffer_pool_entry entries[BUFFER_POOL_MAX];
+
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+};
+
+/* Dumb buffers, for the KMS backend. fb->x, fb->y and fb->format say what to create */
+int create_drm_buffer(int drm_fd, struct fb *fb);
+void release_drm_buffer(int drm_fd, struct fb *fb);
+
+int buffer_pool_init(struct buffer_pool *pool, struct backend *be, int max_idle);
+
+/*
+ * A mapped buffer of this size and format, a cached one if there is any.
+ * Cached ones still have whatever was painted in them last.
+ */
+struct fb *buffer_pool_get(struct buffer_pool *pool, int width, int height, uint32_t format);
+
+/* Back to the pool, for the next get to reuse */
+void buffer_pool_put(struct buffer_pool *pool, struct fb *fb);
+
+/* Release every buffer, in use or not */
+void buffer_pool_fini(struct buffer_pool *pool);
+
+void buffer_pool_dump_stats(struct buffer_pool *pool);
+
+#endif
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "drm_capture.h"
+#include "drm_ring.h"
+
+/* Frames copied out and waiting for the capture thread */
+#define CAPTURE_SLOTS 4
+/* Writes are whole batches, in blocks O_DIRECT can take */
+#define CAPTURE_BATCH (4 << 20)
+#define CAPTURE_ALIGN 4096
+
+struct capture {
+	int fd;
+	int direct;
+	/* Encoded frames, gathered till there's a whole batch to write */
+	char *batch;
+	size_t fill;
+	char *encoded;
+	long encoded_size;
+
+	struct paint_buf slots[CAPTURE_SLOTS];
+	/* Display to capture thread, and back */
+	struct spsc_ring free;
+	struct spsc_ring ready;
+	int ready_efd;
+	pthread_t thread;
+	int started;
+	atomic_int stop;
+	/* Set by the capture thread once a write failed, the rest are dropped */
+	int failed;
+
+	struct capture_stats stats;
+};
+
+static void wake(int efd)
+{
+	uint64_t one = 1;
+
+	if (write(efd, &one, sizeof(one)) < 0)
+		printf("Capture wakeup failed: %m\n");
+}
+
+static void wait_wake(int efd)
+{
+	uint64_t count;
+
+	if (read(efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		printf("Capture wait failed: %m\n");
+}
+
+/* ============ Writes =========== */
+
+static int direct_off(struct capture *cap)
+{
+	int flags = fcntl(cap->fd, F_GETFL);
+
+	if (flags < 0 || fcntl(cap->fd, F_SETFL, flags & ~O_DIRECT) < 0) {
+		printf("Can't turn O_DIRECT off for the capture: %m\n");
+		return -1;
+	}
+
+	cap->direct = 0;
+	return 0;
+}
+
+static int write_out(struct capture *cap, const char *p, size_t n)
+{
+	ssize_t ret;
+
+	while (n) {
+		ret = write(cap->fd, p, n);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		/* Some filesystems only say they don't do O_DIRECT once written to */
+		if (ret < 0 && errno == EINVAL && cap->direct) {
+			if (direct_off(cap))
+				return -1;
+			continue;
+		}
+
+		if (ret <= 0) {
+			printf("Capture write failed: %m\n");
+			return -1;
+		}
+
+		p += ret;
+		n -= ret;
+	}
+
+	return 0;
+}
+
+static int append(struct capture *cap, const char *data, size_t n)
+{
+	size_t len;
+
+	while (n) {
+		len = CAPTURE_BATCH - cap->fill;
+		if (len > n)
+			len = n;
+
+		memcpy(cap->batch + cap->fill, data, len);
+		cap->fill += len;
+		data += len;
+		n -= len;
+
+		if (cap->fill == CAPTURE_BATCH) {
+			if (write_out(cap, cap->batch, CAPTURE_BATCH))
+				return -1;
+			cap->fill = 0;
+		}
+	}
+
+	return 0;
+}
+
+/* The last batch isn't a whole block, O_DIRECT can't write it */
+static int flush_batch(struct capture *cap)
+{
+	if (!cap->fill)
+		return 0;
+
+	if (cap->direct && direct_off(cap))
+		return -1;
+
+	if (write_out(cap, cap->batch, cap->fill))
+		return -1;
+
+	cap->fill = 0;
+	return 0;
+}
+
+/* ============ Capture thread =========== */
+
+static int encode_frame(struct capture *cap, struct paint_buf *buf)
+{
+	struct paint_view view;
+	long size;
+
+	if (paint_view_init(&view, buf, 0, 0, buf->width, buf->height))
+		return -1;
+
+	size = paint_encode(cap->encoded, cap->encoded_size, &view);
+	if (size < 0 || append(cap, cap->encoded, size))
+		return -1;
+
+	cap->stats.captured++;
+	cap->stats.raw_bytes += (unsigned long long)buf->width * buf->height * 4;
+	cap->stats.bytes += size;
+	return 0;
+}
+
+static void *capture_thread(void *arg)
+{
+	struct capture *cap = arg;
+	uint32_t idx;
+	int stop;
+
+	for (;;) {
+		/* Everything pushed before the stop is in the ring by now */
+		stop = atomic_load(&cap->stop);
+		if (ring_pop(&cap->ready, &idx)) {
+			if (stop)
+				break;
+			wait_wake(cap->ready_efd);
+			continue;
+		}
+
+		if (!cap->failed && encode_frame(cap, &cap->slots[idx])) {
+			printf("Capture stops at frame %lu\n", cap->stats.captured);
+			cap->failed = 1;
+		}
+
+		ring_push(&cap->free, idx);
+	}
+
+	if (!cap->failed && flush_batch(cap))
+		cap->failed = 1;
+
+	return NULL;
+}
+
+/* ============ Capture =========== */
+
+struct capture *capture_open(const char *path, int width, int height, uint32_t format)
+{
+	struct capture *cap;
+	char *base;
+	int i;
+
+	cap = calloc(1, sizeof(*cap));
+	if (!cap)
+		return NULL;
+
+	cap->fd = cap->ready_efd = -1;
+	ring_init(&cap->free);
+	ring_init(&cap->ready);
+	atomic_init(&cap->stop, 0);
+
+	cap->encoded_size = paint_encode_bound(width, height);
+	if (paint_format_cpp(format) != 4 || cap->encoded_size < 0) {
+		printf("Can't capture %dx%d frames of format 0x%x\n", width, height, format);
+		goto fail;
+	}
+
+	cap->encoded = malloc(cap->encoded_size);
+	if (!cap->encoded || posix_memalign((void **)&cap->batch, CAPTURE_ALIGN, CAPTURE_BATCH)) {
+		printf("Out of memory for the capture buffers\n");
+		goto fail;
+	}
+
+	for (i = 0; i < CAPTURE_SLOTS; i++) {
+		if (posix_memalign((void **)&base, 64, (size_t)width * height * 4)) {
+			printf("Out of memory for %d capture frames\n", CAPTURE_SLOTS);
+			goto fail;
+		}
+
+		paint_buf_init(&cap->slots[i], base, width, height, 0, format);
+		ring_push(&cap->free, i);
+	}
+
+	cap->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+	cap->direct = cap->fd >= 0;
+	if (cap->fd < 0 && errno == EINVAL)
+		cap->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (cap->fd < 0) {
+		printf("Can't create %s: %m\n", path);
+		goto fail;
+	}
+
+	cap->ready_efd = eventfd(0, EFD_CLOEXEC);
+	if (cap->ready_efd < 0) {
+		printf("Can't create the capture eventfd: %m\n");
+		goto fail;
+	}
+
+	if (pthread_create(&cap->thread, NULL, capture_thread, cap)) {
+		printf("Can't start the capture thread\n");
+		goto fail;
+	}
+
+	cap->started = 1;
+	printf("Capturing %dx%d frames to %s%s\n", width, height, path,
+		cap->direct ? "" : ", through the page cache");
+	return cap;
+
+fail:
+	capture_close(cap, NULL);
+	return NULL;
+}
+
+int capture_frame(struct capture *cap, const struct paint_buf *buf)
+{
+	struct paint_view dst, src;
+	struct paint_buf *slot;
+	uint32_t idx;
+
+	if (ring_pop(&cap->free, &idx)) {
+		cap->stats.dropped++;
+		return -1;
+	}
+
+	slot = &cap->slots[idx];
+	if (paint_view_init(&dst, slot, 0, 0, slot->width, slot->height) ||
+		paint_view_init(&src, buf, 0, 0, slot->width, slot->height) ||
+		paint_blit(&dst, &src)) {
+		ring_push(&cap->free, idx);
+		return -1;
+	}
+
+	ring_push(&cap->ready, idx);
+	wake(cap->ready_efd);
+	return 0;
+}
+
+int capture_close(struct capture *cap, struct capture_stats *stats)
+{
+	int ret = 0, i;
+
+	if (cap->started) {
+		atomic_store(&cap->stop, 1);
+		wake(cap->ready_efd);
+		pthread_join(cap->thread, NULL);
+		ret = cap->failed ? -1 : 0;
+	}
+
+	if (cap->fd >= 0 && close(cap->fd)) {
+		printf("Closing the capture failed: %m\n");
+		ret = -1;
+	}
+	if (cap->ready_efd >= 0)
+		close(cap->ready_efd);
+
+	for (i = 0; i < CAPTURE_SLOTS; i++)
+		free(cap->slots[i].base);
+
+	free(cap->encoded);
+	free(cap->batch);
+	if (stats)
+		*stats = cap->stats;
+	free(cap);
+	return ret;
+}
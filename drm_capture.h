@@ -0,0 +1,70 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Capture of frames to a file, for looking at them offline. Each frame is
+ * copied out of the framebuffer once, which is all the reading of the
+ * mapping there is, and a capture thread encodes it with libpaint's
+ * lossless codec and appends it to the file. The file is the encoded
+ * frames one after the other: --play shows it again, and with --headless
+ * --dump that writes the frames out as PPM files.
+ *
+ * Writes are batched into large aligned blocks that go out with O_DIRECT,
+ * so that a long capture doesn't fill the page cache up, or with plain
+ * writes where the filesystem doesn't take O_DIRECT. When the capture
+ * thread falls behind, frames are dropped and counted, the display never
+ * waits for it.
+ */
+#ifndef __DRM_CAPTURE_H__
+#define __DRM_CAPTURE_H__
+
+#include <stdint.h>
+
+#include "paint.h"
+
+struct capture_stats {
+	/* Frames written, and those dropped with no staging buffer free */
+	unsigned long captured;
+	unsigned long dropped;
+	/* Size of the frames written, and what they took in the file */
+	unsigned long long raw_bytes;
+	unsigned long long bytes;
+};
+
+struct capture;
+
+/* Frames of width x height in format, to a new file at path. NULL on errors */
+struct capture *capture_open(const char *path, int width, int height, uint32_t format);
+
+/*
+ * Copy buf out to be captured, or drop it when all the staging buffers
+ * are in use. -1 for drops and errors. From one thread only.
+ */
+int capture_frame(struct capture *cap, const struct paint_buf *buf);
+
+/*
+ * Write out all the frames copied out so far and close the file. Returns
+ * -1 if any of them failed to be written. stats can be NULL.
+ */
+int capture_close(struct capture *cap, struct capture_stats *stats);
+
+#endif
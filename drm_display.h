@@ -0,0 +1,54 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/* Framebuffer and display pipe, as drm_draw_pixels sets them up */
+#ifndef __DRM_DISPLAY_H__
+#define __DRM_DISPLAY_H__
+
+#include <stdint.h>
+#include <xf86drmMode.h>
+#include "paint.h"
+
+struct fb {
+	int x;
+	int y;
+	int d;
+	int handle;
+	int fb_fd;
+	uint32_t format;
+	uint32_t stride;
+	uint32_t size;
+	char *mapped_fb;
+	/* Painted since the buffer last went to the display */
+	struct paint_damage damage;
+	/* Cached copy to paint in, when the tool runs with a shadow */
+	struct paint_shadow *shadow;
+};
+
+struct drm_display {
+	uint32_t crtc_id;
+	uint32_t conn_id;
+	uint32_t enc_id;
+	drmModeModeInfo mode;
+};
+
+#endif
@@ -21,6 +21,10 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
 /* open*/
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -28,164 +32,215 @@
 /* close */
 #include <unistd.h>
 
-/* Map */
-#include <sys/mman.h>
-
 /* DRM */
 #include <xf86drmMode.h>
-#include <drm/drm_fourcc.h>
+#include "drm_snapshot.h"
+#include "drm_uevent.h"
 
 #define CARD_0 "/dev/dri/card0"
 
-struct drm_format_name {
-        char a;
-        char b;
-        char c;
-        char d;
-};
+/* More connectors than this in one burst of events re-reads them all */
+#define WATCH_MAX_CONNECTORS 16
 
-static void drm_print_format_name(uint32_t code)
+static void usage(const char *name)
 {
-        struct drm_format_name name;
+    printf("Usage: %s [options]\n", name);
+    printf("  -d, --device PATH  DRM device to read (default %s)\n", CARD_0);
+    printf("  -j, --json         Print the whole topology as JSON\n");
+    printf("  -s, --save FILE    Save a binary snapshot of the topology\n");
+    printf("  -l, --load FILE    Print a saved snapshot, without opening the device\n");
+    printf("  -w, --watch        Print what changes on every hotplug, till killed\n");
+    printf("  -D, --diff A B     Print what changed from saved snapshot A to B\n");
+    printf("  -h, --help         This help\n");
+}
+
+/*
+ * Wait for hotplug uevents, and diff the objects they touched against the
+ * last snapshot. Sleeps in poll() in between, so it costs nothing idle.
+ */
+static int watch(int fd, struct drm_snapshot *snap, int json)
+{
+    uint32_t conns[WATCH_MAX_CONNECTORS];
+    struct uevent_monitor mon;
+    struct drm_snapshot next;
+    struct drm_uevent ev;
+    struct pollfd pfd;
+    int num_conns;
+    int all;
+    int ret;
+
+    if (uevent_monitor_init(&mon, fd))
+        return -1;
 
-	if (!code)
-		return;
+    if (!json)
+        printf("Watching for hotplugs\n");
+    fflush(stdout);
 
-    name.a = code & 0xff;
-    name.b = ((code & (0xff << 8)) >> 8);
-    name.c = ((code & (0xff << 16)) >> 16);
-    name.d = ((code & (0xff << 24)) >> 24);
+    pfd.fd = mon.sock;
+    pfd.events = POLLIN;
 
-	if (name.a == 'X' && name.b == 'R') {
-		printf("Format name XBGR%c%c\n", name.c, name.d);
-		return;
-	}
+    for (;;) {
+        ret = poll(&pfd, 1, -1);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0) {
+            printf("Poll fail: %m\n");
+            break;
+        }
+
+        /* Hotplugs come in bursts, handle all of them in one go */
+        num_conns = 0;
+        all = 0;
+        while ((ret = uevent_monitor_read(&mon, &ev)) != -EAGAIN) {
+            if (ret <= 0)
+                continue;
+
+            if (!ev.connector || num_conns == WATCH_MAX_CONNECTORS)
+                all = 1;
+            else
+                conns[num_conns++] = ev.connector;
+        }
+
+        if (!all && !num_conns)
+            continue;
 
-    if (name.a == 'R' && name.b == 'X') {
-		printf("Format name RGBX%c%c\n", name.c, name.d);
-		return;
-	}
+        if (snapshot_reread(&next, snap, fd, conns, all ? 0 : num_conns)) {
+            ret = -1;
+            break;
+        }
+
+        if (!json) {
+            if (all)
+                printf("\nHotplug:\n");
+            else
+                printf("\nHotplug on %d connector(s):\n", num_conns);
+        }
 
-    if (name.a == 'A' && name.b == 'R') {
-		printf("Format name ABGR%c%c\n", name.c, name.d);
-		return;
-	}
+        if (!snapshot_diff(snap, &next, stdout, json) && !json)
+            printf("no changes\n");
+        fflush(stdout);
 
-    if (name.a == 'R' && name.b == 'A') {
-		printf("Format name RGBA%c%c\n", name.c, name.d);
-		return;
-	}
+        snapshot_free(snap);
+        *snap = next;
+    }
 
-    printf("Format name %c%c%c%c\n", name.a, name.b, name.c, name.d);
+    uevent_monitor_fini(&mon);
+    return ret;
 }
 
-int main()
+/* Changes between two saved snapshots, exits with 1 if there are any like diff(1) */
+static int diff_files(const char *a, const char *b, int json)
 {
-    int fd;
-    int count;
-    drmModeResPtr res;
+    struct drm_snapshot old, new;
+    int changes;
 
-    fd = open(CARD_0, O_RDWR);
-    if (fd < 0) {
-        printf("Error open\n");
+    if (snapshot_load(&old, a))
         return -1;
-    }
 
-    res = drmModeGetResources(fd);
-    if (!res) {
-        printf("Error get res\n");
-        close (fd);
+    if (snapshot_load(&new, b)) {
+        snapshot_free(&old);
         return -1;
     }
 
-    printf("Get Res: CRTCs: %d Connectors: %d Enc: %d FBs: %d\n",
-            res->count_crtcs, res->count_connectors,
-            res->count_encoders, res->count_fbs);
-
-    printf("\n============== CRTCs =================\n");
-    for (count = 0; count < res->count_crtcs; count++) {
-        drmModeCrtcPtr crtc;
-        
-        crtc = drmModeGetCrtc(fd, res->crtcs[count]);
-        if (crtc) {
-            printf("CRTC: id:0x%x, w:%d h:%d x:%d y:%d\n",
-            crtc->crtc_id, crtc->width, crtc->height,
-            crtc->x, crtc->y);
+    changes = snapshot_diff(&old, &new, stdout, json);
+    snapshot_free(&old);
+    snapshot_free(&new);
+    return changes ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "device", required_argument, NULL, 'd' },
+        { "json", no_argument, NULL, 'j' },
+        { "save", required_argument, NULL, 's' },
+        { "load", required_argument, NULL, 'l' },
+        { "watch", no_argument, NULL, 'w' },
+        { "diff", no_argument, NULL, 'D' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    const char *device = CARD_0;
+    const char *save = NULL;
+    const char *load = NULL;
+    struct drm_snapshot snap;
+    int json = 0;
+    int watching = 0;
+    int diff = 0;
+    int fd;
+    int opt;
+    int ret = 0;
+
+    while ((opt = getopt_long(argc, argv, "d:js:l:wDh", options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            device = optarg;
+            break;
+        case 'j':
+            json = 1;
+            break;
+        case 's':
+            save = optarg;
+            break;
+        case 'l':
+            load = optarg;
+            break;
+        case 'w':
+            watching = 1;
+            break;
+        case 'D':
+            diff = 1;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (diff) {
+        if (argc - optind != 2) {
+            usage(argv[0]);
+            return -1;
         }
-        drmModeFreeCrtc(crtc);
+        return diff_files(argv[optind], argv[optind + 1], json);
     }
-    printf("==========================================\n");
-
-    printf("\n============== Connectors =================\n");
-    for (count = 0; count < res->count_connectors; count++) {
-        drmModeConnectorPtr conn;
-        
-        conn = drmModeGetConnector(fd, res->connectors[count]);
-        if (conn) {
-            printf("Conn: id:0x%x, wxh(mm):%dx%d, status:%d props: %d modes:%d\n",
-                    conn->connector_id, conn->mmWidth, conn->mmHeight,
-                    conn->connection, conn->count_props,
-                    conn->count_modes);  
+
+    if (load) {
+        if (snapshot_load(&snap, load))
+            return -1;
+    } else {
+        fd = open(device, O_RDWR);
+        if (fd < 0) {
+            printf("Error open\n");
+            return -1;
         }
 
-        if (!count) {
-            int i;
-            drmModePropertyPtr prop;
-
-            printf("\n\t============== Connector props =================\n");
-            for (i= 0; i < conn->count_props; i++) {
-                prop = drmModeGetProperty(fd, conn->props[i]);
-                if (prop) {
-                    printf("\tConn Prop: id: 0x%x, name: %s\n", 
-                    prop->prop_id, prop->name);
-                }
-                drmModeFreeProperty(prop);
-            }
-            printf("\t==========================================\n");
+        ret = snapshot_read(&snap, fd);
+        if (ret) {
+            close(fd);
+            return -1;
         }
 
-        drmModeFreeConnector(conn);
-    }
-    printf("==========================================\n");
-
-    printf("\n============== Encs =================\n");
-    for (count = 0; count < res->count_encoders; count++) {
-        drmModeEncoderPtr enc;
-        
-        enc = drmModeGetEncoder(fd, res->encoders[count]);
-        if (enc) {
-            printf("ENC: id:0x%x, type: %d\n", enc->encoder_id, enc->encoder_type);
+        if (watching) {
+            ret = watch(fd, &snap, json);
+            snapshot_free(&snap);
+            close(fd);
+            return ret;
         }
-        drmModeFreeEncoder(enc);
+        close(fd);
     }
-    printf("==========================================\n");
-
-    printf("\n============== Planes =================\n");
-    drmModePlaneResPtr pres = drmModeGetPlaneResources(fd);
-    for (count = 0; count < pres->count_planes; count++) {
-        drmModePlanePtr p;
-
-        p = drmModeGetPlane(fd, pres->planes[count]);
-        if (p) {
-            int fmt;
-
-            printf("\nPlane: CRTC id:0x%x, plane id: 0x%x num_formats: %d\n",
-                    p->crtc_id, p->plane_id, p->count_formats);
-            printf("Supported Formats:\n");
-            for (fmt = 0; fmt < p->count_formats; fmt++) {
-                printf("0x%x ", p->formats[fmt]);
-		drm_print_format_name(p->formats[fmt]);
-                if (fmt && fmt%10 == 0)
-                    printf("\n");
-            }
-            printf("\n");
-        }
-        drmModeFreePlane(p);
+
+    if (save) {
+        ret = snapshot_save(&snap, save);
+    } else if (json) {
+        snapshot_print_json(&snap, stdout);
+    } else {
+        snapshot_print_text(&snap, stdout);
     }
-    printf("\n==========================================\n");
 
-    drmModeFreePlaneResources(pres);
-    drmModeFreeResources(res);
-    close(fd);
-    return 0;
+    snapshot_free(&snap);
+    return ret;
 }
@@ -25,22 +25,50 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
+#include <drm/drm_fourcc.h>
 #include "paint.h"
+#include "drm_display.h"
+#include "drm_swapchain.h"
+#include "drm_buffer_pool.h"
+#include "drm_atomic.h"
+#include "drm_backend.h"
+#include "drm_frame_stats.h"
+#include "drm_pipeline.h"
+#include "drm_playback.h"
+#include "drm_capture.h"
 
 /* Defaults to init framebuffer */
 #define XRES 1920
 #define YRES 1200
 #define DEPTH_BYTES_PER_PIXEL 4
+#define FB_FORMAT DRM_FORMAT_XRGB8888
+
+/* Buffers in the swapchain, and how long each frame stays on screen */
+#define NUM_BUFFERS 2
+#define HOLD_MS 3000
 
 /* Graphic card nodes */
 #define CARD_0 "/dev/dri/card0"
 #define CARD_1 "/dev/dri/card1"
 
+/* The headless display, unless --headless says otherwise */
+#define HEADLESS_W 1920
+#define HEADLESS_H 1080
+#define HEADLESS_HZ 60
+
+/* Width of the bar sweeping across the screen, as a fraction of it */
+#define ANIM_BAR_DIV 8
+/* Pixels the bar moves by every frame */
+#define ANIM_STEP 16
+
 /* Verbose */
 uint8_t be_loud;
 
@@ -52,379 +80,980 @@ static uint32_t clr_val[] = {
 	0xFFFFFFFF, /* White */
 };
 
-struct fb {
-	int x;
-	int y;
-	int d;
-	int handle;
-	int fb_fd;
-	uint32_t stride;
-	uint32_t size;
-	char *mapped_fb;
-};
+static int hold_ms = HOLD_MS;
+static int use_shadow;
+static int use_legacy;
+/* Test pattern to paint in place of the tricolor frame and the bar, -1 for none */
+static int pattern = -1;
+/* Print the CRC32C of every frame put on screen */
+static int print_checksums;
+/* Size to show the sub-buffer at, 0x0 for as it is, and the filter if in software */
+static int scale_w, scale_h;
+static int scale_filter = PAINT_SCALE_BILINEAR;
+/* Frames from a file in place of the animation */
+static struct playback *playback;
+/* Where the frames put on screen get captured to */
+static struct capture *capture;
+/* When the last frame went on screen */
+static struct timespec last_shown;
+
+/* libpaint's view of the mapped framebuffer, with the pitch the driver picked */
+static void fb_scanout_buf(struct fb *fb, struct paint_buf *buf)
+{
+	buf->base = fb->mapped_fb;
+	buf->width = fb->x;
+	buf->height = fb->y;
+	buf->stride = fb->stride;
+	buf->format = fb->format;
+	buf->damage = &fb->damage;
+}
 
-struct drm_display {
-	uint32_t crtc_id;
-	uint32_t conn_id;
-	uint32_t enc_id;
-	drmModeModeInfo mode;
-};
+/* Where to paint the fb: the shadow if there is one, else the mapping */
+static void fb_paint_buf(struct fb *fb, struct paint_buf *buf)
+{
+	if (fb->shadow)
+		*buf = fb->shadow->buf;
+	else
+		fb_scanout_buf(fb, buf);
+}
 
-static void dump_videomodes(drmModeConnector *conn)
+/*
+ * Dumb buffer mappings are mostly write-combined, so reading them back is
+ * slow. With a shadow everything gets painted (and read) in cached memory,
+ * and only the damage is streamed to the mapping before it's displayed.
+ */
+static int create_shadow(struct fb *fb)
 {
-	int i;
-	drmModeModeInfo *mode;
+	struct paint_buf target;
 
-	printf("\n\t================================\n");
-	for (i = 0; i < conn->count_modes; i ++) {
-		mode = &conn->modes[i];
-		printf("\tMode:%s %dx%d clock %d\n", mode->name, mode->hdisplay, mode->vdisplay, mode->clock);
+	fb->shadow = malloc(sizeof(*fb->shadow));
+	if (!fb->shadow)
+		return -1;
+
+	fb_scanout_buf(fb, &target);
+	if (paint_shadow_init(fb->shadow, &target)) {
+		free(fb->shadow);
+		fb->shadow = NULL;
+		return -1;
 	}
-	printf("\t================================\n");
+
+	return 0;
 }
 
-static void dump_props(int fd, uint32_t *props, int prop_count)
+static void flush_shadow(struct fb *fb)
 {
-	int i;
-	drmModePropertyPtr prop;
+	if (fb->shadow)
+		paint_shadow_flush(fb->shadow);
+}
 
-	if (!prop_count || !props)
-	return;
+/* Of the shadow when there is one, reading back the scanout mapping is slow */
+static uint32_t fb_checksum(struct fb *fb)
+{
+	struct paint_buf buf;
 
-	printf("\n\t================================\n");
-	for (i = 0; i < prop_count; i++) {
-		prop = drmModeGetProperty(fd, props[i]);
-		if (prop) {
-			printf("\t %s:id %d\n", prop->name, prop->prop_id);
-			drmModeFreeProperty(prop);
-		}
-	}
-	printf("\t================================\n");
+	fb_paint_buf(fb, &buf);
+	return paint_buf_checksum(&buf);
+}
+
+/* Off to the capture file, as it's about to go on screen */
+static void capture_fb(struct fb *fb)
+{
+	struct paint_buf buf;
+
+	if (!capture)
+		return;
+
+	fb_paint_buf(fb, &buf);
+	capture_frame(capture, &buf);
 }
 
 static void paint_white(struct fb *fb)
 {
-	paint_a_buffer_white(fb->mapped_fb, fb->x, fb->y, fb->d);
+	struct paint_buf buf;
+
+	fb_paint_buf(fb, &buf);
+	paint_a_buffer_white(&buf);
 }
 
-static void blank_subbuffer(struct fb *fb, int xres, int yres, int x_off, int y_off, int x, int y)
+static void blank_subbuffer(struct fb *fb, int x_off, int y_off, int x, int y)
 {
-	blank_a_buffer_region(fb->mapped_fb, xres, yres, x_off, y_off, x, y, 4);
+	struct paint_buf buf;
+
+	fb_paint_buf(fb, &buf);
+	blank_a_buffer_region(&buf, x_off, y_off, x, y);
 }
 
-static void paint_subbuffer(struct fb *fb, int xres, int yres, int x_off, int y_off, int x, int y)
+static void paint_subbuffer(struct fb *fb, int x_off, int y_off, int x, int y)
 {
-	paint_a_buffer_region_tricolor(fb->mapped_fb, xres, yres, x_off, y_off, x, y, 4);
+	struct paint_buf buf;
+
+	fb_paint_buf(fb, &buf);
+	paint_a_buffer_region_tricolor(&buf, x_off, y_off, x, y);
 }
 
 static void paint_tricolor(struct fb *fb)
 {
-	paint_buffer_tricolor(fb->mapped_fb, fb->x, fb->y, 4);
+	struct paint_buf buf;
+
+	fb_paint_buf(fb, &buf);
+	if (pattern >= 0)
+		paint_pattern(&buf, pattern, 0);
+	else
+		paint_buffer_tricolor(&buf);
 }
 
-static int display_drm_buffer(int drm_fd, struct fb *fb, struct drm_display *display)
+/* Copy a w x h region of src to (x, y) of dst, no copy in between */
+static int copy_subbuffer(struct fb *dst, int x, int y, struct fb *src,
+		int x_off, int y_off, int w, int h)
 {
-	int ret; 
+	struct paint_buf dst_buf, src_buf;
+	struct paint_view dst_view, src_view;
 
-	if (!fb || !display || drm_fd < 0) {
-		printf("Can't display, invalid inputs\n");
+	fb_paint_buf(dst, &dst_buf);
+	fb_paint_buf(src, &src_buf);
+
+	if (paint_view_init(&dst_view, &dst_buf, x, y, w, h) ||
+		paint_view_init(&src_view, &src_buf, x_off, y_off, w, h))
+		return -1;
+
+	return paint_blit(&dst_view, &src_view);
+}
+
+/* Scale a w x h region of src into the dst_w x dst_h one at (x, y) of dst */
+static int scale_subbuffer(struct fb *dst, int x, int y, int dst_w, int dst_h,
+		struct fb *src, int x_off, int y_off, int w, int h)
+{
+	struct paint_buf dst_buf, src_buf;
+	struct paint_view dst_view, src_view;
+
+	fb_paint_buf(dst, &dst_buf);
+	fb_paint_buf(src, &src_buf);
+
+	if (paint_view_init(&dst_view, &dst_buf, x, y, dst_w, dst_h) ||
+		paint_view_init(&src_view, &src_buf, x_off, y_off, w, h))
+		return -1;
+
+	return paint_scale(&dst_view, &src_view, scale_filter);
+}
+
+/*
+ * Show the w x h region of src at (x_off, y_off) at the top left of the
+ * screen, on an overlay plane, so that the display composes it over the
+ * frame, scaled to crtc_w x crtc_h. src stays held till the plane is off.
+ * Returns the plane, or -1 if no plane can do it.
+ */
+static int overlay_subbuffer(struct swapchain *sc, struct drm_atomic *atomic, struct fb *src,
+		int x_off, int y_off, int w, int h, int crtc_w, int crtc_h)
+{
+	struct atomic_plane_state st = {
+		.fb_id = src->fb_fd,
+		.src_x = x_off,
+		.src_y = y_off,
+		.src_w = w,
+		.src_h = h,
+		.crtc_w = crtc_w,
+		.crtc_h = crtc_h,
+	};
+	int plane;
+
+	plane = atomic_find_overlay(atomic, src->format);
+	if (plane < 0) {
+		printf("No overlay plane for format 0x%x\n", src->format);
 		return -1;
 	}
 
-	/* Set the mode and fb on CRTC */
-	ret = drmModeSetCrtc(drm_fd, display->crtc_id,
-			fb->fb_fd, 0, 0,
-			&display->conn_id, 1,
-			&display->mode);
-	if (ret < 0) {
-		printf("Set CRTC fail, ret =%d\n", ret);
+	if (swapchain_hold(sc, src))
+		return -1;
+
+	/* The TEST_ONLY check in there tells if the hardware can place it there */
+	atomic_plane_set(atomic, plane, &st);
+	if (atomic_commit_planes(atomic)) {
+		swapchain_release(sc, src);
 		return -1;
 	}
 
-	/* Keep the buffer on screen for a few seconds */
-	sleep(3);
-	return 0;
+	if (be_loud)
+		printf("Subbuffer on plane %u\n", atomic->planes[plane].obj.id);
+	return plane;
+}
+
+static void overlay_off(struct drm_atomic *atomic, int plane)
+{
+	struct atomic_plane_state off = { 0, };
+
+	atomic_plane_set(atomic, plane, &off);
+	atomic_commit_planes(atomic);
 }
 
-static int create_drm_buffer(int drm_fd, struct fb *fb)
+static long ms_since(struct timespec *ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - ts->tv_sec) * 1000 + (now.tv_nsec - ts->tv_nsec) / 1000000;
+}
+
+/*
+ * Keep the last frame on screen for hold_ms, handling the flip events
+ * meanwhile so that the buffers get freed up as soon as they are off screen.
+ */
+static int hold_last_frame(struct swapchain *sc)
 {
-	struct drm_mode_create_dumb creq;
-	struct drm_mode_map_dumb mreq;
-	struct drm_mode_destroy_dumb dreq;
-	char *mapped_buffer;
+	long left;
 	int ret;
 
-	/* create dumb buffer */
-	memset(&creq, 0, sizeof(creq));
-	creq.width = fb->x;
-	creq.height = fb->y;
-	creq.bpp = 32;
-	ret = drmIoctl(drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
-	if (ret < 0) {
-		printf("cannot create dumb buffer (%d): %m\n", errno);
-		return -errno;
+	if (!last_shown.tv_sec && !last_shown.tv_nsec)
+		return 0;
+
+	while ((left = hold_ms - ms_since(&last_shown)) > 0) {
+		ret = swapchain_dispatch(sc, left);
+		if (ret < 0)
+			return ret;
 	}
 
-	fb->stride = creq.pitch;
-	fb->size = creq.size;
-	fb->handle = creq.handle;
+	return 0;
+}
 
-	/* create framebuffer object for the dumb-buffer */
-	ret = drmModeAddFB(drm_fd, fb->x, fb->y, 24, 32, fb->stride, fb->handle, &fb->fb_fd);
-	if (ret) {
-		printf("cannot create framebuffer (%d): %m\n", errno);
-		ret = -errno;
-		goto err_destroy;
-	}
+static struct fb *get_drm_buffer(struct swapchain *sc)
+{
+	struct fb *fb = swapchain_acquire(sc);
 
-	/* prepare buffer for memory mapping */
-	memset(&mreq, 0, sizeof(mreq));
-	mreq.handle = fb->handle;
-	ret = drmIoctl(drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
-	if (ret) {
-		printf("cannot map dumb buffer (%d): %m\n", errno);
-		ret = -errno;
-		goto err_fb;
-	}
+	if (!fb)
+		printf("Failed to get a free buffer\n");
+	return fb;
+}
 
-	/* perform actual memory mapping */
-	fb->mapped_fb = mmap(0, fb->size, PROT_READ | PROT_WRITE, MAP_SHARED, drm_fd, mreq.offset);
-	if (fb->mapped_fb == MAP_FAILED) {
-		printf("cannot mmap dumb buffer (%d): %m\n", errno);
-		ret = -errno;
-		goto err_fb;
+/* The frame was painted while the previous one was on screen, flip to it */
+static int display_drm_buffer(struct swapchain *sc, struct fb *fb)
+{
+	int ret;
+
+	if (!sc || !fb) {
+		printf("Can't display, invalid inputs\n");
+		return -1;
 	}
 
-	/* clear the framebuffer to 0 */
-	memset(fb->mapped_fb, 0, fb->size);
+	/* Not on screen yet, so this can overlap with the hold time too */
+	flush_shadow(fb);
+	capture_fb(fb);
+
+	ret = hold_last_frame(sc);
+	if (ret)
+		return -1;
+
+	ret = swapchain_present(sc, fb);
+	if (ret)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &last_shown);
+	if (print_checksums)
+		printf("Frame on screen: crc32c 0x%08x\n", fb_checksum(fb));
 	return 0;
+}
 
-err_fb:
-	drmModeRmFB(drm_fd, fb->fb_fd);
+/*
+ * The frame on screen, for a small update painted in place. Its hold time
+ * is over first, as it changes once painted.
+ */
+static struct fb *get_front_buffer(struct swapchain *sc)
+{
+	struct fb *fb;
 
-err_destroy:
-	memset(&dreq, 0, sizeof(dreq));
-	dreq.handle = fb->handle;
-	drmIoctl(drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
-	return ret;
+	if (hold_last_frame(sc))
+		return NULL;
+
+	fb = swapchain_front(sc);
+	if (!fb)
+		printf("Failed to get the buffer on screen\n");
+	return fb;
 }
 
-void release_drm_buffer(int drm_fd, struct fb *fb)
+/* Send just the damaged part of the frame on screen to the display */
+static int update_drm_buffer(struct swapchain *sc)
 {
-	struct drm_mode_destroy_dumb dreq;
+	struct fb *fb = swapchain_front(sc);
+	int ret;
 
-	munmap(fb->mapped_fb, fb->size);
-	drmModeRmFB(drm_fd, fb->fb_fd);
+	if (fb) {
+		flush_shadow(fb);
+		capture_fb(fb);
+	}
 
-	memset(&dreq, 0, sizeof(dreq));
-	dreq.handle = fb->handle;
+	ret = swapchain_flush(sc);
+	if (ret)
+		return -1;
 
-	drmIoctl(drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+	clock_gettime(CLOCK_MONOTONIC, &last_shown);
+	if (print_checksums && fb)
+		printf("Frame on screen: crc32c 0x%08x\n", fb_checksum(fb));
+	return 0;
 }
 
-static int get_drm_display(int drm_fd, struct drm_display *display)
+/* ============ Swapchain buffers =========== */
+
+/* From the pool, of the mode's size, with a shadow each if painting in one */
+static int get_swapchain_buffers(struct buffer_pool *pool, struct drm_display *display,
+		struct fb **fbs, int count)
 {
-	int i, ret = 0;
-	uint32_t active_crtc;
-	drmModeRes *res;
-	drmModeCrtc *crtc;
-	drmModeEncoder *enc;
-	drmModeModeInfo *mode;
-	drmModeConnector *conn;
+	int i;
 
-	res = drmModeGetResources(drm_fd);
-	if (!res) {
-		printf("Failed to get resources\n");
-		ret = -1;
-		goto fail_res;
-	}
+	for (i = 0; i < count; i++) {
+		fbs[i] = buffer_pool_get(pool, display->mode.hdisplay,
+				display->mode.vdisplay, FB_FORMAT);
+		if (!fbs[i]) {
+			printf("Failed to create a drm buffer\n");
+			goto err;
+		}
 
-	if (be_loud ) {
-		printf("Resources of card: CRTCs:%d Connectors:%d Encoders:%d FBs: %d\n",
-			res->count_crtcs, res->count_connectors, res->count_encoders,
-			res->count_fbs);
+		if (use_shadow && !fbs[i]->shadow && create_shadow(fbs[i])) {
+			printf("Failed to create a shadow buffer\n");
+			i++;
+			goto err;
+		}
 	}
 
-	/* Get the first connected connector */
-	for (i = 0; i < res->count_connectors; i++) {
-		conn = drmModeGetConnector(drm_fd, res->connectors[i]);
+	return 0;
 
-		if (be_loud) {
-			printf("Connector %d: properties: %d\n", conn->connector_id, conn->count_props);
-			dump_props(drm_fd, conn->props, conn->count_props);
-		}
+err:
+	while (i--)
+		buffer_pool_put(pool, fbs[i]);
+	return -1;
+}
 
-		if (conn->connection == DRM_MODE_CONNECTED)
-			break;
+/*
+ * Back to the pool once no flip needs them. The one on screen goes first,
+ * gets hand out the most recently put buffers, so it's the last one a
+ * swapchain built from the pool paints in.
+ */
+static void put_swapchain_buffers(struct swapchain *sc, struct buffer_pool *pool)
+{
+	int i;
 
-		drmModeFreeConnector(conn);
-		conn = NULL;
-	}
+	swapchain_wait_idle(sc);
 
-	if (!conn) {
-		printf("No connected connector found\n");
-		ret = -1;
-		goto fail_conn;
+	if (sc->front >= 0)
+		buffer_pool_put(pool, sc->bufs[sc->front]);
+	for (i = 0; i < sc->count; i++) {
+		if (i != sc->front)
+			buffer_pool_put(pool, sc->bufs[i]);
 	}
 
-	printf("Picking Connector: id:%d \n", conn->connector_id);
+	sc->count = 0;
+	sc->front = -1;
+}
+
+/* Another number of buffers, the ones already there come back from the pool */
+static int resize_swapchain(struct swapchain *sc, struct buffer_pool *pool, int count)
+{
+	struct fb *fbs[SWAPCHAIN_MAX_BUFFERS];
+
+	put_swapchain_buffers(sc, pool);
+	if (get_swapchain_buffers(pool, sc->display, fbs, count))
+		return -1;
+
+	return swapchain_init(sc, sc->drm_fd, sc->display, fbs, count, sc->ops, sc->priv);
+}
+
+/* ============ Animation =========== */
+
+/* What is known about a frame till its flip lands */
+struct anim_frame {
+	uint32_t frame;
+	uint32_t render_us;
+	uint32_t crc;
+	struct timespec submit;
+};
+
+struct anim {
+	struct swapchain *sc;
+	struct frame_stats stats;
+	/* By swapchain buffer, a buffer has one frame in flight at most */
+	struct anim_frame queued[SWAPCHAIN_MAX_BUFFERS];
+	unsigned int last_seq;
+	int flipped;
+};
+
+static long long ts_us(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000LL + ts->tv_nsec / 1000;
+}
+
+static int fb_index(struct swapchain *sc, struct fb *fb)
+{
+	int i;
 
-	if (be_loud && conn->count_modes) {
-		printf("Supported Videomodes on connector:%d\n", conn->count_modes);
-		dump_videomodes(conn);
+	for (i = 0; i < sc->count; i++) {
+		if (sc->bufs[i] == fb)
+			return i;
 	}
 
-	/* Get the preferred resolution */
-	for (i = 0; i < conn->count_modes; i++) {
-		mode = &conn->modes[i];
+	return -1;
+}
 
-		if (mode->type & DRM_MODE_TYPE_PREFERRED)
-			break;
-		mode = NULL;
+/* Flip event timestamps are CLOCK_MONOTONIC, same as the submit time */
+static void anim_flip(struct swapchain *sc, struct fb *fb, unsigned int seq,
+		unsigned int tv_sec, unsigned int tv_usec, void *data)
+{
+	struct anim *anim = data;
+	struct frame_sample sample = { 0, };
+	struct anim_frame *q;
+	long long latency;
+	int idx = fb_index(sc, fb);
+
+	if (idx < 0)
+		return;
+
+	q = &anim->queued[idx];
+	latency = tv_sec * 1000000LL + tv_usec - ts_us(&q->submit);
+
+	sample.frame = q->frame;
+	sample.render_us = q->render_us;
+	sample.latency_us = latency > 0 ? latency : 0;
+	sample.seq = seq;
+	/* Every frame should land on the vblank right after the previous one */
+	if (anim->flipped && seq > anim->last_seq + 1)
+		sample.missed = seq - anim->last_seq - 1;
+
+	if (print_checksums)
+		printf("Frame %u: crc32c 0x%08x\n", q->frame, q->crc);
+
+	anim->last_seq = seq;
+	anim->flipped = 1;
+	frame_stats_add(&anim->stats, &sample);
+}
+
+/*
+ * Frame n: a bar sweeping across a black screen, frame n of the pattern, or
+ * the frame of the file due then
+ */
+static void paint_anim_frame(struct fb *fb, int n)
+{
+	int bar_w = fb->x / ANIM_BAR_DIV;
+	struct paint_buf buf;
+
+	fb_paint_buf(fb, &buf);
+	if (playback) {
+		playback_show(playback, n, &buf);
+		return;
 	}
 
-	if (!mode) {
-		printf("No preferred mode found\n");
-		ret = -1;
-		goto fail_conn;
+	if (pattern >= 0) {
+		paint_pattern(&buf, pattern, n);
+		return;
 	}
 
-	printf("Picking Mode: %dx%d clk %d\n", mode->hdisplay, mode->vdisplay, mode->clock);
+	/* Clears the rest of the frame itself */
+	paint_a_buffer_region_tricolor(&buf, (n * ANIM_STEP) % (fb->x - bar_w), 0, bar_w, fb->y);
+}
 
-	/* Get the enc coupled with connector */
-	enc = drmModeGetEncoder(drm_fd, conn->encoder_id);
-	if (!enc) {
-		printf("No encoder found\n");
-		ret = -1;
-		goto fail_enc;
-	}
+/* Paint frame n in fb, and note how long it took */
+static void render_anim_frame(struct fb *fb, int n, void *data)
+{
+	struct anim *anim = data;
+	struct timespec start, done;
+	struct anim_frame *q;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	paint_anim_frame(fb, n);
+	flush_shadow(fb);
+	clock_gettime(CLOCK_MONOTONIC, &done);
+
+	q = &anim->queued[fb_index(anim->sc, fb)];
+	q->frame = n;
+	q->render_us = ts_us(&done) - ts_us(&start);
+	/* Not part of the render time, it's only there to check the frames */
+	if (print_checksums)
+		q->crc = fb_checksum(fb);
+	capture_fb(fb);
+}
 
-	printf("Picking encoder:%d\n", enc->encoder_id);
+/* The flip event can only be handled on the next dispatch, after this */
+static void anim_submitted(struct fb *fb, void *data)
+{
+	struct anim *anim = data;
 
-	/* Get the CRTC on which encoder is active */
-	active_crtc = enc->crtc_id;
-	crtc = drmModeGetCrtc(drm_fd, active_crtc);
-	if (!crtc) {
-		printf("No CRTC found\n");
-		ret = -1;
-		goto fail_crtc;
+	clock_gettime(CLOCK_MONOTONIC, &anim->queued[fb_index(anim->sc, fb)].submit);
+}
+
+/*
+ * Render and flip frames back to back. There is no timer: acquiring the
+ * next buffer waits for a flip to free one up, so the loop runs at the
+ * refresh rate as long as frames render in time, and misses vblanks when
+ * they don't.
+ */
+static int animate_sync(struct anim *anim, int frames)
+{
+	struct fb *fb;
+	int i, ret;
+
+	for (i = 0; i < frames; i++) {
+		fb = get_drm_buffer(anim->sc);
+		if (!fb)
+			return -1;
+
+		render_anim_frame(fb, i, anim);
+
+		ret = swapchain_present(anim->sc, fb);
+		if (ret) {
+			printf("Failed to present frame %d\n", i);
+			return ret;
+		}
+		anim_submitted(fb, anim);
 	}
 
-	printf("Found CRTC: %d\n", crtc->crtc_id);
+	return swapchain_wait_idle(anim->sc);
+}
 
-	/* Steal required info */
-	display->crtc_id = crtc->crtc_id;
-	display->conn_id = conn->connector_id;
-	display->enc_id = enc->encoder_id;
-	memcpy(&display->mode, mode, sizeof(*mode));
-	ret = 0;
+/* Same frames, rendered on a thread of their own while this one presents */
+static int animate_async(struct anim *anim, int frames, enum pipeline_mode mode)
+{
+	struct pipeline_stats stats;
+	int ret;
 
-fail_crtc:
-	drmModeFreeEncoder(enc);
+	ret = pipeline_run(anim->sc, frames, mode, render_anim_frame, anim_submitted, anim, &stats);
+	printf("Pipeline: %lu frames rendered, %lu presented, %lu dropped\n",
+		stats.rendered, stats.presented, stats.dropped);
+	return ret;
+}
 
-fail_enc:
-	drmModeFreeConnector(conn);
+static int animate(struct swapchain *sc, int frames, const char *csv, int async,
+		enum pipeline_mode mode)
+{
+	struct anim anim = { .sc = sc, };
+	int ret;
 
-fail_conn:
-	drmModeFreeResources(res);
+	if (frame_stats_init(&anim.stats, frames))
+		return -1;
+
+	swapchain_set_flip_cb(sc, anim_flip, &anim);
+	if (async)
+		ret = animate_async(&anim, frames, mode);
+	else
+		ret = animate_sync(&anim, frames);
+	swapchain_set_flip_cb(sc, NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &last_shown);
+
+	frame_stats_report(&anim.stats, stdout);
+	if (csv && frame_stats_write_csv(&anim.stats, csv))
+		ret = -1;
 
-fail_res:
+	frame_stats_fini(&anim.stats);
 	return ret;
 }
 
-int main(void)
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n", prog);
+	printf("  -b, --buffers=N     buffers in the swapchain, 2 to 4 (default %d)\n", NUM_BUFFERS);
+	printf("  -t, --hold=MS       time each frame stays on screen (default %d)\n", HOLD_MS);
+	printf("  -l, --legacy        legacy SetCrtc/PageFlip even if atomic is there\n");
+	printf("  -s, --shadow        paint in cached memory, stream the damage out\n");
+	printf("  -v, --verbose       dump the connectors and modes\n");
+	printf("  -d, --device=PATH   DRM device to draw on (default %s)\n", CARD_0);
+	printf("  -H, --headless[=WxH@HZ]  draw in memory, with simulated vblanks\n"
+	       "                      (default %dx%d@%d, @0 flips without waiting)\n",
+	       HEADLESS_W, HEADLESS_H, HEADLESS_HZ);
+	printf("  -D, --dump=DIR      with --headless, write each frame shown to DIR\n");
+	printf("  -n, --frames=N      animate N frames at the refresh rate, and time them\n");
+	printf("  -c, --csv=FILE      with --frames, write the timings of each frame to FILE\n");
+	printf("  -a, --async         with --frames, render on a thread of its own\n");
+	printf("  -m, --mailbox       with --async, flip to the newest frame, drop older ones\n"
+	       "                      (%d buffers unless --buffers says otherwise)\n",
+	       SWAPCHAIN_MAX_BUFFERS);
+	printf("  -k, --checksum      print the CRC32C of each frame put on screen\n");
+	printf("  -p, --pattern=NAME  paint a test pattern instead: smpte, gradient, checker,\n"
+	       "                      ramps or zoneplate (which moves with --frames)\n");
+	printf("  -P, --play=PATH     animate with frames from PATH: packed XRGB8888 frames,\n"
+	       "                      or files numbered like frame-%%05d.ppm (PPM or raw)\n");
+	printf("  -r, --fps=N         with --play, frames a second (default the refresh rate)\n");
+	printf("  -R, --raw-size=WxH  with --play, size of raw frames (default the screen's)\n");
+	printf("  -C, --capture=FILE  capture the frames put on screen to FILE, losslessly\n"
+	       "                      compressed, --play shows them again\n");
+	printf("  -S, --scale=WxH[:FILTER]  show the sub-buffer scaled to WxH, by a plane\n"
+	       "                      or else in software with FILTER: nearest, bilinear\n"
+	       "                      (default) or lanczos\n");
+}
+
+int main(int argc, char **argv)
 {
-	int drm_fd;
+	static const struct option long_opts[] = {
+		{ "buffers", required_argument, NULL, 'b' },
+		{ "hold", required_argument, NULL, 't' },
+		{ "legacy", no_argument, NULL, 'l' },
+		{ "shadow", no_argument, NULL, 's' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "device", required_argument, NULL, 'd' },
+		{ "headless", optional_argument, NULL, 'H' },
+		{ "dump", required_argument, NULL, 'D' },
+		{ "frames", required_argument, NULL, 'n' },
+		{ "csv", required_argument, NULL, 'c' },
+		{ "async", no_argument, NULL, 'a' },
+		{ "mailbox", no_argument, NULL, 'm' },
+		{ "pattern", required_argument, NULL, 'p' },
+		{ "checksum", no_argument, NULL, 'k' },
+		{ "scale", required_argument, NULL, 'S' },
+		{ "play", required_argument, NULL, 'P' },
+		{ "fps", required_argument, NULL, 'r' },
+		{ "raw-size", required_argument, NULL, 'R' },
+		{ "capture", required_argument, NULL, 'C' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	const char *device = CARD_0;
+	struct headless_config headless = {
+		.width = HEADLESS_W,
+		.height = HEADLESS_H,
+		.refresh = HEADLESS_HZ,
+	};
+	int use_headless = 0;
+	int anim_frames = 0;
+	const char *csv = NULL;
+	enum pipeline_mode pipe_mode = PIPELINE_FIFO;
+	int async = 0;
+	struct backend be;
+	void *sc_priv;
 	int ret = 0;
-	struct fb fb = {0,};
+	int i, opt;
+	int num_bufs = NUM_BUFFERS;
+	int bufs_given = 0;
+	struct buffer_pool pool;
+	struct drm_atomic atomic = {0, };
+	const struct swapchain_ops *ops = NULL;
+	int overlay = -1;
+	struct fb *fbs[SWAPCHAIN_MAX_BUFFERS];
+	struct fb *fb;
+	struct swapchain sc;
 	struct drm_display display = {0, };
-	char *sub;
-	int sub_pitch;
+	struct fb *blanked;
 	int sub_h = 600;
 	int sub_v = 200;
+	char filter[16];
+	struct playback_config play_cfg = { 0, };
+	struct playback_stats play_stats;
+	const char *capture_path = NULL;
+	struct capture_stats cap_stats;
+
+	while ((opt = getopt_long(argc, argv, "b:t:lsvd:H::D:n:c:amp:kS:P:r:R:C:h", long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'b':
+			num_bufs = atoi(optarg);
+			bufs_given = 1;
+			if (num_bufs < 2 || num_bufs > SWAPCHAIN_MAX_BUFFERS) {
+				printf("Swapchain can have 2 to %d buffers\n", SWAPCHAIN_MAX_BUFFERS);
+				return -1;
+			}
+			break;
+		case 't':
+			hold_ms = atoi(optarg);
+			break;
+		case 'l':
+			use_legacy = 1;
+			break;
+		case 's':
+			use_shadow = 1;
+			break;
+		case 'v':
+			be_loud = 1;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 'H':
+			use_headless = 1;
+			if (optarg && sscanf(optarg, "%dx%d@%d", &headless.width,
+					&headless.height, &headless.refresh) < 2) {
+				printf("Headless display is WxH or WxH@HZ\n");
+				return -1;
+			}
+			break;
+		case 'D':
+			headless.dump_dir = optarg;
+			break;
+		case 'n':
+			anim_frames = atoi(optarg);
+			break;
+		case 'c':
+			csv = optarg;
+			break;
+		case 'a':
+			async = 1;
+			break;
+		case 'm':
+			async = 1;
+			pipe_mode = PIPELINE_MAILBOX;
+			break;
+		case 'k':
+			print_checksums = 1;
+			break;
+		case 'p':
+			pattern = paint_pattern_lookup(optarg);
+			if (pattern < 0) {
+				printf("No test pattern called %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'P':
+			play_cfg.path = optarg;
+			break;
+		case 'r':
+			play_cfg.fps = atoi(optarg);
+			if (play_cfg.fps <= 0) {
+				printf("Frame rate has to be more than 0\n");
+				return -1;
+			}
+			break;
+		case 'R':
+			if (sscanf(optarg, "%dx%d", &play_cfg.width, &play_cfg.height) != 2 ||
+				play_cfg.width <= 0 || play_cfg.height <= 0) {
+				printf("Raw frame size is WxH\n");
+				return -1;
+			}
+			break;
+		case 'C':
+			capture_path = optarg;
+			break;
+		case 'S':
+			i = sscanf(optarg, "%dx%d:%15s", &scale_w, &scale_h, filter);
+			if (i < 2 || scale_w <= 0 || scale_h <= 0) {
+				printf("Scale is WxH or WxH:FILTER\n");
+				return -1;
+			}
+			if (i == 3) {
+				scale_filter = paint_scale_filter_lookup(filter);
+				if (scale_filter < 0) {
+					printf("No scaling filter called %s\n", filter);
+					return -1;
+				}
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
 
-	drm_fd = open(CARD_0, O_RDWR);
-	if (drm_fd < 0) {
-		printf("Failed to open graphic card\n");
+	if (use_headless)
+		ret = backend_headless_init(&be, &headless, be_loud);
+	else
+		ret = backend_drm_init(&be, device, be_loud);
+	if (ret)
 		return -1;
-	}
 
-	ret = get_drm_display(drm_fd, &display);
+	ret = be.ops->get_display(&be, &display);
 	if (ret) {
 		printf("Failed to get display\n");
 		ret = -1;
 		goto close;
 	}
 
-	/* Set the fb size as per the mode, and create a framebuffer */
-	fb.x = display.mode.hdisplay;
-	fb.y = display.mode.vdisplay;
-	fb.d = DEPTH_BYTES_PER_PIXEL;
-	ret = create_drm_buffer(drm_fd, &fb);
+	buffer_pool_init(&pool, &be, SWAPCHAIN_MAX_BUFFERS);
+
+	/* Set the fb size as per the mode, and get the swapchain buffers */
+	if (get_swapchain_buffers(&pool, &display, fbs, num_bufs)) {
+		ret = -1;
+		goto release_buffer;
+	}
+
+	/* Atomic when the driver has it, legacy otherwise */
+	ops = be.sc_ops;
+	sc_priv = be.priv;
+	if (be.kms && !use_legacy && !atomic_init(&atomic, be.drm_fd, &display)) {
+		ops = &swapchain_atomic_ops;
+		sc_priv = &atomic;
+		printf("Using atomic modesetting\n");
+	}
+
+	ret = swapchain_init(&sc, be.drm_fd, &display, fbs, num_bufs, ops, sc_priv);
 	if (ret) {
-		printf("Failed to create a drm buffer\n");
 		ret = -1;
-		goto close;
+		goto release_buffer;
 	}
 
 	/* Setup color table */
 	init_clr_hash(color_max, clr_val);
 
+	if (capture_path) {
+		capture = capture_open(capture_path, fbs[0]->x, fbs[0]->y, fbs[0]->format);
+		if (!capture) {
+			ret = -1;
+			goto idle;
+		}
+	}
+
+	/*
+	 * Each frame gets painted in a free buffer while the previous one is
+	 * still on screen, so every frame is painted from scratch. Small
+	 * changes to a frame are painted in place and flushed as damage.
+	 */
+
 	/* Draw tricolor lines on buffer */
-	paint_tricolor(&fb);
+	fb = get_drm_buffer(&sc);
+	if (!fb) {
+		ret = -1;
+		goto idle;
+	}
 
-	ret = display_drm_buffer(drm_fd, &fb, &display);
+	paint_tricolor(fb);
+	ret = display_drm_buffer(&sc, fb);
 	if (ret) {
-		printf("Failed to display buffer of %dx%d\n", fb.x, fb.y);
+		printf("Failed to display buffer of %dx%d\n", fb->x, fb->y);
 		ret = -1;
-		goto release_buffer;
+		goto idle;
+	}
+
+	/*
+	 * Mailbox only drops frames with all the buffers, take them unless
+	 * told otherwise. The ones there already are reused.
+	 */
+	if ((anim_frames > 0 || play_cfg.path) && pipe_mode == PIPELINE_MAILBOX && !bufs_given &&
+		sc.count < SWAPCHAIN_MAX_BUFFERS) {
+		if (resize_swapchain(&sc, &pool, SWAPCHAIN_MAX_BUFFERS)) {
+			printf("Failed to get %d buffers\n", SWAPCHAIN_MAX_BUFFERS);
+			ret = -1;
+			goto idle;
+		}
+	}
+
+	/* Frames from a file: all of them once, unless --frames says otherwise */
+	if (play_cfg.path) {
+		play_cfg.refresh = display.mode.vrefresh;
+		playback = playback_open(&play_cfg, fb->x, fb->y, fb->format);
+		if (!playback) {
+			ret = -1;
+			goto idle;
+		}
+
+		if (anim_frames <= 0)
+			anim_frames = playback_vblanks(playback);
+
+		ret = animate(&sc, anim_frames, csv, async, pipe_mode);
+		playback_get_stats(playback, &play_stats);
+		printf("Playback: %lu frames shown, %lu dropped\n", play_stats.shown,
+			play_stats.dropped);
+		playback_close(playback);
+		playback = NULL;
+		goto idle;
+	}
+
+	/* An animation instead of the still frames, once the modeset is done */
+	if (anim_frames > 0) {
+		ret = animate(&sc, anim_frames, csv, async, pipe_mode);
+		goto idle;
 	}
 
 	/* paint something else */
-	paint_subbuffer(&fb, fb.x, fb.y, 200, 200, 1280, 720);
-	ret = display_drm_buffer(drm_fd, &fb, &display);
-	if (ret) {
-		printf("Failed to display buffer 1920x1080\n");
+	fb = get_drm_buffer(&sc);
+	if (!fb) {
 		ret = -1;
+		goto idle;
 	}
 
-	/* blank some pixels */
-	blank_subbuffer(&fb, fb.x, fb.y, 400, 400, sub_h, sub_v);
-	ret = display_drm_buffer(drm_fd, &fb, &display);
+	paint_subbuffer(fb, 200, 200, 1280, 720);
+	ret = display_drm_buffer(&sc, fb);
 	if (ret) {
 		printf("Failed to display buffer 1920x1080\n");
 		ret = -1;
 	}
 
-	sub = get_a_subbuffer_copy(fb.mapped_fb, fb.x, fb.y, 400, 400, sub_h, sub_v, 4);
-	if (!sub) {
-		printf("Failed to get the subbuffer\n");
+	/* blank some pixels, only this region needs to go to the display */
+	fb = get_front_buffer(&sc);
+	if (!fb) {
 		ret = -1;
+		goto idle;
 	}
-	sub_pitch = sub_h * 4;
 
-	/* White paint the buffer first */
-	paint_white(&fb);
-	ret = display_drm_buffer(drm_fd, &fb, &display);
+	blank_subbuffer(fb, 400, 400, sub_h, sub_v);
+	blanked = fb;
+
+	ret = update_drm_buffer(&sc);
 	if (ret) {
-		printf("Failed to display white-buffer\n");
+		printf("Failed to update buffer 1920x1080\n");
 		ret = -1;
 	}
 
-	/* Display the subbuffer now at 0,0 but maintain the pitch of small buffer */
-	for (ret = 0; ret < sub_v; ret++)
-		memcpy(fb.mapped_fb + ret * fb.stride, sub, sub_pitch);
+	/* White paint the buffer first */
+	fb = get_drm_buffer(&sc);
+	if (!fb) {
+		ret = -1;
+		goto idle;
+	}
 
-	ret = display_drm_buffer(drm_fd, &fb, &display);
+	paint_white(fb);
+	ret = display_drm_buffer(&sc, fb);
 	if (ret) {
-		printf("Failed to display sub-buffer\n");
+		printf("Failed to display white-buffer\n");
 		ret = -1;
 	}
 
+	/*
+	 * Display the subbuffer now at 0,0, straight from the blanked frame's
+	 * buffer. That one is off screen now, but nothing painted it since.
+	 * An overlay plane can show it with no copy at all, else blit it.
+	 * Same for --scale, with the plane's scaler or else libpaint's.
+	 */
+	fb = get_front_buffer(&sc);
+	if (!fb) {
+		ret = -1;
+		goto idle;
+	}
+
+	if (!scale_w) {
+		scale_w = sub_h;
+		scale_h = sub_v;
+	}
+
+	if (ops == &swapchain_atomic_ops)
+		overlay = overlay_subbuffer(&sc, &atomic, blanked, 400, 400, sub_h, sub_v,
+				scale_w, scale_h);
+
+	if (overlay >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &last_shown);
+	} else {
+		if (scale_w != sub_h || scale_h != sub_v)
+			ret = scale_subbuffer(fb, 0, 0, scale_w, scale_h, blanked,
+					400, 400, sub_h, sub_v);
+		else
+			ret = copy_subbuffer(fb, 0, 0, blanked, 400, 400, sub_h, sub_v);
+		if (ret) {
+			printf("Failed to copy the subbuffer\n");
+			ret = -1;
+		}
+
+		ret = update_drm_buffer(&sc);
+		if (ret) {
+			printf("Failed to display sub-buffer\n");
+			ret = -1;
+		}
+	}
+
+	/* Let the last frame stay for a while too */
+	hold_last_frame(&sc);
+
+	if (overlay >= 0) {
+		overlay_off(&atomic, overlay);
+		swapchain_release(&sc, blanked);
+	}
+
+	/* Every exit once the swapchain is up, flips may still be in flight */
+idle:
+	put_swapchain_buffers(&sc, &pool);
+
 release_buffer:
-	release_drm_buffer(drm_fd, &fb);
+	if (capture) {
+		if (capture_close(capture, &cap_stats))
+			ret = -1;
+		capture = NULL;
+		printf("Capture: %lu frames, %lu dropped, %llu KB in %llu KB\n",
+			cap_stats.captured, cap_stats.dropped, cap_stats.raw_bytes >> 10,
+			cap_stats.bytes >> 10);
+	}
+
+	if (be_loud)
+		buffer_pool_dump_stats(&pool);
+	buffer_pool_fini(&pool);
+	atomic_fini(&atomic);
 
 close:
-	close(drm_fd);
+	backend_fini(&be);
 	return ret;
 }
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "drm_frame_stats.h"
+
+/* Histogram buckets double from 1 ms, the last one takes everything over */
+#define HIST_BUCKETS 8
+
+int frame_stats_init(struct frame_stats *stats, int cap)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	stats->samples = calloc(cap, sizeof(*stats->samples));
+	if (!stats->samples) {
+		printf("Can't allocate stats for %d frames\n", cap);
+		return -1;
+	}
+
+	stats->cap = cap;
+	return 0;
+}
+
+void frame_stats_fini(struct frame_stats *stats)
+{
+	free(stats->samples);
+	memset(stats, 0, sizeof(*stats));
+}
+
+void frame_stats_add(struct frame_stats *stats, const struct frame_sample *sample)
+{
+	if (stats->count < stats->cap)
+		stats->samples[stats->count++] = *sample;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted values */
+static uint32_t percentile(const uint32_t *sorted, int n, int pct)
+{
+	return sorted[(n - 1) * pct / 100];
+}
+
+static void report_metric(const struct frame_stats *stats, size_t offset, const char *name,
+		uint32_t *vals, FILE *out)
+{
+	int hist[HIST_BUCKETS] = { 0, };
+	int i, b, n = stats->count;
+
+	for (i = 0; i < n; i++) {
+		vals[i] = *(const uint32_t *)((const char *)&stats->samples[i] + offset);
+
+		for (b = 0; b < HIST_BUCKETS - 1 && vals[i] >= (1000u << b); b++)
+			;
+		hist[b]++;
+	}
+
+	qsort(vals, n, sizeof(*vals), cmp_u32);
+	fprintf(out, "%-8s p50 %6u us  p99 %6u us  max %6u us\n", name,
+		percentile(vals, n, 50), percentile(vals, n, 99), vals[n - 1]);
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+
+		if (b == HIST_BUCKETS - 1)
+			fprintf(out, "  >= %3u ms: %d\n", 1u << (b - 1), hist[b]);
+		else
+			fprintf(out, "  <  %3u ms: %d\n", 1u << b, hist[b]);
+	}
+}
+
+void frame_stats_report(const struct frame_stats *stats, FILE *out)
+{
+	unsigned long missed = 0;
+	int i, dropped = 0;
+	uint32_t *vals;
+
+	if (!stats->count) {
+		fprintf(out, "No frames timed\n");
+		return;
+	}
+
+	vals = malloc(stats->count * sizeof(*vals));
+	if (!vals)
+		return;
+
+	for (i = 0; i < stats->count; i++) {
+		missed += stats->samples[i].missed;
+		dropped += !!stats->samples[i].missed;
+	}
+
+	fprintf(out, "%d frames, %d dropped (%lu vblanks missed)\n", stats->count, dropped, missed);
+	report_metric(stats, offsetof(struct frame_sample, render_us), "render", vals, out);
+	report_metric(stats, offsetof(struct frame_sample, latency_us), "latency", vals, out);
+	free(vals);
+}
+
+int frame_stats_write_csv(const struct frame_stats *stats, const char *path)
+{
+	const struct frame_sample *s;
+	FILE *f;
+	int i;
+
+	f = fopen(path, "w");
+	if (!f) {
+		printf("Can't write %s: %m\n", path);
+		return -1;
+	}
+
+	fprintf(f, "frame,render_us,latency_us,seq,missed\n");
+	for (i = 0; i < stats->count; i++) {
+		s = &stats->samples[i];
+		fprintf(f, "%u,%u,%u,%u,%u\n", s->frame, s->render_us, s->latency_us, s->seq, s->missed);
+	}
+
+	return fclose(f) ? -1 : 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Per frame timings of an animation: how long the frame took to render,
+ * how long its flip took to land once submitted, and the vblanks missed
+ * on the way. Reported as percentiles and histograms, or as CSV.
+ */
+#ifndef __DRM_FRAME_STATS_H__
+#define __DRM_FRAME_STATS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct frame_sample {
+	uint32_t frame;
+	uint32_t render_us;
+	/* Submit to flip event */
+	uint32_t latency_us;
+	/* vblank the flip landed on, and the ones since the previous flip it missed */
+	uint32_t seq;
+	uint32_t missed;
+};
+
+struct frame_stats {
+	int count;
+	int cap;
+	struct frame_sample *samples;
+};
+
+int frame_stats_init(struct frame_stats *stats, int cap);
+void frame_stats_fini(struct frame_stats *stats);
+
+/* Dropped once full, the report says how many were kept */
+void frame_stats_add(struct frame_stats *stats, const struct frame_sample *sample);
+
+/* p50/p99/max and a histogram of render time and latency, and the dropped frames */
+void frame_stats_report(const struct frame_stats *stats, FILE *out);
+int frame_stats_write_csv(const struct frame_stats *stats, const char *path);
+
+#endif
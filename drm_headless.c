@@ -0,0 +1,346 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * A display which only lives in memory: framebuffers are memfds, and
+ * vblanks come from a timerfd ticking at the refresh rate. Flips complete
+ * on the next tick, like on hardware, so everything above the swapchain
+ * runs as it would on a KMS device.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+#include <drm/drm_fourcc.h>
+#include "drm_backend.h"
+
+/* Pitches aligned like a GPU would, which keeps rows apart in the cache too */
+#define HEADLESS_PITCH_ALIGN 64
+
+struct headless {
+	struct headless_config cfg;
+	uint32_t next_fb_id;
+
+	/* Flipped to, on screen at the next vblank */
+	struct fb *pending;
+	unsigned int seq;
+
+	/* Frames put on screen, since the first one */
+	unsigned int frames;
+	struct timespec first;
+};
+
+static double secs_since(const struct timespec *ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - ts->tv_sec) + (now.tv_nsec - ts->tv_nsec) / 1e9;
+}
+
+/* ============ Frame dumps =========== */
+
+static void dump_frame(struct headless *h, struct fb *fb)
+{
+	char path[512];
+	uint8_t *rgb;
+	uint32_t *row;
+	FILE *f;
+	int x, y;
+
+	if (!h->cfg.dump_dir)
+		return;
+
+	if (fb->format != DRM_FORMAT_XRGB8888 && fb->format != DRM_FORMAT_ARGB8888) {
+		printf("Can only dump XRGB8888 frames, not 0x%x\n", fb->format);
+		return;
+	}
+
+	snprintf(path, sizeof(path), "%s/frame-%05u.ppm", h->cfg.dump_dir, h->frames);
+	f = fopen(path, "wb");
+	if (!f) {
+		printf("Can't write %s: %m\n", path);
+		return;
+	}
+
+	rgb = malloc(fb->x * 3);
+	if (!rgb) {
+		fclose(f);
+		return;
+	}
+
+	fprintf(f, "P6\n%d %d\n255\n", fb->x, fb->y);
+	for (y = 0; y < fb->y; y++) {
+		row = (uint32_t *)(fb->mapped_fb + (size_t)y * fb->stride);
+		for (x = 0; x < fb->x; x++) {
+			rgb[x * 3] = row[x] >> 16;
+			rgb[x * 3 + 1] = row[x] >> 8;
+			rgb[x * 3 + 2] = row[x];
+		}
+		fwrite(rgb, 3, fb->x, f);
+	}
+
+	free(rgb);
+	fclose(f);
+}
+
+/* fb is on screen now */
+static void frame_shown(struct headless *h, struct fb *fb)
+{
+	if (!h->frames)
+		clock_gettime(CLOCK_MONOTONIC, &h->first);
+
+	dump_frame(h, fb);
+	h->frames++;
+}
+
+/* ============ Swapchain ops =========== */
+
+/* Vblanks since the last read, 0 if there were none */
+static uint64_t read_vblanks(struct swapchain *sc)
+{
+	uint64_t ticks;
+
+	if (read(sc->drm_fd, &ticks, sizeof(ticks)) != sizeof(ticks))
+		return 0;
+
+	return ticks;
+}
+
+static int headless_set_crtc(struct swapchain *sc, struct fb *fb)
+{
+	frame_shown(sc->priv, fb);
+	return 0;
+}
+
+static int headless_page_flip(struct swapchain *sc, struct fb *fb)
+{
+	struct headless *h = sc->priv;
+
+	if (h->pending)
+		return -EBUSY;
+
+	/* Vblanks which went by already don't count for this flip */
+	if (h->cfg.refresh)
+		h->seq += read_vblanks(sc);
+
+	h->pending = fb;
+	return 0;
+}
+
+static int headless_wait_event(struct swapchain *sc, int timeout_ms)
+{
+	struct headless *h = sc->priv;
+
+	if (h->cfg.refresh)
+		return swapchain_drm_wait_event(sc, timeout_ms);
+
+	/* No vblanks to wait for, a flip is done as soon as it's queued */
+	if (h->pending)
+		return 1;
+
+	poll(NULL, 0, timeout_ms);
+	return 0;
+}
+
+static int headless_handle_event(struct swapchain *sc)
+{
+	struct headless *h = sc->priv;
+	struct timespec now;
+	struct fb *fb;
+
+	if (h->cfg.refresh) {
+		uint64_t ticks = read_vblanks(sc);
+
+		if (!ticks)
+			return 0;
+		h->seq += ticks;
+	} else {
+		h->seq++;
+	}
+
+	if (!h->pending)
+		return 0;
+
+	fb = h->pending;
+	h->pending = NULL;
+	frame_shown(h, fb);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	sc->evctx.page_flip_handler(sc->drm_fd, h->seq, now.tv_sec, now.tv_nsec / 1000, sc);
+	return 0;
+}
+
+/* Nothing to flush in memory, but the frame on screen changed */
+static int headless_dirty_fb(struct swapchain *sc, struct fb *fb, drmModeClipPtr clips,
+		int num_clips)
+{
+	frame_shown(sc->priv, fb);
+	return 0;
+}
+
+static const struct swapchain_ops headless_swapchain_ops = {
+	.set_crtc = headless_set_crtc,
+	.page_flip = headless_page_flip,
+	.wait_event = headless_wait_event,
+	.handle_event = headless_handle_event,
+	.dirty_fb = headless_dirty_fb,
+};
+
+/* ============ Backend =========== */
+
+static int headless_get_display(struct backend *be, struct drm_display *display)
+{
+	struct headless *h = be->priv;
+	drmModeModeInfo *mode = &display->mode;
+
+	memset(display, 0, sizeof(*display));
+	display->crtc_id = 1;
+	display->conn_id = 2;
+	display->enc_id = 3;
+
+	mode->hdisplay = mode->hsync_start = mode->hsync_end = mode->htotal = h->cfg.width;
+	mode->vdisplay = mode->vsync_start = mode->vsync_end = mode->vtotal = h->cfg.height;
+	mode->vrefresh = h->cfg.refresh;
+	mode->clock = (uint64_t)h->cfg.width * h->cfg.height * h->cfg.refresh / 1000;
+	mode->type = DRM_MODE_TYPE_PREFERRED | DRM_MODE_TYPE_DRIVER;
+	snprintf(mode->name, sizeof(mode->name), "%dx%d", h->cfg.width, h->cfg.height);
+
+	printf("Headless display: %dx%d@%d\n", h->cfg.width, h->cfg.height, h->cfg.refresh);
+	return 0;
+}
+
+/* A memfd stands in for the dumb buffer, fb->handle is its fd */
+static int headless_create_buffer(struct backend *be, struct fb *fb)
+{
+	struct headless *h = be->priv;
+	int cpp = paint_format_cpp(fb->format);
+	int fd;
+
+	if (!cpp) {
+		printf("Can't create buffer, format 0x%x not supported\n", fb->format);
+		return -EINVAL;
+	}
+
+	fb->stride = (fb->x * cpp + HEADLESS_PITCH_ALIGN - 1) & ~(HEADLESS_PITCH_ALIGN - 1);
+	fb->size = fb->stride * fb->y;
+
+	fd = memfd_create("headless-fb", MFD_CLOEXEC);
+	if (fd < 0) {
+		printf("cannot create memfd (%d): %m\n", errno);
+		return -errno;
+	}
+
+	if (ftruncate(fd, fb->size)) {
+		printf("cannot size memfd (%d): %m\n", errno);
+		close(fd);
+		return -errno;
+	}
+
+	/* Zero filled already, populating it faults all of it in now */
+	fb->mapped_fb = mmap(0, fb->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	if (fb->mapped_fb == MAP_FAILED) {
+		printf("cannot mmap memfd (%d): %m\n", errno);
+		close(fd);
+		return -errno;
+	}
+
+	fb->handle = fd;
+	fb->fb_fd = ++h->next_fb_id;
+	return 0;
+}
+
+static void headless_release_buffer(struct backend *be, struct fb *fb)
+{
+	munmap(fb->mapped_fb, fb->size);
+	close(fb->handle);
+}
+
+static void headless_fini(struct backend *be)
+{
+	struct headless *h = be->priv;
+	double secs = secs_since(&h->first);
+
+	if (h->frames > 1) {
+		printf("Headless: %u frames in %.3fs, %.1f fps, %u vblanks\n",
+			h->frames, secs, (h->frames - 1) / secs, h->seq);
+	}
+
+	if (be->drm_fd >= 0)
+		close(be->drm_fd);
+	free(h);
+}
+
+static const struct backend_ops headless_backend_ops = {
+	.get_display = headless_get_display,
+	.create_buffer = headless_create_buffer,
+	.release_buffer = headless_release_buffer,
+	.fini = headless_fini,
+};
+
+int backend_headless_init(struct backend *be, const struct headless_config *cfg, int verbose)
+{
+	struct itimerspec vblank = { 0, };
+	struct headless *h;
+	long long period;
+
+	if (cfg->width <= 0 || cfg->height <= 0 || cfg->refresh < 0) {
+		printf("Invalid headless display %dx%d@%d\n", cfg->width, cfg->height, cfg->refresh);
+		return -1;
+	}
+
+	memset(be, 0, sizeof(*be));
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return -1;
+
+	h->cfg = *cfg;
+	be->drm_fd = -1;
+
+	if (cfg->refresh) {
+		be->drm_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (be->drm_fd < 0) {
+			printf("Can't create vblank timer: %m\n");
+			free(h);
+			return -1;
+		}
+
+		period = 1000000000LL / cfg->refresh;
+		vblank.it_interval.tv_sec = period / 1000000000LL;
+		vblank.it_interval.tv_nsec = period % 1000000000LL;
+		vblank.it_value = vblank.it_interval;
+		timerfd_settime(be->drm_fd, 0, &vblank, NULL);
+	}
+
+	be->ops = &headless_backend_ops;
+	be->sc_ops = &headless_swapchain_ops;
+	be->verbose = verbose;
+	be->priv = h;
+	return 0;
+}
@@ -0,0 +1,273 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "drm_pipeline.h"
+#include "drm_ring.h"
+
+struct pipeline {
+	struct swapchain *sc;
+	int frames;
+	enum pipeline_mode mode;
+	pipeline_render_fn render;
+	pipeline_present_fn present;
+	void *data;
+
+	/* Presenter to renderer, and back */
+	struct spsc_ring free;
+	struct spsc_ring ready;
+	int free_efd;
+	int ready_efd;
+
+	/* Set by the renderer after its last push, and by the presenter to stop it */
+	atomic_int done;
+	atomic_int stop;
+	atomic_ulong rendered;
+};
+
+static void wake(int efd)
+{
+	uint64_t one = 1;
+
+	if (write(efd, &one, sizeof(one)) < 0)
+		printf("Pipeline wakeup failed: %m\n");
+}
+
+/* Blocks till woken, unless the eventfd is non-blocking */
+static void wait_wake(int efd)
+{
+	uint64_t count;
+
+	if (read(efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		printf("Pipeline wait failed: %m\n");
+}
+
+static void *render_thread(void *arg)
+{
+	struct pipeline *p = arg;
+	uint32_t idx;
+	int n;
+
+	for (n = 0; n < p->frames; n++) {
+		/* The eventfd counts, so a wakeup sent before this read isn't lost */
+		while (ring_pop(&p->free, &idx)) {
+			if (atomic_load(&p->stop))
+				goto out;
+			wait_wake(p->free_efd);
+		}
+
+		if (atomic_load(&p->stop))
+			goto out;
+
+		p->render(p->sc->bufs[idx], n, p->data);
+		atomic_fetch_add(&p->rendered, 1);
+
+		/* Can't be full, there are more slots than buffers */
+		ring_push(&p->ready, idx);
+		wake(p->ready_efd);
+	}
+
+out:
+	atomic_store(&p->done, 1);
+	wake(p->ready_efd);
+	return NULL;
+}
+
+static int sc_index(struct swapchain *sc, struct fb *fb)
+{
+	int i;
+
+	for (i = 0; i < sc->count; i++) {
+		if (sc->bufs[i] == fb)
+			return i;
+	}
+
+	return -1;
+}
+
+/* Hand every buffer which is off screen now to the renderer */
+static void recycle(struct pipeline *p)
+{
+	struct fb *fb;
+	int woke = 0;
+
+	while ((fb = swapchain_try_acquire(p->sc))) {
+		ring_push(&p->free, sc_index(p->sc, fb));
+		woke = 1;
+	}
+
+	if (woke)
+		wake(p->free_efd);
+}
+
+/* A dropped mailbox frame goes straight back to be rendered over */
+static void give_back(struct pipeline *p, uint32_t idx)
+{
+	ring_push(&p->free, idx);
+	wake(p->free_efd);
+}
+
+/* Sleep till a frame is rendered or, with one in flight, a flip lands */
+static int wait_for_work(struct pipeline *p)
+{
+	struct swapchain *sc = p->sc;
+	struct pollfd pfd[2] = {
+		{ .fd = p->ready_efd, .events = POLLIN },
+		{ .fd = sc->pending >= 0 ? sc->drm_fd : -1, .events = POLLIN },
+	};
+	/* Flips of a device without an fd complete on the next dispatch */
+	int timeout = sc->pending >= 0 && sc->drm_fd < 0 ? 0 : -1;
+	int ret;
+
+	do {
+		ret = poll(pfd, 2, timeout);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		printf("Pipeline poll fail: %m\n");
+		return -errno;
+	}
+
+	if (pfd[0].revents & POLLIN)
+		wait_wake(p->ready_efd);
+	return 0;
+}
+
+static int present_loop(struct pipeline *p, struct pipeline_stats *stats)
+{
+	struct swapchain *sc = p->sc;
+	int64_t next = -1;
+	uint32_t idx;
+	int done, ret;
+
+	for (;;) {
+		if (sc->pending >= 0) {
+			ret = swapchain_dispatch(sc, 0);
+			if (ret < 0)
+				return ret;
+		}
+
+		recycle(p);
+
+		/* Read before the ring, so that a set done means it had the last frame */
+		done = atomic_load(&p->done);
+
+		if (p->mode == PIPELINE_MAILBOX) {
+			while (!ring_pop(&p->ready, &idx)) {
+				if (next >= 0) {
+					give_back(p, next);
+					stats->dropped++;
+				}
+				next = idx;
+			}
+		} else if (next < 0 && !ring_pop(&p->ready, &idx)) {
+			next = idx;
+		}
+
+		if (next >= 0 && sc->pending < 0) {
+			ret = swapchain_present(sc, sc->bufs[next]);
+			if (ret)
+				return ret;
+
+			if (p->present)
+				p->present(sc->bufs[next], p->data);
+			stats->presented++;
+			next = -1;
+			continue;
+		}
+
+		if (done && next < 0 && sc->pending < 0)
+			return 0;
+
+		ret = wait_for_work(p);
+		if (ret)
+			return ret;
+	}
+}
+
+int pipeline_run(struct swapchain *sc, int frames, enum pipeline_mode mode,
+		pipeline_render_fn render, pipeline_present_fn present, void *data,
+		struct pipeline_stats *stats)
+{
+	struct pipeline p = {
+		.sc = sc,
+		.frames = frames,
+		.mode = mode,
+		.render = render,
+		.present = present,
+		.data = data,
+	};
+	pthread_t thread;
+	int i, ret;
+
+	memset(stats, 0, sizeof(*stats));
+	if (mode == PIPELINE_MAILBOX && sc->count < 4)
+		printf("Mailbox with %d buffers, no frames can be dropped\n", sc->count);
+
+	ring_init(&p.free);
+	ring_init(&p.ready);
+	atomic_init(&p.done, 0);
+	atomic_init(&p.stop, 0);
+	atomic_init(&p.rendered, 0);
+
+	p.free_efd = eventfd(0, EFD_CLOEXEC);
+	p.ready_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (p.free_efd < 0 || p.ready_efd < 0) {
+		printf("Can't create pipeline eventfds: %m\n");
+		ret = -1;
+		goto close;
+	}
+
+	if (pthread_create(&thread, NULL, render_thread, &p)) {
+		printf("Can't start render thread\n");
+		ret = -1;
+		goto close;
+	}
+
+	ret = present_loop(&p, stats);
+	if (!ret)
+		ret = swapchain_wait_idle(sc);
+
+	atomic_store(&p.stop, 1);
+	wake(p.free_efd);
+	pthread_join(thread, NULL);
+	stats->rendered = atomic_load(&p.rendered);
+
+	/* Whatever the renderer still had, or didn't get to, is free again */
+	for (i = 0; i < sc->count; i++)
+		swapchain_cancel(sc, sc->bufs[i]);
+
+close:
+	if (p.free_efd >= 0)
+		close(p.free_efd);
+	if (p.ready_efd >= 0)
+		close(p.ready_efd);
+	return ret;
+}
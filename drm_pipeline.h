@@ -0,0 +1,66 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Rendering and presenting on two threads: a render thread paints frames
+ * into free buffers, while the thread calling pipeline_run() presents
+ * them and handles the flip events. Buffers go from one to the other over
+ * two lock-free rings, free ones one way and rendered ones the other, and
+ * an eventfd each wakes up the side waiting on a ring. A slow frame then
+ * only delays its own flip, and painting overlaps with scanout.
+ *
+ * In FIFO mode every frame is shown, in order. In mailbox mode only the
+ * newest rendered frame goes on screen at the next flip, older ones not
+ * flipped yet are dropped and handed back to be rendered over. That needs
+ * a buffer more: on screen, flipping, waiting and being rendered.
+ */
+#ifndef __DRM_PIPELINE_H__
+#define __DRM_PIPELINE_H__
+
+#include "drm_swapchain.h"
+
+/* On the render thread: paint frame number n in fb */
+typedef void (*pipeline_render_fn)(struct fb *fb, int n, void *data);
+/* On the presenting thread, right after fb's flip got queued */
+typedef void (*pipeline_present_fn)(struct fb *fb, void *data);
+
+enum pipeline_mode {
+	PIPELINE_FIFO,
+	PIPELINE_MAILBOX,
+};
+
+struct pipeline_stats {
+	unsigned long rendered;
+	unsigned long presented;
+	/* Mailbox frames a newer one replaced before they got to the screen */
+	unsigned long dropped;
+};
+
+/*
+ * Render and present frames frames. sc has to have a frame on screen
+ * already, and it's used from this thread only.
+ */
+int pipeline_run(struct swapchain *sc, int frames, enum pipeline_mode mode,
+		pipeline_render_fn render, pipeline_present_fn present, void *data,
+		struct pipeline_stats *stats);
+
+#endif
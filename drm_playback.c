@@ -0,0 +1,754 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+#include "drm_playback.h"
+#include "drm_ring.h"
+
+/* Frames staged ahead of the display, plus the one it shows */
+#define PLAYBACK_SLOTS 4
+/* Frames to skip past the display by, once behind it */
+#define PLAYBACK_LEAD 2
+
+struct playback_slot {
+	long frame;
+	struct paint_buf buf;
+};
+
+struct playback {
+	struct playback_config cfg;
+	/* Frames in the file or sequence, played in a loop */
+	long count;
+	int sequence;
+	int first_index;
+
+	/* The packed file, mapped whole */
+	char *map;
+	size_t map_size;
+	size_t frame_bytes;
+	/* Of a capture's encoded frames, which aren't all the same size, and its end */
+	size_t *offsets;
+
+	/* PPM frames of another size get converted in here, then scaled */
+	struct paint_buf scratch;
+
+	struct playback_slot slots[PLAYBACK_SLOTS];
+	/* Display to prefetch thread, and back */
+	struct spsc_ring free;
+	struct spsc_ring ready;
+	int free_efd;
+	int ready_efd;
+	pthread_t thread;
+	int started;
+	atomic_int stop;
+	/* Set by the prefetch thread when it can't go on */
+	atomic_int failed;
+	/* The vblank the display is at */
+	atomic_long due;
+
+	/* Display side only, and the next staged frame once it's popped off the ring */
+	struct playback_slot *current;
+	struct playback_slot *next;
+	long last_frame;
+	struct playback_stats stats;
+};
+
+/* One frame's bytes, mapped: raw XRGB8888, PPM pixels or an encoded frame */
+struct src_frame {
+	const char *data;
+	size_t size;
+	int width;
+	int height;
+	int ppm;
+	int coded;
+	uint32_t format;
+	/* The mapping of a sequence file, which goes once the frame is staged */
+	void *map;
+	size_t map_size;
+};
+
+static void wake(int efd)
+{
+	uint64_t one = 1;
+
+	if (write(efd, &one, sizeof(one)) < 0)
+		printf("Playback wakeup failed: %m\n");
+}
+
+static void wait_wake(int efd)
+{
+	uint64_t count;
+
+	if (read(efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		printf("Playback wait failed: %m\n");
+}
+
+/* ============ Frame files =========== */
+
+/* A printf pattern with exactly one %d in it, and maybe a width */
+static int is_sequence(const char *path)
+{
+	const char *p = strchr(path, '%');
+
+	if (!p)
+		return 0;
+
+	for (p++; *p >= '0' && *p <= '9'; p++)
+		;
+	return *p == 'd' && !strchr(p, '%');
+}
+
+static void sequence_path(struct playback *pb, long idx, char *path, size_t len)
+{
+	snprintf(path, len, pb->cfg.path, (int)(pb->first_index + idx));
+}
+
+/* Past the "P6 width height 255" header, with its comments, NULL if it isn't one */
+static const char *ppm_pixels(const char *p, size_t size, int *width, int *height)
+{
+	const char *end = p + size;
+	long val[3];
+	int i;
+
+	if (size < 2 || p[0] != 'P' || p[1] != '6')
+		return NULL;
+	p += 2;
+
+	for (i = 0; i < 3; i++) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '#')) {
+			if (*p == '#') {
+				while (p < end && *p != '\n')
+					p++;
+			} else {
+				p++;
+			}
+		}
+
+		for (val[i] = 0; p < end && *p >= '0' && *p <= '9' && val[i] < 65536; p++)
+			val[i] = val[i] * 10 + *p - '0';
+	}
+
+	/* A single whitespace, then the pixels */
+	if (p >= end || val[2] != 255 || val[0] <= 0 || val[1] <= 0 ||
+		val[0] >= 65536 || val[1] >= 65536) {
+		printf("Only 8 bit PPM files can be played\n");
+		return NULL;
+	}
+	p++;
+
+	if ((size_t)(end - p) < (size_t)val[0] * val[1] * 3) {
+		printf("PPM file is too short for %ldx%ld\n", val[0], val[1]);
+		return NULL;
+	}
+
+	*width = val[0];
+	*height = val[1];
+	return p;
+}
+
+static int parse_frame(struct playback *pb, struct src_frame *f)
+{
+	struct paint_frame_info info;
+	const char *px;
+
+	if (!paint_decode_info(f->data, f->size, &info)) {
+		f->coded = 1;
+		f->width = info.width;
+		f->height = info.height;
+		f->format = info.format;
+		return 0;
+	}
+
+	px = ppm_pixels(f->data, f->size, &f->width, &f->height);
+	if (px) {
+		f->ppm = 1;
+		f->data = px;
+		return 0;
+	}
+
+	if (f->size >= 2 && f->data[0] == 'P' && f->data[1] == '6')
+		return -1;
+
+	f->ppm = 0;
+	f->format = DRM_FORMAT_XRGB8888;
+	f->width = pb->cfg.width;
+	f->height = pb->cfg.height;
+	if (f->size < (size_t)f->width * f->height * 4) {
+		printf("Raw frame is too short for %dx%d XRGB8888\n", f->width, f->height);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *map_file(const char *path, size_t *size)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		printf("Can't open %s: %m\n", path);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || !st.st_size) {
+		printf("Can't play %s, it's empty\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		printf("Can't map %s: %m\n", path);
+		return NULL;
+	}
+
+	/* Read ahead hard, and drop pages once past them */
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	*size = st.st_size;
+	return map;
+}
+
+/* Where a frame of the packed file is in it */
+static void frame_span(const struct playback *pb, long idx, size_t *offset, size_t *size)
+{
+	if (pb->offsets) {
+		*offset = pb->offsets[idx];
+		*size = pb->offsets[idx + 1] - pb->offsets[idx];
+	} else {
+		*offset = idx * pb->frame_bytes;
+		*size = pb->frame_bytes;
+	}
+}
+
+static int open_frame(struct playback *pb, long frame, struct src_frame *f)
+{
+	long idx = frame % pb->count;
+	char path[4096];
+	size_t offset;
+
+	memset(f, 0, sizeof(*f));
+	if (!pb->sequence) {
+		frame_span(pb, idx, &offset, &f->size);
+		f->data = pb->map + offset;
+		return parse_frame(pb, f);
+	}
+
+	sequence_path(pb, idx, path, sizeof(path));
+	f->map = map_file(path, &f->map_size);
+	if (!f->map)
+		return -1;
+
+	f->data = f->map;
+	f->size = f->map_size;
+	if (parse_frame(pb, f)) {
+		munmap(f->map, f->map_size);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void close_frame(struct src_frame *f)
+{
+	if (f->map)
+		munmap(f->map, f->map_size);
+}
+
+/* Get the pages of a frame coming up read in, while the ones before it get staged */
+static void prefetch_frame(struct playback *pb, long frame)
+{
+	long idx = frame % pb->count;
+	long page = sysconf(_SC_PAGESIZE);
+	size_t offset, size;
+	char path[4096];
+	uintptr_t start;
+	int fd;
+
+	if (!pb->sequence) {
+		frame_span(pb, idx, &offset, &size);
+		start = (uintptr_t)(pb->map + offset) & ~(page - 1);
+		madvise((void *)start, size + page, MADV_WILLNEED);
+		return;
+	}
+
+	/* Not mapped yet, the page cache gets it all the same */
+	sequence_path(pb, idx, path, sizeof(path));
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
+
+/* ============ Staging =========== */
+
+/* The frame due at vblank */
+static long frame_at(const struct playback *pb, long vblank)
+{
+	if (pb->count == 1)
+		return 0;
+	if (!pb->cfg.fps || !pb->cfg.refresh)
+		return vblank;
+
+	return (long long)vblank * pb->cfg.fps / pb->cfg.refresh;
+}
+
+/* The first frame after this one to go on screen, some get skipped over the refresh rate */
+static long next_shown(const struct playback *pb, long frame)
+{
+	long vblank;
+
+	/* A still has no frame after it, frame_at() would give it again */
+	if (pb->count == 1 || !pb->cfg.fps || !pb->cfg.refresh)
+		return frame + 1;
+
+	vblank = ((long long)(frame + 1) * pb->cfg.refresh + pb->cfg.fps - 1) / pb->cfg.fps;
+	return frame_at(pb, vblank);
+}
+
+static void ppm_to_xrgb(struct paint_buf *dst, const struct src_frame *f)
+{
+	const uint8_t *s = (const uint8_t *)f->data;
+	uint32_t *d;
+	int x, y;
+
+	for (y = 0; y < f->height; y++) {
+		d = (uint32_t *)(dst->base + (long)y * dst->stride);
+		for (x = 0; x < f->width; x++, s += 3)
+			d[x] = 0xff000000 | s[0] << 16 | s[1] << 8 | s[2];
+	}
+}
+
+static int scratch_for(struct playback *pb, int width, int height, uint32_t format)
+{
+	char *base;
+
+	if (pb->scratch.base && pb->scratch.width == width && pb->scratch.height == height) {
+		pb->scratch.format = format;
+		return 0;
+	}
+
+	base = realloc(pb->scratch.base, (size_t)width * height * 4);
+	if (!base) {
+		printf("Out of memory for a %dx%d frame\n", width, height);
+		return -1;
+	}
+
+	return paint_buf_init(&pb->scratch, base, width, height, 0, format);
+}
+
+static int decode_into(struct paint_buf *dst, const struct src_frame *f)
+{
+	struct paint_view view;
+
+	if (paint_view_init(&view, dst, 0, 0, dst->width, dst->height))
+		return -1;
+
+	return paint_decode(&view, f->data, f->size);
+}
+
+/* Frame into slot, in the framebuffer's format and size */
+static int stage_frame(struct playback *pb, struct playback_slot *slot, long frame)
+{
+	struct paint_buf *dst = &slot->buf, src;
+	struct paint_view dst_view, src_view;
+	struct src_frame f;
+	int ret;
+
+	if (open_frame(pb, frame, &f))
+		return -1;
+
+	slot->frame = frame;
+	if (f.ppm && f.width == dst->width && f.height == dst->height &&
+		(dst->format == DRM_FORMAT_XRGB8888 || dst->format == DRM_FORMAT_ARGB8888)) {
+		ppm_to_xrgb(dst, &f);
+		close_frame(&f);
+		return 0;
+	}
+
+	/* Captures of this same framebuffer decode straight into the slot */
+	if (f.coded && f.width == dst->width && f.height == dst->height &&
+		f.format == dst->format) {
+		ret = decode_into(dst, &f);
+		close_frame(&f);
+		return ret;
+	}
+
+	if (f.ppm) {
+		ret = scratch_for(pb, f.width, f.height, DRM_FORMAT_XRGB8888);
+		if (!ret)
+			ppm_to_xrgb(&pb->scratch, &f);
+		src = pb->scratch;
+	} else if (f.coded) {
+		ret = scratch_for(pb, f.width, f.height, f.format);
+		if (!ret)
+			ret = decode_into(&pb->scratch, &f);
+		src = pb->scratch;
+	} else {
+		/* Only ever read from */
+		ret = paint_buf_init(&src, (char *)f.data, f.width, f.height, 0,
+				DRM_FORMAT_XRGB8888);
+	}
+
+	if (!ret)
+		ret = paint_view_init(&src_view, &src, 0, 0, src.width, src.height) ||
+			paint_view_init(&dst_view, dst, 0, 0, dst->width, dst->height);
+	if (!ret) {
+		if (src.width == dst->width && src.height == dst->height)
+			ret = paint_blit(&dst_view, &src_view);
+		else
+			ret = paint_scale(&dst_view, &src_view, PAINT_SCALE_BILINEAR);
+	}
+
+	close_frame(&f);
+	return ret;
+}
+
+static void *prefetch_thread(void *arg)
+{
+	struct playback *pb = arg;
+	long next = 0, hinted = -1, due, f;
+	uint32_t idx;
+	int i;
+
+	while (!atomic_load(&pb->stop)) {
+		/* A still, staged once and shown for as long as it takes */
+		if (pb->count == 1 && next) {
+			wait_wake(pb->free_efd);
+			continue;
+		}
+
+		/* The eventfd counts, so a wakeup sent before this read isn't lost */
+		if (ring_pop(&pb->free, &idx)) {
+			wait_wake(pb->free_efd);
+			continue;
+		}
+
+		/*
+		 * No use staging frames the display is past already. Aim a bit
+		 * further, or by the time it's staged the display is past it too.
+		 */
+		due = atomic_load(&pb->due);
+		if (next < frame_at(pb, due))
+			next = frame_at(pb, due + PLAYBACK_LEAD);
+
+		/* Reads of the frames coming up go on while this one gets staged */
+		for (i = 0, f = next; i < PLAYBACK_SLOTS; i++, f = next_shown(pb, f)) {
+			if (f > hinted) {
+				prefetch_frame(pb, f);
+				hinted = f;
+			}
+		}
+
+		if (stage_frame(pb, &pb->slots[idx], next)) {
+			printf("Failed to stage frame %ld, playback stops there\n", next);
+			atomic_store(&pb->failed, 1);
+			wake(pb->ready_efd);
+			break;
+		}
+
+		ring_push(&pb->ready, idx);
+		wake(pb->ready_efd);
+		next = next_shown(pb, next);
+	}
+
+	return NULL;
+}
+
+/* ============ Playback =========== */
+
+/* A capture: encoded frames one after the other, each one says its size */
+static int index_capture(struct playback *pb)
+{
+	struct paint_frame_info info;
+	size_t offset = 0, *offsets;
+	long room = 0;
+
+	for (pb->count = 0; offset < pb->map_size; pb->count++) {
+		if (paint_decode_info(pb->map + offset, pb->map_size - offset, &info))
+			break;
+
+		/* One more for the end of the last frame */
+		if (pb->count + 1 >= room) {
+			room = room ? room * 2 : 256;
+			offsets = realloc(pb->offsets, room * sizeof(*offsets));
+			if (!offsets) {
+				printf("Out of memory for the index of %s\n", pb->cfg.path);
+				return -1;
+			}
+			pb->offsets = offsets;
+		}
+
+		pb->offsets[pb->count] = offset;
+		offset += info.size;
+	}
+
+	pb->offsets[pb->count] = offset;
+	if (offset != pb->map_size)
+		printf("%s is cut short, playing its first %ld frames\n", pb->cfg.path, pb->count);
+
+	return 0;
+}
+
+static int count_frames(struct playback *pb)
+{
+	struct paint_frame_info info;
+	char path[4096];
+
+	if (!pb->sequence) {
+		pb->map = map_file(pb->cfg.path, &pb->map_size);
+		if (!pb->map)
+			return -1;
+
+		if (!paint_decode_info(pb->map, pb->map_size, &info))
+			return index_capture(pb);
+
+		/* A single PPM frame, a still to show for as long as asked */
+		if (pb->map[0] == 'P' && pb->map[1] == '6') {
+			pb->frame_bytes = pb->map_size;
+			pb->count = 1;
+			return 0;
+		}
+
+		pb->frame_bytes = (size_t)pb->cfg.width * pb->cfg.height * 4;
+		pb->count = pb->map_size / pb->frame_bytes;
+		if (!pb->count) {
+			printf("%s has no whole %dx%d XRGB8888 frame\n", pb->cfg.path,
+					pb->cfg.width, pb->cfg.height);
+			return -1;
+		}
+		return 0;
+	}
+
+	/* Numbered from 0 or 1, till the first one missing */
+	for (pb->first_index = 0; pb->first_index < 2; pb->first_index++) {
+		sequence_path(pb, 0, path, sizeof(path));
+		if (!access(path, R_OK))
+			break;
+	}
+
+	for (pb->count = 0; ; pb->count++) {
+		sequence_path(pb, pb->count, path, sizeof(path));
+		if (access(path, R_OK))
+			break;
+	}
+
+	if (!pb->count) {
+		printf("No frames found as %s\n", pb->cfg.path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int alloc_slots(struct playback *pb, int width, int height, uint32_t format)
+{
+	int cpp = paint_format_cpp(format);
+	struct playback_slot *slot;
+	char *base;
+	int i;
+
+	for (i = 0; i < PLAYBACK_SLOTS; i++) {
+		slot = &pb->slots[i];
+		if (posix_memalign((void **)&base, 64, (size_t)width * height * cpp)) {
+			printf("Out of memory for %d staging frames\n", PLAYBACK_SLOTS);
+			return -1;
+		}
+
+		paint_buf_init(&slot->buf, base, width, height, 0, format);
+		slot->frame = -1;
+		ring_push(&pb->free, i);
+	}
+
+	return 0;
+}
+
+struct playback *playback_open(const struct playback_config *cfg, int width, int height,
+		uint32_t format)
+{
+	struct playback *pb;
+	uint32_t idx;
+
+	pb = calloc(1, sizeof(*pb));
+	if (!pb)
+		return NULL;
+
+	pb->cfg = *cfg;
+	if (!pb->cfg.width || !pb->cfg.height) {
+		pb->cfg.width = width;
+		pb->cfg.height = height;
+	}
+	pb->sequence = is_sequence(cfg->path);
+	pb->free_efd = pb->ready_efd = -1;
+	ring_init(&pb->free);
+	ring_init(&pb->ready);
+	atomic_init(&pb->stop, 0);
+	atomic_init(&pb->failed, 0);
+	atomic_init(&pb->due, 0);
+	pb->last_frame = -1;
+
+	if (!paint_format_cpp(format)) {
+		printf("Can't play frames into format 0x%x\n", format);
+		goto fail;
+	}
+
+	if (count_frames(pb) || alloc_slots(pb, width, height, format))
+		goto fail;
+
+	pb->free_efd = eventfd(0, EFD_CLOEXEC);
+	pb->ready_efd = eventfd(0, EFD_CLOEXEC);
+	if (pb->free_efd < 0 || pb->ready_efd < 0) {
+		printf("Can't create playback eventfds: %m\n");
+		goto fail;
+	}
+
+	if (pthread_create(&pb->thread, NULL, prefetch_thread, pb)) {
+		printf("Can't start the prefetch thread\n");
+		goto fail;
+	}
+
+	pb->started = 1;
+
+	/* The first frame has to be there to start with */
+	while (ring_pop(&pb->ready, &idx)) {
+		if (atomic_load(&pb->failed))
+			goto fail;
+		wait_wake(pb->ready_efd);
+	}
+	pb->current = &pb->slots[idx];
+
+	printf("Playing %ld frames of %s\n", pb->count, pb->cfg.path);
+	return pb;
+
+fail:
+	playback_close(pb);
+	return NULL;
+}
+
+void playback_close(struct playback *pb)
+{
+	int i;
+
+	if (pb->started) {
+		atomic_store(&pb->stop, 1);
+		wake(pb->free_efd);
+		pthread_join(pb->thread, NULL);
+	}
+
+	if (pb->free_efd >= 0)
+		close(pb->free_efd);
+	if (pb->ready_efd >= 0)
+		close(pb->ready_efd);
+
+	for (i = 0; i < PLAYBACK_SLOTS; i++)
+		free(pb->slots[i].buf.base);
+
+	free(pb->scratch.base);
+	free(pb->offsets);
+	if (pb->map)
+		munmap(pb->map, pb->map_size);
+	free(pb);
+}
+
+long playback_vblanks(const struct playback *pb)
+{
+	if (!pb->cfg.fps || !pb->cfg.refresh)
+		return pb->count;
+
+	return ((long long)pb->count * pb->cfg.refresh + pb->cfg.fps - 1) / pb->cfg.fps;
+}
+
+void playback_get_stats(const struct playback *pb, struct playback_stats *stats)
+{
+	*stats = pb->stats;
+}
+
+static void give_back(struct playback *pb, struct playback_slot *slot)
+{
+	ring_push(&pb->free, slot - pb->slots);
+	wake(pb->free_efd);
+}
+
+long playback_show(struct playback *pb, long vblank, struct paint_buf *buf)
+{
+	long frame = frame_at(pb, vblank);
+	struct paint_view dst, src;
+	uint32_t idx;
+
+	atomic_store(&pb->due, vblank);
+
+	/*
+	 * Take staged frames up to the one due, those before it which got
+	 * staged too late go back unseen. Past a skip the next one can be
+	 * ahead of the display: it waits for its turn, and the current one
+	 * stays on screen till then.
+	 */
+	for (;;) {
+		if (!pb->next) {
+			if (ring_pop(&pb->ready, &idx))
+				break;
+			pb->next = &pb->slots[idx];
+		}
+
+		if (pb->current && pb->next->frame > frame)
+			break;
+
+		if (pb->current)
+			give_back(pb, pb->current);
+		pb->current = pb->next;
+		pb->next = NULL;
+	}
+
+	if (!pb->current)
+		return -1;
+
+	/* A frame rate under the refresh rate asks for frames more than once */
+	if (frame != pb->last_frame) {
+		if (pb->current->frame == frame)
+			pb->stats.shown++;
+		else
+			pb->stats.dropped++;
+		pb->last_frame = frame;
+	}
+
+	if (paint_view_init(&dst, buf, 0, 0, buf->width, buf->height) ||
+		paint_view_init(&src, &pb->current->buf, 0, 0, buf->width, buf->height) ||
+		paint_blit(&dst, &src))
+		return -1;
+
+	return pb->current->frame;
+}
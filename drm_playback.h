@@ -0,0 +1,86 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Playback of raw frames from files: a file of packed XRGB8888 frames, a
+ * capture of encoded frames (as --capture writes them), or a numbered
+ * sequence of files (frame-%05d.ppm, as --dump writes them), each one PPM
+ * (P6) or raw XRGB8888 frame. Files are read through mmap. A prefetch
+ * thread stays a few frames ahead of the display: it asks for the pages
+ * of the coming frames, and decodes or converts the frames to the
+ * framebuffer's format and size in staging buffers, so that putting one
+ * on screen is a plain copy. Staged frames go to the display over a
+ * lock-free ring, and their buffers come back over another.
+ *
+ * The display asks for the frame due at each vblank. When that one isn't
+ * staged yet the newest one before it is shown again, and the frame
+ * counts as dropped. The prefetch thread then skips ahead of the display
+ * instead of staging frames which are late already. Only the frames the
+ * display will ask for get staged, whatever the frame rate.
+ */
+#ifndef __DRM_PLAYBACK_H__
+#define __DRM_PLAYBACK_H__
+
+#include <stdint.h>
+
+#include "paint.h"
+
+struct playback_config {
+	/* A file, or a printf pattern with one %d for a numbered sequence */
+	const char *path;
+	/* Of raw frames, PPM files say their own. 0 for the framebuffer's */
+	int width;
+	int height;
+	/* Frames a second, and the display's refresh rate. 0 for a frame a vblank */
+	int fps;
+	int refresh;
+};
+
+struct playback_stats {
+	/* Frames which were on screen when due */
+	unsigned long shown;
+	/* Frames which weren't staged in time, the previous one stayed instead */
+	unsigned long dropped;
+};
+
+struct playback;
+
+/*
+ * Open the frames and start prefetching, for a framebuffer of width x
+ * height in format. Returns once the first frame is staged, NULL on errors.
+ */
+struct playback *playback_open(const struct playback_config *cfg, int width, int height,
+		uint32_t format);
+void playback_close(struct playback *pb);
+
+/* vblanks it takes to show every frame once */
+long playback_vblanks(const struct playback *pb);
+void playback_get_stats(const struct playback *pb, struct playback_stats *stats);
+
+/*
+ * Copy the frame due at vblank (counting from 0, looping over the file)
+ * into buf, or the newest staged frame before it when it isn't staged in
+ * time. Returns the frame copied, -1 if there is none. From one thread only.
+ */
+long playback_show(struct playback *pb, long vblank, struct paint_buf *buf);
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Single producer, single consumer ring of small integers (buffer
+ * indices). No locks: the producer only moves head and the consumer only
+ * moves tail, each publishing with a release store that the other side
+ * reads with acquire. They sit on their own cache lines, so the two
+ * threads don't bounce one line between them on every push and pop.
+ */
+#ifndef __DRM_RING_H__
+#define __DRM_RING_H__
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* A power of two, more than the buffers in any swapchain */
+#define RING_SLOTS 8
+
+struct spsc_ring {
+	_Atomic uint32_t head __attribute__((aligned(64)));
+	_Atomic uint32_t tail __attribute__((aligned(64)));
+	uint32_t slots[RING_SLOTS] __attribute__((aligned(64)));
+};
+
+static inline void ring_init(struct spsc_ring *ring)
+{
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+}
+
+/* Producer side, -1 if full */
+static inline int ring_push(struct spsc_ring *ring, uint32_t val)
+{
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if (head - tail == RING_SLOTS)
+		return -1;
+
+	ring->slots[head & (RING_SLOTS - 1)] = val;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return 0;
+}
+
+/* Consumer side, -1 if empty */
+static inline int ring_pop(struct spsc_ring *ring, uint32_t *val)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (head == tail)
+		return -1;
+
+	*val = ring->slots[tail & (RING_SLOTS - 1)];
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,1029 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "drm_snapshot.h"
+
+#define SNAP_MAGIC "DRMSNAP"
+#define SNAP_VERSION 1
+
+static const size_t elem_size[SNAP_NUM_ARRAYS] = {
+	[SNAP_CRTCS] = sizeof(struct snap_crtc),
+	[SNAP_CONNECTORS] = sizeof(struct snap_connector),
+	[SNAP_ENCODERS] = sizeof(struct snap_encoder),
+	[SNAP_PLANES] = sizeof(struct snap_plane),
+	[SNAP_MODES] = sizeof(drmModeModeInfo),
+	[SNAP_PROPS] = sizeof(struct snap_prop),
+	[SNAP_FORMATS] = sizeof(uint32_t),
+	[SNAP_MODIFIERS] = sizeof(struct snap_modifier),
+	[SNAP_BLOB_DATA] = 1,
+};
+
+/* ============ Building =========== */
+
+/* Room for n more zeroed entries at the end of an array, NULL if out of memory */
+static void *snap_push(struct drm_snapshot *snap, enum snap_array a, uint32_t n)
+{
+	uint32_t need = snap->count[a] + n;
+	uint32_t cap = snap->cap[a] ? snap->cap[a] : 16;
+	char *p;
+
+	if (need > snap->cap[a]) {
+		while (cap < need)
+			cap *= 2;
+
+		p = realloc(snap->arr[a], (size_t)cap * elem_size[a]);
+		if (!p)
+			return NULL;
+
+		snap->arr[a] = p;
+		snap->cap[a] = cap;
+	}
+
+	p = (char *)snap->arr[a] + (size_t)snap->count[a] * elem_size[a];
+	memset(p, 0, (size_t)n * elem_size[a]);
+	snap->count[a] = need;
+	return p;
+}
+
+/*
+ * Property IDs are shared by all the objects of a type (every connector's
+ * EDID is the same property), so each one gets looked up just once.
+ */
+struct prop_cache {
+	int count;
+	int cap;
+	drmModePropertyPtr *props;
+};
+
+static drmModePropertyPtr cached_prop(struct prop_cache *cache, int drm_fd, uint32_t id)
+{
+	drmModePropertyPtr prop, *p;
+	int i;
+
+	for (i = 0; i < cache->count; i++) {
+		if (cache->props[i]->prop_id == id)
+			return cache->props[i];
+	}
+
+	prop = drmModeGetProperty(drm_fd, id);
+	if (!prop)
+		return NULL;
+
+	if (cache->count == cache->cap) {
+		p = realloc(cache->props, sizeof(*p) * (cache->cap ? cache->cap * 2 : 64));
+		if (!p) {
+			drmModeFreeProperty(prop);
+			return NULL;
+		}
+		cache->props = p;
+		cache->cap = cache->cap ? cache->cap * 2 : 64;
+	}
+
+	cache->props[cache->count++] = prop;
+	return prop;
+}
+
+static void free_prop_cache(struct prop_cache *cache)
+{
+	int i;
+
+	for (i = 0; i < cache->count; i++)
+		drmModeFreeProperty(cache->props[i]);
+	free(cache->props);
+}
+
+static int read_blob(struct drm_snapshot *snap, int drm_fd, uint32_t blob_id, struct snap_range *range)
+{
+	drmModePropertyBlobPtr blob;
+	uint8_t *data;
+
+	blob = drmModeGetPropertyBlob(drm_fd, blob_id);
+	if (!blob)
+		return 0;
+
+	range->first = snap->count[SNAP_BLOB_DATA];
+	data = snap_push(snap, SNAP_BLOB_DATA, blob->length);
+	if (!data && blob->length) {
+		drmModeFreePropertyBlob(blob);
+		return -1;
+	}
+
+	memcpy(data, blob->data, blob->length);
+	range->count = blob->length;
+	drmModeFreePropertyBlob(blob);
+	return 0;
+}
+
+static int read_props(struct drm_snapshot *snap, struct prop_cache *cache, int drm_fd,
+		uint32_t obj_id, uint32_t obj_type, struct snap_range *range)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyPtr prop;
+	struct snap_prop *sp;
+	int i, e, ret = 0;
+
+	props = drmModeObjectGetProperties(drm_fd, obj_id, obj_type);
+	if (!props)
+		return 0;
+
+	range->first = snap->count[SNAP_PROPS];
+	for (i = 0; i < props->count_props; i++) {
+		sp = snap_push(snap, SNAP_PROPS, 1);
+		if (!sp) {
+			ret = -1;
+			break;
+		}
+
+		sp->id = props->props[i];
+		sp->value = props->prop_values[i];
+		range->count++;
+
+		prop = cached_prop(cache, drm_fd, sp->id);
+		if (!prop)
+			continue;
+
+		sp->flags = prop->flags;
+		snprintf(sp->name, sizeof(sp->name), "%s", prop->name);
+
+		if (prop->flags & DRM_MODE_PROP_ENUM) {
+			for (e = 0; e < prop->count_enums; e++) {
+				if (prop->enums[e].value == sp->value)
+					snprintf(sp->enum_name, sizeof(sp->enum_name), "%s", prop->enums[e].name);
+			}
+		}
+
+		if ((prop->flags & DRM_MODE_PROP_BLOB) && sp->value) {
+			ret = read_blob(snap, drm_fd, sp->value, &sp->blob);
+			if (ret)
+				break;
+		}
+	}
+
+	drmModeFreeObjectProperties(props);
+	return ret;
+}
+
+static const struct snap_prop *find_prop(const struct drm_snapshot *snap,
+		const struct snap_range *props, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < props->count; i++) {
+		if (!strcmp(snap->props[props->first + i].name, name))
+			return &snap->props[props->first + i];
+	}
+
+	return NULL;
+}
+
+/* IN_FORMATS: the format/modifier pairs the plane can scan out */
+static int read_in_formats(struct drm_snapshot *snap, struct snap_plane *plane)
+{
+	const struct snap_prop *prop = find_prop(snap, &plane->props, "IN_FORMATS");
+	const struct drm_format_modifier_blob *hdr;
+	const struct drm_format_modifier *mods;
+	const uint32_t *formats;
+	struct snap_modifier *m;
+	uint32_t i, f;
+
+	if (!prop || prop->blob.count < sizeof(*hdr))
+		return 0;
+
+	hdr = (const void *)(snap->blob_data + prop->blob.first);
+	if (hdr->formats_offset + (uint64_t)hdr->count_formats * 4 > prop->blob.count ||
+		hdr->modifiers_offset + (uint64_t)hdr->count_modifiers * sizeof(*mods) > prop->blob.count)
+		return 0;
+
+	formats = (const void *)((const char *)hdr + hdr->formats_offset);
+	mods = (const void *)((const char *)hdr + hdr->modifiers_offset);
+
+	plane->modifiers.first = snap->count[SNAP_MODIFIERS];
+	for (i = 0; i < hdr->count_modifiers; i++) {
+		for (f = 0; f < 64 && mods[i].offset + f < hdr->count_formats; f++) {
+			if (!(mods[i].formats & (1ULL << f)))
+				continue;
+
+			m = snap_push(snap, SNAP_MODIFIERS, 1);
+			if (!m)
+				return -1;
+
+			m->format = formats[mods[i].offset + f];
+			m->modifier = mods[i].modifier;
+			plane->modifiers.count++;
+		}
+	}
+
+	return 0;
+}
+
+static int read_crtc(struct drm_snapshot *snap, struct prop_cache *cache, int drm_fd, uint32_t id)
+{
+	struct snap_crtc *c;
+	drmModeCrtcPtr crtc;
+
+	crtc = drmModeGetCrtc(drm_fd, id);
+	if (!crtc)
+		return 0;
+
+	c = snap_push(snap, SNAP_CRTCS, 1);
+	if (!c) {
+		drmModeFreeCrtc(crtc);
+		return -1;
+	}
+
+	c->id = crtc->crtc_id;
+	c->fb_id = crtc->buffer_id;
+	c->x = crtc->x;
+	c->y = crtc->y;
+	c->width = crtc->width;
+	c->height = crtc->height;
+	c->mode_valid = crtc->mode_valid;
+	c->mode = crtc->mode;
+	drmModeFreeCrtc(crtc);
+
+	return read_props(snap, cache, drm_fd, c->id, DRM_MODE_OBJECT_CRTC, &c->props);
+}
+
+/* This one probes the connector, so it picks up hotplugs */
+static int read_connector(struct drm_snapshot *snap, struct prop_cache *cache, int drm_fd,
+		uint32_t id)
+{
+	drmModeConnectorPtr conn;
+	struct snap_connector *c;
+	drmModeModeInfo *modes;
+
+	conn = drmModeGetConnector(drm_fd, id);
+	if (!conn)
+		return 0;
+
+	c = snap_push(snap, SNAP_CONNECTORS, 1);
+	modes = snap_push(snap, SNAP_MODES, conn->count_modes);
+	if (!c || (!modes && conn->count_modes)) {
+		drmModeFreeConnector(conn);
+		return -1;
+	}
+
+	c->id = conn->connector_id;
+	c->type = conn->connector_type;
+	c->type_id = conn->connector_type_id;
+	c->connection = conn->connection;
+	c->mm_width = conn->mmWidth;
+	c->mm_height = conn->mmHeight;
+	c->encoder_id = conn->encoder_id;
+	c->modes.first = snap->count[SNAP_MODES] - conn->count_modes;
+	c->modes.count = conn->count_modes;
+	memcpy(modes, conn->modes, sizeof(*modes) * conn->count_modes);
+	drmModeFreeConnector(conn);
+
+	return read_props(snap, cache, drm_fd, c->id, DRM_MODE_OBJECT_CONNECTOR, &c->props);
+}
+
+static int read_encoder(struct drm_snapshot *snap, int drm_fd, uint32_t id)
+{
+	drmModeEncoderPtr enc;
+	struct snap_encoder *e;
+
+	enc = drmModeGetEncoder(drm_fd, id);
+	if (!enc)
+		return 0;
+
+	e = snap_push(snap, SNAP_ENCODERS, 1);
+	if (!e) {
+		drmModeFreeEncoder(enc);
+		return -1;
+	}
+
+	e->id = enc->encoder_id;
+	e->type = enc->encoder_type;
+	e->crtc_id = enc->crtc_id;
+	e->possible_crtcs = enc->possible_crtcs;
+	e->possible_clones = enc->possible_clones;
+	drmModeFreeEncoder(enc);
+	return 0;
+}
+
+/* CRTCs, connectors and encoders: what a hotplug can change */
+static int read_outputs(struct drm_snapshot *snap, struct prop_cache *cache, int drm_fd)
+{
+	drmModeResPtr res;
+	int i, ret = 0;
+
+	res = drmModeGetResources(drm_fd);
+	if (!res) {
+		printf("Error get res\n");
+		return -1;
+	}
+
+	snap->num_fbs = res->count_fbs;
+	for (i = 0; i < res->count_crtcs && !ret; i++)
+		ret = read_crtc(snap, cache, drm_fd, res->crtcs[i]);
+	for (i = 0; i < res->count_connectors && !ret; i++)
+		ret = read_connector(snap, cache, drm_fd, res->connectors[i]);
+	for (i = 0; i < res->count_encoders && !ret; i++)
+		ret = read_encoder(snap, drm_fd, res->encoders[i]);
+
+	drmModeFreeResources(res);
+	return ret;
+}
+
+static int read_planes(struct drm_snapshot *snap, struct prop_cache *cache, int drm_fd)
+{
+	drmModePlaneResPtr pres;
+	drmModePlanePtr plane;
+	struct snap_plane *p;
+	uint32_t *formats;
+	int i, ret = 0;
+
+	pres = drmModeGetPlaneResources(drm_fd);
+	if (!pres)
+		return 0;
+
+	for (i = 0; i < pres->count_planes && !ret; i++) {
+		plane = drmModeGetPlane(drm_fd, pres->planes[i]);
+		if (!plane)
+			continue;
+
+		p = snap_push(snap, SNAP_PLANES, 1);
+		formats = snap_push(snap, SNAP_FORMATS, plane->count_formats);
+		if (!p || (!formats && plane->count_formats)) {
+			drmModeFreePlane(plane);
+			ret = -1;
+			break;
+		}
+
+		p->id = plane->plane_id;
+		p->crtc_id = plane->crtc_id;
+		p->fb_id = plane->fb_id;
+		p->possible_crtcs = plane->possible_crtcs;
+		p->formats.first = snap->count[SNAP_FORMATS] - plane->count_formats;
+		p->formats.count = plane->count_formats;
+		memcpy(formats, plane->formats, sizeof(*formats) * plane->count_formats);
+		drmModeFreePlane(plane);
+
+		ret = read_props(snap, cache, drm_fd, p->id, DRM_MODE_OBJECT_PLANE, &p->props);
+		if (!ret)
+			ret = read_in_formats(snap, p);
+	}
+
+	drmModeFreePlaneResources(pres);
+	return ret;
+}
+
+int snapshot_read(struct drm_snapshot *snap, int drm_fd)
+{
+	struct prop_cache cache = { 0, };
+	int ret;
+
+	memset(snap, 0, sizeof(*snap));
+
+	/* All the planes, primary and cursor ones included */
+	drmSetClientCap(drm_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+
+	ret = read_outputs(snap, &cache, drm_fd);
+	if (!ret)
+		ret = read_planes(snap, &cache, drm_fd);
+
+	free_prop_cache(&cache);
+	if (ret)
+		snapshot_free(snap);
+
+	return ret;
+}
+
+/* ============ Partial re-reads =========== */
+
+/* Append entries src of the same array in old, dst gets where they landed */
+static int copy_range(struct drm_snapshot *snap, const struct drm_snapshot *old,
+		enum snap_array a, struct snap_range src, struct snap_range *dst)
+{
+	void *p;
+
+	dst->first = snap->count[a];
+	dst->count = src.count;
+	p = snap_push(snap, a, src.count);
+	if (!p && src.count)
+		return -1;
+
+	memcpy(p, (const char *)old->arr[a] + (size_t)src.first * elem_size[a],
+		(size_t)src.count * elem_size[a]);
+	return 0;
+}
+
+static int copy_props(struct drm_snapshot *snap, const struct drm_snapshot *old,
+		struct snap_range src, struct snap_range *dst)
+{
+	struct snap_prop *prop;
+	uint32_t i;
+
+	if (copy_range(snap, old, SNAP_PROPS, src, dst))
+		return -1;
+
+	for (i = 0; i < dst->count; i++) {
+		prop = &snap->props[dst->first + i];
+		if (copy_range(snap, old, SNAP_BLOB_DATA, prop->blob, &prop->blob))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int copy_crtc(struct drm_snapshot *snap, const struct drm_snapshot *old, uint32_t i)
+{
+	struct snap_crtc *c = snap_push(snap, SNAP_CRTCS, 1);
+
+	if (!c)
+		return -1;
+
+	*c = old->crtcs[i];
+	return copy_props(snap, old, old->crtcs[i].props, &c->props);
+}
+
+static int copy_connector(struct drm_snapshot *snap, const struct drm_snapshot *old, uint32_t i)
+{
+	struct snap_connector *c = snap_push(snap, SNAP_CONNECTORS, 1);
+
+	if (!c)
+		return -1;
+
+	*c = old->connectors[i];
+	if (copy_range(snap, old, SNAP_MODES, old->connectors[i].modes, &c->modes))
+		return -1;
+
+	return copy_props(snap, old, old->connectors[i].props, &c->props);
+}
+
+static int copy_plane(struct drm_snapshot *snap, const struct drm_snapshot *old, uint32_t i)
+{
+	struct snap_plane *p = snap_push(snap, SNAP_PLANES, 1);
+
+	if (!p)
+		return -1;
+
+	*p = old->planes[i];
+	if (copy_range(snap, old, SNAP_FORMATS, old->planes[i].formats, &p->formats) ||
+		copy_range(snap, old, SNAP_MODIFIERS, old->planes[i].modifiers, &p->modifiers))
+		return -1;
+
+	return copy_props(snap, old, old->planes[i].props, &p->props);
+}
+
+static int in_list(uint32_t id, const uint32_t *ids, int num_ids)
+{
+	int i;
+
+	for (i = 0; i < num_ids; i++) {
+		if (ids[i] == id)
+			return 1;
+	}
+
+	return 0;
+}
+
+int snapshot_reread(struct drm_snapshot *snap, const struct drm_snapshot *old, int drm_fd,
+		const uint32_t *conn_ids, int num_conn_ids)
+{
+	struct prop_cache cache = { 0, };
+	struct snap_range all = { 0, 0 };
+	uint32_t i;
+	int ret = 0;
+
+	memset(snap, 0, sizeof(*snap));
+	snap->num_fbs = old->num_fbs;
+
+	if (!num_conn_ids) {
+		ret = read_outputs(snap, &cache, drm_fd);
+	} else {
+		for (i = 0; i < old->count[SNAP_CRTCS] && !ret; i++)
+			ret = copy_crtc(snap, old, i);
+
+		for (i = 0; i < old->count[SNAP_CONNECTORS] && !ret; i++) {
+			if (in_list(old->connectors[i].id, conn_ids, num_conn_ids))
+				ret = read_connector(snap, &cache, drm_fd, old->connectors[i].id);
+			else
+				ret = copy_connector(snap, old, i);
+		}
+
+		/* Encoders have no lists of their own, they go in one copy */
+		all.count = old->count[SNAP_ENCODERS];
+		if (!ret)
+			ret = copy_range(snap, old, SNAP_ENCODERS, all, &all);
+	}
+
+	/* Planes and their formats don't change at runtime */
+	for (i = 0; i < old->count[SNAP_PLANES] && !ret; i++)
+		ret = copy_plane(snap, old, i);
+
+	free_prop_cache(&cache);
+	if (ret)
+		snapshot_free(snap);
+
+	return ret;
+}
+
+void snapshot_free(struct drm_snapshot *snap)
+{
+	int a;
+
+	if (snap->map) {
+		munmap(snap->map, snap->map_size);
+	} else {
+		for (a = 0; a < SNAP_NUM_ARRAYS; a++)
+			free(snap->arr[a]);
+	}
+
+	memset(snap, 0, sizeof(*snap));
+}
+
+/* ============ Binary file =========== */
+
+struct snap_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_fbs;
+	uint32_t count[SNAP_NUM_ARRAYS];
+	/* A layout change makes old files fail to load, and not load garbage */
+	uint32_t elem_size[SNAP_NUM_ARRAYS];
+};
+
+/* Every array starts 8 byte aligned in the file, so it can be used in place */
+static size_t array_bytes(uint32_t count, enum snap_array a)
+{
+	return ((size_t)count * elem_size[a] + 7) & ~(size_t)7;
+}
+
+int snapshot_save(const struct drm_snapshot *snap, const char *path)
+{
+	static const char zeros[8];
+	struct snap_file_header hdr;
+	size_t bytes;
+	FILE *f;
+	int a;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+	hdr.version = SNAP_VERSION;
+	hdr.num_fbs = snap->num_fbs;
+	for (a = 0; a < SNAP_NUM_ARRAYS; a++) {
+		hdr.count[a] = snap->count[a];
+		hdr.elem_size[a] = elem_size[a];
+	}
+
+	f = fopen(path, "wb");
+	if (!f) {
+		printf("Can't write %s: %m\n", path);
+		return -1;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	for (a = 0; a < SNAP_NUM_ARRAYS; a++) {
+		bytes = (size_t)snap->count[a] * elem_size[a];
+		fwrite(snap->arr[a], 1, bytes, f);
+		fwrite(zeros, 1, array_bytes(snap->count[a], a) - bytes, f);
+	}
+
+	if (fclose(f)) {
+		printf("Can't write %s: %m\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Written so that first + count can't wrap */
+static int range_ok(const struct drm_snapshot *snap, enum snap_array a, struct snap_range r)
+{
+	return r.first <= snap->count[a] && r.count <= snap->count[a] - r.first;
+}
+
+static int name_ok(const char *name)
+{
+	return memchr(name, 0, SNAP_NAME_LEN) != NULL;
+}
+
+/* Every range of every object within its array, and the names terminated */
+static int snapshot_check(const struct drm_snapshot *snap)
+{
+	const struct snap_connector *c;
+	const struct snap_plane *p;
+	const struct snap_prop *pr;
+	uint32_t i;
+
+	for (i = 0; i < snap->count[SNAP_CRTCS]; i++) {
+		if (!range_ok(snap, SNAP_PROPS, snap->crtcs[i].props))
+			return -1;
+	}
+
+	for (i = 0; i < snap->count[SNAP_CONNECTORS]; i++) {
+		c = &snap->connectors[i];
+		if (!range_ok(snap, SNAP_MODES, c->modes) || !range_ok(snap, SNAP_PROPS, c->props))
+			return -1;
+	}
+
+	for (i = 0; i < snap->count[SNAP_PLANES]; i++) {
+		p = &snap->planes[i];
+		if (!range_ok(snap, SNAP_FORMATS, p->formats) ||
+			!range_ok(snap, SNAP_MODIFIERS, p->modifiers) ||
+			!range_ok(snap, SNAP_PROPS, p->props))
+			return -1;
+	}
+
+	for (i = 0; i < snap->count[SNAP_PROPS]; i++) {
+		pr = &snap->props[i];
+		if (!range_ok(snap, SNAP_BLOB_DATA, pr->blob) || !name_ok(pr->name) ||
+			!name_ok(pr->enum_name))
+			return -1;
+	}
+
+	return 0;
+}
+
+int snapshot_load(struct drm_snapshot *snap, const char *path)
+{
+	const struct snap_file_header *hdr;
+	size_t off, total;
+	struct stat st;
+	char *map;
+	int fd, a;
+
+	memset(snap, 0, sizeof(*snap));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Can't open %s: %m\n", path);
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		printf("%s is not a snapshot\n", path);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		printf("Can't map %s: %m\n", path);
+		return -1;
+	}
+
+	hdr = (const void *)map;
+	if (memcmp(hdr->magic, SNAP_MAGIC, sizeof(SNAP_MAGIC)) || hdr->version != SNAP_VERSION)
+		goto bad;
+
+	total = sizeof(*hdr);
+	for (a = 0; a < SNAP_NUM_ARRAYS; a++) {
+		if (hdr->elem_size[a] != elem_size[a])
+			goto bad;
+		total += array_bytes(hdr->count[a], a);
+	}
+
+	if (total > st.st_size)
+		goto bad;
+
+	snap->map = map;
+	snap->map_size = st.st_size;
+	snap->num_fbs = hdr->num_fbs;
+
+	off = sizeof(*hdr);
+	for (a = 0; a < SNAP_NUM_ARRAYS; a++) {
+		snap->count[a] = hdr->count[a];
+		snap->arr[a] = map + off;
+		off += array_bytes(hdr->count[a], a);
+	}
+
+	/* Nothing reading it checks the ranges again */
+	if (snapshot_check(snap)) {
+		printf("%s is corrupt\n", path);
+		snapshot_free(snap);
+		return -1;
+	}
+
+	return 0;
+
+bad:
+	printf("%s is not a snapshot of this version\n", path);
+	munmap(map, st.st_size);
+	return -1;
+}
+
+/* ============ Text =========== */
+
+static void print_format_name(FILE *out, uint32_t code)
+{
+	char a = code & 0xff, b = code >> 8 & 0xff, c = code >> 16 & 0xff, d = code >> 24 & 0xff;
+
+	if (!code)
+		return;
+
+	if (a == 'X' && b == 'R') {
+		fprintf(out, "Format name XBGR%c%c\n", c, d);
+		return;
+	}
+
+	if (a == 'R' && b == 'X') {
+		fprintf(out, "Format name RGBX%c%c\n", c, d);
+		return;
+	}
+
+	if (a == 'A' && b == 'R') {
+		fprintf(out, "Format name ABGR%c%c\n", c, d);
+		return;
+	}
+
+	if (a == 'R' && b == 'A') {
+		fprintf(out, "Format name RGBA%c%c\n", c, d);
+		return;
+	}
+
+	fprintf(out, "Format name %c%c%c%c\n", a, b, c, d);
+}
+
+/* The same report drm_display_info always printed */
+void snapshot_print_text(const struct drm_snapshot *snap, FILE *out)
+{
+	const struct snap_connector *conn;
+	const struct snap_plane *p;
+	const struct snap_prop *prop;
+	uint32_t i, j;
+
+	fprintf(out, "Get Res: CRTCs: %d Connectors: %d Enc: %d FBs: %d\n",
+		snap->count[SNAP_CRTCS], snap->count[SNAP_CONNECTORS],
+		snap->count[SNAP_ENCODERS], snap->num_fbs);
+
+	fprintf(out, "\n============== CRTCs =================\n");
+	for (i = 0; i < snap->count[SNAP_CRTCS]; i++) {
+		fprintf(out, "CRTC: id:0x%x, w:%d h:%d x:%d y:%d\n",
+			snap->crtcs[i].id, snap->crtcs[i].width, snap->crtcs[i].height,
+			snap->crtcs[i].x, snap->crtcs[i].y);
+	}
+	fprintf(out, "==========================================\n");
+
+	fprintf(out, "\n============== Connectors =================\n");
+	for (i = 0; i < snap->count[SNAP_CONNECTORS]; i++) {
+		conn = &snap->connectors[i];
+		fprintf(out, "Conn: id:0x%x, wxh(mm):%dx%d, status:%d props: %d modes:%d\n",
+			conn->id, conn->mm_width, conn->mm_height, conn->connection,
+			conn->props.count, conn->modes.count);
+
+		/* Properties are the same for all, just the first one lists them */
+		if (i)
+			continue;
+
+		fprintf(out, "\n\t============== Connector props =================\n");
+		for (j = 0; j < conn->props.count; j++) {
+			prop = &snap->props[conn->props.first + j];
+			fprintf(out, "\tConn Prop: id: 0x%x, name: %s\n", prop->id, prop->name);
+		}
+		fprintf(out, "\t==========================================\n");
+	}
+	fprintf(out, "==========================================\n");
+
+	fprintf(out, "\n============== Encs =================\n");
+	for (i = 0; i < snap->count[SNAP_ENCODERS]; i++)
+		fprintf(out, "ENC: id:0x%x, type: %d\n", snap->encoders[i].id, snap->encoders[i].type);
+	fprintf(out, "==========================================\n");
+
+	fprintf(out, "\n============== Planes =================\n");
+	for (i = 0; i < snap->count[SNAP_PLANES]; i++) {
+		p = &snap->planes[i];
+		fprintf(out, "\nPlane: CRTC id:0x%x, plane id: 0x%x num_formats: %d\n",
+			p->crtc_id, p->id, p->formats.count);
+		fprintf(out, "Supported Formats:\n");
+		for (j = 0; j < p->formats.count; j++) {
+			fprintf(out, "0x%x ", snap->formats[p->formats.first + j]);
+			print_format_name(out, snap->formats[p->formats.first + j]);
+			if (j && j % 10 == 0)
+				fprintf(out, "\n");
+		}
+		fprintf(out, "\n");
+	}
+	fprintf(out, "\n==========================================\n");
+}
+
+/* ============ JSON =========== */
+
+static void json_string(FILE *out, const char *s, size_t max)
+{
+	size_t i;
+
+	fputc('"', out);
+	for (i = 0; i < max && s[i]; i++) {
+		if (s[i] == '"' || s[i] == '\\')
+			fprintf(out, "\\%c", s[i]);
+		else if ((unsigned char)s[i] < 0x20 || (unsigned char)s[i] >= 0x7f)
+			fprintf(out, "\\u%04x", (unsigned char)s[i]);
+		else
+			fputc(s[i], out);
+	}
+	fputc('"', out);
+}
+
+static void json_fourcc(FILE *out, uint32_t format)
+{
+	char name[4] = { format & 0xff, format >> 8 & 0xff, format >> 16 & 0xff, format >> 24 & 0xff };
+
+	json_string(out, name, sizeof(name));
+}
+
+static void json_mode(FILE *out, const drmModeModeInfo *m)
+{
+	fprintf(out, "{\"name\":");
+	json_string(out, m->name, sizeof(m->name));
+	fprintf(out, ",\"clock\":%u,\"hdisplay\":%u,\"hsync_start\":%u,\"hsync_end\":%u,"
+		"\"htotal\":%u,\"hskew\":%u,\"vdisplay\":%u,\"vsync_start\":%u,"
+		"\"vsync_end\":%u,\"vtotal\":%u,\"vscan\":%u,\"vrefresh\":%u,"
+		"\"flags\":%u,\"type\":%u}",
+		m->clock, m->hdisplay, m->hsync_start, m->hsync_end, m->htotal, m->hskew,
+		m->vdisplay, m->vsync_start, m->vsync_end, m->vtotal, m->vscan, m->vrefresh,
+		m->flags, m->type);
+}
+
+static void json_hex(FILE *out, const uint8_t *data, uint32_t len)
+{
+	uint32_t i;
+
+	fputc('"', out);
+	for (i = 0; i < len; i++)
+		fprintf(out, "%02x", data[i]);
+	fputc('"', out);
+}
+
+/* The identification bits of an EDID, and the monitor name if it has one */
+static void json_edid(FILE *out, const uint8_t *e, uint32_t len)
+{
+	static const uint8_t header[8] = { 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0 };
+	uint16_t mfg = e[8] << 8 | e[9];
+	char vendor[3], name[14] = "";
+	const uint8_t *d;
+	int i, j;
+
+	vendor[0] = '@' + (mfg >> 10 & 0x1f);
+	vendor[1] = '@' + (mfg >> 5 & 0x1f);
+	vendor[2] = '@' + (mfg & 0x1f);
+
+	/* Display descriptors, 0xfc is the monitor name */
+	for (i = 54; i <= 108; i += 18) {
+		d = e + i;
+		if (d[0] || d[1] || d[3] != 0xfc)
+			continue;
+
+		for (j = 0; j < 13 && d[5 + j] != '\n'; j++)
+			name[j] = d[5 + j];
+		name[j] = 0;
+	}
+
+	fprintf(out, "{\"valid\":%s,\"vendor\":", memcmp(e, header, 8) ? "false" : "true");
+	json_string(out, vendor, sizeof(vendor));
+	fprintf(out, ",\"product\":%u,\"serial\":%u,\"year\":%u,\"version\":\"%u.%u\",\"name\":",
+		e[10] | e[11] << 8, e[12] | e[13] << 8 | e[14] << 16 | (uint32_t)e[15] << 24,
+		1990 + e[17], e[18], e[19]);
+	json_string(out, name, sizeof(name));
+	fprintf(out, ",\"size\":%u,\"raw\":", len);
+	json_hex(out, e, len);
+	fputc('}', out);
+}
+
+/* Blobs the tool knows get decoded, the rest come out as hex */
+static void json_blob(FILE *out, const struct drm_snapshot *snap, const struct snap_prop *prop)
+{
+	const uint8_t *data = snap->blob_data + prop->blob.first;
+
+	if (!strcmp(prop->name, "EDID") && prop->blob.count >= 128)
+		json_edid(out, data, prop->blob.count);
+	else if (!strcmp(prop->name, "MODE_ID") && prop->blob.count >= sizeof(drmModeModeInfo))
+		json_mode(out, (const drmModeModeInfo *)data);
+	else
+		json_hex(out, data, prop->blob.count);
+}
+
+static void json_props(FILE *out, const struct drm_snapshot *snap, const struct snap_range *props)
+{
+	const struct snap_prop *prop;
+	uint32_t i;
+
+	fprintf(out, "\"properties\":[");
+	for (i = 0; i < props->count; i++) {
+		prop = &snap->props[props->first + i];
+		fprintf(out, "%s{\"id\":%u,\"name\":", i ? "," : "", prop->id);
+		json_string(out, prop->name, sizeof(prop->name));
+		fprintf(out, ",\"flags\":%u,\"immutable\":%s,\"value\":%llu", prop->flags,
+			prop->flags & DRM_MODE_PROP_IMMUTABLE ? "true" : "false",
+			(unsigned long long)prop->value);
+
+		if (prop->enum_name[0]) {
+			fprintf(out, ",\"enum\":");
+			json_string(out, prop->enum_name, sizeof(prop->enum_name));
+		}
+
+		if (prop->blob.count) {
+			fprintf(out, ",\"blob\":");
+			json_blob(out, snap, prop);
+		}
+		fputc('}', out);
+	}
+	fputc(']', out);
+}
+
+void snapshot_print_json(const struct drm_snapshot *snap, FILE *out)
+{
+	const struct snap_connector *conn;
+	const struct snap_encoder *enc;
+	const struct snap_crtc *crtc;
+	const struct snap_plane *p;
+	const struct snap_modifier *m;
+	uint32_t i, j;
+
+	fprintf(out, "{\"fbs\":%u,\"crtcs\":[", snap->num_fbs);
+	for (i = 0; i < snap->count[SNAP_CRTCS]; i++) {
+		crtc = &snap->crtcs[i];
+		fprintf(out, "%s{\"id\":%u,\"fb_id\":%u,\"x\":%u,\"y\":%u,\"width\":%u,\"height\":%u,\"mode\":",
+			i ? "," : "", crtc->id, crtc->fb_id, crtc->x, crtc->y, crtc->width, crtc->height);
+		if (crtc->mode_valid)
+			json_mode(out, &crtc->mode);
+		else
+			fprintf(out, "null");
+		fputc(',', out);
+		json_props(out, snap, &crtc->props);
+		fputc('}', out);
+	}
+
+	fprintf(out, "],\"connectors\":[");
+	for (i = 0; i < snap->count[SNAP_CONNECTORS]; i++) {
+		conn = &snap->connectors[i];
+		fprintf(out, "%s{\"id\":%u,\"type\":%u,\"type_id\":%u,\"connection\":%u,"
+			"\"mm_width\":%u,\"mm_height\":%u,\"encoder_id\":%u,\"modes\":[",
+			i ? "," : "", conn->id, conn->type, conn->type_id, conn->connection,
+			conn->mm_width, conn->mm_height, conn->encoder_id);
+		for (j = 0; j < conn->modes.count; j++) {
+			if (j)
+				fputc(',', out);
+			json_mode(out, &snap->modes[conn->modes.first + j]);
+		}
+		fprintf(out, "],");
+		json_props(out, snap, &conn->props);
+		fputc('}', out);
+	}
+
+	fprintf(out, "],\"encoders\":[");
+	for (i = 0; i < snap->count[SNAP_ENCODERS]; i++) {
+		enc = &snap->encoders[i];
+		fprintf(out, "%s{\"id\":%u,\"type\":%u,\"crtc_id\":%u,\"possible_crtcs\":%u,"
+			"\"possible_clones\":%u}", i ? "," : "", enc->id, enc->type, enc->crtc_id,
+			enc->possible_crtcs, enc->possible_clones);
+	}
+
+	fprintf(out, "],\"planes\":[");
+	for (i = 0; i < snap->count[SNAP_PLANES]; i++) {
+		p = &snap->planes[i];
+		fprintf(out, "%s{\"id\":%u,\"crtc_id\":%u,\"fb_id\":%u,\"possible_crtcs\":%u,\"formats\":[",
+			i ? "," : "", p->id, p->crtc_id, p->fb_id, p->possible_crtcs);
+		for (j = 0; j < p->formats.count; j++) {
+			if (j)
+				fputc(',', out);
+			json_fourcc(out, snap->formats[p->formats.first + j]);
+		}
+
+		fprintf(out, "],\"modifiers\":[");
+		for (j = 0; j < p->modifiers.count; j++) {
+			m = &snap->modifiers[p->modifiers.first + j];
+			fprintf(out, "%s{\"format\":", j ? "," : "");
+			json_fourcc(out, m->format);
+			fprintf(out, ",\"modifier\":\"0x%016llx\"}", (unsigned long long)m->modifier);
+		}
+		fprintf(out, "],");
+		json_props(out, snap, &p->props);
+		fputc('}', out);
+	}
+
+	fprintf(out, "]}\n");
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * A snapshot of the DRM topology: CRTCs, connectors, encoders and planes
+ * with all their properties, read from the device in one go. Entries of
+ * the variable length lists (modes, properties, formats, modifiers, blob
+ * contents) all live in shared arrays, and objects point at them with a
+ * snap_range. That keeps the snapshot flat, so it saves to a file as is
+ * and loads back with a single mmap.
+ */
+#ifndef __DRM_SNAPSHOT_H__
+#define __DRM_SNAPSHOT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#define SNAP_NAME_LEN 32
+
+/* entries [first, first + count) of one of the shared arrays */
+struct snap_range {
+	uint32_t first;
+	uint32_t count;
+};
+
+struct snap_prop {
+	uint32_t id;
+	uint32_t flags;
+	uint64_t value;
+	char name[SNAP_NAME_LEN];
+	/* Name of the value, for enum properties */
+	char enum_name[SNAP_NAME_LEN];
+	/* Contents in blob_data, for blob properties */
+	struct snap_range blob;
+};
+
+struct snap_crtc {
+	uint32_t id;
+	uint32_t fb_id;
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mode_valid;
+	uint32_t pad;
+	drmModeModeInfo mode;
+	struct snap_range props;
+};
+
+struct snap_connector {
+	uint32_t id;
+	uint32_t type;
+	uint32_t type_id;
+	uint32_t connection;
+	uint32_t mm_width;
+	uint32_t mm_height;
+	uint32_t encoder_id;
+	uint32_t pad;
+	struct snap_range modes;
+	struct snap_range props;
+};
+
+struct snap_encoder {
+	uint32_t id;
+	uint32_t type;
+	uint32_t crtc_id;
+	uint32_t possible_crtcs;
+	uint32_t possible_clones;
+};
+
+struct snap_plane {
+	uint32_t id;
+	uint32_t crtc_id;
+	uint32_t fb_id;
+	uint32_t possible_crtcs;
+	struct snap_range formats;
+	/* From IN_FORMATS, if the plane has it */
+	struct snap_range modifiers;
+	struct snap_range props;
+};
+
+struct snap_modifier {
+	uint32_t format;
+	uint32_t pad;
+	uint64_t modifier;
+};
+
+enum snap_array {
+	SNAP_CRTCS,
+	SNAP_CONNECTORS,
+	SNAP_ENCODERS,
+	SNAP_PLANES,
+	SNAP_MODES,
+	SNAP_PROPS,
+	SNAP_FORMATS,
+	SNAP_MODIFIERS,
+	SNAP_BLOB_DATA,
+	SNAP_NUM_ARRAYS,
+};
+
+struct drm_snapshot {
+	uint32_t num_fbs;
+	uint32_t count[SNAP_NUM_ARRAYS];
+	/* The typed pointers are in enum snap_array order */
+	union {
+		void *arr[SNAP_NUM_ARRAYS];
+		struct {
+			struct snap_crtc *crtcs;
+			struct snap_connector *connectors;
+			struct snap_encoder *encoders;
+			struct snap_plane *planes;
+			drmModeModeInfo *modes;
+			struct snap_prop *props;
+			uint32_t *formats;
+			struct snap_modifier *modifiers;
+			uint8_t *blob_data;
+		};
+	};
+
+	/* Allocated entries, while reading from a device */
+	uint32_t cap[SNAP_NUM_ARRAYS];
+	/* The file mapping, for a loaded snapshot */
+	void *map;
+	size_t map_size;
+};
+
+/* Read everything from the device */
+int snapshot_read(struct drm_snapshot *snap, int drm_fd);
+
+/*
+ * A new snapshot from old, re-reading only what a hotplug can change:
+ * just the listed connectors, or with none listed all the CRTCs,
+ * connectors and encoders. Everything else is copied over from old.
+ */
+int snapshot_reread(struct drm_snapshot *snap, const struct drm_snapshot *old, int drm_fd,
+		const uint32_t *conn_ids, int num_conn_ids);
+
+/* Native endianness, meant for the same machine or an alike one */
+int snapshot_save(const struct drm_snapshot *snap, const char *path);
+int snapshot_load(struct drm_snapshot *snap, const char *path);
+
+void snapshot_free(struct drm_snapshot *snap);
+
+void snapshot_print_text(const struct drm_snapshot *snap, FILE *out);
+void snapshot_print_json(const struct drm_snapshot *snap, FILE *out);
+
+/*
+ * Print what changed from old to new, one change per line, as text or as
+ * JSON objects. Objects are matched by ID, and blobs by their contents
+ * (a re-probed EDID gets a new blob ID). Returns the number of changes.
+ */
+int snapshot_diff(const struct drm_snapshot *old, const struct drm_snapshot *new,
+		FILE *out, int json);
+
+#endif
@@ -0,0 +1,360 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/* Snapshot diffs, for drm_display_info --watch and --diff */
+#include <stdio.h>
+#include <string.h>
+
+#include "drm_snapshot.h"
+
+#define VALUE_LEN 64
+
+struct diff_out {
+	FILE *out;
+	int json;
+	int changes;
+};
+
+static void diff_json_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(out, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20 || (unsigned char)*s >= 0x7f)
+			fprintf(out, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+/* A whole object came or went */
+static void emit_object(struct diff_out *d, const char *obj, uint32_t id, const char *change)
+{
+	d->changes++;
+
+	if (!d->json) {
+		fprintf(d->out, "%s %u: %s\n", obj, id, change);
+		return;
+	}
+
+	fprintf(d->out, "{\"object\":\"%s\",\"id\":%u,\"change\":\"%s\"}\n", obj, id, change);
+}
+
+/* A field changed, from is NULL for an added list entry and to for a removed one */
+static void emit_field(struct diff_out *d, const char *obj, uint32_t id, const char *field,
+		const char *from, const char *to)
+{
+	d->changes++;
+
+	if (!d->json) {
+		if (!from)
+			fprintf(d->out, "%s %u: %s: + %s\n", obj, id, field, to);
+		else if (!to)
+			fprintf(d->out, "%s %u: %s: - %s\n", obj, id, field, from);
+		else
+			fprintf(d->out, "%s %u: %s: %s -> %s\n", obj, id, field, from, to);
+		return;
+	}
+
+	fprintf(d->out, "{\"object\":\"%s\",\"id\":%u,\"field\":", obj, id);
+	diff_json_string(d->out, field);
+	fprintf(d->out, ",\"old\":");
+	if (from)
+		diff_json_string(d->out, from);
+	else
+		fprintf(d->out, "null");
+	fprintf(d->out, ",\"new\":");
+	if (to)
+		diff_json_string(d->out, to);
+	else
+		fprintf(d->out, "null");
+	fprintf(d->out, "}\n");
+}
+
+static void diff_u32(struct diff_out *d, const char *obj, uint32_t id, const char *field,
+		uint32_t from, uint32_t to)
+{
+	char a[VALUE_LEN], b[VALUE_LEN];
+
+	if (from == to)
+		return;
+
+	snprintf(a, sizeof(a), "%u", from);
+	snprintf(b, sizeof(b), "%u", to);
+	emit_field(d, obj, id, field, a, b);
+}
+
+static void mode_str(const drmModeModeInfo *m, char *buf, size_t len)
+{
+	snprintf(buf, len, "%.*s@%u", (int)sizeof(m->name), m->name, m->vrefresh);
+}
+
+/* ============ Properties =========== */
+
+static const uint8_t *blob_of(const struct drm_snapshot *snap, const struct snap_prop *prop)
+{
+	return snap->blob_data + prop->blob.first;
+}
+
+static void prop_str(const struct drm_snapshot *snap, const struct snap_prop *prop,
+		char *buf, size_t len)
+{
+	if (prop->enum_name[0])
+		snprintf(buf, len, "%.*s", (int)sizeof(prop->enum_name), prop->enum_name);
+	else if (!strcmp(prop->name, "MODE_ID") && prop->blob.count >= sizeof(drmModeModeInfo))
+		mode_str((const drmModeModeInfo *)blob_of(snap, prop), buf, len);
+	else if (prop->flags & DRM_MODE_PROP_BLOB)
+		snprintf(buf, len, prop->blob.count ? "blob of %u bytes" : "none", prop->blob.count);
+	else
+		snprintf(buf, len, "%llu", (unsigned long long)prop->value);
+}
+
+static int prop_equal(const struct drm_snapshot *a, const struct snap_prop *pa,
+		const struct drm_snapshot *b, const struct snap_prop *pb)
+{
+	/* Blob IDs change with every update, even when the contents don't */
+	if (pa->flags & DRM_MODE_PROP_BLOB) {
+		return pa->blob.count == pb->blob.count &&
+			!memcmp(blob_of(a, pa), blob_of(b, pb), pa->blob.count);
+	}
+
+	return pa->value == pb->value;
+}
+
+static void diff_props(struct diff_out *d, const char *obj, uint32_t id,
+		const struct drm_snapshot *old, const struct snap_range *old_props,
+		const struct drm_snapshot *new, const struct snap_range *new_props)
+{
+	const struct snap_prop *a, *b;
+	char from[VALUE_LEN], to[VALUE_LEN];
+	uint32_t i, j;
+
+	for (i = 0; i < old_props->count; i++) {
+		a = &old->props[old_props->first + i];
+		b = NULL;
+		for (j = 0; j < new_props->count && !b; j++) {
+			if (new->props[new_props->first + j].id == a->id)
+				b = &new->props[new_props->first + j];
+		}
+
+		prop_str(old, a, from, sizeof(from));
+		if (!b) {
+			emit_field(d, obj, id, a->name, from, NULL);
+			continue;
+		}
+
+		if (prop_equal(old, a, new, b))
+			continue;
+
+		prop_str(new, b, to, sizeof(to));
+		/* Same summary for different blobs, say at least that it changed */
+		if (!strcmp(from, to))
+			snprintf(to + strlen(to), sizeof(to) - strlen(to), " (changed)");
+		emit_field(d, obj, id, b->name, from, to);
+	}
+
+	for (j = 0; j < new_props->count; j++) {
+		b = &new->props[new_props->first + j];
+		for (i = 0; i < old_props->count; i++) {
+			if (old->props[old_props->first + i].id == b->id)
+				break;
+		}
+
+		if (i == old_props->count) {
+			prop_str(new, b, to, sizeof(to));
+			emit_field(d, obj, id, b->name, NULL, to);
+		}
+	}
+}
+
+/* ============ Objects =========== */
+
+static int has_mode(const drmModeModeInfo *modes, uint32_t count, const drmModeModeInfo *m)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		if (!memcmp(&modes[i], m, sizeof(*m)))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Modes are compared whole, a list entry only shows up if it came or went */
+static void diff_modes(struct diff_out *d, uint32_t id,
+		const struct drm_snapshot *old, const struct snap_range *old_modes,
+		const struct drm_snapshot *new, const struct snap_range *new_modes)
+{
+	const drmModeModeInfo *a = old->modes + old_modes->first;
+	const drmModeModeInfo *b = new->modes + new_modes->first;
+	char str[VALUE_LEN];
+	uint32_t i;
+
+	for (i = 0; i < old_modes->count; i++) {
+		if (!has_mode(b, new_modes->count, &a[i])) {
+			mode_str(&a[i], str, sizeof(str));
+			emit_field(d, "connector", id, "modes", str, NULL);
+		}
+	}
+
+	for (i = 0; i < new_modes->count; i++) {
+		if (!has_mode(a, old_modes->count, &b[i])) {
+			mode_str(&b[i], str, sizeof(str));
+			emit_field(d, "connector", id, "modes", NULL, str);
+		}
+	}
+}
+
+static void diff_crtc(struct diff_out *d, const struct drm_snapshot *old, const struct snap_crtc *a,
+		const struct drm_snapshot *new, const struct snap_crtc *b)
+{
+	char from[VALUE_LEN] = "none", to[VALUE_LEN] = "none";
+
+	diff_u32(d, "crtc", a->id, "fb_id", a->fb_id, b->fb_id);
+	diff_u32(d, "crtc", a->id, "x", a->x, b->x);
+	diff_u32(d, "crtc", a->id, "y", a->y, b->y);
+	diff_u32(d, "crtc", a->id, "width", a->width, b->width);
+	diff_u32(d, "crtc", a->id, "height", a->height, b->height);
+
+	if (a->mode_valid != b->mode_valid ||
+		(a->mode_valid && memcmp(&a->mode, &b->mode, sizeof(a->mode)))) {
+		if (a->mode_valid)
+			mode_str(&a->mode, from, sizeof(from));
+		if (b->mode_valid)
+			mode_str(&b->mode, to, sizeof(to));
+		emit_field(d, "crtc", a->id, "mode", from, to);
+	}
+
+	diff_props(d, "crtc", a->id, old, &a->props, new, &b->props);
+}
+
+static void diff_connector(struct diff_out *d,
+		const struct drm_snapshot *old, const struct snap_connector *a,
+		const struct drm_snapshot *new, const struct snap_connector *b)
+{
+	diff_u32(d, "connector", a->id, "connection", a->connection, b->connection);
+	diff_u32(d, "connector", a->id, "mm_width", a->mm_width, b->mm_width);
+	diff_u32(d, "connector", a->id, "mm_height", a->mm_height, b->mm_height);
+	diff_u32(d, "connector", a->id, "encoder_id", a->encoder_id, b->encoder_id);
+	diff_modes(d, a->id, old, &a->modes, new, &b->modes);
+	diff_props(d, "connector", a->id, old, &a->props, new, &b->props);
+}
+
+static void diff_encoder(struct diff_out *d, const struct snap_encoder *a,
+		const struct snap_encoder *b)
+{
+	diff_u32(d, "encoder", a->id, "crtc_id", a->crtc_id, b->crtc_id);
+	diff_u32(d, "encoder", a->id, "possible_crtcs", a->possible_crtcs, b->possible_crtcs);
+	diff_u32(d, "encoder", a->id, "possible_clones", a->possible_clones, b->possible_clones);
+}
+
+static void diff_plane(struct diff_out *d, const struct drm_snapshot *old, const struct snap_plane *a,
+		const struct drm_snapshot *new, const struct snap_plane *b)
+{
+	diff_u32(d, "plane", a->id, "crtc_id", a->crtc_id, b->crtc_id);
+	diff_u32(d, "plane", a->id, "fb_id", a->fb_id, b->fb_id);
+	diff_u32(d, "plane", a->id, "possible_crtcs", a->possible_crtcs, b->possible_crtcs);
+	diff_props(d, "plane", a->id, old, &a->props, new, &b->props);
+}
+
+/*
+ * All the object structs start with their ID, which is what they are
+ * matched by. Index of the object with that ID, -1 if there is none.
+ */
+static int find_object(const struct drm_snapshot *snap, enum snap_array a, size_t size, uint32_t id)
+{
+	const char *arr = snap->arr[a];
+	uint32_t i;
+
+	for (i = 0; i < snap->count[a]; i++) {
+		if (*(const uint32_t *)(arr + i * size) == id)
+			return i;
+	}
+
+	return -1;
+}
+
+int snapshot_diff(const struct drm_snapshot *old, const struct drm_snapshot *new,
+		FILE *out, int json)
+{
+	struct diff_out d = { out, json, 0 };
+	uint32_t i;
+	int j;
+
+	for (i = 0; i < old->count[SNAP_CRTCS]; i++) {
+		j = find_object(new, SNAP_CRTCS, sizeof(*new->crtcs), old->crtcs[i].id);
+		if (j < 0)
+			emit_object(&d, "crtc", old->crtcs[i].id, "removed");
+		else
+			diff_crtc(&d, old, &old->crtcs[i], new, &new->crtcs[j]);
+	}
+
+	for (i = 0; i < new->count[SNAP_CRTCS]; i++) {
+		if (find_object(old, SNAP_CRTCS, sizeof(*old->crtcs), new->crtcs[i].id) < 0)
+			emit_object(&d, "crtc", new->crtcs[i].id, "added");
+	}
+
+	/* MST connectors come and go with the branch devices behind them */
+	for (i = 0; i < old->count[SNAP_CONNECTORS]; i++) {
+		j = find_object(new, SNAP_CONNECTORS, sizeof(*new->connectors), old->connectors[i].id);
+		if (j < 0)
+			emit_object(&d, "connector", old->connectors[i].id, "removed");
+		else
+			diff_connector(&d, old, &old->connectors[i], new, &new->connectors[j]);
+	}
+
+	for (i = 0; i < new->count[SNAP_CONNECTORS]; i++) {
+		if (find_object(old, SNAP_CONNECTORS, sizeof(*old->connectors), new->connectors[i].id) < 0)
+			emit_object(&d, "connector", new->connectors[i].id, "added");
+	}
+
+	for (i = 0; i < old->count[SNAP_ENCODERS]; i++) {
+		j = find_object(new, SNAP_ENCODERS, sizeof(*new->encoders), old->encoders[i].id);
+		if (j < 0)
+			emit_object(&d, "encoder", old->encoders[i].id, "removed");
+		else
+			diff_encoder(&d, &old->encoders[i], &new->encoders[j]);
+	}
+
+	for (i = 0; i < new->count[SNAP_ENCODERS]; i++) {
+		if (find_object(old, SNAP_ENCODERS, sizeof(*old->encoders), new->encoders[i].id) < 0)
+			emit_object(&d, "encoder", new->encoders[i].id, "added");
+	}
+
+	for (i = 0; i < old->count[SNAP_PLANES]; i++) {
+		j = find_object(new, SNAP_PLANES, sizeof(*new->planes), old->planes[i].id);
+		if (j < 0)
+			emit_object(&d, "plane", old->planes[i].id, "removed");
+		else
+			diff_plane(&d, old, &old->planes[i], new, &new->planes[j]);
+	}
+
+	for (i = 0; i < new->count[SNAP_PLANES]; i++) {
+		if (find_object(old, SNAP_PLANES, sizeof(*old->planes), new->planes[i].id) < 0)
+			emit_object(&d, "plane", new->planes[i].id, "added");
+	}
+
+	return d.changes;
+}
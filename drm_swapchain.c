@@ -0,0 +1,345 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "drm_swapchain.h"
+
+/* A flip which doesn't complete in this long is not going to */
+#define FLIP_TIMEOUT_MS 1000
+
+static int libdrm_set_crtc(struct swapchain *sc, struct fb *fb)
+{
+	struct drm_display *display = sc->display;
+
+	return drmModeSetCrtc(sc->drm_fd, display->crtc_id, fb->fb_fd, 0, 0,
+			&display->conn_id, 1, &display->mode);
+}
+
+static int libdrm_page_flip(struct swapchain *sc, struct fb *fb)
+{
+	return drmModePageFlip(sc->drm_fd, sc->display->crtc_id, fb->fb_fd,
+			DRM_MODE_PAGE_FLIP_EVENT, sc);
+}
+
+int swapchain_drm_wait_event(struct swapchain *sc, int timeout_ms)
+{
+	struct pollfd pfd = {
+		.fd = sc->drm_fd,
+		.events = POLLIN,
+	};
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -errno : ret;
+}
+
+int swapchain_drm_handle_event(struct swapchain *sc)
+{
+	return drmHandleEvent(sc->drm_fd, &sc->evctx);
+}
+
+int swapchain_drm_dirty_fb(struct swapchain *sc, struct fb *fb, drmModeClipPtr clips,
+		int num_clips)
+{
+	return drmModeDirtyFB(sc->drm_fd, fb->fb_fd, clips, num_clips);
+}
+
+const struct swapchain_ops swapchain_libdrm_ops = {
+	.set_crtc = libdrm_set_crtc,
+	.page_flip = libdrm_page_flip,
+	.wait_event = swapchain_drm_wait_event,
+	.handle_event = swapchain_drm_handle_event,
+	.dirty_fb = swapchain_drm_dirty_fb,
+};
+
+static void page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec,
+		unsigned int tv_usec, void *data)
+{
+	struct swapchain *sc = data;
+
+	if (sc->pending < 0) {
+		printf("Flip event without a pending flip\n");
+		return;
+	}
+
+	if (sc->front >= 0)
+		sc->state[sc->front] = SC_BUF_FREE;
+
+	sc->front = sc->pending;
+	sc->state[sc->front] = SC_BUF_SCANOUT;
+	sc->pending = -1;
+
+	sc->flips++;
+	sc->last_seq = sequence;
+	sc->last_sec = tv_sec;
+	sc->last_usec = tv_usec;
+
+	if (sc->flip_cb)
+		sc->flip_cb(sc, sc->bufs[sc->front], sequence, tv_sec, tv_usec, sc->flip_data);
+}
+
+int swapchain_init(struct swapchain *sc, int drm_fd, struct drm_display *display,
+		struct fb **bufs, int count, const struct swapchain_ops *ops, void *priv)
+{
+	int i;
+
+	if (!sc || !display || !bufs || count < 2 || count > SWAPCHAIN_MAX_BUFFERS) {
+		printf("Invalid swapchain of %d buffers\n", count);
+		return -1;
+	}
+
+	memset(sc, 0, sizeof(*sc));
+	sc->drm_fd = drm_fd;
+	sc->display = display;
+	sc->ops = ops ? ops : &swapchain_libdrm_ops;
+	sc->priv = priv;
+	sc->evctx.version = 2;
+	sc->evctx.page_flip_handler = page_flip_handler;
+	sc->count = count;
+	sc->front = -1;
+	sc->pending = -1;
+
+	for (i = 0; i < count; i++) {
+		sc->bufs[i] = bufs[i];
+		sc->state[i] = SC_BUF_FREE;
+	}
+
+	return 0;
+}
+
+void swapchain_set_flip_cb(struct swapchain *sc, swapchain_flip_cb cb, void *data)
+{
+	sc->flip_cb = cb;
+	sc->flip_data = data;
+}
+
+int swapchain_dispatch(struct swapchain *sc, int timeout_ms)
+{
+	int ret;
+
+	ret = sc->ops->wait_event(sc, timeout_ms);
+	if (ret <= 0)
+		return ret;
+
+	ret = sc->ops->handle_event(sc);
+	if (ret < 0) {
+		printf("Failed to handle DRM event, ret=%d\n", ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+int swapchain_wait_idle(struct swapchain *sc)
+{
+	int ret;
+
+	while (sc->pending >= 0) {
+		ret = sc->ops->wait_event(sc, FLIP_TIMEOUT_MS);
+		if (ret < 0)
+			return ret;
+		if (!ret) {
+			printf("Timed out waiting for page flip\n");
+			return -ETIMEDOUT;
+		}
+
+		ret = sc->ops->handle_event(sc);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+struct fb *swapchain_try_acquire(struct swapchain *sc)
+{
+	int i;
+
+	for (i = 0; i < sc->count; i++) {
+		if (sc->state[i] == SC_BUF_FREE) {
+			sc->state[i] = SC_BUF_ACQUIRED;
+			return sc->bufs[i];
+		}
+	}
+
+	return NULL;
+}
+
+struct fb *swapchain_acquire(struct swapchain *sc)
+{
+	struct fb *fb;
+
+	for (;;) {
+		fb = swapchain_try_acquire(sc);
+		if (fb)
+			return fb;
+
+		/* Everything is on screen or queued, only a flip can free one up */
+		if (sc->pending < 0) {
+			printf("No free buffer in swapchain\n");
+			return NULL;
+		}
+
+		if (swapchain_wait_idle(sc))
+			return NULL;
+	}
+}
+
+static int swapchain_index(struct swapchain *sc, struct fb *fb)
+{
+	int i;
+
+	for (i = 0; i < sc->count; i++) {
+		if (sc->bufs[i] == fb)
+			return i;
+	}
+
+	return -1;
+}
+
+int swapchain_hold(struct swapchain *sc, struct fb *fb)
+{
+	int idx = swapchain_index(sc, fb);
+
+	if (idx < 0 || sc->state[idx] != SC_BUF_FREE) {
+		printf("Can only hold a free buffer\n");
+		return -EINVAL;
+	}
+
+	sc->state[idx] = SC_BUF_HELD;
+	return 0;
+}
+
+void swapchain_cancel(struct swapchain *sc, struct fb *fb)
+{
+	int idx = swapchain_index(sc, fb);
+
+	if (idx >= 0 && sc->state[idx] == SC_BUF_ACQUIRED)
+		sc->state[idx] = SC_BUF_FREE;
+}
+
+void swapchain_release(struct swapchain *sc, struct fb *fb)
+{
+	int idx = swapchain_index(sc, fb);
+
+	if (idx >= 0 && sc->state[idx] == SC_BUF_HELD)
+		sc->state[idx] = SC_BUF_FREE;
+}
+
+int swapchain_present(struct swapchain *sc, struct fb *fb)
+{
+	int idx = swapchain_index(sc, fb);
+	int ret;
+
+	if (idx < 0 || sc->state[idx] != SC_BUF_ACQUIRED) {
+		printf("Can't present a buffer which was not acquired\n");
+		return -EINVAL;
+	}
+
+	/* Only one flip can be in flight on a CRTC */
+	ret = swapchain_wait_idle(sc);
+	if (ret)
+		return ret;
+
+	if (sc->front < 0) {
+		/* Nothing on screen yet, so this one needs the modeset */
+		ret = sc->ops->set_crtc(sc, fb);
+		if (ret < 0) {
+			printf("Set CRTC fail, ret =%d\n", ret);
+			return ret;
+		}
+
+		sc->front = idx;
+		sc->state[idx] = SC_BUF_SCANOUT;
+		paint_damage_clear(&fb->damage);
+		return 0;
+	}
+
+	ret = sc->ops->page_flip(sc, fb);
+	if (ret < 0) {
+		printf("Page flip fail, ret =%d\n", ret);
+		return ret;
+	}
+
+	/* A flip puts up the whole buffer anyway */
+	sc->pending = idx;
+	sc->state[idx] = SC_BUF_PENDING;
+	paint_damage_clear(&fb->damage);
+	return 0;
+}
+
+struct fb *swapchain_front(struct swapchain *sc)
+{
+	/* The flip has to land first, or the update goes to the old frame */
+	if (swapchain_wait_idle(sc) || sc->front < 0)
+		return NULL;
+
+	return sc->bufs[sc->front];
+}
+
+int swapchain_flush(struct swapchain *sc)
+{
+	drmModeClip clips[PAINT_DAMAGE_MAX];
+	struct paint_damage *damage;
+	struct paint_rect *r;
+	struct fb *fb;
+	int i, ret;
+
+	fb = swapchain_front(sc);
+	if (!fb) {
+		printf("Nothing on screen to flush\n");
+		return -EINVAL;
+	}
+
+	damage = &fb->damage;
+	if (!damage->count)
+		return 0;
+
+	for (i = 0; i < damage->count; i++) {
+		r = &damage->rects[i];
+		clips[i].x1 = r->x;
+		clips[i].y1 = r->y;
+		clips[i].x2 = r->x + r->w;
+		clips[i].y2 = r->y + r->h;
+	}
+
+	ret = sc->ops->dirty_fb(sc, fb, clips, damage->count);
+	paint_damage_clear(damage);
+
+	/* Drivers scanning out straight from the buffer have nothing to flush */
+	if (ret == -ENOSYS)
+		return 0;
+
+	if (ret < 0) {
+		printf("Dirty FB fail, ret =%d\n", ret);
+		return ret;
+	}
+
+	return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * A swapchain of 2 to 4 dumb buffers, presented with page flips. The first
+ * present does the modeset, every later one queues a flip and the buffer
+ * which was on screen becomes free again when the flip event arrives.
+ * Small updates can instead go to the buffer on screen, with DirtyFB.
+ */
+#ifndef __DRM_SWAPCHAIN_H__
+#define __DRM_SWAPCHAIN_H__
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "drm_display.h"
+
+#define SWAPCHAIN_MAX_BUFFERS 4
+
+struct swapchain;
+
+/*
+ * The DRM calls the swapchain makes, swapchain_libdrm_ops are the legacy
+ * ones. Anything else (atomic, a mock, a headless device) can be plugged
+ * in instead, with its state in sc->priv.
+ */
+struct swapchain_ops {
+	/* First frame, with the modeset */
+	int (*set_crtc)(struct swapchain *sc, struct fb *fb);
+	/* Queue a flip to fb, which sends an event once it's done */
+	int (*page_flip)(struct swapchain *sc, struct fb *fb);
+	/* Wait for an event, > 0 if there is one, 0 on timeout */
+	int (*wait_event)(struct swapchain *sc, int timeout_ms);
+	int (*handle_event)(struct swapchain *sc);
+	int (*dirty_fb)(struct swapchain *sc, struct fb *fb, drmModeClipPtr clips, int num_clips);
+};
+
+extern const struct swapchain_ops swapchain_libdrm_ops;
+
+/* The event and DirtyFB ops of swapchain_libdrm_ops, for other ops to reuse */
+int swapchain_drm_wait_event(struct swapchain *sc, int timeout_ms);
+int swapchain_drm_handle_event(struct swapchain *sc);
+int swapchain_drm_dirty_fb(struct swapchain *sc, struct fb *fb, drmModeClipPtr clips,
+		int num_clips);
+
+/* Called when a flip lands, with the vblank it landed on */
+typedef void (*swapchain_flip_cb)(struct swapchain *sc, struct fb *fb, unsigned int seq,
+		unsigned int tv_sec, unsigned int tv_usec, void *data);
+
+enum sc_buf_state {
+	SC_BUF_FREE,
+	/* Handed out by swapchain_acquire(), being painted */
+	SC_BUF_ACQUIRED,
+	/* Flip queued, waiting for the flip event */
+	SC_BUF_PENDING,
+	SC_BUF_SCANOUT,
+	/* Kept off the free list by the user, e.g. while on an overlay plane */
+	SC_BUF_HELD,
+};
+
+struct swapchain {
+	int drm_fd;
+	struct drm_display *display;
+	const struct swapchain_ops *ops;
+	void *priv;
+	drmEventContext evctx;
+
+	int count;
+	struct fb *bufs[SWAPCHAIN_MAX_BUFFERS];
+	enum sc_buf_state state[SWAPCHAIN_MAX_BUFFERS];
+	int front;
+	int pending;
+
+	/* Completed flips, and the vblank of the last one */
+	unsigned int flips;
+	unsigned int last_seq;
+	unsigned int last_sec;
+	unsigned int last_usec;
+
+	swapchain_flip_cb flip_cb;
+	void *flip_data;
+};
+
+/* NULL ops are the legacy libdrm ones, priv is for the ops to use */
+int swapchain_init(struct swapchain *sc, int drm_fd, struct drm_display *display,
+		struct fb **bufs, int count, const struct swapchain_ops *ops, void *priv);
+
+/* A buffer which is not on screen, waits for a flip to complete if needed */
+struct fb *swapchain_acquire(struct swapchain *sc);
+
+/* Same, but NULL right away if none is free */
+struct fb *swapchain_try_acquire(struct swapchain *sc);
+
+/* Give an acquired buffer back without presenting it */
+void swapchain_cancel(struct swapchain *sc, struct fb *fb);
+
+/* Put an acquired buffer on screen, returns once the flip is queued */
+int swapchain_present(struct swapchain *sc, struct fb *fb);
+
+/*
+ * The buffer on screen, for partial updates painted in place. They reach
+ * the display with swapchain_flush(), which sends just the damaged clips.
+ */
+struct fb *swapchain_front(struct swapchain *sc);
+int swapchain_flush(struct swapchain *sc);
+
+/* Keep a free buffer from being acquired, till it's released again */
+int swapchain_hold(struct swapchain *sc, struct fb *fb);
+void swapchain_release(struct swapchain *sc, struct fb *fb);
+
+/* Get told about every completed flip, NULL to stop */
+void swapchain_set_flip_cb(struct swapchain *sc, swapchain_flip_cb cb, void *data);
+
+/* Handle flip events for up to timeout_ms, returns < 0 on error */
+int swapchain_dispatch(struct swapchain *sc, int timeout_ms);
+
+/* Wait till there is no flip in flight */
+int swapchain_wait_idle(struct swapchain *sc);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/netlink.h>
+
+#include "drm_uevent.h"
+
+/* The kernel's multicast group, udev rebroadcasts on another one */
+#define UEVENT_GROUP_KERNEL 1
+#define UEVENT_BUF_SIZE 4096
+
+int uevent_monitor_init(struct uevent_monitor *mon, int drm_fd)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = UEVENT_GROUP_KERNEL,
+	};
+	struct stat st;
+
+	if (fstat(drm_fd, &st) || !S_ISCHR(st.st_mode)) {
+		printf("Not a DRM device, nothing to watch\n");
+		return -1;
+	}
+
+	mon->rdev = st.st_rdev;
+	mon->sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			NETLINK_KOBJECT_UEVENT);
+	if (mon->sock < 0) {
+		printf("Can't open uevent socket: %m\n");
+		return -1;
+	}
+
+	if (bind(mon->sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		printf("Can't bind uevent socket: %m\n");
+		close(mon->sock);
+		return -1;
+	}
+
+	return 0;
+}
+
+void uevent_monitor_fini(struct uevent_monitor *mon)
+{
+	close(mon->sock);
+}
+
+int uevent_monitor_read(struct uevent_monitor *mon, struct drm_uevent *ev)
+{
+	char buf[UEVENT_BUF_SIZE];
+	struct sockaddr_nl from;
+	socklen_t from_len = sizeof(from);
+	int drm = 0, hotplug = 0;
+	long major = -1, minor = -1;
+	const char *key;
+	ssize_t len;
+
+	len = recvfrom(mon->sock, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&from, &from_len);
+	if (len < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ? -EAGAIN : -errno;
+
+	/* Only the kernel sends these, anyone else is spoofing them */
+	if (from.nl_pid)
+		return 0;
+
+	memset(ev, 0, sizeof(*ev));
+	buf[len] = 0;
+
+	/* "ACTION@DEVPATH" first, then KEY=value strings, each NUL terminated */
+	for (key = buf + strlen(buf) + 1; key < buf + len; key += strlen(key) + 1) {
+		if (!strcmp(key, "SUBSYSTEM=drm"))
+			drm = 1;
+		else if (!strcmp(key, "HOTPLUG=1"))
+			hotplug = 1;
+		else if (!strncmp(key, "MAJOR=", 6))
+			major = strtol(key + 6, NULL, 10);
+		else if (!strncmp(key, "MINOR=", 6))
+			minor = strtol(key + 6, NULL, 10);
+		else if (!strncmp(key, "CONNECTOR=", 10))
+			ev->connector = strtoul(key + 10, NULL, 10);
+		else if (!strncmp(key, "PROPERTY=", 9))
+			ev->property = strtoul(key + 9, NULL, 10);
+	}
+
+	return drm && hotplug && major == major(mon->rdev) && minor == minor(mon->rdev);
+}
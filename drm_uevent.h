@@ -0,0 +1,55 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * DRM hotplug uevents, straight from the kernel over netlink. Only the
+ * events of one DRM device are reported, the socket is non-blocking so it
+ * can be drained after a poll() wakes up.
+ */
+#ifndef __DRM_UEVENT_H__
+#define __DRM_UEVENT_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct uevent_monitor {
+	int sock;
+	dev_t rdev;
+};
+
+struct drm_uevent {
+	/* The connector and property which changed, 0 if the event doesn't say */
+	uint32_t connector;
+	uint32_t property;
+};
+
+/* Watch for hotplugs on the device drm_fd is open on */
+int uevent_monitor_init(struct uevent_monitor *mon, int drm_fd);
+void uevent_monitor_fini(struct uevent_monitor *mon);
+
+/*
+ * Read one pending message: 1 for a hotplug of our device, 0 for anything
+ * else, -EAGAIN once there is nothing left to read.
+ */
+int uevent_monitor_read(struct uevent_monitor *mon, struct drm_uevent *ev);
+
+#endif
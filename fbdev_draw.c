@@ -1,108 +1,329 @@
 #include <linux/fb.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
-#define pixel(r, g, b, varinfo) \
-	(r << varinfo.red.offset) | \
-	(g << varinfo.green.offset) | \
-	(b << varinfo.blue.offset)
+#include "paint.h"
 
-int main()
-{
-	struct fb_fix_screeninfo fixinfo;
+#define FBDEV_0 "/dev/fb0"
+
+/* Geometry of a file-backed fake device, unless --size says otherwise */
+#define FAKE_XRES 1920
+#define FAKE_YRES 1080
+
+/* Width of the bar swept across with --frames, and its step per frame */
+#define ANIM_BAR_DIV 8
+#define ANIM_STEP 16
+
+static uint32_t clr_val[] = {
+	0, /*black */
+	0x00FF0000, /* Red */
+	0x0000FF00, /* Green */
+	0x000000FF, /* Blue */
+	0xFFFFFFFF, /* White */
+};
+
+struct fbdev {
+	int fd;
+	/* A regular file standing in for the device, no ioctls on it */
+	int fake;
 	struct fb_var_screeninfo varinfo;
-	long screensize;
+	struct fb_fix_screeninfo fixinfo;
 	uint8_t *fbp;
-	int fb_fd, ret;
-	int x,y;
+	long screensize;
+	uint32_t format;
+	/* 2 when yres_virtual has room for a back buffer to pan to */
+	int pages;
+	int front;
+};
+
+/* The DRM fourcc libpaint knows the device's pixel layout as, 0 if none */
+static uint32_t fbdev_format(const struct fb_var_screeninfo *v)
+{
+	if (v->bits_per_pixel == 16 && v->red.offset == 11 && v->green.length == 6)
+		return DRM_FORMAT_RGB565;
+
+	if (v->bits_per_pixel != 32)
+		return 0;
+
+	if (v->red.offset == 20 && v->red.length == 10)
+		return DRM_FORMAT_XRGB2101010;
+
+	if (v->red.offset == 16 && v->blue.offset == 0)
+		return v->transp.length ? DRM_FORMAT_ARGB8888 : DRM_FORMAT_XRGB8888;
+
+	if (v->red.offset == 0 && v->blue.offset == 16)
+		return DRM_FORMAT_ABGR8888;
+
+	return 0;
+}
+
+static int open_fake(struct fbdev *fb, const char *path, int xres, int yres)
+{
+	struct fb_var_screeninfo *v = &fb->varinfo;
 
-	fb_fd = open("/dev/fb0", O_RDWR);
-	if (fb_fd < 0) {
-		printf("Failed to open fbdev 0\n");
+	fb->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fb->fd < 0) {
+		printf("Failed to open fake fbdev %s: %m\n", path);
+		return -1;
+	}
+
+	/* XRGB8888, with a back buffer below the visible one */
+	v->xres = v->xres_virtual = xres;
+	v->yres = yres;
+	v->yres_virtual = 2 * yres;
+	v->bits_per_pixel = 32;
+	v->red.offset = 16;
+	v->green.offset = 8;
+	v->red.length = v->green.length = v->blue.length = 8;
+	fb->fixinfo.line_length = xres * 4;
+	fb->fake = 1;
+
+	if (ftruncate(fb->fd, (off_t)v->yres_virtual * fb->fixinfo.line_length)) {
+		printf("Failed to size fake fbdev: %m\n");
+		close(fb->fd);
+		return -1;
+	}
+
+	printf("Fake fbdev %s: %dx%d\n", path, xres, yres);
+	return 0;
+}
+
+static int open_device(struct fbdev *fb, const char *path)
+{
+	struct fb_var_screeninfo *v = &fb->varinfo;
+	int ret;
+
+	fb->fd = open(path, O_RDWR);
+	if (fb->fd < 0) {
+		printf("Failed to open fbdev %s\n", path);
 		return -1;
 	}
 
 	/* Get variable screen info */
-	ret = ioctl(fb_fd, FBIOGET_VSCREENINFO, &varinfo);
+	ret = ioctl(fb->fd, FBIOGET_VSCREENINFO, v);
 	if (ret < 0) {
 		printf("Failed to get fbdev varinfo\n");
-		close(fb_fd);
-		return -2;
+		goto fail;
 	}
 
-	varinfo.grayscale=0;
-	varinfo.bits_per_pixel=32;
+	/* 32 BPP, and twice the height to have a page to pan to */
+	v->grayscale = 0;
+	v->bits_per_pixel = 32;
+	v->xres_virtual = v->xres;
+	v->yres_virtual = 2 * v->yres;
+	v->xoffset = v->yoffset = 0;
 
-	/* Set variable screen info for new BPP */
-	ret = ioctl(fb_fd, FBIOPUT_VSCREENINFO, &varinfo);
+	ret = ioctl(fb->fd, FBIOPUT_VSCREENINFO, v);
 	if (ret < 0) {
-		printf("Failed to set bpp\n");
-		close(fb_fd);
-		return -3;
+		/* Plenty of drivers have no room for the second page */
+		ioctl(fb->fd, FBIOGET_VSCREENINFO, v);
+		v->grayscale = 0;
+		v->bits_per_pixel = 32;
+		if (ioctl(fb->fd, FBIOPUT_VSCREENINFO, v) < 0)
+			printf("Failed to set bpp, drawing at %d\n", v->bits_per_pixel);
 	}
 
 	/* Get new variable info */
-	ret = ioctl(fb_fd, FBIOGET_VSCREENINFO, &varinfo);
+	ret = ioctl(fb->fd, FBIOGET_VSCREENINFO, v);
 	if (ret < 0) {
 		printf("Failed to get new variable info\n");
-		close(fb_fd);
-		return -4;
+		goto fail;
 	}
 
-	ret = ioctl(fb_fd, FBIOGET_FSCREENINFO, &fixinfo);
+	ret = ioctl(fb->fd, FBIOGET_FSCREENINFO, &fb->fixinfo);
 	if (ret < 0) {
 		printf("Failed to get fb fix info\n");
-		close(fb_fd);
-		return -5;
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	close(fb->fd);
+	return -1;
+}
+
+/* A path which is not a character device is a file-backed fake */
+static int fbdev_open(struct fbdev *fb, const char *path, int fake_xres, int fake_yres)
+{
+	struct stat st;
+	int ret;
+
+	memset(fb, 0, sizeof(*fb));
+
+	if (stat(path, &st) && errno != ENOENT) {
+		printf("Can't stat %s: %m\n", path);
+		return -1;
+	}
+
+	if (!stat(path, &st) && S_ISCHR(st.st_mode))
+		ret = open_device(fb, path);
+	else
+		ret = open_fake(fb, path, fake_xres, fake_yres);
+	if (ret)
+		return ret;
+
+	fb->format = fbdev_format(&fb->varinfo);
+	if (!fb->format) {
+		printf("Can't paint %d bpp with red at %d\n", fb->varinfo.bits_per_pixel,
+			fb->varinfo.red.offset);
+		goto fail;
 	}
 
-	screensize = varinfo.yres_virtual * fixinfo.line_length;
-	if (!screensize) {
-		printf("Zero screen size, pitch=%d y=%d\n", fixinfo.line_length, varinfo.yres_virtual);
-		close(fb_fd);
-		return -6;
+	fb->screensize = (long)fb->varinfo.yres_virtual * fb->fixinfo.line_length;
+	if (!fb->screensize) {
+		printf("Zero screen size, pitch=%d y=%d\n", fb->fixinfo.line_length,
+			fb->varinfo.yres_virtual);
+		goto fail;
 	}
 
 	/* Map framebuffer memory in this app's space */
-	fbp = mmap(0, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fb_fd, (off_t)0);
-	if (!fbp) {
+	fb->fbp = mmap(0, fb->screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fb->fd, (off_t)0);
+	if (fb->fbp == MAP_FAILED) {
 		printf("mmap failed\n");
-		close(fb_fd);
-		return -7;
+		goto fail;
 	}
 
-	/* Draw the tricolor on the screen */
-	for (x = 0; x < varinfo.xres; x++) {
+	fb->pages = fb->varinfo.yres_virtual >= 2 * fb->varinfo.yres ? 2 : 1;
+	fb->front = fb->varinfo.yoffset >= fb->varinfo.yres;
+	if (fb->pages < 2)
+		printf("No room to pan, drawing straight on screen\n");
+	return 0;
 
-		/* Red */
-		for (y = 0; y < varinfo.yres/3; y++) {
-			long location = (x + varinfo.xoffset) * (varinfo.bits_per_pixel / 8) +
-					(y+varinfo.yoffset) * fixinfo.line_length;
-			*((uint32_t*)(fbp + location)) = pixel(0xFF, 0x00, 0x00, varinfo);
-		}
+fail:
+	close(fb->fd);
+	return -1;
+}
+
+static void fbdev_close(struct fbdev *fb)
+{
+	munmap(fb->fbp, fb->screensize);
+	close(fb->fd);
+}
+
+/* The page off screen, or the one on screen when there is only one */
+static int back_page(struct fbdev *fb)
+{
+	return fb->pages > 1 ? !fb->front : fb->front;
+}
 
-		/* Green */
-		for (y = varinfo.yres/3; y < (2 * varinfo.yres)/3; y++) {
-			long location = (x+varinfo.xoffset) * (varinfo.bits_per_pixel/8) +
-					(y+varinfo.yoffset) * fixinfo.line_length;
-			*((uint32_t*)(fbp + location)) = pixel(0x00, 0xFF, 0x00, varinfo);
+static void page_buf(struct fbdev *fb, int page, struct paint_buf *buf)
+{
+	struct fb_var_screeninfo *v = &fb->varinfo;
+	uint8_t *base = fb->fbp + (long)page * v->yres * fb->fixinfo.line_length;
+
+	paint_buf_init(buf, (char *)base, v->xres, v->yres, fb->fixinfo.line_length, fb->format);
+}
+
+/* Pan to the back page at the next vblank, it becomes the front one */
+static int fbdev_flip(struct fbdev *fb)
+{
+	struct fb_var_screeninfo v = fb->varinfo;
+	uint32_t crtc = 0;
+
+	if (fb->pages < 2)
+		return 0;
+
+	v.yoffset = back_page(fb) * v.yres;
+	v.activate = FB_ACTIVATE_VBL;
+
+	if (!fb->fake) {
+		if (ioctl(fb->fd, FBIOPAN_DISPLAY, &v) < 0) {
+			printf("Failed to pan to y=%d: %m\n", v.yoffset);
+			return -1;
 		}
 
-		/* Blue */
-		for (y = (2 * varinfo.yres)/3; y < varinfo.yres; y++) {
-			long location = (x+varinfo.xoffset) * (varinfo.bits_per_pixel/8) +
-					(y+varinfo.yoffset) * fixinfo.line_length;
-			*((uint32_t*)(fbp + location)) = pixel(0x00, 0x00, 0xFF, varinfo);
+		/* The old front is painted next, so the pan must have landed */
+		ioctl(fb->fd, FBIO_WAITFORVSYNC, &crtc);
+	}
+
+	fb->varinfo.yoffset = v.yoffset;
+	fb->front = back_page(fb);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options] [device]\n", prog);
+	printf("  -d, --device=PATH   fbdev to draw on (default %s), a regular file\n"
+	       "                      is used as a fake device\n", FBDEV_0);
+	printf("  -s, --size=WxH      size of a fake device (default %dx%d)\n", FAKE_XRES, FAKE_YRES);
+	printf("  -n, --frames=N      sweep a bar across for N frames after the tricolor\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "device", required_argument, NULL, 'd' },
+		{ "size", required_argument, NULL, 's' },
+		{ "frames", required_argument, NULL, 'n' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	const char *path = FBDEV_0;
+	int fake_xres = FAKE_XRES;
+	int fake_yres = FAKE_YRES;
+	struct paint_buf buf;
+	struct fbdev fb;
+	int frames = 0;
+	int bar_w;
+	int i, opt;
+
+	while ((opt = getopt_long(argc, argv, "d:s:n:h", long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			path = optarg;
+			break;
+		case 's':
+			if (sscanf(optarg, "%dx%d", &fake_xres, &fake_yres) != 2 ||
+				fake_xres <= 0 || fake_yres <= 0) {
+				printf("Size is WxH\n");
+				return -1;
+			}
+			break;
+		case 'n':
+			frames = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
 		}
+	}
+
+	if (optind < argc)
+		path = argv[optind];
+
+	if (fbdev_open(&fb, path, fake_xres, fake_yres))
+		return -1;
+
+	init_clr_hash(color_max, clr_val);
+
+	/* Draw the tricolor off screen, row by row with the libpaint fills, then pan to it */
+	page_buf(&fb, back_page(&fb), &buf);
+	paint_buffer_tricolor(&buf);
+	if (fbdev_flip(&fb))
+		goto out;
 
+	bar_w = fb.varinfo.xres / ANIM_BAR_DIV;
+	for (i = 0; i < frames; i++) {
+		page_buf(&fb, back_page(&fb), &buf);
+		paint_a_buffer_region_tricolor(&buf, (i * ANIM_STEP) % (buf.width - bar_w), 0,
+				bar_w, buf.height);
+		if (fbdev_flip(&fb))
+			break;
 	}
 
-	munmap(fbp, screensize);
-	close(fb_fd);
+out:
+	fbdev_close(&fb);
 	printf("Fbdev draw done\n");
 	return 0;
 }
@@ -22,219 +22,1180 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdint.h>	
 #include <malloc.h>
-#include <wchar.h>
 #include "paint.h"
+#include "paint_simd.h"
+#include "paint_thread.h"
 
-static struct clr_hash_table *table;
+/* ============ Pixel formats =========== */
 
-/* ============ Color hash table related functions =========== */
+/* Colors come in as XRGB8888, and get packed once per call for the buffer */
+static uint32_t pack_xrgb8888(uint32_t c)
+{
+	return c;
+}
 
-void init_clr_hash(int num, uint32_t *clr_val)
+static uint32_t pack_argb8888(uint32_t c)
+{
+	return c | 0xFF000000;
+}
+
+static uint32_t pack_abgr8888(uint32_t c)
+{
+	return 0xFF000000 | (c & 0xFF) << 16 | (c & 0xFF00) | (c >> 16 & 0xFF);
+}
+
+static uint32_t pack_xrgb2101010(uint32_t c)
+{
+	uint32_t r = c >> 16 & 0xFF, g = c >> 8 & 0xFF, b = c & 0xFF;
+
+	/* Replicate the top bits, so that 0xFF becomes 0x3FF */
+	r = r << 2 | r >> 6;
+	g = g << 2 | g >> 6;
+	b = b << 2 | b >> 6;
+	return r << 20 | g << 10 | b;
+}
+
+static uint32_t pack_rgb565(uint32_t c)
+{
+	uint32_t r = c >> 16 & 0xFF, g = c >> 8 & 0xFF, b = c & 0xFF;
+
+	return (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+}
+
+/* And back to XRGB8888, for blits between formats */
+static uint32_t unpack_xrgb8888(uint32_t px)
+{
+	return px;
+}
+
+static uint32_t unpack_argb8888(uint32_t px)
+{
+	return px & 0xFFFFFF;
+}
+
+static uint32_t unpack_abgr8888(uint32_t px)
+{
+	return (px & 0xFF) << 16 | (px & 0xFF00) | (px >> 16 & 0xFF);
+}
+
+static uint32_t unpack_xrgb2101010(uint32_t px)
+{
+	return (px >> 22 & 0xFF) << 16 | (px >> 12 & 0xFF) << 8 | (px >> 2 & 0xFF);
+}
+
+static uint32_t unpack_rgb565(uint32_t px)
+{
+	uint32_t r = px >> 11 & 0x1F, g = px >> 5 & 0x3F, b = px & 0x1F;
+
+	r = r << 3 | r >> 2;
+	g = g << 2 | g >> 4;
+	b = b << 3 | b >> 2;
+	return r << 16 | g << 8 | b;
+}
+
+/* ============ Banded fills, run on the paint workers =========== */
+
+struct fill_rows {
+	char *base;
+	int stride;
+	int n_pixels;
+	uint32_t val;
+};
+
+/* One band function per pixel size, so the row loop has no format branches */
+#define DEFINE_FILL_ROWS_BAND(bits)						\
+static void fill_rows_band##bits(void *arg, int y0, int y1)			\
+{										\
+	struct fill_rows *f = arg;						\
+	int y;									\
+										\
+	for (y = y0; y < y1; y++)						\
+		paint_fill##bits((uint##bits##_t *)(f->base + (long)y * f->stride),	\
+				f->val, f->n_pixels);				\
+}
+
+DEFINE_FILL_ROWS_BAND(16)
+DEFINE_FILL_ROWS_BAND(32)
+
+static void clear_rows_band(void *arg, int y0, int y1)
+{
+	struct fill_rows *f = arg;
+
+	memset(f->base + (long)y0 * f->stride, 0, (long)(y1 - y0) * f->stride);
+}
+
+struct paint_format {
+	uint32_t fourcc;
+	int cpp;
+	uint32_t (*pack)(uint32_t xrgb);
+	uint32_t (*unpack)(uint32_t px);
+	paint_band_fn fill_band;
+};
+
+static const struct paint_format formats[] = {
+	{ DRM_FORMAT_XRGB8888, 4, pack_xrgb8888, unpack_xrgb8888, fill_rows_band32 },
+	{ DRM_FORMAT_ARGB8888, 4, pack_argb8888, unpack_argb8888, fill_rows_band32 },
+	{ DRM_FORMAT_ABGR8888, 4, pack_abgr8888, unpack_abgr8888, fill_rows_band32 },
+	{ DRM_FORMAT_XRGB2101010, 4, pack_xrgb2101010, unpack_xrgb2101010, fill_rows_band32 },
+	{ DRM_FORMAT_RGB565, 2, pack_rgb565, unpack_rgb565, fill_rows_band16 },
+};
+
+static const struct paint_format *lookup_format(uint32_t fourcc)
 {
 	int i;
 
-	table = malloc(sizeof(struct clr_hash_table));
-	for (i = 0; i < num; i++) {
-		table->cval[i] = malloc(sizeof(struct clr_hash_data));
-		table->cval[i]->clr = i; //enum color
-		table->cval[i]->val = clr_val[i];		
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		if (formats[i].fourcc == fourcc)
+			return &formats[i];
 	}
-	table->entries = num;
+
+	return NULL;
 }
 
-int hash_get_index(int key)
+/* ============ Color palette =========== */
+
+/*
+ * The palette is one flat block: the colors as given, followed by
+ * the same colors already packed for each of the formats[], in that order.
+ * Painting with color c in format f is then just px[(1 + f) * entries + c].
+ */
+static struct paint_palette *palette;
+/* The one set up by init_clr_hash(), owned by libpaint */
+static struct paint_palette *default_palette;
+
+#define NUM_FORMATS (sizeof(formats) / sizeof(formats[0]))
+
+static int format_has_alpha(uint32_t fourcc)
 {
-	return key % MAX_CLR_SUPPORTED;
+	return fourcc == DRM_FORMAT_ARGB8888 || fourcc == DRM_FORMAT_ABGR8888;
 }
 
-uint64_t hash_get_clr_val(int key)
+/* The formats with alpha have it in the top byte, as ARGB8888 colors do */
+static struct paint_palette *palette_create(int num, const uint32_t *clr_val, int argb)
 {
-	int index;
+	struct paint_palette *pal;
+	uint32_t px;
+	int f, i;
 
-	if (!table || key < 0 || key > table->entries) {
-		printf("Invalid input\n");
-		return -1;
+	if (num <= 0 || !clr_val) {
+		printf("Invalid input, empty palette\n");
+		return NULL;
 	}
 
-	index = hash_get_index(key);
-	return table->cval[index]->val;
+	pal = malloc(sizeof(*pal) + (1 + NUM_FORMATS) * num * sizeof(uint32_t));
+	if (!pal)
+		return NULL;
+
+	pal->entries = num;
+	memcpy(pal->px, clr_val, num * sizeof(uint32_t));
+	for (f = 0; f < NUM_FORMATS; f++) {
+		uint32_t *packed = pal->px + (1 + f) * num;
+
+		for (i = 0; i < num; i++) {
+			px = formats[f].pack(clr_val[i]);
+			if (argb && format_has_alpha(formats[f].fourcc))
+				px = (px & 0xFFFFFF) | (clr_val[i] & 0xFF000000);
+			packed[i] = px;
+		}
+	}
+
+	return pal;
 }
 
-void delete_clr_hash(int key)
+struct paint_palette *paint_palette_create(int num, const uint32_t *clr_val)
 {
-	int i = 0;
-
-	for (i = 0; i < table->entries; i++)
-		free(table->cval[i]);
-	free(table);
+	return palette_create(num, clr_val, 0);
 }
 
+struct paint_palette *paint_palette_create_argb(int num, const uint32_t *clr_val)
+{
+	return palette_create(num, clr_val, 1);
+}
 
-/* ============ Drawing functions =========== */
+void paint_palette_destroy(struct paint_palette *pal)
+{
+	if (palette == pal)
+		palette = default_palette;
+	free(pal);
+}
 
-static void paint_a_line(char *buf, int pitch, uint32_t val)
+const uint32_t *paint_palette_get(const struct paint_palette *pal, uint32_t format)
 {
-	int n_pixels = pitch/4;
-	int *ib = (int *)buf;
+	const struct paint_format *fmt = lookup_format(format);
 
-	wmemset(ib, val, n_pixels);
+	if (!pal || !fmt)
+		return NULL;
+
+	return pal->px + (1 + (fmt - formats)) * pal->entries;
 }
 
-void _paint_x(char *buf, int xres, int x, uint32_t val)
+void paint_set_palette(struct paint_palette *pal)
 {
-	uint32_t *pixel = buf;
+	palette = pal ? pal : default_palette;
+}
 
-	if (x < xres) {
-		pixel[x++] = val;
-		_paint_x(buf, xres, x, val);
+/* Colors of the active palette, ready to be written in buffers of fmt */
+static const uint32_t *get_palette_px(const struct paint_format *fmt)
+{
+	if (!palette) {
+		printf("No palette, call init_clr_hash() first\n");
+		return NULL;
 	}
+
+	return palette->px + (1 + (fmt - formats)) * palette->entries;
 }
 
-void _paint_y(char *fb, int xres, int yres, int y, int bpp, uint32_t val)
+/* The old color table API, now just the default palette */
+void init_clr_hash(int num, uint32_t *clr_val)
 {
-	int pitch = xres * bpp;
+	struct paint_palette *pal = paint_palette_create(num, clr_val);
 
-	if (y < yres) {
-		_paint_x(fb + y++ * pitch, xres, 0, val);
-		_paint_y(fb, xres, yres, y, bpp, val);
+	if (!pal)
+		return;
+
+	if (palette == default_palette)
+		palette = pal;
+	free(default_palette);
+	default_palette = pal;
+}
+
+uint64_t hash_get_clr_val(int key)
+{
+	if (!palette || (unsigned int)key >= palette->entries)
+		return -1;
+
+	return palette->px[key];
+}
+
+void delete_clr_hash(int key)
+{
+	if (palette == default_palette)
+		palette = NULL;
+	free(default_palette);
+	default_palette = NULL;
+}
+
+static const struct paint_format *get_buf_format(const struct paint_buf *buf)
+{
+	const struct paint_format *fmt;
+
+	if (!buf || !buf->base || buf->width <= 0 || buf->height <= 0) {
+		printf("Invalid input, no buffer to paint\n");
+		return NULL;
 	}
+
+	fmt = lookup_format(buf->format);
+	if (!fmt) {
+		printf("Unsupported format 0x%x\n", buf->format);
+		return NULL;
+	}
+
+	if (buf->stride < buf->width * fmt->cpp) {
+		printf("Stride %d too small for %d pixels\n", buf->stride, buf->width);
+		return NULL;
+	}
+
+	return fmt;
+}
+
+/* Clip a region to the buffer, returns 0 if nothing is left of it */
+static int clip_region(const struct paint_buf *buf, int *x, int *y, int *h, int *v)
+{
+	if (*x < 0) {
+		*h += *x;
+		*x = 0;
+	}
+	if (*y < 0) {
+		*v += *y;
+		*y = 0;
+	}
+	if (*x + *h > buf->width)
+		*h = buf->width - *x;
+	if (*y + *v > buf->height)
+		*v = buf->height - *y;
+
+	return *h > 0 && *v > 0;
 }
 
-void paint_buf_recursively(char *fb, int xres, int yres, int bpp, int val)
+/* Fill a w x rows block at (x, y) with a color already packed for the buffer */
+static void paint_rows(const struct paint_format *fmt, struct paint_buf *buf,
+		int x, int y, int w, int rows, uint32_t px)
 {
-	if (!fb || !xres || !yres)
+	struct fill_rows f;
+
+	if (rows <= 0)
 		return;
 
-	_paint_y(fb, xres, yres, 0, bpp, val);
+	if (buf->damage)
+		paint_damage_add(buf->damage, x, y, w, rows);
+
+	f.base = buf->base + (long)y * buf->stride + x * fmt->cpp;
+	f.stride = buf->stride;
+	f.n_pixels = w;
+	f.val = px;
+
+	paint_run_bands(rows, w * fmt->cpp, fmt->fill_band, &f);
 }
 
-void blank_a_buffer_region(char *fb, int X, int Y, int x_off, int y_off, int h, int v, int bpp)
+/* Zero out the whole buffer, padding included */
+static void paint_clear(struct paint_buf *buf)
 {
-	int ret = 0;
-	int pitch = X * bpp;
-	int bsz = Y * pitch;
-	int sb_pitch = h * bpp;
-	int sb_sz = v * sb_pitch;
-	int j;
-	char *sb;
+	struct fill_rows f = { buf->base, buf->stride, 0, 0 };
 
-	sb = fb + y_off * pitch + x_off * bpp;
+	if (buf->damage)
+		paint_damage_add(buf->damage, 0, 0, buf->width, buf->height);
+
+	paint_run_bands(buf->height, buf->stride, clear_rows_band, &f);
+}
 
+/* Horizontal thirds of a region, top to bottom */
+static void paint_rows_tricolor(const struct paint_format *fmt, struct paint_buf *buf,
+		const uint32_t *px, int x, int y, int w, int rows)
+{
 #ifdef LINE_BY_LINE
-	for (j = 0; j < v; j++)
-		paint_a_line(sb + j * pitch, sb_pitch, hash_get_clr_val(red));
+	uint32_t clr[3] = { px[red], px[red], px[red] };
 #else
-	for (j = 0; j < v; j++)
-		_paint_x(sb + j * pitch, h, 0, hash_get_clr_val(black));
+	uint32_t clr[3] = { px[red], px[green], px[blue] };
 #endif
+	int i;
+
+	for (i = 0; i < 3; i++)
+		paint_rows(fmt, buf, x, y + i * rows / 3, w,
+			(i + 1) * rows / 3 - i * rows / 3, clr[i]);
 }
 
-#ifdef LINE_BY_LINE
-void paint_a_buffer_region_solid(char *fb, int X, int Y, int x_off, int y_off, int h, int v, int bpp, int clr_val)
+/* ============ Damage tracking =========== */
+
+static long rect_area(const struct paint_rect *r)
+{
+	return (long)r->w * r->h;
+}
+
+/* Touching counts too, two adjacent rectangles are better sent as one */
+static int rects_touch(const struct paint_rect *a, const struct paint_rect *b)
+{
+	return a->x <= b->x + b->w && b->x <= a->x + a->w &&
+		a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static struct paint_rect rect_union(const struct paint_rect *a, const struct paint_rect *b)
 {
-	int ret = 0;
-	int pitch = X * bpp;
-	int bsz = Y * pitch;
-	int sb_pitch = h * bpp;
-	int sb_sz = v * sb_pitch;
-	int sb_clr_sz = sb_sz/3;
-	int j;
-	char *sb;
+	struct paint_rect u;
+	int x2 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+	int y2 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
 
-	memset(fb, 0, bsz);
+	u.x = a->x < b->x ? a->x : b->x;
+	u.y = a->y < b->y ? a->y : b->y;
+	u.w = x2 - u.x;
+	u.h = y2 - u.y;
+	return u;
+}
 
-	sb = fb + y_off * pitch + x_off * bpp;
-	for (j = 0; j < v; j++)
-		paint_a_line(sb + j * pitch, sb_pitch, clr_val);
+static void damage_remove(struct paint_damage *damage, int i)
+{
+	damage->rects[i] = damage->rects[--damage->count];
 }
-#endif
 
-void paint_a_buffer_white(char *fb, int X, int Y, int bpp)
+void paint_damage_clear(struct paint_damage *damage)
 {
-#ifdef LINE_BY_LINE
-	paint_a_buffer_region_solid(fb, X, Y, 0, 0, X, Y, bpp, hash_get_clr_val(red));
-#else
-	paint_buf_recursively(fb, X, Y, bpp, hash_get_clr_val(white));
-#endif
+	damage->count = 0;
 }
 
-char *get_a_subbuffer_copy(char *fb, int X, int Y, int xoff, int yoff, int h, int v, int bpp)
+void paint_damage_add(struct paint_damage *damage, int x, int y, int w, int h)
 {
-	char *output;
-	char *sub;
-	int pitch = X * bpp;
-	int sb_pitch = h * bpp;
+	struct paint_rect r = { x, y, w, h };
+	struct paint_rect u;
+	long grow, best_grow;
+	int i, best;
+
+	if (w <= 0 || h <= 0)
+		return;
+
+	/* A merge can make the result reach others, so go again after each one */
+	for (;;) {
+		for (i = 0; i < damage->count; i++) {
+			if (rects_touch(&r, &damage->rects[i]))
+				break;
+		}
+
+		if (i < damage->count) {
+			r = rect_union(&r, &damage->rects[i]);
+			damage_remove(damage, i);
+			continue;
+		}
+
+		if (damage->count < PAINT_DAMAGE_MAX)
+			break;
+
+		best = 0;
+		best_grow = -1;
+		for (i = 0; i < damage->count; i++) {
+			u = rect_union(&r, &damage->rects[i]);
+			grow = rect_area(&u) - rect_area(&damage->rects[i]);
+			if (best_grow < 0 || grow < best_grow) {
+				best_grow = grow;
+				best = i;
+			}
+		}
+
+		r = rect_union(&r, &damage->rects[best]);
+		damage_remove(damage, best);
+	}
+
+	damage->rects[damage->count++] = r;
+}
+
+long paint_damage_area(const struct paint_damage *damage)
+{
+	long area = 0;
 	int i;
 
-	if (!fb || !X || !Y) {
-		printf("Invalid input, cant get the buffer\n");
+	/* Rectangles in the list never overlap, the areas just add up */
+	for (i = 0; i < damage->count; i++)
+		area += rect_area(&damage->rects[i]);
+
+	return area;
+}
+
+/* ============ Views and blits =========== */
+
+struct blit_rows {
+	char *dst;
+	const char *src;
+	int dst_stride;
+	int src_stride;
+	int n_pixels;
+	const struct paint_format *dst_fmt;
+	const struct paint_format *src_fmt;
+};
+
+/* Smaller blits are likely read back soon, and stay in the cache for it */
+#define BLIT_NT_MIN_BYTES PAINT_BAND_BYTES
+
+static void copy_rows_band(void *arg, int y0, int y1)
+{
+	struct blit_rows *b = arg;
+	size_t bytes = (size_t)b->n_pixels * b->dst_fmt->cpp;
+	int y;
+
+	for (y = y0; y < y1; y++)
+		paint_copy_nt(b->dst + (long)y * b->dst_stride,
+				b->src + (long)y * b->src_stride, bytes);
+
+	paint_stream_fence();
+}
+
+static void copy_rows_cached_band(void *arg, int y0, int y1)
+{
+	struct blit_rows *b = arg;
+	size_t bytes = (size_t)b->n_pixels * b->dst_fmt->cpp;
+	int y;
+
+	for (y = y0; y < y1; y++)
+		memcpy(b->dst + (long)y * b->dst_stride,
+				b->src + (long)y * b->src_stride, bytes);
+}
+
+static uint32_t read_px(const char *p, int cpp)
+{
+	return cpp == 2 ? *(const uint16_t *)p : *(const uint32_t *)p;
+}
+
+static void write_px(char *p, int cpp, uint32_t px)
+{
+	if (cpp == 2)
+		*(uint16_t *)p = px;
+	else
+		*(uint32_t *)p = px;
+}
+
+static void convert_rows_band(void *arg, int y0, int y1)
+{
+	struct blit_rows *b = arg;
+	const struct paint_format *df = b->dst_fmt, *sf = b->src_fmt;
+	const char *s;
+	char *d;
+	int x, y;
+
+	for (y = y0; y < y1; y++) {
+		s = b->src + (long)y * b->src_stride;
+		d = b->dst + (long)y * b->dst_stride;
+		for (x = 0; x < b->n_pixels; x++, s += sf->cpp, d += df->cpp)
+			write_px(d, df->cpp, df->pack(sf->unpack(read_px(s, sf->cpp))));
+	}
+}
+
+/* Overlapping views, rows go in the order which reads each before it's written */
+static void move_rows(struct blit_rows *b, int rows)
+{
+	size_t bytes = (size_t)b->n_pixels * b->dst_fmt->cpp;
+	int y;
+
+	if (b->dst <= b->src) {
+		for (y = 0; y < rows; y++)
+			memmove(b->dst + (long)y * b->dst_stride,
+					b->src + (long)y * b->src_stride, bytes);
+	} else {
+		for (y = rows - 1; y >= 0; y--)
+			memmove(b->dst + (long)y * b->dst_stride,
+					b->src + (long)y * b->src_stride, bytes);
+	}
+}
+
+static int views_overlap(const struct paint_view *a, const struct paint_view *b,
+		int w, int h, int cpp_a, int cpp_b)
+{
+	const char *a_end = a->base + (long)(h - 1) * a->stride + w * cpp_a;
+	const char *b_end = b->base + (long)(h - 1) * b->stride + w * cpp_b;
+
+	return a->base < b_end && b->base < a_end;
+}
+
+int paint_view_init(struct paint_view *view, const struct paint_buf *buf,
+		int x, int y, int w, int h)
+{
+	const struct paint_format *fmt = get_buf_format(buf);
+
+	if (!fmt || !clip_region(buf, &x, &y, &w, &h))
+		return -1;
+
+	view->base = buf->base + (long)y * buf->stride + x * fmt->cpp;
+	view->width = w;
+	view->height = h;
+	view->stride = buf->stride;
+	view->format = buf->format;
+	view->x = x;
+	view->y = y;
+	view->damage = buf->damage;
+	return 0;
+}
+
+/* stream forces non-temporal stores, whatever the size */
+static int blit_views(const struct paint_view *dst, const struct paint_view *src, int stream)
+{
+	const struct paint_format *df, *sf;
+	struct blit_rows b;
+	int w, h;
+
+	if (!dst || !src || !dst->base || !src->base) {
+		printf("Invalid input, nothing to blit\n");
+		return -1;
+	}
+
+	df = lookup_format(dst->format);
+	sf = lookup_format(src->format);
+	if (!df || !sf) {
+		printf("Can't blit 0x%x to 0x%x\n", src->format, dst->format);
+		return -1;
+	}
+
+	w = dst->width < src->width ? dst->width : src->width;
+	h = dst->height < src->height ? dst->height : src->height;
+	if (w <= 0 || h <= 0)
+		return 0;
+
+	b.dst = dst->base;
+	b.src = src->base;
+	b.dst_stride = dst->stride;
+	b.src_stride = src->stride;
+	b.n_pixels = w;
+	b.dst_fmt = df;
+	b.src_fmt = sf;
+
+	if (views_overlap(dst, src, w, h, df->cpp, sf->cpp)) {
+		if (df != sf) {
+			printf("Can't convert formats in place\n");
+			return -1;
+		}
+		move_rows(&b, h);
+	} else if (df != sf) {
+		paint_run_bands(h, w * df->cpp, convert_rows_band, &b);
+	} else if (stream || (long)h * w * df->cpp >= BLIT_NT_MIN_BYTES) {
+		paint_run_bands(h, w * df->cpp, copy_rows_band, &b);
+	} else {
+		copy_rows_cached_band(&b, 0, h);
+	}
+
+	if (dst->damage)
+		paint_damage_add(dst->damage, dst->x, dst->y, w, h);
+
+	return 0;
+}
+
+int paint_blit(const struct paint_view *dst, const struct paint_view *src)
+{
+	return blit_views(dst, src, 0);
+}
+
+/* ============ Shadow buffers =========== */
+
+int paint_shadow_init(struct paint_shadow *shadow, const struct paint_buf *target)
+{
+	const struct paint_format *fmt = get_buf_format(target);
+	int stride;
+	void *mem;
+
+	if (!fmt)
+		return -1;
+
+	/* Rows start on a cache line, so that each row streams out in whole lines */
+	stride = (target->width * fmt->cpp + 63) & ~63;
+	if (posix_memalign(&mem, 64, (size_t)stride * target->height)) {
+		printf("Out of memory for %dx%d shadow buffer\n", target->width, target->height);
+		return -1;
+	}
+
+	memset(mem, 0, (size_t)stride * target->height);
+	paint_buf_init(&shadow->buf, mem, target->width, target->height, stride, target->format);
+	shadow->buf.damage = &shadow->damage;
+	shadow->target = *target;
+
+	/* Whatever the target has, it isn't what the shadow has yet */
+	paint_damage_clear(&shadow->damage);
+	paint_damage_add(&shadow->damage, 0, 0, target->width, target->height);
+	return 0;
+}
+
+void paint_shadow_fini(struct paint_shadow *shadow)
+{
+	free(shadow->buf.base);
+	shadow->buf.base = NULL;
+}
+
+int paint_shadow_flush(struct paint_shadow *shadow)
+{
+	struct paint_view dst, src;
+	struct paint_rect *r;
+	int i, ret = 0;
+
+	for (i = 0; i < shadow->damage.count; i++) {
+		r = &shadow->damage.rects[i];
+		if (paint_view_init(&dst, &shadow->target, r->x, r->y, r->w, r->h) ||
+			paint_view_init(&src, &shadow->buf, r->x, r->y, r->w, r->h))
+			continue;
+
+		ret |= blit_views(&dst, &src, 1);
+	}
+
+	paint_damage_clear(&shadow->damage);
+	return ret;
+}
+
+/* ============ Checksums =========== */
+
+/*
+ * CRCs are linear: the CRC of A then B is the CRC of A with |B| zero bytes
+ * appended, xor the CRC of B started from 0. Appending zeros is a 32x32
+ * matrix over GF(2), so rows can be checksummed in parallel and chained
+ * up after, with the matrix for one row's worth of bytes.
+ */
+static uint32_t gf2_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	for (; vec; vec >>= 1, mat++) {
+		if (vec & 1)
+			sum ^= *mat;
+	}
+
+	return sum;
+}
+
+/* res = b after a, res can't be either of them */
+static void gf2_mul(uint32_t *res, const uint32_t *a, const uint32_t *b)
+{
+	int n;
+
+	for (n = 0; n < 32; n++)
+		res[n] = gf2_times(b, a[n]);
+}
+
+/* The matrix appending len zero bytes, by squaring the one for a zero bit */
+static void crc32c_zeros_op(uint32_t *op, size_t len)
+{
+	uint32_t pow[32], tmp[32];
+	int n;
+
+	pow[0] = PAINT_CRC32C_POLY;
+	for (n = 1; n < 32; n++)
+		pow[n] = 1u << (n - 1);
+
+	for (n = 0; n < 32; n++)
+		op[n] = 1u << n;
+
+	/* 1 bit to 8 bits, a byte */
+	for (n = 0; n < 3; n++) {
+		gf2_mul(tmp, pow, pow);
+		memcpy(pow, tmp, sizeof(pow));
+	}
+
+	for (; len; len >>= 1) {
+		if (len & 1) {
+			gf2_mul(tmp, op, pow);
+			memcpy(op, tmp, sizeof(tmp));
+		}
+		gf2_mul(tmp, pow, pow);
+		memcpy(pow, tmp, sizeof(pow));
+	}
+}
+
+struct checksum_rows {
+	const struct paint_view *view;
+	size_t bytes;
+	uint32_t *row_crc;
+};
+
+static void checksum_rows_band(void *arg, int y0, int y1)
+{
+	struct checksum_rows *c = arg;
+	int y;
+
+	for (y = y0; y < y1; y++)
+		c->row_crc[y] = paint_crc32c(0, c->view->base + (long)y * c->view->stride, c->bytes);
+}
+
+uint32_t paint_view_checksum(const struct paint_view *view)
+{
+	const struct paint_format *fmt = lookup_format(view->format);
+	struct checksum_rows c;
+	uint32_t crc = 0xffffffff, op[32];
+	int y;
+
+	if (!fmt || !view->base || view->width <= 0 || view->height <= 0)
+		return 0;
+
+	c.view = view;
+	c.bytes = (size_t)view->width * fmt->cpp;
+	c.row_crc = malloc(view->height * sizeof(*c.row_crc));
+	if (!c.row_crc) {
+		printf("Out of memory for the checksum of %d rows\n", view->height);
+		return 0;
+	}
+
+	paint_run_bands(view->height, c.bytes, checksum_rows_band, &c);
+
+	crc32c_zeros_op(op, c.bytes);
+	for (y = 0; y < view->height; y++)
+		crc = gf2_times(op, crc) ^ c.row_crc[y];
+
+	free(c.row_crc);
+	return ~crc;
+}
+
+uint32_t paint_buf_checksum(const struct paint_buf *buf)
+{
+	struct paint_view view;
+
+	if (paint_view_init(&view, buf, 0, 0, buf->width, buf->height))
+		return 0;
+
+	return paint_view_checksum(&view);
+}
+
+/* ============ Layer compositing =========== */
+
+static int layer_opaque(const struct paint_layer *l)
+{
+	return l->buf.format == DRM_FORMAT_XRGB8888;
+}
+
+/* Rows of what gets blended: the premultiplied copy, for straight alpha layers */
+static const uint32_t *layer_row(const struct paint_layer *l, int y)
+{
+	const char *base = l->premul ? (const char *)l->premul : l->buf.base;
+
+	return (const uint32_t *)(base + (long)y * l->buf.stride);
+}
+
+static uint32_t premultiply_px(uint32_t px)
+{
+	uint32_t a = px >> 24, out = a << 24, t;
+	int shift;
+
+	if (a == 255 || !a)
+		return a ? px : 0;
+
+	for (shift = 0; shift < 24; shift += 8) {
+		t = ((px >> shift) & 0xff) * a + 128;
+		out |= ((t + (t >> 8)) >> 8) << shift;
+	}
+
+	return out;
+}
+
+static void premultiply_rect(struct paint_layer *l, const struct paint_rect *r)
+{
+	const uint32_t *src;
+	uint32_t *dst;
+	int x, y;
+
+	for (y = r->y; y < r->y + r->h; y++) {
+		src = (const uint32_t *)(l->buf.base + (long)y * l->buf.stride);
+		dst = (uint32_t *)layer_row(l, y);
+		for (x = r->x; x < r->x + r->w; x++)
+			dst[x] = premultiply_px(src[x]);
+	}
+}
+
+static int layer_covers(const struct paint_layer *l, const struct paint_rect *r)
+{
+	return l->visible && l->x <= r->x && l->y <= r->y &&
+		l->x + l->buf.width >= r->x + r->w && l->y + l->buf.height >= r->y + r->h;
+}
+
+/* XRGB8888 pixels into an ARGB8888 target, where X would be taken for alpha */
+static void copy_opaque_row(uint32_t *dst, const uint32_t *src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = src[i] | 0xFF000000;
+}
+
+struct compose_rows {
+	struct paint_compositor *comp;
+	struct paint_rect r;
+	/* Bottom layer to start from, an opaque one covering all of r, or -1 */
+	int first;
+};
+
+/* One target row at a time, through all the layers, while it is in the cache */
+static void compose_rows_band(void *arg, int y0, int y1)
+{
+	struct compose_rows *c = arg;
+	struct paint_compositor *comp = c->comp;
+	const struct paint_rect *r = &c->r;
+	const struct paint_layer *l;
+	uint32_t *row;
+	int i, y, ty, x0, x1;
+
+	for (y = y0; y < y1; y++) {
+		ty = r->y + y;
+		row = (uint32_t *)(comp->target.base + (long)ty * comp->target.stride);
+		if (c->first < 0)
+			paint_fill32(row + r->x, 0, r->w);
+
+		for (i = c->first < 0 ? 0 : c->first; i < comp->num_layers; i++) {
+			l = &comp->layers[i];
+			if (!l->visible || ty < l->y || ty >= l->y + l->buf.height)
+				continue;
+
+			x0 = l->x > r->x ? l->x : r->x;
+			x1 = l->x + l->buf.width < r->x + r->w ? l->x + l->buf.width : r->x + r->w;
+			if (x0 >= x1)
+				continue;
+
+			if (layer_opaque(l) && comp->target.format == DRM_FORMAT_ARGB8888)
+				copy_opaque_row(row + x0, layer_row(l, ty - l->y) + x0 - l->x, x1 - x0);
+			else if (layer_opaque(l))
+				memcpy(row + x0, layer_row(l, ty - l->y) + x0 - l->x, (x1 - x0) * 4);
+			else
+				paint_blend_over(row + x0, layer_row(l, ty - l->y) + x0 - l->x, x1 - x0);
+		}
+	}
+}
+
+static void compose_rect(struct paint_compositor *comp, struct paint_rect *r)
+{
+	struct compose_rows c = { comp, *r, -1 };
+	int i;
+
+	/* Nothing below an opaque layer which covers it all can show through */
+	for (i = comp->num_layers - 1; i >= 0; i--) {
+		if (layer_opaque(&comp->layers[i]) && layer_covers(&comp->layers[i], r)) {
+			c.first = i;
+			break;
+		}
+	}
+
+	paint_run_bands(r->h, r->w * 4, compose_rows_band, &c);
+}
+
+static void damage_layer(struct paint_compositor *comp, const struct paint_layer *l)
+{
+	paint_damage_add(&comp->damage, l->x, l->y, l->buf.width, l->buf.height);
+}
+
+int paint_compositor_init(struct paint_compositor *comp, const struct paint_buf *target)
+{
+	if (!get_buf_format(target))
+		return -1;
+
+	if (target->format != DRM_FORMAT_XRGB8888 && target->format != DRM_FORMAT_ARGB8888) {
+		printf("Can't compose into format 0x%x\n", target->format);
+		return -1;
+	}
+
+	comp->target = *target;
+	comp->num_layers = 0;
+
+	/* Whatever the target has, all of it needs composing once */
+	paint_damage_clear(&comp->damage);
+	paint_damage_add(&comp->damage, 0, 0, target->width, target->height);
+	return 0;
+}
+
+void paint_compositor_fini(struct paint_compositor *comp)
+{
+	int i;
+
+	for (i = 0; i < comp->num_layers; i++) {
+		free(comp->layers[i].buf.base);
+		free(comp->layers[i].premul);
+	}
+
+	comp->num_layers = 0;
+}
+
+int paint_compositor_add_layer(struct paint_compositor *comp, int width, int height,
+		uint32_t format, int flags)
+{
+	struct paint_layer *l = &comp->layers[comp->num_layers];
+	int stride;
+	void *mem;
+
+	if (comp->num_layers == PAINT_MAX_LAYERS) {
+		printf("No room for more than %d layers\n", PAINT_MAX_LAYERS);
+		return -1;
+	}
+
+	if (width <= 0 || height <= 0 ||
+		(format != DRM_FORMAT_ARGB8888 && format != DRM_FORMAT_XRGB8888)) {
+		printf("Can't make a %dx%d layer of format 0x%x\n", width, height, format);
+		return -1;
+	}
+
+	stride = (width * 4 + 63) & ~63;
+	if (posix_memalign(&mem, 64, (size_t)stride * height))
+		goto nomem;
+
+	memset(mem, 0, (size_t)stride * height);
+	paint_buf_init(&l->buf, mem, width, height, stride, format);
+
+	l->premul = NULL;
+	if (format == DRM_FORMAT_ARGB8888 && !(flags & PAINT_LAYER_PREMULTIPLIED)) {
+		if (posix_memalign(&mem, 64, (size_t)stride * height)) {
+			free(l->buf.base);
+			goto nomem;
+		}
+		memset(mem, 0, (size_t)stride * height);
+		l->premul = mem;
+	}
+
+	paint_damage_clear(&l->damage);
+	l->buf.damage = &l->damage;
+	l->x = 0;
+	l->y = 0;
+	l->visible = 1;
+
+	damage_layer(comp, l);
+	return comp->num_layers++;
+
+nomem:
+	printf("Out of memory for %dx%d layer\n", width, height);
+	return -1;
+}
+
+struct paint_buf *paint_compositor_layer(struct paint_compositor *comp, int layer)
+{
+	if (layer < 0 || layer >= comp->num_layers)
 		return NULL;
+
+	return &comp->layers[layer].buf;
+}
+
+void paint_compositor_move_layer(struct paint_compositor *comp, int layer, int x, int y)
+{
+	struct paint_layer *l;
+
+	if (layer < 0 || layer >= comp->num_layers)
+		return;
+
+	l = &comp->layers[layer];
+	if (l->x == x && l->y == y)
+		return;
+
+	/* Where it was needs redoing as much as where it is now */
+	if (l->visible)
+		damage_layer(comp, l);
+
+	l->x = x;
+	l->y = y;
+
+	if (l->visible)
+		damage_layer(comp, l);
+}
+
+void paint_compositor_show_layer(struct paint_compositor *comp, int layer, int visible)
+{
+	struct paint_layer *l;
+
+	if (layer < 0 || layer >= comp->num_layers)
+		return;
+
+	l = &comp->layers[layer];
+	if (!l->visible == !visible)
+		return;
+
+	l->visible = !!visible;
+	damage_layer(comp, l);
+}
+
+long paint_compositor_compose(struct paint_compositor *comp)
+{
+	struct paint_layer *l;
+	struct paint_rect r;
+	long pixels = 0;
+	int i, j;
+
+	if (!comp->target.base)
+		return -1;
+
+	/* What was painted in the layers, premultiplied once, here */
+	for (i = 0; i < comp->num_layers; i++) {
+		l = &comp->layers[i];
+		for (j = 0; j < l->damage.count; j++) {
+			r = l->damage.rects[j];
+			if (l->premul)
+				premultiply_rect(l, &r);
+			if (l->visible)
+				paint_damage_add(&comp->damage, l->x + r.x, l->y + r.y, r.w, r.h);
+		}
+		paint_damage_clear(&l->damage);
 	}
 
-	output = malloc(v * sb_pitch);
-	sub = fb + yoff * pitch + xoff * bpp;
+	for (i = 0; i < comp->damage.count; i++) {
+		r = comp->damage.rects[i];
+		if (!clip_region(&comp->target, &r.x, &r.y, &r.w, &r.h))
+			continue;
 
-	for (i = 0; i < v; i++)
-		memcpy(output, sub + i * pitch, sb_pitch);
+		compose_rect(comp, &r);
+		if (comp->target.damage)
+			paint_damage_add(comp->target.damage, r.x, r.y, r.w, r.h);
+		pixels += (long)r.w * r.h;
+	}
 
-	return output;
+	paint_damage_clear(&comp->damage);
+	return pixels;
+}
+
+/* ============ Drawing functions =========== */
+
+int paint_format_cpp(uint32_t format)
+{
+	const struct paint_format *fmt = lookup_format(format);
+
+	return fmt ? fmt->cpp : 0;
 }
 
-void paint_a_buffer_region_tricolor(char *fb, int X, int Y, int x_off, int y_off, int h, int v, int bpp)
+int paint_buf_init(struct paint_buf *buf, char *base, int width, int height,
+		int stride, uint32_t format)
 {
-	int ret = 0;
-	int pitch = X * bpp;
-	int bsz = Y * pitch;
-	int sb_pitch = h * bpp;
-	int sb_sz = v * sb_pitch;
-	int sb_clr_sz = sb_sz/3;
-	int j;
-	char *sb;
+	buf->base = base;
+	buf->width = width;
+	buf->height = height;
+	buf->format = format;
+	buf->stride = stride ? stride : width * paint_format_cpp(format);
+	buf->damage = NULL;
+
+	return get_buf_format(buf) ? 0 : -1;
+}
 
-	memset(fb, 0, bsz);
-	sb = fb + y_off * pitch + x_off * bpp;
+void paint_a_buffer_region_clr(struct paint_buf *buf, int x_off, int y_off, int h, int v, int clr)
+{
+	const struct paint_format *fmt = get_buf_format(buf);
+	const uint32_t *px;
 
+	if (!fmt || !(px = get_palette_px(fmt)))
+		return;
+
+	if ((unsigned int)clr >= palette->entries) {
+		printf("Color %d not in the palette\n", clr);
+		return;
+	}
+
+	if (clip_region(buf, &x_off, &y_off, &h, &v))
+		paint_rows(fmt, buf, x_off, y_off, h, v, px[clr]);
+}
+
+void blank_a_buffer_region(struct paint_buf *buf, int x_off, int y_off, int h, int v)
+{
 #ifdef LINE_BY_LINE
-	for (j = 0; j < v/3; j++)
-		paint_a_line(sb + j * pitch, sb_pitch, hash_get_clr_val(red));
-	for (j = v/3; j < (2 * v)/3; j++)
-		paint_a_line(sb + j * pitch, sb_pitch, hash_get_clr_val(red));
-	for (j = (2 * v)/ 3; j < v; j++)
-		paint_a_line(sb + j * pitch, sb_pitch, hash_get_clr_val(red));
+	paint_a_buffer_region_clr(buf, x_off, y_off, h, v, red);
 #else
-	paint_buf_recursively(sb, X, v/3, 4, hash_get_clr_val(red));
-	paint_buf_recursively(sb + pitch * v/3, X, v/3, 4, hash_get_clr_val(green));
-	paint_buf_recursively(sb + pitch * 2 * v/3, X, v/3, 4, hash_get_clr_val(blue));
+	paint_a_buffer_region_clr(buf, x_off, y_off, h, v, black);
 #endif
 }
 
 #ifdef LINE_BY_LINE
-static void paint_buffer_single_color(char *buf, int bsz, int bpp, uint32_t val)
+void paint_a_buffer_region_solid(struct paint_buf *buf, int x_off, int y_off, int h, int v, int clr)
 {
-	int *ib = (int *)buf;
-	int n_pixels = bsz/bpp;
+	if (!get_buf_format(buf))
+		return;
 
-	wmemset(ib, val, n_pixels);
+	paint_clear(buf);
+	paint_a_buffer_region_clr(buf, x_off, y_off, h, v, clr);
 }
 #endif
 
-void paint_buffer_tricolor(char *fb, int xres, int yres, int bytes_pp)
+void paint_a_buffer_white(struct paint_buf *buf)
 {
-	int ret = 0;
-	int pitch = xres * bytes_pp;
-	int buf_sz = yres * pitch;
-	int granularity = yres/3;
+	if (!buf)
+		return;
 
 #ifdef LINE_BY_LINE
-	paint_buffer_single_color(fb, buf_sz/3, bytes_pp, hash_get_clr_val(red));
-	paint_buffer_single_color(fb + buf_sz/3, buf_sz/3, bytes_pp, hash_get_clr_val(red));
-	paint_buffer_single_color(fb + 2 * buf_sz/3, buf_sz/3, bytes_pp, hash_get_clr_val(red));
+	paint_a_buffer_region_solid(buf, 0, 0, buf->width, buf->height, red);
 #else
-	paint_buf_recursively(fb, xres, yres/3, 4, hash_get_clr_val(red));
-	paint_buf_recursively(fb + pitch * yres/3, xres, yres/3, 4, hash_get_clr_val(green));
-	paint_buf_recursively(fb + pitch * 2 * yres/3, xres, yres/3, 4, hash_get_clr_val(blue));
+	paint_a_buffer_region_clr(buf, 0, 0, buf->width, buf->height, white);
 #endif
+}
+
+/* The region as tightly packed rows, in a buffer the caller frees */
+char *get_a_subbuffer_copy(struct paint_buf *buf, int xoff, int yoff, int h, int v)
+{
+	struct paint_view src, dst;
+	struct paint_buf out;
+	char *output;
+
+	if (paint_view_init(&src, buf, xoff, yoff, h, v)) {
+		printf("Invalid input, cant get the buffer\n");
+		return NULL;
+	}
+
+	output = malloc((long)src.height * src.width * paint_format_cpp(src.format));
+	if (!output) {
+		printf("Out of memory for %dx%d subbuffer\n", src.width, src.height);
+		return NULL;
+	}
+
+	paint_buf_init(&out, output, src.width, src.height, 0, src.format);
+	paint_view_init(&dst, &out, 0, 0, src.width, src.height);
+	paint_blit(&dst, &src);
 
-}
\ No newline at end of file
+	return output;
+}
+
+void paint_a_buffer_region_tricolor(struct paint_buf *buf, int x_off, int y_off, int h, int v)
+{
+	const struct paint_format *fmt = get_buf_format(buf);
+	const uint32_t *px;
+
+	if (!fmt || !(px = get_palette_px(fmt)))
+		return;
+
+	paint_clear(buf);
+	if (clip_region(buf, &x_off, &y_off, &h, &v))
+		paint_rows_tricolor(fmt, buf, px, x_off, y_off, h, v);
+}
+
+void paint_buffer_tricolor(struct paint_buf *buf)
+{
+	const struct paint_format *fmt = get_buf_format(buf);
+	const uint32_t *px;
+
+	if (fmt && (px = get_palette_px(fmt)))
+		paint_rows_tricolor(fmt, buf, px, 0, 0, buf->width, buf->height);
+}
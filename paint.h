@@ -20,16 +20,41 @@
  *
  */
 
-#define MAX_CLR_SUPPORTED 255
+#ifndef __PAINT_H__
+#define __PAINT_H__
 
-struct clr_hash_data {
-	uint8_t clr;
-	uint64_t val;
-};
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pixel formats are DRM fourcc codes, use the DRM header when there is one */
+#ifdef __has_include
+#if __has_include(<drm/drm_fourcc.h>)
+#include <drm/drm_fourcc.h>
+#endif
+#endif
+
+#ifndef DRM_FORMAT_XRGB8888
+#define PAINT_FOURCC(a, b, c, d) \
+	((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define DRM_FORMAT_RGB565 PAINT_FOURCC('R', 'G', '1', '6')
+#define DRM_FORMAT_XRGB8888 PAINT_FOURCC('X', 'R', '2', '4')
+#define DRM_FORMAT_ARGB8888 PAINT_FOURCC('A', 'R', '2', '4')
+#define DRM_FORMAT_ABGR8888 PAINT_FOURCC('A', 'B', '2', '4')
+#define DRM_FORMAT_XRGB2101010 PAINT_FOURCC('X', 'R', '3', '0')
+#define DRM_FORMAT_NV12 PAINT_FOURCC('N', 'V', '1', '2')
+#define DRM_FORMAT_YUV420 PAINT_FOURCC('Y', 'U', '1', '2')
+#define DRM_FORMAT_YUYV PAINT_FOURCC('Y', 'U', 'Y', 'V')
+#define DRM_FORMAT_P010 PAINT_FOURCC('P', '0', '1', '0')
+#endif
 
-struct clr_hash_table {
-	struct clr_hash_data *cval[MAX_CLR_SUPPORTED];
+/*
+ * A palette: the colors as given (XRGB8888, or ARGB8888 for the ones made
+ * by paint_palette_create_argb()), and the same colors already packed
+ * for every format libpaint can paint, all in one flat block.
+ */
+struct paint_palette {
 	int entries;
+	uint32_t px[];
 };
 
 enum color {
@@ -41,12 +66,301 @@ enum color {
     color_max,
 };
 
+/* Default palette, indexed by enum color (or any index below num) */
 void init_clr_hash(int num, uint32_t *clr_val);
 void delete_clr_hash(int key);
 uint64_t hash_get_clr_val(int key);
 
-char *get_a_subbuffer_copy(char *fb, int X, int Y, int xoff, int yoff, int h, int v, int bpp);
-void blank_a_buffer_region(char *fb, int X, int Y, int x_off, int y_off, int h, int v, int bpp);
-void paint_a_buffer_region_tricolor(char *fb, int X, int Y, int x_off, int y_off, int h, int v, int bpp);
-void paint_a_buffer_white(char *fb, int X, int Y, int bpp);
-void paint_buffer_tricolor(char *fb, int xres, int yres, int bytes_pp);
\ No newline at end of file
+/*
+ * User defined palettes of any size. paint_palette_get() returns the
+ * colors packed for a format, index it with the color to get the pixel.
+ * paint_set_palette() makes it the one the paint functions draw with,
+ * NULL goes back to the default one. Palettes are owned by the caller.
+ * paint_palette_create_argb() takes ARGB8888 colors, and keeps their alpha
+ * when painting in ARGB8888 or ABGR8888 buffers, to paint translucent
+ * layers with. Other palettes paint those opaque.
+ */
+struct paint_palette *paint_palette_create(int num, const uint32_t *clr_val);
+struct paint_palette *paint_palette_create_argb(int num, const uint32_t *clr_val);
+void paint_palette_destroy(struct paint_palette *pal);
+const uint32_t *paint_palette_get(const struct paint_palette *pal, uint32_t format);
+void paint_set_palette(struct paint_palette *pal);
+
+/* Rectangles of a buffer touched since the damage was last cleared */
+#define PAINT_DAMAGE_MAX 8
+
+struct paint_rect {
+	int x;
+	int y;
+	int w;
+	int h;
+};
+
+struct paint_damage {
+	int count;
+	struct paint_rect rects[PAINT_DAMAGE_MAX];
+};
+
+/*
+ * A buffer to paint: stride is the bytes between two rows, format is a
+ * DRM fourcc, one of XRGB8888, ARGB8888, ABGR8888, XRGB2101010, RGB565.
+ * Colors are always given as XRGB8888 and converted for the buffer.
+ * When damage is set, everything painted gets added to it.
+ */
+struct paint_buf {
+	char *base;
+	int width;
+	int height;
+	int stride;
+	uint32_t format;
+	struct paint_damage *damage;
+};
+
+/* Bytes per pixel of a format, 0 if libpaint can't paint it */
+int paint_format_cpp(uint32_t format);
+
+/* Fill up a paint_buf, stride 0 means tightly packed rows */
+int paint_buf_init(struct paint_buf *buf, char *base, int width, int height,
+		int stride, uint32_t format);
+
+/*
+ * Damage tracking: overlapping or touching rectangles get merged, and once
+ * the list is full a new one is merged with whichever grows the least.
+ */
+void paint_damage_clear(struct paint_damage *damage);
+void paint_damage_add(struct paint_damage *damage, int x, int y, int w, int h);
+long paint_damage_area(const struct paint_damage *damage);
+
+/*
+ * A view is a window into a paint_buf which doesn't own the pixels: base is
+ * the top left pixel of the window, x and y where that is in the buffer.
+ * Blits into a view add to the buffer's damage.
+ */
+struct paint_view {
+	char *base;
+	int width;
+	int height;
+	int stride;
+	uint32_t format;
+	int x;
+	int y;
+	struct paint_damage *damage;
+};
+
+/* View the w x h region of buf at (x, y), clipped to buf. -1 if none of it is left */
+int paint_view_init(struct paint_view *view, const struct paint_buf *buf,
+		int x, int y, int w, int h);
+
+/*
+ * Copy src into dst, as much of it as both views have room for. Views can
+ * overlap, and pixels get converted if the formats differ (not in place).
+ */
+int paint_blit(const struct paint_view *dst, const struct paint_view *src);
+
+/*
+ * Scale all of src into all of dst, as a display plane's scaler would:
+ * nearest neighbour, bilinear (2 taps whatever the ratio, like most
+ * hardware) or Lanczos-3, widened when shrinking so that it doesn't alias.
+ * The filters are separable, with coefficient tables worked out once per
+ * call. Both views have to be of the same 8 bit per channel format
+ * (XRGB8888, ARGB8888 or ABGR8888), and not overlap. Alpha is filtered
+ * like any other channel, which is right for premultiplied alpha.
+ */
+enum paint_scale_filter {
+	PAINT_SCALE_NEAREST = 0,
+	PAINT_SCALE_BILINEAR,
+	PAINT_SCALE_LANCZOS,
+	PAINT_SCALE_MAX,
+};
+
+int paint_scale(const struct paint_view *dst, const struct paint_view *src,
+		enum paint_scale_filter filter);
+const char *paint_scale_filter_name(enum paint_scale_filter filter);
+/* The filter by name, -1 if there is none */
+int paint_scale_filter_lookup(const char *name);
+
+/*
+ * CRC32C of the pixels, row after row, leaving the padding at the end of
+ * the rows out: the same pixels give the same checksum whatever the stride.
+ * Uses the CPU's CRC32 instructions where it has them. 0 for invalid input.
+ */
+uint32_t paint_view_checksum(const struct paint_view *view);
+uint32_t paint_buf_checksum(const struct paint_buf *buf);
+
+/*
+ * Lossless compression of frames of any 32 bit format, to capture them: a
+ * QOI style code of runs, recently seen pixels and small deltas, which
+ * takes solid fills down to next to nothing. Chunks of rows are coded and
+ * decoded on the paint workers. An encoded frame is self contained: it has
+ * its size, format and the CRC32C of its pixels, which decoding checks.
+ *
+ * paint_encode_bound() is the room the encoding of a frame can take, -1 if
+ * it can't be encoded. paint_encode() returns the size the frame took, -1
+ * on errors. paint_decode() writes the frame to the top left of dst, which
+ * has to be of its format and at least its size.
+ */
+struct paint_frame_info {
+	int width;
+	int height;
+	uint32_t format;
+	uint32_t checksum;
+	/* Of the encoded frame, the next one follows it in a stream */
+	uint32_t size;
+};
+
+long paint_encode_bound(int width, int height);
+long paint_encode(void *out, size_t size, const struct paint_view *src);
+/* -1 if in doesn't start with a whole encoded frame */
+int paint_decode_info(const void *in, size_t size, struct paint_frame_info *info);
+int paint_decode(const struct paint_view *dst, const void *in, size_t size);
+
+/*
+ * A shadow buffer: normal cached memory to paint in place of the target
+ * (a write-combined scanout mapping, typically), which is never read. The
+ * flush streams just the damaged rectangles out to the target and adds
+ * them to the target's damage. The first flush writes all of it.
+ */
+struct paint_shadow {
+	struct paint_buf buf;
+	struct paint_damage damage;
+	struct paint_buf target;
+};
+
+int paint_shadow_init(struct paint_shadow *shadow, const struct paint_buf *target);
+void paint_shadow_fini(struct paint_shadow *shadow);
+int paint_shadow_flush(struct paint_shadow *shadow);
+
+/*
+ * Software composition of layers into a target buffer, for when there are
+ * more layers than hardware planes. Layers are ARGB8888, with straight or
+ * premultiplied (PAINT_LAYER_PREMULTIPLIED) alpha, or XRGB8888 which is
+ * always opaque. They are stacked in the order they were added, over black.
+ *
+ * Paint into a layer through paint_compositor_layer(), its damage is kept
+ * by the compositor. paint_compositor_compose() then recomposes only what
+ * changed since the last call: damaged, moved, shown or hidden layers. The
+ * target is read back while blending, so it should be in cached memory (a
+ * paint_shadow buffer) rather than a scanout mapping.
+ */
+#define PAINT_MAX_LAYERS 8
+#define PAINT_LAYER_PREMULTIPLIED (1 << 0)
+
+struct paint_layer {
+	struct paint_buf buf;
+	struct paint_damage damage;
+	int x;
+	int y;
+	int visible;
+	/* Straight alpha layers: the same pixels premultiplied, what gets blended */
+	uint32_t *premul;
+};
+
+struct paint_compositor {
+	struct paint_buf target;
+	/* Target rectangles to recompose, moves and visibility changes */
+	struct paint_damage damage;
+	int num_layers;
+	struct paint_layer layers[PAINT_MAX_LAYERS];
+};
+
+/* The target has to be XRGB8888 or ARGB8888 */
+int paint_compositor_init(struct paint_compositor *comp, const struct paint_buf *target);
+void paint_compositor_fini(struct paint_compositor *comp);
+
+/* A new, fully transparent (or black, for XRGB8888) layer on top. Returns its index */
+int paint_compositor_add_layer(struct paint_compositor *comp, int width, int height,
+		uint32_t format, int flags);
+struct paint_buf *paint_compositor_layer(struct paint_compositor *comp, int layer);
+void paint_compositor_move_layer(struct paint_compositor *comp, int layer, int x, int y);
+void paint_compositor_show_layer(struct paint_compositor *comp, int layer, int visible);
+
+/* Returns the number of target pixels recomposed, -1 on errors */
+long paint_compositor_compose(struct paint_compositor *comp);
+
+/*
+ * YUV buffers for video planes, as laid out by DRM: NV12 (Y plane, then
+ * a plane of interleaved U and V at half the width and height), YUV420
+ * (Y, U and V planes, U and V at half the width and height), YUYV (one
+ * plane, Y0 U Y1 V for each pair of pixels) and P010 (NV12 with 16 bit
+ * samples, the 10 bits in the top ones).
+ */
+struct paint_yuv_buf {
+	char *planes[3];
+	int pitches[3];
+	int width;
+	int height;
+	uint32_t format;
+};
+
+/* The DRM color encodings and ranges, as in the plane properties */
+enum paint_yuv_encoding {
+	PAINT_YUV_BT601 = 0,
+	PAINT_YUV_BT709,
+};
+
+enum paint_yuv_range {
+	PAINT_YUV_LIMITED = 0,
+	PAINT_YUV_FULL,
+};
+
+/*
+ * Planes one after the other from base, as in a single dumb buffer: pitch
+ * is the Y plane's (0 for tightly packed), the others follow from it.
+ * Returns the total size, -1 for formats which aren't YUV ones or pitches
+ * too small for width (odd widths get rounded up to whole U V pairs).
+ */
+long paint_yuv_buf_init(struct paint_yuv_buf *buf, char *base, int width, int height,
+		int pitch, uint32_t format);
+
+/*
+ * Convert an XRGB8888 or ARGB8888 (alpha ignored) view to YUV, as much of
+ * it as dst has room for. Chroma is the average of each 2x2 (2x1 for YUYV)
+ * block of pixels. Rows are converted in bands on the paint workers.
+ * Coefficients are fixed point, so samples are within 0.52 of a code value
+ * of a float reference at 8 bits, and within 0.55 at 10 (P010).
+ */
+int paint_convert_to_yuv(struct paint_yuv_buf *dst, const struct paint_view *src,
+		enum paint_yuv_encoding encoding, enum paint_yuv_range range);
+
+/*
+ * Test patterns over the whole buffer: SMPTE color bars, gradients (gray
+ * and hue), a checkerboard, red/green/blue/gray ramps for gamma checks,
+ * and a zone plate whose rings move with frame (the others ignore it).
+ * Patterns are built the first time they are asked for at a resolution
+ * and format, and kept for the next times, so switching between them
+ * costs no more than a copy. The cache can be dropped at any time.
+ */
+enum paint_pattern {
+	PAINT_PATTERN_SMPTE = 0,
+	PAINT_PATTERN_GRADIENT,
+	PAINT_PATTERN_CHECKER,
+	PAINT_PATTERN_RAMPS,
+	PAINT_PATTERN_ZONEPLATE,
+	PAINT_PATTERN_MAX,
+};
+
+int paint_pattern(struct paint_buf *buf, enum paint_pattern pattern, int frame);
+const char *paint_pattern_name(enum paint_pattern pattern);
+/* The pattern by name, -1 if there is none */
+int paint_pattern_lookup(const char *name);
+void paint_pattern_cache_clear(void);
+
+char *get_a_subbuffer_copy(struct paint_buf *buf, int xoff, int yoff, int h, int v);
+void blank_a_buffer_region(struct paint_buf *buf, int x_off, int y_off, int h, int v);
+void paint_a_buffer_region_clr(struct paint_buf *buf, int x_off, int y_off, int h, int v, int clr);
+void paint_a_buffer_region_tricolor(struct paint_buf *buf, int x_off, int y_off, int h, int v);
+void paint_a_buffer_white(struct paint_buf *buf);
+void paint_buffer_tricolor(struct paint_buf *buf);
+
+/*
+ * Worker threads used by the fills, 0 picks PAINT_THREADS from environment
+ * or the number of online CPUs. 1 runs everything on the calling thread,
+ * painting exactly the same output.
+ */
+int paint_set_threads(int n);
+int paint_get_threads(void);
+
+/* Name of the fill kernel ISA picked at load time (scalar/sse2/avx2/avx512/neon) */
+const char *paint_get_simd_isa(void);
+
+#endif
@@ -0,0 +1,820 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * paint_bench: micro benchmarks for libpaint, runs on plain memory so
+ * no DRM device is required. Built twice by 'make bench', once for the
+ * recursive and once for the LINE_BY_LINE flavour of libpaint.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "paint.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#ifdef LINE_BY_LINE
+#define BUILD_NAME "line_by_line"
+#else
+#define BUILD_NAME "recursive"
+#endif
+
+#define HUGEPAGE_SZ (2UL << 20)
+#define BENCH_REPS 3
+
+static uint32_t clr_val[] = {
+	0, /*black */
+	0x00FF0000, /* Red */
+	0x0000FF00, /* Green */
+	0x000000FF, /* Blue */
+	0xFFFFFFFF, /* White */
+};
+
+struct bench_res {
+	const char *name;
+	int x;
+	int y;
+};
+
+static struct bench_res resolutions[] = {
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "1440p", 2560, 1440 },
+	{ "4k", 3840, 2160 },
+	{ "5k", 5120, 2880 },
+	{ "8k", 7680, 4320 },
+};
+
+enum buf_kind {
+	BUF_MALLOC,
+	BUF_HUGEPAGE,
+	BUF_KIND_MAX,
+};
+
+static const char *buf_kind_names[BUF_KIND_MAX] = {
+	"malloc",
+	"hugepage",
+};
+
+struct bench_format {
+	const char *name;
+	uint32_t fourcc;
+};
+
+static struct bench_format bench_formats[] = {
+	{ "xrgb8888", DRM_FORMAT_XRGB8888 },
+	{ "argb8888", DRM_FORMAT_ARGB8888 },
+	{ "abgr8888", DRM_FORMAT_ABGR8888 },
+	{ "xrgb2101010", DRM_FORMAT_XRGB2101010 },
+	{ "rgb565", DRM_FORMAT_RGB565 },
+};
+
+struct bench_buf {
+	enum buf_kind kind;
+	struct paint_buf pb;
+	const char *format_name;
+	char *fb;
+	size_t size;
+	int x;
+	int y;
+	int cpp;
+	/* hugepage was asked for, but we ended up with THP or 4K pages */
+	int fallback;
+	/* Set up by the first shadow case, with this buffer as the target */
+	struct paint_shadow shadow;
+	/* Set up by the first compositor case, composing into this buffer */
+	struct paint_compositor comp;
+	/* Allocated by the first YUV case, converted into from this buffer */
+	struct paint_yuv_buf yuv;
+	/* The zoneplate, encoded by the first codec case */
+	char *encoded;
+	long encoded_size;
+};
+
+struct bench_case {
+	const char *name;
+	void (*run)(struct bench_buf *buf);
+	/* bytes written by one call */
+	uint64_t (*bytes)(struct bench_buf *buf);
+	/* Only runs on XRGB8888 and ARGB8888 buffers */
+	int argb_only;
+};
+
+struct bench_opts {
+	int json;
+	int no_hugepages;
+	int threads;
+	double min_time_ms;
+	const char *res_filter;
+	const char *func_filter;
+	struct bench_format *format;
+};
+
+/* Sub-region used for the region APIs: centered, half the size each way */
+#define REGION_X(b) ((b)->x / 4)
+#define REGION_Y(b) ((b)->y / 4)
+#define REGION_H(b) ((b)->x / 2)
+#define REGION_V(b) ((b)->y / 2)
+
+static volatile uint64_t sink;
+
+/* ============ Bench cases, one per exported paint.h function =========== */
+
+static void run_paint_buffer_tricolor(struct bench_buf *b)
+{
+	paint_buffer_tricolor(&b->pb);
+}
+
+static void run_paint_a_buffer_white(struct bench_buf *b)
+{
+	paint_a_buffer_white(&b->pb);
+}
+
+static void run_paint_a_buffer_region_tricolor(struct bench_buf *b)
+{
+	paint_a_buffer_region_tricolor(&b->pb, REGION_X(b), REGION_Y(b),
+			REGION_H(b), REGION_V(b));
+}
+
+static void run_blank_a_buffer_region(struct bench_buf *b)
+{
+	blank_a_buffer_region(&b->pb, REGION_X(b), REGION_Y(b),
+			REGION_H(b), REGION_V(b));
+}
+
+static void run_paint_a_buffer_region_clr(struct bench_buf *b)
+{
+	paint_a_buffer_region_clr(&b->pb, REGION_X(b), REGION_Y(b),
+			REGION_H(b), REGION_V(b), blue);
+}
+
+static void run_get_a_subbuffer_copy(struct bench_buf *b)
+{
+	char *sub;
+
+	sub = get_a_subbuffer_copy(&b->pb, REGION_X(b), REGION_Y(b),
+			REGION_H(b), REGION_V(b));
+	free(sub);
+}
+
+/* The region is blitted to its bottom right, so the views don't overlap */
+static void run_paint_blit(struct bench_buf *b)
+{
+	struct paint_view dst, src;
+
+	paint_view_init(&src, &b->pb, 0, 0, REGION_H(b), REGION_V(b));
+	paint_view_init(&dst, &b->pb, b->x - REGION_H(b), b->y - REGION_V(b),
+			REGION_H(b), REGION_V(b));
+	paint_blit(&dst, &src);
+}
+
+/* Paint the region in the shadow, then stream it out to the buffer */
+static void run_paint_shadow_flush(struct bench_buf *b)
+{
+	if (!b->shadow.buf.base && paint_shadow_init(&b->shadow, &b->pb))
+		return;
+
+	blank_a_buffer_region(&b->shadow.buf, REGION_X(b), REGION_Y(b),
+			REGION_H(b), REGION_V(b));
+	paint_shadow_flush(&b->shadow);
+}
+
+/*
+ * An opaque background and a translucent, straight alpha layer the size of
+ * the region, which moves back and forth by a pixel every call.
+ */
+static int init_bench_compositor(struct bench_buf *b)
+{
+	struct paint_buf *l;
+	uint32_t *row;
+	int layer, x, y;
+
+	if (paint_compositor_init(&b->comp, &b->pb))
+		return -1;
+
+	layer = paint_compositor_add_layer(&b->comp, b->x, b->y, DRM_FORMAT_XRGB8888, 0);
+	paint_buffer_tricolor(paint_compositor_layer(&b->comp, layer));
+
+	layer = paint_compositor_add_layer(&b->comp, REGION_H(b), REGION_V(b), DRM_FORMAT_ARGB8888, 0);
+	l = paint_compositor_layer(&b->comp, layer);
+	for (y = 0; y < l->height; y++) {
+		row = (uint32_t *)(l->base + (long)y * l->stride);
+		for (x = 0; x < l->width; x++)
+			row[x] = (uint32_t)(x * 255 / l->width) << 24 | 0x00336699;
+	}
+	paint_damage_add(l->damage, 0, 0, l->width, l->height);
+	paint_compositor_move_layer(&b->comp, layer, REGION_X(b), REGION_Y(b));
+	paint_compositor_compose(&b->comp);
+	return 0;
+}
+
+static void run_paint_compositor_compose(struct bench_buf *b)
+{
+	struct paint_layer *l;
+
+	if (!b->comp.target.base && init_bench_compositor(b))
+		return;
+
+	l = &b->comp.layers[1];
+	paint_compositor_move_layer(&b->comp, 1, l->x == REGION_X(b) ? l->x + 1 : REGION_X(b), l->y);
+	paint_compositor_compose(&b->comp);
+}
+
+static void run_paint_pattern(struct bench_buf *b)
+{
+	paint_pattern(&b->pb, PAINT_PATTERN_SMPTE, 0);
+}
+
+/* Moving, so that every call paints a new frame */
+static void run_paint_pattern_zoneplate(struct bench_buf *b)
+{
+	static int frame;
+
+	paint_pattern(&b->pb, PAINT_PATTERN_ZONEPLATE, frame++);
+}
+
+/* The top left quarter, scaled up into the 3/4 of the buffer after it */
+static void run_scale(struct bench_buf *b, enum paint_scale_filter filter)
+{
+	struct paint_view dst, src;
+
+	paint_view_init(&src, &b->pb, 0, 0, b->x / 4, b->y / 4);
+	paint_view_init(&dst, &b->pb, b->x / 4, b->y / 4, b->x * 3 / 4, b->y * 3 / 4);
+	paint_scale(&dst, &src, filter);
+}
+
+static void run_paint_scale(struct bench_buf *b)
+{
+	run_scale(b, PAINT_SCALE_BILINEAR);
+}
+
+static void run_paint_scale_lanczos(struct bench_buf *b)
+{
+	run_scale(b, PAINT_SCALE_LANCZOS);
+}
+
+static void run_paint_convert_to_yuv(struct bench_buf *b)
+{
+	struct paint_view src;
+	long size;
+
+	if (!b->yuv.planes[0]) {
+		size = paint_yuv_buf_init(&b->yuv, NULL, b->x, b->y, 0, DRM_FORMAT_NV12);
+		if (size < 0 || paint_yuv_buf_init(&b->yuv, malloc(size), b->x, b->y, 0,
+				DRM_FORMAT_NV12) < 0 || !b->yuv.planes[0])
+			return;
+	}
+
+	paint_view_init(&src, &b->pb, 0, 0, b->x, b->y);
+	paint_convert_to_yuv(&b->yuv, &src, PAINT_YUV_BT709, PAINT_YUV_LIMITED);
+}
+
+/* A frame of the zoneplate, which is about as hard to compress as the patterns get */
+static int encode_bench_frame(struct bench_buf *b)
+{
+	struct paint_view view;
+	long bound;
+
+	if (b->encoded)
+		return 0;
+
+	bound = paint_encode_bound(b->x, b->y);
+	if (bound < 0 || !(b->encoded = malloc(bound)))
+		return -1;
+
+	paint_pattern(&b->pb, PAINT_PATTERN_ZONEPLATE, 0);
+	paint_view_init(&view, &b->pb, 0, 0, b->x, b->y);
+	b->encoded_size = paint_encode(b->encoded, bound, &view);
+	return b->encoded_size < 0 ? -1 : 0;
+}
+
+static void run_paint_encode(struct bench_buf *b)
+{
+	struct paint_view src;
+
+	if (encode_bench_frame(b))
+		return;
+
+	paint_view_init(&src, &b->pb, 0, 0, b->x, b->y);
+	paint_encode(b->encoded, paint_encode_bound(b->x, b->y), &src);
+}
+
+static void run_paint_decode(struct bench_buf *b)
+{
+	struct paint_view dst;
+
+	if (encode_bench_frame(b))
+		return;
+
+	paint_view_init(&dst, &b->pb, 0, 0, b->x, b->y);
+	paint_decode(&dst, b->encoded, b->encoded_size);
+}
+
+static void run_hash_get_clr_val(struct bench_buf *b)
+{
+	sink += hash_get_clr_val(green);
+}
+
+static uint64_t full_bytes(struct bench_buf *b)
+{
+	return (uint64_t)b->x * b->y * b->cpp;
+}
+
+static uint64_t region_bytes(struct bench_buf *b)
+{
+	return (uint64_t)REGION_H(b) * REGION_V(b) * b->cpp;
+}
+
+static uint64_t region_tricolor_bytes(struct bench_buf *b)
+{
+	/* The whole buffer is cleared first */
+	return full_bytes(b) + region_bytes(b);
+}
+
+static uint64_t scale_bytes(struct bench_buf *b)
+{
+	return (uint64_t)(b->x * 3 / 4) * (b->y * 3 / 4) * b->cpp;
+}
+
+static uint64_t no_bytes(struct bench_buf *b)
+{
+	return 0;
+}
+
+static struct bench_case cases[] = {
+	{ "paint_buffer_tricolor", run_paint_buffer_tricolor, full_bytes },
+	{ "paint_a_buffer_white", run_paint_a_buffer_white, full_bytes },
+	{ "paint_a_buffer_region_tricolor", run_paint_a_buffer_region_tricolor, region_tricolor_bytes },
+	{ "blank_a_buffer_region", run_blank_a_buffer_region, region_bytes },
+	{ "paint_a_buffer_region_clr", run_paint_a_buffer_region_clr, region_bytes },
+	{ "get_a_subbuffer_copy", run_get_a_subbuffer_copy, region_bytes },
+	{ "paint_blit", run_paint_blit, region_bytes },
+	{ "paint_shadow_flush", run_paint_shadow_flush, region_bytes },
+	{ "paint_compositor_compose", run_paint_compositor_compose, region_bytes, 1 },
+	{ "paint_pattern", run_paint_pattern, full_bytes },
+	{ "paint_pattern_zoneplate", run_paint_pattern_zoneplate, full_bytes },
+	{ "paint_scale", run_paint_scale, scale_bytes, 1 },
+	{ "paint_scale_lanczos", run_paint_scale_lanczos, scale_bytes, 1 },
+	{ "paint_convert_to_yuv", run_paint_convert_to_yuv, full_bytes, 1 },
+	{ "paint_encode", run_paint_encode, full_bytes, 1 },
+	{ "paint_decode", run_paint_decode, full_bytes, 1 },
+	{ "hash_get_clr_val", run_hash_get_clr_val, no_bytes },
+};
+
+/* ============ Buffers =========== */
+
+static int alloc_bench_buf(struct bench_buf *b, enum buf_kind kind, int x, int y,
+		struct bench_format *f)
+{
+	b->kind = kind;
+	b->x = x;
+	b->y = y;
+	b->cpp = paint_format_cpp(f->fourcc);
+	b->format_name = f->name;
+	b->size = (size_t)x * y * b->cpp;
+	b->fallback = 0;
+	b->shadow.buf.base = NULL;
+	b->comp.target.base = NULL;
+	b->yuv.planes[0] = NULL;
+	b->encoded = NULL;
+
+	if (kind == BUF_MALLOC) {
+		if (posix_memalign((void **)&b->fb, 64, b->size))
+			return -1;
+		memset(b->fb, 0, b->size);
+		return paint_buf_init(&b->pb, b->fb, x, y, 0, f->fourcc);
+	}
+
+	b->size = (b->size + HUGEPAGE_SZ - 1) & ~(HUGEPAGE_SZ - 1);
+	b->fb = mmap(NULL, b->size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+	if (b->fb != MAP_FAILED)
+		return paint_buf_init(&b->pb, b->fb, x, y, 0, f->fourcc);
+
+	/* No reserved hugetlb pages, ask for transparent hugepages instead */
+	b->fallback = 1;
+	b->fb = mmap(NULL, b->size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b->fb == MAP_FAILED)
+		return -1;
+
+	madvise(b->fb, b->size, MADV_HUGEPAGE);
+	memset(b->fb, 0, b->size);
+	return paint_buf_init(&b->pb, b->fb, x, y, 0, f->fourcc);
+}
+
+static void free_bench_buf(struct bench_buf *b)
+{
+	if (b->shadow.buf.base)
+		paint_shadow_fini(&b->shadow);
+	if (b->comp.target.base)
+		paint_compositor_fini(&b->comp);
+	free(b->yuv.planes[0]);
+	free(b->encoded);
+
+	if (b->kind == BUF_MALLOC)
+		free(b->fb);
+	else
+		munmap(b->fb, b->size);
+}
+
+/* ============ Timing =========== */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+struct bench_result {
+	uint64_t calls;
+	double ns_per_call;
+	double cycles_per_call;
+};
+
+/*
+ * Calibrate the number of calls to fill min_time, then keep the best of
+ * BENCH_REPS batches, which is the least disturbed one.
+ */
+static void run_case(struct bench_case *c, struct bench_buf *b, double min_time_ms,
+		struct bench_result *r)
+{
+	uint64_t t0, t1, c0, c1, calls = 1, i;
+	int rep;
+
+	/* Warm up, fault in pages and caches */
+	c->run(b);
+
+	for (;;) {
+		t0 = now_ns();
+		for (i = 0; i < calls; i++)
+			c->run(b);
+		t1 = now_ns();
+
+		if ((t1 - t0) >= min_time_ms * 1e6 / BENCH_REPS)
+			break;
+		calls *= 2;
+	}
+
+	r->calls = calls;
+	r->ns_per_call = 1e300;
+	for (rep = 0; rep < BENCH_REPS; rep++) {
+		c0 = now_cycles();
+		t0 = now_ns();
+		for (i = 0; i < calls; i++)
+			c->run(b);
+		t1 = now_ns();
+		c1 = now_cycles();
+
+		if ((double)(t1 - t0) / calls < r->ns_per_call) {
+			r->ns_per_call = (double)(t1 - t0) / calls;
+			r->cycles_per_call = (double)(c1 - c0) / calls;
+		}
+	}
+}
+
+/* ============ Reporting =========== */
+
+static void report(struct bench_opts *o, struct bench_case *c, struct bench_res *res,
+		struct bench_buf *b, struct bench_result *r)
+{
+	uint64_t bytes = c->bytes(b);
+	double pixels = (double)bytes / b->cpp;
+	double mpix_s = pixels / r->ns_per_call * 1e3;
+	double gb_s = bytes / r->ns_per_call;
+	double cpp = pixels ? r->cycles_per_call / pixels : 0;
+
+	if (o->json) {
+		printf("{\"build\":\"%s\",\"isa\":\"%s\",\"threads\":%d,\"format\":\"%s\",\"func\":\"%s\",\"buffer\":\"%s\","
+			"\"hugepage_fallback\":%d,\"res\":\"%s\",\"width\":%d,\"height\":%d,"
+			"\"calls\":%llu,\"ns_per_call\":%.1f,\"mpix_s\":%.1f,\"gb_s\":%.3f,"
+			"\"cycles_per_pixel\":%.4f}\n",
+			BUILD_NAME, paint_get_simd_isa(), paint_get_threads(), b->format_name, c->name,
+			buf_kind_names[b->kind], b->fallback, res->name, res->x, res->y,
+			(unsigned long long)r->calls, r->ns_per_call, mpix_s, gb_s, cpp);
+		return;
+	}
+
+	printf("%-12s %-31s %-9s%s %-6s %12.1f %10.1f %8.2f %8.3f\n",
+		BUILD_NAME, c->name, buf_kind_names[b->kind], b->fallback ? "*" : " ",
+		res->name, r->ns_per_call, mpix_s, gb_s, cpp);
+}
+
+/* ============ Golden checksums =========== */
+
+/* Odd sizes, and rows padded with junk which must not count */
+#define GOLDEN_W 643
+#define GOLDEN_H 481
+#define GOLDEN_PAD 72
+/* The zone plate is checked at this frame too, it moves */
+#define GOLDEN_FRAME 5
+
+struct golden {
+	const char *pattern;
+	int frame;
+	const char *format;
+	uint32_t crc;
+};
+
+/* From --print-golden, when a pattern changes on purpose */
+static const struct golden golden[] = {
+	{ "smpte", 0, "xrgb8888", 0xd0aa23e6 },
+	{ "gradient", 0, "xrgb8888", 0xab6eb6ca },
+	{ "checker", 0, "xrgb8888", 0xab87b4f1 },
+	{ "ramps", 0, "xrgb8888", 0x41d20e41 },
+	{ "zoneplate", 0, "xrgb8888", 0xcd07509a },
+	{ "zoneplate", 5, "xrgb8888", 0x5d44e699 },
+	{ "smpte", 0, "argb8888", 0x8fe81e66 },
+	{ "gradient", 0, "argb8888", 0xf42c8b4a },
+	{ "checker", 0, "argb8888", 0xf4c58971 },
+	{ "ramps", 0, "argb8888", 0x1e9033c1 },
+	{ "zoneplate", 0, "argb8888", 0x92456d1a },
+	{ "zoneplate", 5, "argb8888", 0x0206db19 },
+	{ "smpte", 0, "abgr8888", 0xad61cd71 },
+	{ "gradient", 0, "abgr8888", 0xd9f8c844 },
+	{ "checker", 0, "abgr8888", 0xf4c58971 },
+	{ "ramps", 0, "abgr8888", 0x2665661b },
+	{ "zoneplate", 0, "abgr8888", 0x92456d1a },
+	{ "zoneplate", 5, "abgr8888", 0x0206db19 },
+	{ "smpte", 0, "xrgb2101010", 0x109d126f },
+	{ "gradient", 0, "xrgb2101010", 0x3a6f13f5 },
+	{ "checker", 0, "xrgb2101010", 0x29cf6e06 },
+	{ "ramps", 0, "xrgb2101010", 0x0bc961f8 },
+	{ "zoneplate", 0, "xrgb2101010", 0xa9e719c1 },
+	{ "zoneplate", 5, "xrgb2101010", 0x4a1c5005 },
+	{ "smpte", 0, "rgb565", 0xa6701183 },
+	{ "gradient", 0, "rgb565", 0x2116d9f1 },
+	{ "checker", 0, "rgb565", 0xe93e2543 },
+	{ "ramps", 0, "rgb565", 0x822607b4 },
+	{ "zoneplate", 0, "rgb565", 0xba02ea4c },
+	{ "zoneplate", 5, "rgb565", 0x02c1e23e },
+};
+
+static const struct golden *find_golden(const char *pattern, int frame, const char *format)
+{
+	int i;
+
+	for (i = 0; i < sizeof(golden) / sizeof(golden[0]); i++) {
+		if (!strcmp(golden[i].pattern, pattern) && golden[i].frame == frame &&
+			!strcmp(golden[i].format, format))
+			return &golden[i];
+	}
+
+	return NULL;
+}
+
+/* The same pattern, tightly packed and padded, must checksum the same */
+static int pattern_checksum(int pattern, int frame, struct bench_format *f, uint32_t *crc)
+{
+	int cpp = paint_format_cpp(f->fourcc), stride = GOLDEN_W * cpp + GOLDEN_PAD;
+	struct paint_buf tight, padded;
+	char *mem_tight, *mem_padded;
+	int ret = -1;
+
+	mem_tight = malloc((size_t)GOLDEN_W * cpp * GOLDEN_H);
+	mem_padded = malloc((size_t)stride * GOLDEN_H);
+	if (!mem_tight || !mem_padded)
+		goto out;
+
+	memset(mem_padded, 0xa5, (size_t)stride * GOLDEN_H);
+	paint_buf_init(&tight, mem_tight, GOLDEN_W, GOLDEN_H, 0, f->fourcc);
+	paint_buf_init(&padded, mem_padded, GOLDEN_W, GOLDEN_H, stride, f->fourcc);
+	if (paint_pattern(&tight, pattern, frame) || paint_pattern(&padded, pattern, frame))
+		goto out;
+
+	*crc = paint_buf_checksum(&tight);
+	if (*crc != paint_buf_checksum(&padded)) {
+		printf("FAIL %s %s: the row padding changes the checksum\n",
+			paint_pattern_name(pattern), f->name);
+		goto out;
+	}
+
+	ret = 0;
+out:
+	free(mem_tight);
+	free(mem_padded);
+	return ret;
+}
+
+/*
+ * Paint every pattern in every format in plain memory, and compare the
+ * checksums with the golden ones. With print, write the table out instead.
+ */
+static int run_golden(int print)
+{
+	/* CRC32C of 32 zero bytes, the iSCSI test vector */
+	uint32_t zeros[8] = { 0 }, crc;
+	const struct golden *g;
+	struct paint_buf zb;
+	int f, p, frame, failed = 0, checked = 0;
+
+	paint_buf_init(&zb, (char *)zeros, 8, 1, 0, DRM_FORMAT_XRGB8888);
+	if (paint_buf_checksum(&zb) != 0x8a9136aa) {
+		printf("FAIL crc32c: 0x%08x for 32 zero bytes, not 0x8a9136aa\n",
+			paint_buf_checksum(&zb));
+		return -1;
+	}
+
+	for (f = 0; f < sizeof(bench_formats) / sizeof(bench_formats[0]); f++) {
+		for (p = 0; p < PAINT_PATTERN_MAX; p++) {
+			for (frame = 0; frame <= GOLDEN_FRAME; frame += GOLDEN_FRAME) {
+				if (frame && p != PAINT_PATTERN_ZONEPLATE)
+					continue;
+
+				if (pattern_checksum(p, frame, &bench_formats[f], &crc)) {
+					failed++;
+					continue;
+				}
+
+				if (print) {
+					printf("\t{ \"%s\", %d, \"%s\", 0x%08x },\n", paint_pattern_name(p),
+						frame, bench_formats[f].name, crc);
+					continue;
+				}
+
+				checked++;
+				g = find_golden(paint_pattern_name(p), frame, bench_formats[f].name);
+				if (!g) {
+					printf("FAIL %s frame %d %s: no golden checksum\n",
+						paint_pattern_name(p), frame, bench_formats[f].name);
+					failed++;
+				} else if (g->crc != crc) {
+					printf("FAIL %s frame %d %s: crc32c 0x%08x, golden 0x%08x\n",
+						paint_pattern_name(p), frame, bench_formats[f].name, crc, g->crc);
+					failed++;
+				}
+			}
+		}
+	}
+
+	if (!print)
+		printf("Golden checksums (isa %s, %d threads): %d checked, %d failed\n",
+			paint_get_simd_isa(), paint_get_threads(), checked, failed);
+	return failed ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options]\n", prog);
+	printf("  -j, --json            one JSON object per result line\n");
+	printf("  -t, --min-time=MS     time budget per case (default 200)\n");
+	printf("  -r, --res=NAME        only run this resolution (720p ... 8k)\n");
+	printf("  -f, --func=NAME       only run this function\n");
+	printf("  -n, --no-hugepages    skip the hugepage backed buffers\n");
+	printf("  -F, --format=NAME     xrgb8888 (default), argb8888, abgr8888,\n");
+	printf("                        xrgb2101010 or rgb565\n");
+	printf("  -T, --threads=N       paint worker threads (default: all CPUs)\n");
+	printf("  -g, --golden          check the test patterns against the golden checksums\n");
+	printf("  -G, --print-golden    print the golden checksum table\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "json", no_argument, NULL, 'j' },
+		{ "min-time", required_argument, NULL, 't' },
+		{ "res", required_argument, NULL, 'r' },
+		{ "func", required_argument, NULL, 'f' },
+		{ "no-hugepages", no_argument, NULL, 'n' },
+		{ "threads", required_argument, NULL, 'T' },
+		{ "format", required_argument, NULL, 'F' },
+		{ "golden", no_argument, NULL, 'g' },
+		{ "print-golden", no_argument, NULL, 'G' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	struct bench_opts o = { .min_time_ms = 200, .format = &bench_formats[0] };
+	struct bench_result r;
+	struct bench_buf b;
+	int i, k, c, opt, golden_mode = 0, ret;
+
+	while ((opt = getopt_long(argc, argv, "jt:r:f:nT:F:gGh", long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'j':
+			o.json = 1;
+			break;
+		case 't':
+			o.min_time_ms = atof(optarg);
+			break;
+		case 'r':
+			o.res_filter = optarg;
+			break;
+		case 'f':
+			o.func_filter = optarg;
+			break;
+		case 'n':
+			o.no_hugepages = 1;
+			break;
+		case 'T':
+			o.threads = atoi(optarg);
+			break;
+		case 'F':
+			for (i = 0; i < sizeof(bench_formats) / sizeof(bench_formats[0]); i++) {
+				if (!strcmp(optarg, bench_formats[i].name))
+					o.format = &bench_formats[i];
+			}
+			if (strcmp(optarg, o.format->name)) {
+				printf("Unknown format %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'g':
+			golden_mode = 1;
+			break;
+		case 'G':
+			golden_mode = 2;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : -1;
+		}
+	}
+
+	init_clr_hash(color_max, clr_val);
+	if (paint_set_threads(o.threads))
+		return -1;
+
+	if (golden_mode) {
+		ret = run_golden(golden_mode == 2);
+		paint_pattern_cache_clear();
+		return ret ? 1 : 0;
+	}
+
+	if (!o.json) {
+		printf("libpaint bench, build %s, isa %s, %d threads, %s (* = no hugetlb pages, THP used)\n",
+			BUILD_NAME, paint_get_simd_isa(), paint_get_threads(), o.format->name);
+		printf("%-12s %-31s %-10s %-6s %12s %10s %8s %8s\n", "build", "function",
+			"buffer", "res", "ns/call", "MPix/s", "GB/s", "cyc/pix");
+	}
+
+	for (i = 0; i < sizeof(resolutions) / sizeof(resolutions[0]); i++) {
+		if (o.res_filter && strcmp(o.res_filter, resolutions[i].name))
+			continue;
+
+		for (k = 0; k < BUF_KIND_MAX; k++) {
+			if (k == BUF_HUGEPAGE && o.no_hugepages)
+				continue;
+
+			if (alloc_bench_buf(&b, k, resolutions[i].x, resolutions[i].y, o.format)) {
+				printf("Failed to allocate %s buffer for %s\n",
+					buf_kind_names[k], resolutions[i].name);
+				continue;
+			}
+
+			for (c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+				if (o.func_filter && strcmp(o.func_filter, cases[c].name))
+					continue;
+				if (cases[c].argb_only && b.pb.format != DRM_FORMAT_XRGB8888 &&
+					b.pb.format != DRM_FORMAT_ARGB8888)
+					continue;
+
+				run_case(&cases[c], &b, o.min_time_ms, &r);
+				report(&o, &cases[c], &resolutions[i], &b, &r);
+			}
+
+			free_bench_buf(&b);
+		}
+	}
+
+	delete_clr_hash(0);
+	paint_pattern_cache_clear();
+	return 0;
+}
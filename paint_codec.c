@@ -0,0 +1,447 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Lossless frame coding, after QOI: each pixel is a run of the previous
+ * one, an index into a table of 64 recently seen pixels, a small delta to
+ * the previous one, or else the bytes themselves. The 4 bytes of a pixel
+ * are coded as they are, whatever they mean in the format, with the one
+ * in the middle of the low 3 as the base of the luma deltas (green, in
+ * all the 8 bit formats). The top byte (alpha or X) is expected to stay
+ * the same, and costs a whole pixel when it changes.
+ *
+ * Rows go in chunks which are coded independently, from the same starting
+ * state, so that they can be coded and decoded on all the paint workers.
+ * A frame is a header, the size of each chunk, then the chunks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "paint.h"
+#include "paint_simd.h"
+#include "paint_thread.h"
+
+/* "PQF1" */
+#define CODEC_MAGIC ('P' | 'Q' << 8 | 'F' << 16 | (uint32_t)'1' << 24)
+/* Rows in a chunk, whatever the number of workers so that the output is too */
+#define CODEC_CHUNK_ROWS 16
+/* Sizes of a frame stay in 32 bits */
+#define CODEC_MAX_DIM 16384
+
+/* Ops: the top 2 bits, or all 8 for the whole pixel ones */
+#define OP_INDEX 0x00
+#define OP_DIFF 0x40
+#define OP_LUMA 0x80
+#define OP_RUN 0xc0
+#define OP_RGB 0xfe
+#define OP_RGBA 0xff
+#define OP_MASK 0xc0
+/* 63 and 64 would be OP_RGB and OP_RGBA */
+#define RUN_MAX 62
+/* The most a pixel can take, as OP_RGBA */
+#define PIXEL_MAX_BYTES 5
+
+struct codec_header {
+	uint32_t magic;
+	/* The whole frame, this header included */
+	uint32_t size;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	/* CRC32C of the pixels, as paint_view_checksum() */
+	uint32_t checksum;
+	uint32_t chunk_rows;
+	uint32_t reserved;
+};
+
+static int num_chunks(int height)
+{
+	return (height + CODEC_CHUNK_ROWS - 1) / CODEC_CHUNK_ROWS;
+}
+
+static size_t chunk_bound(int width)
+{
+	return (size_t)width * CODEC_CHUNK_ROWS * PIXEL_MAX_BYTES;
+}
+
+static int codec_format(uint32_t format)
+{
+	return paint_format_cpp(format) == 4;
+}
+
+static inline uint32_t pixel_hash(uint32_t px)
+{
+	return (px * 0x9e3779b1u) >> 26;
+}
+
+/* Byte i of px minus byte i of prev, wrapping around */
+static inline int byte_delta(uint32_t px, uint32_t prev, int i)
+{
+	return (int8_t)((px >> (i * 8)) - (prev >> (i * 8)));
+}
+
+static inline uint32_t add_bytes(uint32_t prev, int d0, int d1, int d2)
+{
+	return (prev & 0xff000000) | ((prev + d0) & 0xff) |
+		(((prev >> 8) + d1) & 0xff) << 8 | (((prev >> 16) + d2) & 0xff) << 16;
+}
+
+/* ============ Encoding =========== */
+
+static uint8_t *put_run(uint8_t *p, size_t run)
+{
+	for (; run >= RUN_MAX; run -= RUN_MAX)
+		*p++ = OP_RUN | (RUN_MAX - 1);
+	if (run)
+		*p++ = OP_RUN | (run - 1);
+
+	return p;
+}
+
+static uint8_t *put_pixel(uint8_t *p, uint32_t *index, uint32_t px, uint32_t prev)
+{
+	uint32_t h = pixel_hash(px);
+	int d0, d1, d2;
+
+	if (index[h] == px) {
+		*p++ = OP_INDEX | h;
+		return p;
+	}
+	index[h] = px;
+
+	if ((px ^ prev) >> 24) {
+		*p++ = OP_RGBA;
+		memcpy(p, &px, 4);
+		return p + 4;
+	}
+
+	/* Biased to start at 0, so that one compare checks a range, or three of them */
+	d0 = byte_delta(px, prev, 0) + 2;
+	d1 = byte_delta(px, prev, 1) + 2;
+	d2 = byte_delta(px, prev, 2) + 2;
+	if ((unsigned int)(d0 | d1 | d2) < 4) {
+		*p++ = OP_DIFF | d2 << 4 | d1 << 2 | d0;
+	} else if ((unsigned int)(d1 + 30) < 64 &&
+		(unsigned int)((d2 - d1 + 8) | (d0 - d1 + 8)) < 16) {
+		*p++ = OP_LUMA | (d1 + 30);
+		*p++ = (d2 - d1 + 8) << 4 | (d0 - d1 + 8);
+	} else {
+		*p++ = OP_RGB;
+		*p++ = px;
+		*p++ = px >> 8;
+		*p++ = px >> 16;
+	}
+
+	return p;
+}
+
+/* Rows [y0, y1) of src into out, returns the bytes written */
+static size_t encode_chunk(uint8_t *out, const struct paint_view *src, int y0, int y1)
+{
+	uint32_t index[64] = { 0, };
+	uint32_t prev = 0xff000000;
+	const uint32_t *row;
+	uint8_t *p = out;
+	size_t run = 0, n;
+	int x, y;
+
+	for (y = y0; y < y1; y++) {
+		row = (const uint32_t *)(src->base + (long)y * src->stride);
+		for (x = 0; x < src->width; ) {
+			/* Runs go on over the end of the row, flat areas are mostly runs */
+			if (row[x] == prev) {
+				/* Mostly short, a call is only worth it past a few pixels */
+				for (n = x++; x < src->width && x - n < 8 && row[x] == prev; x++)
+					;
+				if (x - n == 8)
+					x += paint_span32(row + x, prev, src->width - x);
+				run += x - n;
+				continue;
+			}
+
+			p = put_run(p, run);
+			run = 0;
+			p = put_pixel(p, index, row[x], prev);
+			prev = row[x++];
+		}
+	}
+
+	return put_run(p, run) - out;
+}
+
+struct encode_chunks {
+	const struct paint_view *src;
+	uint8_t *data;
+	uint32_t *sizes;
+	size_t bound;
+};
+
+static void encode_chunks_band(void *arg, int c0, int c1)
+{
+	struct encode_chunks *e = arg;
+	int c, y0;
+
+	for (c = c0; c < c1; c++) {
+		y0 = c * CODEC_CHUNK_ROWS;
+		e->sizes[c] = encode_chunk(e->data + c * e->bound, e->src, y0,
+				y0 + CODEC_CHUNK_ROWS < e->src->height ?
+				y0 + CODEC_CHUNK_ROWS : e->src->height);
+	}
+}
+
+long paint_encode_bound(int width, int height)
+{
+	if (width <= 0 || height <= 0 || width > CODEC_MAX_DIM || height > CODEC_MAX_DIM)
+		return -1;
+
+	return sizeof(struct codec_header) + num_chunks(height) * (sizeof(uint32_t) +
+			chunk_bound(width));
+}
+
+long paint_encode(void *out, size_t size, const struct paint_view *src)
+{
+	struct codec_header *hdr = out;
+	long bound = paint_encode_bound(src->width, src->height);
+	struct encode_chunks e;
+	int c, chunks = num_chunks(src->height);
+	uint8_t *p;
+
+	if (!src->base || !codec_format(src->format) || bound < 0) {
+		printf("Can't encode a %dx%d frame of format 0x%x\n", src->width,
+				src->height, src->format);
+		return -1;
+	}
+
+	if (size < (size_t)bound) {
+		printf("Frame encoding needs %ld bytes, not %zu\n", bound, size);
+		return -1;
+	}
+
+	/* Each chunk gets the room for the worst case, then they're packed */
+	e.src = src;
+	e.sizes = (uint32_t *)(hdr + 1);
+	e.data = (uint8_t *)(e.sizes + chunks);
+	e.bound = chunk_bound(src->width);
+	paint_run_bands(chunks, src->width * CODEC_CHUNK_ROWS * 4, encode_chunks_band, &e);
+
+	p = e.data + e.sizes[0];
+	for (c = 1; c < chunks; c++) {
+		memmove(p, e.data + c * e.bound, e.sizes[c]);
+		p += e.sizes[c];
+	}
+
+	hdr->magic = CODEC_MAGIC;
+	hdr->size = p - (uint8_t *)out;
+	hdr->format = src->format;
+	hdr->width = src->width;
+	hdr->height = src->height;
+	hdr->checksum = paint_view_checksum(src);
+	hdr->chunk_rows = CODEC_CHUNK_ROWS;
+	hdr->reserved = 0;
+	return hdr->size;
+}
+
+/* ============ Decoding =========== */
+
+int paint_decode_info(const void *in, size_t size, struct paint_frame_info *info)
+{
+	struct codec_header hdr;
+
+	if (size < sizeof(hdr))
+		return -1;
+
+	memcpy(&hdr, in, sizeof(hdr));
+	if (hdr.magic != CODEC_MAGIC || hdr.chunk_rows != CODEC_CHUNK_ROWS ||
+		!codec_format(hdr.format) || !hdr.width || !hdr.height ||
+		hdr.width > CODEC_MAX_DIM || hdr.height > CODEC_MAX_DIM ||
+		hdr.size > size || hdr.size < sizeof(hdr) + num_chunks(hdr.height) * sizeof(uint32_t))
+		return -1;
+
+	info->width = hdr.width;
+	info->height = hdr.height;
+	info->format = hdr.format;
+	info->checksum = hdr.checksum;
+	info->size = hdr.size;
+	return 0;
+}
+
+/* A chunk has to come out to exactly its rows, or it's corrupt */
+static int decode_chunk(const struct paint_view *dst, const uint8_t *in, size_t size,
+		int y0, int y1, int width)
+{
+	const uint8_t *p = in, *end = in + size;
+	uint32_t index[64] = { 0, };
+	uint32_t prev = 0xff000000, px;
+	uint32_t *row;
+	size_t run = 0, n;
+	int x, y, d;
+	uint8_t op;
+
+	for (y = y0; y < y1; y++) {
+		row = (uint32_t *)(dst->base + (long)y * dst->stride);
+		for (x = 0; x < width; ) {
+			if (run) {
+				n = run < (size_t)(width - x) ? run : (size_t)(width - x);
+				paint_fill32(row + x, prev, n);
+				run -= n;
+				x += n;
+				continue;
+			}
+
+			if (p >= end)
+				return -1;
+
+			op = *p++;
+			if (op == OP_RGB) {
+				if (end - p < 3)
+					return -1;
+				px = (prev & 0xff000000) | p[0] | p[1] << 8 | p[2] << 16;
+				p += 3;
+			} else if (op == OP_RGBA) {
+				if (end - p < 4)
+					return -1;
+				memcpy(&px, p, 4);
+				p += 4;
+			} else if ((op & OP_MASK) == OP_INDEX) {
+				px = index[op];
+			} else if ((op & OP_MASK) == OP_DIFF) {
+				px = add_bytes(prev, (op & 3) - 2, (op >> 2 & 3) - 2, (op >> 4 & 3) - 2);
+			} else if ((op & OP_MASK) == OP_LUMA) {
+				if (p >= end)
+					return -1;
+				d = (op & 0x3f) - 32;
+				px = add_bytes(prev, d + (*p & 0xf) - 8, d, d + (*p >> 4) - 8);
+				p++;
+			} else {
+				run = (op & 0x3f) + 1;
+				continue;
+			}
+
+			index[pixel_hash(px)] = px;
+			row[x++] = prev = px;
+		}
+	}
+
+	return run || p != end ? -1 : 0;
+}
+
+struct decode_chunks {
+	const struct paint_view *dst;
+	const uint8_t *data;
+	/* Where each chunk starts in data, and where the last one ends */
+	size_t *offsets;
+	int width;
+	int height;
+	/* Set to 1 by the chunks which don't decode */
+	int *bad;
+};
+
+static void decode_chunks_band(void *arg, int c0, int c1)
+{
+	struct decode_chunks *d = arg;
+	int c, y0;
+
+	for (c = c0; c < c1; c++) {
+		y0 = c * CODEC_CHUNK_ROWS;
+		d->bad[c] = decode_chunk(d->dst, d->data + d->offsets[c],
+				d->offsets[c + 1] - d->offsets[c], y0,
+				y0 + CODEC_CHUNK_ROWS < d->height ? y0 + CODEC_CHUNK_ROWS : d->height,
+				d->width) < 0;
+	}
+}
+
+int paint_decode(const struct paint_view *dst, const void *in, size_t size)
+{
+	struct paint_frame_info info;
+	struct paint_view frame;
+	struct decode_chunks d;
+	const uint8_t *sizes;
+	size_t offset = 0;
+	uint32_t chunk_size;
+	int c, chunks, ret = 0;
+
+	if (paint_decode_info(in, size, &info)) {
+		printf("Not a frame libpaint encoded, or a truncated one\n");
+		return -1;
+	}
+
+	if (!dst->base || dst->format != info.format || dst->width < info.width ||
+		dst->height < info.height) {
+		printf("Can't decode a %dx%d frame of format 0x%x into %dx%d of 0x%x\n",
+				info.width, info.height, info.format, dst->width, dst->height,
+				dst->format);
+		return -1;
+	}
+
+	chunks = num_chunks(info.height);
+	d.dst = dst;
+	/* Frames in a stream follow each other with no padding, nothing is aligned */
+	sizes = (const uint8_t *)in + sizeof(struct codec_header);
+	d.data = sizes + chunks * sizeof(uint32_t);
+	d.width = info.width;
+	d.height = info.height;
+	d.offsets = malloc((chunks + 1) * sizeof(*d.offsets) + chunks * sizeof(*d.bad));
+	if (!d.offsets) {
+		printf("Out of memory to decode %d chunks\n", chunks);
+		return -1;
+	}
+	d.bad = (int *)(d.offsets + chunks + 1);
+
+	for (c = 0; c < chunks; c++) {
+		d.offsets[c] = offset;
+		memcpy(&chunk_size, sizes + c * sizeof(uint32_t), sizeof(chunk_size));
+		offset += chunk_size;
+	}
+	d.offsets[chunks] = offset;
+
+	if (offset != info.size - (d.data - (const uint8_t *)in)) {
+		printf("Frame chunks don't add up to its size\n");
+		free(d.offsets);
+		return -1;
+	}
+
+	paint_run_bands(chunks, info.width * CODEC_CHUNK_ROWS * 4, decode_chunks_band, &d);
+
+	for (c = 0; c < chunks; c++)
+		ret |= d.bad[c];
+	free(d.offsets);
+	if (ret) {
+		printf("Corrupt frame, it doesn't decode\n");
+		return -1;
+	}
+
+	/* Decoding right doesn't mean it's the frame which was encoded */
+	frame = *dst;
+	frame.width = info.width;
+	frame.height = info.height;
+	if (paint_view_checksum(&frame) != info.checksum) {
+		printf("Decoded frame doesn't match its checksum\n");
+		return -1;
+	}
+
+	if (dst->damage)
+		paint_damage_add(dst->damage, dst->x, dst->y, info.width, info.height);
+
+	return 0;
+}
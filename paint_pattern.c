@@ -0,0 +1,438 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Test patterns. Most of them are a handful of distinct rows: those are
+ * built once per resolution and format, and painting the pattern is then
+ * just streaming the right template into each row. The zone plate differs
+ * in every row, it keeps the phase of each pixel instead and looks the
+ * pixels up for the frame with a SIMD kernel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "paint.h"
+#include "paint_simd.h"
+#include "paint_thread.h"
+
+/* Patterns of the recent resolutions and formats, most recently used first */
+#define PATTERN_CACHE_MAX 8
+
+#define CHECKER_SIZE 64
+/* Zone plate phase added per frame, out of 256 for a whole period */
+#define ZONE_SPEED 8
+
+struct pattern_cache {
+	enum paint_pattern pattern;
+	int width;
+	int height;
+	uint32_t format;
+	int cpp;
+	/* Template rows, packed for the format, row_bytes apart */
+	char *rows;
+	int row_bytes;
+	/* Template of each row */
+	uint16_t *row_map;
+	/* Zone plate: phase of each pixel, and the 256 gray levels packed */
+	uint8_t *phase;
+	uint32_t lut[256];
+	struct pattern_cache *next;
+};
+
+static struct pattern_cache *cache;
+
+static const char *pattern_names[PAINT_PATTERN_MAX] = {
+	[PAINT_PATTERN_SMPTE] = "smpte",
+	[PAINT_PATTERN_GRADIENT] = "gradient",
+	[PAINT_PATTERN_CHECKER] = "checker",
+	[PAINT_PATTERN_RAMPS] = "ramps",
+	[PAINT_PATTERN_ZONEPLATE] = "zoneplate",
+};
+
+/* ============ Template rows, as XRGB8888 =========== */
+
+static void fill_span(uint32_t *row, int x0, int x1, uint32_t color)
+{
+	if (x1 > x0)
+		paint_fill32(row + x0, color, x1 - x0);
+}
+
+/* SMPTE ECR 1-1978 color bars, 75% */
+static const uint32_t smpte_top[7] = {
+	0xc0c0c0, 0xc0c000, 0x00c0c0, 0x00c000, 0xc000c0, 0xc00000, 0x0000c0,
+};
+
+static const uint32_t smpte_middle[7] = {
+	0x0000c0, 0x131313, 0xc000c0, 0x131313, 0x00c0c0, 0x131313, 0xc0c0c0,
+};
+
+/* -I, white, +Q, black over 5/4 of a bar each, then PLUGE and black */
+static const uint32_t smpte_bottom[8] = {
+	0x00214c, 0xffffff, 0x32006a, 0x131313, 0x090909, 0x131313, 0x1d1d1d, 0x131313,
+};
+
+static int smpte_rows(uint32_t *xrgb, uint16_t *row_map, int w, int h)
+{
+	/* Edges of the bottom row, in 1/84ths of the width */
+	static const int bottom_x[9] = { 0, 15, 30, 45, 60, 64, 68, 72, 84 };
+	int i, y;
+
+	for (i = 0; i < 7; i++) {
+		fill_span(xrgb, i * w / 7, (i + 1) * w / 7, smpte_top[i]);
+		fill_span(xrgb + w, i * w / 7, (i + 1) * w / 7, smpte_middle[i]);
+	}
+
+	for (i = 0; i < 8; i++)
+		fill_span(xrgb + 2 * w, bottom_x[i] * w / 84, bottom_x[i + 1] * w / 84, smpte_bottom[i]);
+
+	for (y = 0; y < h; y++)
+		row_map[y] = y < h * 2 / 3 ? 0 : y < h * 3 / 4 ? 1 : 2;
+
+	return 3;
+}
+
+static uint32_t gray(int level)
+{
+	return (uint32_t)level * 0x010101;
+}
+
+/* Fully saturated hue h out of 6 * 256, red to red */
+static uint32_t hue(int h)
+{
+	int ramp = h & 255;
+
+	switch (h >> 8) {
+	case 0: return 0xff0000 | ramp << 8;
+	case 1: return (255 - ramp) << 16 | 0x00ff00;
+	case 2: return 0x00ff00 | ramp;
+	case 3: return (255 - ramp) << 8 | 0x0000ff;
+	case 4: return ramp << 16 | 0x0000ff;
+	default: return 0xff0000 | (255 - ramp);
+	}
+}
+
+/* Black to white over the top half, through all the hues below */
+static int gradient_rows(uint32_t *xrgb, uint16_t *row_map, int w, int h)
+{
+	int x, y, div = w > 1 ? w - 1 : 1;
+
+	for (x = 0; x < w; x++) {
+		xrgb[x] = gray(x * 255 / div);
+		xrgb[w + x] = hue((int)((long)x * (6 * 256 - 1) / div));
+	}
+
+	for (y = 0; y < h; y++)
+		row_map[y] = y >= h / 2;
+
+	return 2;
+}
+
+static int checker_rows(uint32_t *xrgb, uint16_t *row_map, int w, int h)
+{
+	int x, y;
+
+	for (x = 0; x < w; x += CHECKER_SIZE) {
+		fill_span(xrgb, x, x + CHECKER_SIZE < w ? x + CHECKER_SIZE : w,
+				(x / CHECKER_SIZE) & 1 ? 0 : 0xffffff);
+		fill_span(xrgb + w, x, x + CHECKER_SIZE < w ? x + CHECKER_SIZE : w,
+				(x / CHECKER_SIZE) & 1 ? 0xffffff : 0);
+	}
+
+	for (y = 0; y < h; y++)
+		row_map[y] = (y / CHECKER_SIZE) & 1;
+
+	return 2;
+}
+
+/* Red, green, blue and gray ramps in bands, all 256 levels of each */
+static int ramps_rows(uint32_t *xrgb, uint16_t *row_map, int w, int h)
+{
+	static const uint32_t channels[4] = { 0x010000, 0x000100, 0x000001, 0x010101 };
+	int i, x, y, div = w > 1 ? w - 1 : 1;
+
+	for (i = 0; i < 4; i++) {
+		for (x = 0; x < w; x++)
+			xrgb[i * w + x] = (uint32_t)(x * 255 / div) * channels[i];
+	}
+
+	for (y = 0; y < h; y++)
+		row_map[y] = y * 4 / h;
+
+	return 4;
+}
+
+typedef int (*pattern_rows_fn)(uint32_t *xrgb, uint16_t *row_map, int w, int h);
+
+/* The most template rows any of these make */
+#define PATTERN_MAX_ROWS 4
+
+static const pattern_rows_fn pattern_rows[PAINT_PATTERN_MAX] = {
+	[PAINT_PATTERN_SMPTE] = smpte_rows,
+	[PAINT_PATTERN_GRADIENT] = gradient_rows,
+	[PAINT_PATTERN_CHECKER] = checker_rows,
+	[PAINT_PATTERN_RAMPS] = ramps_rows,
+};
+
+/* ============ Building the cache entries =========== */
+
+/* Pack XRGB8888 rows for the entry's format, with a blit that converts */
+static int pack_rows(const struct pattern_cache *pc, char *packed, int stride,
+		uint32_t *xrgb, int w, int rows)
+{
+	struct paint_buf src_buf, dst_buf;
+	struct paint_view src, dst;
+
+	if (paint_buf_init(&src_buf, (char *)xrgb, w, rows, 0, DRM_FORMAT_XRGB8888) ||
+		paint_buf_init(&dst_buf, packed, w, rows, stride, pc->format) ||
+		paint_view_init(&src, &src_buf, 0, 0, w, rows) ||
+		paint_view_init(&dst, &dst_buf, 0, 0, w, rows))
+		return -1;
+
+	return paint_blit(&dst, &src);
+}
+
+static int build_templates(struct pattern_cache *pc)
+{
+	uint32_t *xrgb;
+	int rows, ret = -1;
+
+	xrgb = calloc((size_t)pc->width * PATTERN_MAX_ROWS, sizeof(*xrgb));
+	pc->row_map = malloc(pc->height * sizeof(*pc->row_map));
+	pc->row_bytes = (pc->width * pc->cpp + 63) & ~63;
+	if (!xrgb || !pc->row_map ||
+		posix_memalign((void **)&pc->rows, 64, (size_t)pc->row_bytes * PATTERN_MAX_ROWS))
+		goto out;
+
+	rows = pattern_rows[pc->pattern](xrgb, pc->row_map, pc->width, pc->height);
+	ret = pack_rows(pc, pc->rows, pc->row_bytes, xrgb, pc->width, rows);
+
+out:
+	free(xrgb);
+	return ret;
+}
+
+/*
+ * cos(k * r^2) with r from the center, k such that the rings get to one
+ * per two pixels at the left and right edges. In 1/256ths of a period,
+ * that is r^2 * 64 / (w / 2).
+ */
+static int build_zoneplate(struct pattern_cache *pc)
+{
+	int w = pc->width, h = pc->height, r_max = w / 2 > 0 ? w / 2 : 1;
+	uint32_t xrgb[256], packed[256];
+	uint8_t *phase;
+	long dx, dy;
+	int i, x, y;
+
+	pc->phase = malloc((size_t)w * h);
+	if (!pc->phase)
+		return -1;
+
+	for (y = 0, phase = pc->phase; y < h; y++) {
+		dy = y - h / 2;
+		for (x = 0; x < w; x++) {
+			dx = x - w / 2;
+			*phase++ = (uint8_t)((dx * dx + dy * dy) * 64 / r_max);
+		}
+	}
+
+	for (i = 0; i < 256; i++)
+		xrgb[i] = gray((int)lround(127.5 + 127.5 * cos(M_PI * i / 128)));
+
+	if (pack_rows(pc, (char *)packed, 0, xrgb, 256, 1))
+		return -1;
+
+	for (i = 0; i < 256; i++)
+		pc->lut[i] = pc->cpp == 2 ? ((uint16_t *)packed)[i] : packed[i];
+
+	return 0;
+}
+
+static void free_entry(struct pattern_cache *pc)
+{
+	free(pc->rows);
+	free(pc->row_map);
+	free(pc->phase);
+	free(pc);
+}
+
+static struct pattern_cache *get_entry(enum paint_pattern pattern, int w, int h, uint32_t format)
+{
+	struct pattern_cache **p, *pc;
+	int n = 0;
+
+	for (p = &cache; *p; p = &(*p)->next, n++) {
+		pc = *p;
+		if (pc->pattern != pattern || pc->width != w || pc->height != h ||
+			pc->format != format)
+			continue;
+
+		/* To the front, it's the most recently used now */
+		*p = pc->next;
+		pc->next = cache;
+		cache = pc;
+		return pc;
+	}
+
+	pc = calloc(1, sizeof(*pc));
+	if (!pc)
+		return NULL;
+
+	pc->pattern = pattern;
+	pc->width = w;
+	pc->height = h;
+	pc->format = format;
+	pc->cpp = paint_format_cpp(format);
+
+	if (pattern == PAINT_PATTERN_ZONEPLATE ? build_zoneplate(pc) : build_templates(pc)) {
+		printf("Failed to build the %dx%d %s pattern\n", w, h, pattern_names[pattern]);
+		free_entry(pc);
+		return NULL;
+	}
+
+	pc->next = cache;
+	cache = pc;
+
+	/* And the least recently used one goes, if there are too many */
+	if (n >= PATTERN_CACHE_MAX) {
+		for (p = &cache; (*p)->next; p = &(*p)->next)
+			;
+		free_entry(*p);
+		*p = NULL;
+	}
+
+	return pc;
+}
+
+/* ============ Painting =========== */
+
+struct pattern_rows {
+	const struct pattern_cache *pc;
+	char *base;
+	int stride;
+	/* Zone plate: gray levels for the frame */
+	uint32_t lut[256];
+};
+
+static void template_rows_band(void *arg, int y0, int y1)
+{
+	struct pattern_rows *p = arg;
+	const struct pattern_cache *pc = p->pc;
+	int y;
+
+	for (y = y0; y < y1; y++)
+		paint_copy_nt(p->base + (long)y * p->stride,
+				pc->rows + pc->row_map[y] * pc->row_bytes, (size_t)pc->width * pc->cpp);
+
+	paint_stream_fence();
+}
+
+static void zoneplate_rows_band(void *arg, int y0, int y1)
+{
+	struct pattern_rows *p = arg;
+	const struct pattern_cache *pc = p->pc;
+	const uint8_t *phase;
+	uint16_t *dst;
+	int x, y;
+
+	for (y = y0; y < y1; y++) {
+		phase = pc->phase + (long)y * pc->width;
+		if (pc->cpp == 4) {
+			paint_lookup32((uint32_t *)(p->base + (long)y * p->stride), phase,
+					p->lut, pc->width);
+			continue;
+		}
+
+		dst = (uint16_t *)(p->base + (long)y * p->stride);
+		for (x = 0; x < pc->width; x++)
+			dst[x] = p->lut[phase[x]];
+	}
+}
+
+int paint_pattern(struct paint_buf *buf, enum paint_pattern pattern, int frame)
+{
+	struct pattern_cache *pc;
+	struct pattern_rows p;
+	int i;
+
+	if (!buf || !buf->base || buf->width <= 0 || buf->height <= 0 ||
+		!paint_format_cpp(buf->format) || pattern < 0 || pattern >= PAINT_PATTERN_MAX) {
+		printf("Invalid input, can't paint a pattern\n");
+		return -1;
+	}
+
+	pc = get_entry(pattern, buf->width, buf->height, buf->format);
+	if (!pc)
+		return -1;
+
+	p.pc = pc;
+	p.base = buf->base;
+	p.stride = buf->stride;
+
+	if (pattern == PAINT_PATTERN_ZONEPLATE) {
+		/* Moving the rings is rotating the gray levels */
+		for (i = 0; i < 256; i++)
+			p.lut[i] = pc->lut[(i + frame * ZONE_SPEED) & 255];
+		paint_run_bands(buf->height, buf->width * pc->cpp, zoneplate_rows_band, &p);
+	} else {
+		paint_run_bands(buf->height, buf->width * pc->cpp, template_rows_band, &p);
+	}
+
+	if (buf->damage)
+		paint_damage_add(buf->damage, 0, 0, buf->width, buf->height);
+
+	return 0;
+}
+
+const char *paint_pattern_name(enum paint_pattern pattern)
+{
+	if (pattern < 0 || pattern >= PAINT_PATTERN_MAX)
+		return NULL;
+
+	return pattern_names[pattern];
+}
+
+int paint_pattern_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < PAINT_PATTERN_MAX; i++) {
+		if (!strcmp(name, pattern_names[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+void paint_pattern_cache_clear(void)
+{
+	struct pattern_cache *pc;
+
+	while (cache) {
+		pc = cache;
+		cache = pc->next;
+		free_entry(pc);
+	}
+}
@@ -0,0 +1,349 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Scaling: every output pixel is a weighted sum of the source pixels
+ * around where it lands, along x and then along y. The weights, and where
+ * each window starts, depend only on the sizes, so they're worked out once
+ * into a table per axis. Each output row is the vertical pass over the
+ * source rows its window covers, into a row of source width which stays
+ * in the cache, and then the horizontal pass over that.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "paint.h"
+#include "paint_simd.h"
+#include "paint_thread.h"
+
+static const char *filter_names[PAINT_SCALE_MAX] = {
+	[PAINT_SCALE_NEAREST] = "nearest",
+	[PAINT_SCALE_BILINEAR] = "bilinear",
+	[PAINT_SCALE_LANCZOS] = "lanczos",
+};
+
+/* ============ Coefficient tables =========== */
+
+/*
+ * Output pixel i of an axis is the sum of taps input pixels from start[i]
+ * on, coef[i * taps] being the first's weight. Windows which would run off
+ * the end are moved back in, with zeros for the weights they gained.
+ */
+struct scale_axis {
+	int taps;
+	int32_t *start;
+	int16_t *coef;
+};
+
+static double filter_bilinear(double x)
+{
+	x = fabs(x);
+	return x < 1 ? 1 - x : 0;
+}
+
+static double sinc(double x)
+{
+	return x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+}
+
+static double filter_lanczos(double x)
+{
+	return fabs(x) < 3 ? sinc(x) * sinc(x / 3) : 0;
+}
+
+/* How far out from an output pixel's center its weights go, in input pixels */
+static double filter_support(enum paint_scale_filter filter, double scale)
+{
+	/* Shrinking, Lanczos widens to take in all the pixels in between */
+	if (filter == PAINT_SCALE_LANCZOS)
+		return 3 * (scale > 1 ? scale : 1);
+
+	return 1;
+}
+
+/*
+ * Weights of out pixel i, in w from input pixel *first on, f being room for
+ * the unrounded ones. Returns how many, the weights rounded to fixed point
+ * and adding up to exactly 1, so that flat colors come out unchanged.
+ */
+static int axis_weights(int in, int out, int i, enum paint_scale_filter filter,
+		int *first, int16_t *w, double *f)
+{
+	double scale = (double)in / out;
+	double support = filter_support(filter, scale);
+	double widen = filter == PAINT_SCALE_LANCZOS && scale > 1 ? scale : 1;
+	double center = (i + 0.5) * scale;
+	double total = 0;
+	int x0, x1, x, n, sum = 0, big = 0;
+
+	x0 = (int)ceil(center - support - 0.5);
+	x1 = (int)floor(center + support - 0.5);
+	if (x0 < 0)
+		x0 = 0;
+	if (x1 > in - 1)
+		x1 = in - 1;
+
+	for (x = x0, n = 0; x <= x1; x++, n++) {
+		f[n] = filter == PAINT_SCALE_LANCZOS ?
+			filter_lanczos((x + 0.5 - center) / widen) :
+			filter_bilinear((x + 0.5 - center) / widen);
+		total += f[n];
+	}
+
+	for (x = 0; x < n; x++) {
+		w[x] = lround(f[x] / total * (1 << PAINT_SCALE_BITS));
+		sum += w[x];
+		if (w[x] > w[big])
+			big = x;
+	}
+	w[big] += (1 << PAINT_SCALE_BITS) - sum;
+
+	/* No taps for the zeros at the ends */
+	while (n > 1 && !w[n - 1])
+		n--;
+	while (n > 1 && !w[0]) {
+		memmove(w, w + 1, --n * sizeof(*w));
+		x0++;
+	}
+
+	*first = x0;
+	return n;
+}
+
+static void axis_fini(struct scale_axis *ax)
+{
+	free(ax->start);
+	free(ax->coef);
+	ax->start = NULL;
+	ax->coef = NULL;
+}
+
+static int axis_init(struct scale_axis *ax, int in, int out, enum paint_scale_filter filter)
+{
+	int max = (int)ceil(filter_support(filter, (double)in / out)) * 2 + 2;
+	int16_t *w = malloc(sizeof(*w) * max * out);
+	int *first = malloc(sizeof(*first) * out * 2);
+	double *f = malloc(sizeof(*f) * max);
+	int *n = first + out;
+	int i, shift, ret = -1;
+
+	ax->taps = 1;
+	ax->start = malloc(sizeof(*ax->start) * out);
+	ax->coef = NULL;
+	if (!ax->start || !w || !first || !f)
+		goto out;
+
+	for (i = 0; i < out; i++) {
+		n[i] = axis_weights(in, out, i, filter, &first[i], w + (long)i * max, f);
+		if (n[i] > ax->taps)
+			ax->taps = n[i];
+	}
+
+	ax->coef = calloc((size_t)out * ax->taps, sizeof(*ax->coef));
+	if (!ax->coef)
+		goto out;
+
+	for (i = 0; i < out; i++) {
+		ax->start[i] = first[i];
+		shift = 0;
+		if (first[i] + ax->taps > in) {
+			ax->start[i] = in - ax->taps;
+			shift = first[i] - ax->start[i];
+		}
+		memcpy(ax->coef + (long)i * ax->taps + shift, w + (long)i * max,
+				sizeof(*w) * n[i]);
+	}
+	ret = 0;
+
+out:
+	free(w);
+	free(first);
+	free(f);
+	return ret;
+}
+
+/* Nearest neighbour: the input pixel each output pixel's center falls in */
+static int axis_init_nearest(struct scale_axis *ax, int in, int out)
+{
+	int i;
+
+	ax->taps = 1;
+	ax->coef = NULL;
+	ax->start = malloc(sizeof(*ax->start) * out);
+	if (!ax->start)
+		return -1;
+
+	for (i = 0; i < out; i++)
+		ax->start[i] = ((2L * i + 1) * in) / (2L * out);
+
+	return 0;
+}
+
+/* ============ Scaling, in bands of output rows =========== */
+
+struct scale_rows {
+	const struct paint_view *dst;
+	const struct paint_view *src;
+	struct scale_axis x;
+	struct scale_axis y;
+};
+
+static const uint32_t *src_row(const struct scale_rows *s, int y)
+{
+	return (const uint32_t *)(s->src->base + (long)y * s->src->stride);
+}
+
+static uint32_t *dst_row(const struct scale_rows *s, int y)
+{
+	return (uint32_t *)(s->dst->base + (long)y * s->dst->stride);
+}
+
+static void nearest_rows_band(void *arg, int y0, int y1)
+{
+	struct scale_rows *s = arg;
+	int y;
+
+	for (y = y0; y < y1; y++)
+		paint_gather32(dst_row(s, y), src_row(s, s->y.start[y]), s->x.start,
+				s->dst->width);
+}
+
+static void filter_rows_band(void *arg, int y0, int y1)
+{
+	struct scale_rows *s = arg;
+	const uint32_t **rows;
+	uint32_t *tmp;
+	int y, t;
+
+	rows = malloc(sizeof(*rows) * s->y.taps);
+	tmp = malloc(sizeof(*tmp) * s->src->width);
+	if (!rows || !tmp) {
+		printf("Out of memory for a %d pixel row\n", s->src->width);
+		goto out;
+	}
+
+	for (y = y0; y < y1; y++) {
+		for (t = 0; t < s->y.taps; t++)
+			rows[t] = src_row(s, s->y.start[y] + t);
+
+		paint_scale_vert(tmp, rows, s->y.coef + (long)y * s->y.taps, s->y.taps,
+				s->src->width);
+		paint_scale_horiz(dst_row(s, y), tmp, s->x.start, s->x.coef, s->x.taps,
+				s->dst->width);
+	}
+
+out:
+	free(rows);
+	free(tmp);
+}
+
+static int scale_format(uint32_t format)
+{
+	return format == DRM_FORMAT_XRGB8888 || format == DRM_FORMAT_ARGB8888 ||
+		format == DRM_FORMAT_ABGR8888;
+}
+
+static int views_overlap(const struct paint_view *a, const struct paint_view *b)
+{
+	const char *a_end = a->base + (long)(a->height - 1) * a->stride + a->width * 4;
+	const char *b_end = b->base + (long)(b->height - 1) * b->stride + b->width * 4;
+
+	return a->base < b_end && b->base < a_end;
+}
+
+int paint_scale(const struct paint_view *dst, const struct paint_view *src,
+		enum paint_scale_filter filter)
+{
+	struct scale_rows s;
+	int ret;
+
+	if (!dst || !src || !dst->base || !src->base || filter < 0 ||
+		filter >= PAINT_SCALE_MAX) {
+		printf("Invalid input, nothing to scale\n");
+		return -1;
+	}
+
+	if (dst->format != src->format || !scale_format(src->format)) {
+		printf("Can't scale 0x%x to 0x%x\n", src->format, dst->format);
+		return -1;
+	}
+
+	if (dst->width <= 0 || dst->height <= 0 || src->width <= 0 || src->height <= 0)
+		return 0;
+
+	if (views_overlap(dst, src)) {
+		printf("Can't scale in place\n");
+		return -1;
+	}
+
+	s.dst = dst;
+	s.src = src;
+	s.x.start = s.y.start = NULL;
+	s.x.coef = s.y.coef = NULL;
+
+	if (filter == PAINT_SCALE_NEAREST)
+		ret = axis_init_nearest(&s.x, src->width, dst->width) ||
+			axis_init_nearest(&s.y, src->height, dst->height);
+	else
+		ret = axis_init(&s.x, src->width, dst->width, filter) ||
+			axis_init(&s.y, src->height, dst->height, filter);
+	if (ret) {
+		printf("Out of memory for the %dx%d to %dx%d filter\n", src->width,
+				src->height, dst->width, dst->height);
+		axis_fini(&s.x);
+		axis_fini(&s.y);
+		return -1;
+	}
+
+	paint_run_bands(dst->height, dst->width * 4,
+			filter == PAINT_SCALE_NEAREST ? nearest_rows_band : filter_rows_band, &s);
+
+	if (dst->damage)
+		paint_damage_add(dst->damage, dst->x, dst->y, dst->width, dst->height);
+
+	axis_fini(&s.x);
+	axis_fini(&s.y);
+	return 0;
+}
+
+const char *paint_scale_filter_name(enum paint_scale_filter filter)
+{
+	if (filter < 0 || filter >= PAINT_SCALE_MAX)
+		return NULL;
+
+	return filter_names[filter];
+}
+
+int paint_scale_filter_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < PAINT_SCALE_MAX; i++) {
+		if (!strcmp(name, filter_names[i]))
+			return i;
+	}
+
+	return -1;
+}
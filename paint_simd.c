@@ -0,0 +1,1346 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "paint_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PAINT_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define PAINT_NEON 1
+#include <arm_neon.h>
+#endif
+
+#ifdef __ARM_FEATURE_CRC32
+#include <arm_acle.h>
+#endif
+
+paint_fill32_fn paint_fill32;
+paint_copy_fn paint_copy_nt;
+paint_blend_fn paint_blend_over;
+paint_lookup32_fn paint_lookup32;
+paint_crc32c_fn paint_crc32c;
+paint_yuv_rows_fn paint_yuv_rows;
+paint_gather32_fn paint_gather32;
+paint_scale_vert_fn paint_scale_vert;
+paint_scale_horiz_fn paint_scale_horiz;
+paint_span32_fn paint_span32;
+enum paint_isa paint_active_isa;
+
+static const char *isa_names[PAINT_ISA_MAX] = {
+	[PAINT_ISA_SCALAR] = "scalar",
+	[PAINT_ISA_SSE2] = "sse2",
+	[PAINT_ISA_AVX2] = "avx2",
+	[PAINT_ISA_AVX512] = "avx512",
+	[PAINT_ISA_NEON] = "neon",
+};
+
+/* ============ Row fill kernels =========== */
+
+static void fill32_scalar(uint32_t *dst, uint32_t val, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = val;
+}
+
+#ifdef PAINT_X86
+__attribute__((target("sse2")))
+static void fill32_sse2(uint32_t *dst, uint32_t val, size_t n)
+{
+	__m128i v = _mm_set1_epi32(val);
+
+	/* Walk up to a 16 byte boundary so that the main loop can use aligned stores */
+	while (n && ((uintptr_t)dst & 15)) {
+		*dst++ = val;
+		n--;
+	}
+
+	for (; n >= 16; n -= 16, dst += 16) {
+		_mm_store_si128((__m128i *)dst, v);
+		_mm_store_si128((__m128i *)(dst + 4), v);
+		_mm_store_si128((__m128i *)(dst + 8), v);
+		_mm_store_si128((__m128i *)(dst + 12), v);
+	}
+
+	for (; n >= 4; n -= 4, dst += 4)
+		_mm_store_si128((__m128i *)dst, v);
+
+	while (n--)
+		*dst++ = val;
+}
+
+__attribute__((target("avx2")))
+static void fill32_avx2(uint32_t *dst, uint32_t val, size_t n)
+{
+	__m256i v = _mm256_set1_epi32(val);
+
+	if (n < 8) {
+		while (n--)
+			*dst++ = val;
+		return;
+	}
+
+	/* Pixels not even 4 byte aligned can never reach a vector boundary */
+	if ((uintptr_t)dst & 3) {
+		for (; n >= 8; n -= 8, dst += 8)
+			_mm256_storeu_si256((__m256i *)dst, v);
+		if (n)
+			_mm256_storeu_si256((__m256i *)(dst + n - 8), v);
+		return;
+	}
+
+	/* One unaligned store covers the head, then continue from the boundary */
+	_mm256_storeu_si256((__m256i *)dst, v);
+	if ((uintptr_t)dst & 31) {
+		size_t skip = (32 - ((uintptr_t)dst & 31)) / 4;
+
+		dst += skip;
+		n -= skip;
+	}
+
+	for (; n >= 32; n -= 32, dst += 32) {
+		_mm256_store_si256((__m256i *)dst, v);
+		_mm256_store_si256((__m256i *)(dst + 8), v);
+		_mm256_store_si256((__m256i *)(dst + 16), v);
+		_mm256_store_si256((__m256i *)(dst + 24), v);
+	}
+
+	for (; n >= 8; n -= 8, dst += 8)
+		_mm256_store_si256((__m256i *)dst, v);
+
+	/* Overlapping store for the tail, n >= 8 pixels were there to begin with */
+	if (n)
+		_mm256_storeu_si256((__m256i *)(dst + n - 8), v);
+}
+
+__attribute__((target("avx512f")))
+static void fill32_avx512(uint32_t *dst, uint32_t val, size_t n)
+{
+	__m512i v = _mm512_set1_epi32(val);
+	size_t head = ((64 - ((uintptr_t)dst & 63)) & 63) / 4;
+
+	if ((uintptr_t)dst & 3) {
+		for (; n >= 16; n -= 16, dst += 16)
+			_mm512_storeu_si512(dst, v);
+		if (n)
+			_mm512_mask_storeu_epi32(dst, (__mmask16)((1u << n) - 1), v);
+		return;
+	}
+
+	if (head > n)
+		head = n;
+
+	/* Masked stores take care of both unaligned ends */
+	if (head) {
+		_mm512_mask_storeu_epi32(dst, (__mmask16)((1u << head) - 1), v);
+		dst += head;
+		n -= head;
+	}
+
+	for (; n >= 64; n -= 64, dst += 64) {
+		_mm512_store_si512(dst, v);
+		_mm512_store_si512(dst + 16, v);
+		_mm512_store_si512(dst + 32, v);
+		_mm512_store_si512(dst + 48, v);
+	}
+
+	for (; n >= 16; n -= 16, dst += 16)
+		_mm512_store_si512(dst, v);
+
+	if (n)
+		_mm512_mask_storeu_epi32(dst, (__mmask16)((1u << n) - 1), v);
+}
+#endif
+
+#ifdef PAINT_NEON
+static void fill32_neon(uint32_t *dst, uint32_t val, size_t n)
+{
+	uint32x4_t v = vdupq_n_u32(val);
+
+	for (; n >= 16; n -= 16, dst += 16) {
+		vst1q_u32(dst, v);
+		vst1q_u32(dst + 4, v);
+		vst1q_u32(dst + 8, v);
+		vst1q_u32(dst + 12, v);
+	}
+
+	for (; n >= 4; n -= 4, dst += 4)
+		vst1q_u32(dst, v);
+
+	while (n--)
+		*dst++ = val;
+}
+#endif
+
+void paint_fill16(uint16_t *dst, uint16_t val, size_t n)
+{
+	if (n && ((uintptr_t)dst & 2)) {
+		*dst++ = val;
+		n--;
+	}
+
+	paint_fill32((uint32_t *)dst, (uint32_t)val << 16 | val, n / 2);
+
+	if (n & 1)
+		dst[n - 1] = val;
+}
+
+/* ============ Streaming copy kernels =========== */
+
+static void copy_scalar(void *dst, const void *src, size_t n)
+{
+	memcpy(dst, src, n);
+}
+
+#ifdef PAINT_X86
+/* Bytes to copy normally before dst reaches an 'align' boundary */
+static size_t head_bytes(void *dst, size_t align, size_t n)
+{
+	size_t head = (align - ((uintptr_t)dst & (align - 1))) & (align - 1);
+
+	return head < n ? head : n;
+}
+
+__attribute__((target("sse2")))
+static void copy_nt_sse2(void *dst, const void *src, size_t n)
+{
+	char *d = dst;
+	const char *s = src;
+	size_t head = head_bytes(d, 16, n);
+
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	n -= head;
+
+	for (; n >= 64; n -= 64, d += 64, s += 64) {
+		_mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+		_mm_stream_si128((__m128i *)(d + 16), _mm_loadu_si128((const __m128i *)(s + 16)));
+		_mm_stream_si128((__m128i *)(d + 32), _mm_loadu_si128((const __m128i *)(s + 32)));
+		_mm_stream_si128((__m128i *)(d + 48), _mm_loadu_si128((const __m128i *)(s + 48)));
+	}
+
+	for (; n >= 16; n -= 16, d += 16, s += 16)
+		_mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+
+	memcpy(d, s, n);
+}
+
+__attribute__((target("avx2")))
+static void copy_nt_avx2(void *dst, const void *src, size_t n)
+{
+	char *d = dst;
+	const char *s = src;
+	size_t head = head_bytes(d, 32, n);
+
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	n -= head;
+
+	for (; n >= 128; n -= 128, d += 128, s += 128) {
+		_mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+		_mm256_stream_si256((__m256i *)(d + 32), _mm256_loadu_si256((const __m256i *)(s + 32)));
+		_mm256_stream_si256((__m256i *)(d + 64), _mm256_loadu_si256((const __m256i *)(s + 64)));
+		_mm256_stream_si256((__m256i *)(d + 96), _mm256_loadu_si256((const __m256i *)(s + 96)));
+	}
+
+	for (; n >= 32; n -= 32, d += 32, s += 32)
+		_mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+
+	memcpy(d, s, n);
+}
+
+__attribute__((target("avx512f")))
+static void copy_nt_avx512(void *dst, const void *src, size_t n)
+{
+	char *d = dst;
+	const char *s = src;
+	size_t head = head_bytes(d, 64, n);
+
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	n -= head;
+
+	for (; n >= 256; n -= 256, d += 256, s += 256) {
+		_mm512_stream_si512((__m512i *)d, _mm512_loadu_si512(s));
+		_mm512_stream_si512((__m512i *)(d + 64), _mm512_loadu_si512(s + 64));
+		_mm512_stream_si512((__m512i *)(d + 128), _mm512_loadu_si512(s + 128));
+		_mm512_stream_si512((__m512i *)(d + 192), _mm512_loadu_si512(s + 192));
+	}
+
+	for (; n >= 64; n -= 64, d += 64, s += 64)
+		_mm512_stream_si512((__m512i *)d, _mm512_loadu_si512(s));
+
+	memcpy(d, s, n);
+}
+#endif
+
+/* ============ Alpha blend kernels =========== */
+
+/*
+ * Porter-Duff over with premultiplied alpha: dst = src + dst * (255 - a) / 255
+ * per channel, divided by 255 with exact rounding. Every kernel works out
+ * the same bits as the scalar one, so they can be compared byte for byte.
+ */
+static uint32_t blend_px(uint32_t d, uint32_t s)
+{
+	uint32_t inv = 255 - (s >> 24), out = 0, c, t;
+	int shift;
+
+	for (shift = 0; shift < 32; shift += 8) {
+		t = ((d >> shift) & 0xff) * inv + 128;
+		c = ((s >> shift) & 0xff) + ((t + (t >> 8)) >> 8);
+		out |= (c > 255 ? 255 : c) << shift;
+	}
+
+	return out;
+}
+
+/* Fully transparent pixels leave dst as it is, opaque ones are just copied */
+static void blend_over_scalar(uint32_t *dst, const uint32_t *src, size_t n)
+{
+	uint32_t a;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		a = src[i] >> 24;
+		if (a == 255)
+			dst[i] = src[i];
+		else if (a)
+			dst[i] = blend_px(dst[i], src[i]);
+	}
+}
+
+#ifdef PAINT_X86
+/* dst * (255 - a) / 255 on 2 pixels unpacked to 16 bit lanes */
+__attribute__((target("sse2")))
+static inline __m128i blend_lanes_sse2(__m128i d, __m128i s)
+{
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xff), 0xff);
+	__m128i t = _mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(255), a));
+
+	t = _mm_add_epi16(t, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void blend_over_sse2(uint32_t *dst, const uint32_t *src, size_t n)
+{
+	const __m128i zero = _mm_setzero_si128(), opaque = _mm_set1_epi32(255);
+	__m128i s, d, a, lo, hi;
+
+	for (; n >= 4; n -= 4, dst += 4, src += 4) {
+		s = _mm_loadu_si128((const __m128i *)src);
+		a = _mm_srli_epi32(s, 24);
+
+		/* Whole vectors of transparent or opaque pixels are the common case */
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, zero)) == 0xffff)
+			continue;
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, opaque)) == 0xffff) {
+			_mm_storeu_si128((__m128i *)dst, s);
+			continue;
+		}
+
+		d = _mm_loadu_si128((const __m128i *)dst);
+		lo = blend_lanes_sse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+		hi = blend_lanes_sse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+		_mm_storeu_si128((__m128i *)dst, _mm_adds_epu8(_mm_packus_epi16(lo, hi), s));
+	}
+
+	blend_over_scalar(dst, src, n);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blend_lanes_avx2(__m256i d, __m256i s)
+{
+	__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xff), 0xff);
+	__m256i t = _mm256_mullo_epi16(d, _mm256_sub_epi16(_mm256_set1_epi16(255), a));
+
+	t = _mm256_add_epi16(t, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+/* Unpack and pack both work within 128 bit lanes, so pixels stay in order */
+__attribute__((target("avx2")))
+static void blend_over_avx2(uint32_t *dst, const uint32_t *src, size_t n)
+{
+	const __m256i zero = _mm256_setzero_si256(), opaque = _mm256_set1_epi32(255);
+	__m256i s, d, a, lo, hi;
+
+	for (; n >= 8; n -= 8, dst += 8, src += 8) {
+		s = _mm256_loadu_si256((const __m256i *)src);
+		a = _mm256_srli_epi32(s, 24);
+
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, zero)) == -1)
+			continue;
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, opaque)) == -1) {
+			_mm256_storeu_si256((__m256i *)dst, s);
+			continue;
+		}
+
+		d = _mm256_loadu_si256((const __m256i *)dst);
+		lo = blend_lanes_avx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero));
+		hi = blend_lanes_avx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero));
+		_mm256_storeu_si256((__m256i *)dst,
+				_mm256_adds_epu8(_mm256_packus_epi16(lo, hi), s));
+	}
+
+	blend_over_scalar(dst, src, n);
+}
+#endif
+
+#ifdef PAINT_NEON
+/*
+ * vld4 splits 8 pixels into B, G, R and A planes, so the alpha checks are
+ * one 64 bit compare. Rounding shifts give the same (t + 128) / 255 as the
+ * other kernels: (t + ((t + 128) >> 8) + 128) >> 8.
+ */
+static void blend_over_neon(uint32_t *dst, const uint32_t *src, size_t n)
+{
+	uint8x8x4_t s, d;
+	uint16x8_t t;
+	uint8x8_t inv;
+	uint64_t a;
+	int c;
+
+	for (; n >= 8; n -= 8, dst += 8, src += 8) {
+		s = vld4_u8((const uint8_t *)src);
+		a = vget_lane_u64(vreinterpret_u64_u8(s.val[3]), 0);
+
+		if (!a)
+			continue;
+		if (a == ~0ULL) {
+			vst1q_u32(dst, vld1q_u32(src));
+			vst1q_u32(dst + 4, vld1q_u32(src + 4));
+			continue;
+		}
+
+		d = vld4_u8((const uint8_t *)dst);
+		inv = vmvn_u8(s.val[3]);
+		for (c = 0; c < 4; c++) {
+			t = vmull_u8(d.val[c], inv);
+			d.val[c] = vqadd_u8(s.val[c], vrshrn_n_u16(vrsraq_n_u16(t, t, 8), 8));
+		}
+		vst4_u8((uint8_t *)dst, d);
+	}
+
+	blend_over_scalar(dst, src, n);
+}
+#endif
+
+/* ============ Table lookup kernels =========== */
+
+static void lookup32_scalar(uint32_t *dst, const uint8_t *idx, const uint32_t *lut, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = lut[idx[i]];
+}
+
+#ifdef PAINT_X86
+__attribute__((target("avx2")))
+static void lookup32_avx2(uint32_t *dst, const uint8_t *idx, const uint32_t *lut, size_t n)
+{
+	__m256i i;
+
+	for (; n >= 8; n -= 8, dst += 8, idx += 8) {
+		i = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)idx));
+		_mm256_storeu_si256((__m256i *)dst, _mm256_i32gather_epi32((const int *)lut, i, 4));
+	}
+
+	lookup32_scalar(dst, idx, lut, n);
+}
+#endif
+
+/* ============ CRC32C kernels =========== */
+
+/*
+ * CRC32C (Castagnoli), reflected, without the pre and post inversion which
+ * is left to the caller, so that a checksum can go on over several calls.
+ * Scalar is slicing by 8: eight tables, one per byte of a 64 bit word.
+ */
+static uint32_t crc32c_table[8][256];
+
+static void crc32c_init_tables(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = crc & 1 ? crc >> 1 ^ PAINT_CRC32C_POLY : crc >> 1;
+		crc32c_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++)
+			crc32c_table[j][i] = crc32c_table[j - 1][i] >> 8 ^
+				crc32c_table[0][crc32c_table[j - 1][i] & 0xff];
+	}
+}
+
+static uint32_t crc32c_scalar(uint32_t crc, const void *buf, size_t n)
+{
+	const uint8_t *p = buf;
+	uint64_t w;
+
+	for (; n && ((uintptr_t)p & 7); n--)
+		crc = crc >> 8 ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+
+	for (; n >= 8; n -= 8, p += 8) {
+		memcpy(&w, p, 8);
+		w ^= crc;
+		crc = crc32c_table[7][w & 0xff] ^ crc32c_table[6][(w >> 8) & 0xff] ^
+			crc32c_table[5][(w >> 16) & 0xff] ^ crc32c_table[4][(w >> 24) & 0xff] ^
+			crc32c_table[3][(w >> 32) & 0xff] ^ crc32c_table[2][(w >> 40) & 0xff] ^
+			crc32c_table[1][(w >> 48) & 0xff] ^ crc32c_table[0][w >> 56];
+	}
+
+	while (n--)
+		crc = crc >> 8 ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+
+	return crc;
+}
+
+#ifdef PAINT_X86
+/* The crc32 instruction is SSE4.2, which every AVX2 CPU has */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const void *buf, size_t n)
+{
+	const uint8_t *p = buf;
+	uint64_t c = crc, w;
+
+	for (; n && ((uintptr_t)p & 7); n--)
+		c = _mm_crc32_u8(c, *p++);
+
+	for (; n >= 8; n -= 8, p += 8) {
+		memcpy(&w, p, 8);
+		c = _mm_crc32_u64(c, w);
+	}
+
+	while (n--)
+		c = _mm_crc32_u8(c, *p++);
+
+	return c;
+}
+#endif
+
+#ifdef __ARM_FEATURE_CRC32
+static uint32_t crc32c_arm(uint32_t crc, const void *buf, size_t n)
+{
+	const uint8_t *p = buf;
+	uint64_t w;
+
+	for (; n && ((uintptr_t)p & 7); n--)
+		crc = __crc32cb(crc, *p++);
+
+	for (; n >= 8; n -= 8, p += 8) {
+		memcpy(&w, p, 8);
+		crc = __crc32cd(crc, w);
+	}
+
+	while (n--)
+		crc = __crc32cb(crc, *p++);
+
+	return crc;
+}
+#endif
+
+/* ============ RGB to YUV kernels =========== */
+
+/*
+ * Two rows of XRGB8888 to Y of each, and U and V of each 2x2 block, as 16
+ * bit samples of c->max at most. Chroma is worked out from the sums of the
+ * block's channels. y1 NULL is one row only: s1 then is the same as s0, so
+ * that the chroma is of the horizontal pairs (4:2:2). An odd last pixel
+ * pairs up with itself. All in integers, the kernels match to the bit.
+ */
+static uint16_t yuv_clamp(const struct paint_yuv_coefs *c, int32_t v)
+{
+	return v < 0 ? 0 : v > c->max ? c->max : v;
+}
+
+static uint16_t yuv_dot(const int16_t *coef, int32_t b, int32_t g, int32_t r,
+		int32_t round, int shift, const struct paint_yuv_coefs *c)
+{
+	return yuv_clamp(c, (coef[0] * b + coef[1] * g + coef[2] * r + round) >> shift);
+}
+
+#define PX_B(p) ((p) & 0xff)
+#define PX_G(p) (((p) >> 8) & 0xff)
+#define PX_R(p) (((p) >> 16) & 0xff)
+
+static void yuv_rows_scalar(const struct paint_yuv_coefs *c, const uint32_t *s0,
+		const uint32_t *s1, uint16_t *y0, uint16_t *y1, uint16_t *u, uint16_t *v, size_t n)
+{
+	uint32_t p[4];
+	int32_t b, g, r;
+	size_t i;
+
+	for (i = 0; i < n; i += 2) {
+		p[0] = s0[i];
+		p[1] = i + 1 < n ? s0[i + 1] : p[0];
+		p[2] = s1[i];
+		p[3] = i + 1 < n ? s1[i + 1] : p[2];
+
+		y0[i] = yuv_dot(c->y, PX_B(p[0]), PX_G(p[0]), PX_R(p[0]), c->y_round, c->shift, c);
+		if (i + 1 < n)
+			y0[i + 1] = yuv_dot(c->y, PX_B(p[1]), PX_G(p[1]), PX_R(p[1]),
+					c->y_round, c->shift, c);
+		if (y1) {
+			y1[i] = yuv_dot(c->y, PX_B(p[2]), PX_G(p[2]), PX_R(p[2]),
+					c->y_round, c->shift, c);
+			if (i + 1 < n)
+				y1[i + 1] = yuv_dot(c->y, PX_B(p[3]), PX_G(p[3]), PX_R(p[3]),
+						c->y_round, c->shift, c);
+		}
+
+		b = PX_B(p[0]) + PX_B(p[1]) + PX_B(p[2]) + PX_B(p[3]);
+		g = PX_G(p[0]) + PX_G(p[1]) + PX_G(p[2]) + PX_G(p[3]);
+		r = PX_R(p[0]) + PX_R(p[1]) + PX_R(p[2]) + PX_R(p[3]);
+		u[i / 2] = yuv_dot(c->u, b, g, r, c->c_round, c->shift + 2, c);
+		v[i / 2] = yuv_dot(c->v, b, g, r, c->c_round, c->shift + 2, c);
+	}
+}
+
+#ifdef PAINT_X86
+/*
+ * Channels go to 16 bits, where madd does two of the three products of a
+ * pixel and hadd adds the pairs up: one 32 bit dot product per pixel.
+ */
+__attribute__((target("avx2")))
+static inline __m128i yuv_pack_avx2(const struct paint_yuv_coefs *c, __m256i dot,
+		int32_t round, int shift)
+{
+	__m256i s = _mm256_srai_epi32(_mm256_add_epi32(dot, _mm256_set1_epi32(round)), shift);
+	__m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+
+	return _mm_min_epu16(packed, _mm_set1_epi16(c->max));
+}
+
+/* Y of 8 pixels, in order: unpacklo has pixels 0, 1 | 4, 5 and unpackhi 2, 3 | 6, 7 */
+__attribute__((target("avx2")))
+static inline __m128i yuv_luma_avx2(const struct paint_yuv_coefs *c, __m256i px, __m256i coef)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coef);
+	__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coef);
+
+	return yuv_pack_avx2(c, _mm256_hadd_epi32(lo, hi), c->y_round, c->shift);
+}
+
+/* Channel sums of the 4 2x2 blocks in 8 pixels of two rows, 16 bits each */
+__attribute__((target("avx2")))
+static inline __m256i yuv_block_sums_avx2(__m256i a, __m256i b)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+	__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+
+	/* Each pixel plus its neighbour, blocks 0 | 2 in lo and 1 | 3 in hi */
+	lo = _mm256_add_epi16(lo, _mm256_shuffle_epi32(lo, 0x4e));
+	hi = _mm256_add_epi16(hi, _mm256_shuffle_epi32(hi, 0x4e));
+	return _mm256_unpacklo_epi64(lo, hi);
+}
+
+/* U or V of 8 blocks, the sums of blocks 0-3 in s0 and 4-7 in s1 */
+__attribute__((target("avx2")))
+static inline __m128i yuv_chroma_avx2(const struct paint_yuv_coefs *c, __m256i s0, __m256i s1,
+		__m256i coef)
+{
+	__m256i dot = _mm256_hadd_epi32(_mm256_madd_epi16(s0, coef), _mm256_madd_epi16(s1, coef));
+
+	/* hadd leaves blocks 0, 1, 4, 5 | 2, 3, 6, 7 */
+	dot = _mm256_permute4x64_epi64(dot, 0xd8);
+	return yuv_pack_avx2(c, dot, c->c_round, c->shift + 2);
+}
+
+/* The B, G, R, X coefficients, once per pixel of a 16 bit channels vector */
+__attribute__((target("avx2")))
+static inline __m256i yuv_coef_avx2(const int16_t *coef)
+{
+	int64_t k;
+
+	memcpy(&k, coef, sizeof(k));
+	return _mm256_set1_epi64x(k);
+}
+
+__attribute__((target("avx2")))
+static void yuv_rows_avx2(const struct paint_yuv_coefs *c, const uint32_t *s0,
+		const uint32_t *s1, uint16_t *y0, uint16_t *y1, uint16_t *u, uint16_t *v, size_t n)
+{
+	const __m256i cy = yuv_coef_avx2(c->y);
+	const __m256i cu = yuv_coef_avx2(c->u);
+	const __m256i cv = yuv_coef_avx2(c->v);
+	__m256i a0, a1, b0, b1, sum0, sum1;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		a0 = _mm256_loadu_si256((const __m256i *)(s0 + i));
+		a1 = _mm256_loadu_si256((const __m256i *)(s0 + i + 8));
+		b0 = _mm256_loadu_si256((const __m256i *)(s1 + i));
+		b1 = _mm256_loadu_si256((const __m256i *)(s1 + i + 8));
+
+		_mm_storeu_si128((__m128i *)(y0 + i), yuv_luma_avx2(c, a0, cy));
+		_mm_storeu_si128((__m128i *)(y0 + i + 8), yuv_luma_avx2(c, a1, cy));
+		if (y1) {
+			_mm_storeu_si128((__m128i *)(y1 + i), yuv_luma_avx2(c, b0, cy));
+			_mm_storeu_si128((__m128i *)(y1 + i + 8), yuv_luma_avx2(c, b1, cy));
+		}
+
+		sum0 = yuv_block_sums_avx2(a0, b0);
+		sum1 = yuv_block_sums_avx2(a1, b1);
+		_mm_storeu_si128((__m128i *)(u + i / 2), yuv_chroma_avx2(c, sum0, sum1, cu));
+		_mm_storeu_si128((__m128i *)(v + i / 2), yuv_chroma_avx2(c, sum0, sum1, cv));
+	}
+
+	yuv_rows_scalar(c, s0 + i, s1 + i, y0 + i, y1 ? y1 + i : NULL, u + i / 2, v + i / 2, n - i);
+}
+#endif
+
+#ifdef PAINT_NEON
+/* 8 pixels a time, vld4 gives the channels as planes */
+static uint16x4_t yuv_dot_neon(const struct paint_yuv_coefs *c, const int16_t *coef,
+		int32x4_t b, int32x4_t g, int32x4_t r, int32_t round, int shift)
+{
+	int32x4_t dot = vmulq_n_s32(b, coef[0]);
+
+	dot = vmlaq_n_s32(dot, g, coef[1]);
+	dot = vmlaq_n_s32(dot, r, coef[2]);
+	dot = vshlq_s32(vaddq_s32(dot, vdupq_n_s32(round)), vdupq_n_s32(-shift));
+	return vmin_u16(vqmovun_s32(dot), vdup_n_u16(c->max));
+}
+
+static int32x4_t widen_lo(uint8x8_t ch)
+{
+	return vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(vmovl_u8(ch))));
+}
+
+static int32x4_t widen_hi(uint8x8_t ch)
+{
+	return vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(vmovl_u8(ch))));
+}
+
+static void yuv_luma_neon(const struct paint_yuv_coefs *c, uint8x8x4_t px, uint16_t *y)
+{
+	vst1q_u16(y, vcombine_u16(
+		yuv_dot_neon(c, c->y, widen_lo(px.val[0]), widen_lo(px.val[1]),
+			widen_lo(px.val[2]), c->y_round, c->shift),
+		yuv_dot_neon(c, c->y, widen_hi(px.val[0]), widen_hi(px.val[1]),
+			widen_hi(px.val[2]), c->y_round, c->shift)));
+}
+
+/* Sums of a channel over the 4 blocks: the two rows, then neighbours */
+static int32x4_t block_sums(uint8x8_t a, uint8x8_t b)
+{
+	return vreinterpretq_s32_u32(vpaddlq_u16(vaddl_u8(a, b)));
+}
+
+static void yuv_rows_neon(const struct paint_yuv_coefs *c, const uint32_t *s0,
+		const uint32_t *s1, uint16_t *y0, uint16_t *y1, uint16_t *u, uint16_t *v, size_t n)
+{
+	uint8x8x4_t a, b;
+	int32x4_t sb, sg, sr;
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = vld4_u8((const uint8_t *)(s0 + i));
+		b = vld4_u8((const uint8_t *)(s1 + i));
+
+		yuv_luma_neon(c, a, y0 + i);
+		if (y1)
+			yuv_luma_neon(c, b, y1 + i);
+
+		sb = block_sums(a.val[0], b.val[0]);
+		sg = block_sums(a.val[1], b.val[1]);
+		sr = block_sums(a.val[2], b.val[2]);
+		vst1_u16(u + i / 2, yuv_dot_neon(c, c->u, sb, sg, sr, c->c_round, c->shift + 2));
+		vst1_u16(v + i / 2, yuv_dot_neon(c, c->v, sb, sg, sr, c->c_round, c->shift + 2));
+	}
+
+	yuv_rows_scalar(c, s0 + i, s1 + i, y0 + i, y1 ? y1 + i : NULL, u + i / 2, v + i / 2, n - i);
+}
+#endif
+
+/* ============ Scaler kernels =========== */
+
+static void gather32_scalar(uint32_t *dst, const uint32_t *src, const int32_t *idx, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = src[idx[i]];
+}
+
+#ifdef PAINT_X86
+__attribute__((target("avx2")))
+static void gather32_avx2(uint32_t *dst, const uint32_t *src, const int32_t *idx, size_t n)
+{
+	__m256i i;
+
+	for (; n >= 8; n -= 8, dst += 8, idx += 8) {
+		i = _mm256_loadu_si256((const __m256i *)idx);
+		_mm256_storeu_si256((__m256i *)dst, _mm256_i32gather_epi32((const int *)src, i, 4));
+	}
+
+	gather32_scalar(dst, src, idx, n);
+}
+#endif
+
+/*
+ * Filters work on the 4 bytes of a pixel as 4 channels, all alike: each
+ * is a sum of taps weighted by coefficients of PAINT_SCALE_BITS fraction,
+ * rounded and clamped to 0-255. Sums are exact in 32 bits, so the kernels
+ * match to the bit.
+ */
+#define SCALE_ROUND (1 << (PAINT_SCALE_BITS - 1))
+
+static uint32_t scale_clamp(int32_t acc)
+{
+	acc >>= PAINT_SCALE_BITS;
+	return acc < 0 ? 0 : acc > 255 ? 255 : acc;
+}
+
+/* Pixel i of the rows */
+static uint32_t scale_vert_px(const uint32_t *const *rows, const int16_t *coef, int taps,
+		size_t i)
+{
+	int32_t acc[4] = { SCALE_ROUND, SCALE_ROUND, SCALE_ROUND, SCALE_ROUND };
+	uint32_t px;
+	int c, t;
+
+	for (t = 0; t < taps; t++) {
+		px = rows[t][i];
+		for (c = 0; c < 4; c++)
+			acc[c] += (int32_t)((px >> (8 * c)) & 0xff) * coef[t];
+	}
+
+	return scale_clamp(acc[0]) | scale_clamp(acc[1]) << 8 |
+		scale_clamp(acc[2]) << 16 | scale_clamp(acc[3]) << 24;
+}
+
+static void scale_vert_scalar(uint32_t *dst, const uint32_t *const *rows, const int16_t *coef,
+		int taps, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = scale_vert_px(rows, coef, taps, i);
+}
+
+static void scale_horiz_scalar(uint32_t *dst, const uint32_t *src, const int32_t *start,
+		const int16_t *coef, int taps, size_t n)
+{
+	const uint32_t *s;
+	int32_t acc[4];
+	size_t i;
+	int c, t;
+
+	for (i = 0; i < n; i++, coef += taps) {
+		s = src + start[i];
+		acc[0] = acc[1] = acc[2] = acc[3] = SCALE_ROUND;
+		for (t = 0; t < taps; t++) {
+			for (c = 0; c < 4; c++)
+				acc[c] += (int32_t)((s[t] >> (8 * c)) & 0xff) * coef[t];
+		}
+
+		dst[i] = scale_clamp(acc[0]) | scale_clamp(acc[1]) << 8 |
+			scale_clamp(acc[2]) << 16 | scale_clamp(acc[3]) << 24;
+	}
+}
+
+#ifdef PAINT_X86
+/*
+ * Two taps a time: their bytes get interleaved and widened to 16 bits, so
+ * that madd multiplies both by their coefficients and adds them up into one
+ * 32 bit sum per channel. An odd last tap pairs up with zeros.
+ */
+static __m128i scale_coef_pair(const int16_t *coef, int t, int taps)
+{
+	return _mm_set1_epi32((uint16_t)coef[t] | (t + 1 < taps ? (uint32_t)coef[t + 1] << 16 : 0));
+}
+
+/* The 16 channels of 4 pixels out of their 32 bit sums */
+static __m128i scale_pack_sse2(__m128i a0, __m128i a1, __m128i a2, __m128i a3)
+{
+	a0 = _mm_srai_epi32(a0, PAINT_SCALE_BITS);
+	a1 = _mm_srai_epi32(a1, PAINT_SCALE_BITS);
+	a2 = _mm_srai_epi32(a2, PAINT_SCALE_BITS);
+	a3 = _mm_srai_epi32(a3, PAINT_SCALE_BITS);
+	return _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3));
+}
+
+static void scale_vert_sse2(uint32_t *dst, const uint32_t *const *rows, const int16_t *coef,
+		int taps, size_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a0, a1, a2, a3, w, p, q, lo, hi;
+	size_t i;
+	int t;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		a0 = a1 = a2 = a3 = _mm_set1_epi32(SCALE_ROUND);
+		for (t = 0; t < taps; t += 2) {
+			w = scale_coef_pair(coef, t, taps);
+			p = _mm_loadu_si128((const __m128i *)(rows[t] + i));
+			q = t + 1 < taps ? _mm_loadu_si128((const __m128i *)(rows[t + 1] + i)) : zero;
+			lo = _mm_unpacklo_epi8(p, q);
+			hi = _mm_unpackhi_epi8(p, q);
+			a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+			a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+			a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+			a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+		}
+
+		_mm_storeu_si128((__m128i *)(dst + i), scale_pack_sse2(a0, a1, a2, a3));
+	}
+
+	for (; i < n; i++)
+		dst[i] = scale_vert_px(rows, coef, taps, i);
+}
+
+/* One output pixel a time, its 4 channels in the 4 sums */
+static void scale_horiz_sse2(uint32_t *dst, const uint32_t *src, const int32_t *start,
+		const int16_t *coef, int taps, size_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const uint32_t *s;
+	__m128i acc, p;
+	size_t i;
+	int t;
+
+	for (i = 0; i < n; i++, coef += taps) {
+		s = src + start[i];
+		acc = _mm_set1_epi32(SCALE_ROUND);
+		for (t = 0; t + 1 < taps; t += 2) {
+			p = _mm_loadl_epi64((const __m128i *)(s + t));
+			p = _mm_unpacklo_epi8(_mm_unpacklo_epi8(p, _mm_srli_si128(p, 4)), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, scale_coef_pair(coef, t, taps)));
+		}
+
+		if (t < taps) {
+			p = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(s[t]), zero), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, scale_coef_pair(coef, t, taps)));
+		}
+
+		acc = _mm_packs_epi32(_mm_srai_epi32(acc, PAINT_SCALE_BITS), zero);
+		dst[i] = _mm_cvtsi128_si32(_mm_packus_epi16(acc, zero));
+	}
+}
+
+/* The SSE2 steps in each 128 bit lane, for 8 pixels a time */
+__attribute__((target("avx2")))
+static void scale_vert_avx2(uint32_t *dst, const uint32_t *const *rows, const int16_t *coef,
+		int taps, size_t n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i a0, a1, a2, a3, w, p, q, lo, hi;
+	size_t i;
+	int t;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a0 = a1 = a2 = a3 = _mm256_set1_epi32(SCALE_ROUND);
+		for (t = 0; t < taps; t += 2) {
+			w = _mm256_broadcastsi128_si256(scale_coef_pair(coef, t, taps));
+			p = _mm256_loadu_si256((const __m256i *)(rows[t] + i));
+			q = t + 1 < taps ? _mm256_loadu_si256((const __m256i *)(rows[t + 1] + i)) : zero;
+			lo = _mm256_unpacklo_epi8(p, q);
+			hi = _mm256_unpackhi_epi8(p, q);
+			a0 = _mm256_add_epi32(a0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), w));
+			a1 = _mm256_add_epi32(a1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), w));
+			a2 = _mm256_add_epi32(a2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), w));
+			a3 = _mm256_add_epi32(a3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), w));
+		}
+
+		a0 = _mm256_srai_epi32(a0, PAINT_SCALE_BITS);
+		a1 = _mm256_srai_epi32(a1, PAINT_SCALE_BITS);
+		a2 = _mm256_srai_epi32(a2, PAINT_SCALE_BITS);
+		a3 = _mm256_srai_epi32(a3, PAINT_SCALE_BITS);
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(
+			_mm256_packs_epi32(a0, a1), _mm256_packs_epi32(a2, a3)));
+	}
+
+	for (; i < n; i++)
+		dst[i] = scale_vert_px(rows, coef, taps, i);
+}
+#endif
+
+#ifdef PAINT_NEON
+static int16x8_t scale_widen_lo(uint8x16_t p)
+{
+	return vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(p)));
+}
+
+static int16x8_t scale_widen_hi(uint8x16_t p)
+{
+	return vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(p)));
+}
+
+static uint8x8_t scale_narrow_neon(int32x4_t a, int32x4_t b)
+{
+	return vqmovun_s16(vcombine_s16(vqshrn_n_s32(a, PAINT_SCALE_BITS),
+			vqshrn_n_s32(b, PAINT_SCALE_BITS)));
+}
+
+/* 4 pixels a time, a widening multiply-accumulate per tap */
+static void scale_vert_neon(uint32_t *dst, const uint32_t *const *rows, const int16_t *coef,
+		int taps, size_t n)
+{
+	int32x4_t a0, a1, a2, a3;
+	int16x8_t lo, hi;
+	uint8x16_t p;
+	size_t i;
+	int t;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		a0 = a1 = a2 = a3 = vdupq_n_s32(SCALE_ROUND);
+		for (t = 0; t < taps; t++) {
+			p = vld1q_u8((const uint8_t *)(rows[t] + i));
+			lo = scale_widen_lo(p);
+			hi = scale_widen_hi(p);
+			a0 = vmlal_n_s16(a0, vget_low_s16(lo), coef[t]);
+			a1 = vmlal_n_s16(a1, vget_high_s16(lo), coef[t]);
+			a2 = vmlal_n_s16(a2, vget_low_s16(hi), coef[t]);
+			a3 = vmlal_n_s16(a3, vget_high_s16(hi), coef[t]);
+		}
+
+		vst1q_u8((uint8_t *)(dst + i), vcombine_u8(scale_narrow_neon(a0, a1),
+				scale_narrow_neon(a2, a3)));
+	}
+
+	for (; i < n; i++)
+		dst[i] = scale_vert_px(rows, coef, taps, i);
+}
+
+static void scale_horiz_neon(uint32_t *dst, const uint32_t *src, const int32_t *start,
+		const int16_t *coef, int taps, size_t n)
+{
+	const uint32_t *s;
+	int32x4_t acc;
+	int16x4_t p;
+	size_t i;
+	int t;
+
+	for (i = 0; i < n; i++, coef += taps) {
+		s = src + start[i];
+		acc = vdupq_n_s32(SCALE_ROUND);
+		for (t = 0; t < taps; t++) {
+			p = vget_low_s16(vreinterpretq_s16_u16(vmovl_u8(vcreate_u8(s[t]))));
+			acc = vmlal_n_s16(acc, p, coef[t]);
+		}
+
+		dst[i] = vget_lane_u32(vreinterpret_u32_u8(scale_narrow_neon(acc, acc)), 0);
+	}
+}
+#endif
+
+/* ============ Run length kernels =========== */
+
+static size_t span32_scalar(const uint32_t *src, uint32_t val, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n && src[i] == val; i++)
+		;
+	return i;
+}
+
+#ifdef PAINT_X86
+__attribute__((target("sse2")))
+static size_t span32_sse2(const uint32_t *src, uint32_t val, size_t n)
+{
+	__m128i v = _mm_set1_epi32(val);
+	size_t i;
+	int mask;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(
+				_mm_loadu_si128((const __m128i *)(src + i)), v)));
+		if (mask != 0xf)
+			return i + __builtin_ctz(~mask);
+	}
+
+	return i + span32_scalar(src + i, val, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t span32_avx2(const uint32_t *src, uint32_t val, size_t n)
+{
+	__m256i v = _mm256_set1_epi32(val);
+	size_t i;
+	int mask;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(
+				_mm256_loadu_si256((const __m256i *)(src + i)), v)));
+		if (mask != 0xff)
+			return i + __builtin_ctz(~mask);
+	}
+
+	return i + span32_scalar(src + i, val, n - i);
+}
+#endif
+
+#ifdef PAINT_NEON
+static size_t span32_neon(const uint32_t *src, uint32_t val, size_t n)
+{
+	uint32x4_t v = vdupq_n_u32(val);
+	uint64x2_t eq;
+	size_t i;
+
+	/* 4 lanes to 4 bits each, all ones when they all match */
+	for (i = 0; i + 4 <= n; i += 4) {
+		eq = vreinterpretq_u64_u32(vceqq_u32(vld1q_u32(src + i), v));
+		if ((vgetq_lane_u64(eq, 0) & vgetq_lane_u64(eq, 1)) != ~0ull)
+			break;
+	}
+
+	return i + span32_scalar(src + i, val, n - i);
+}
+#endif
+
+void paint_stream_fence(void)
+{
+#ifdef PAINT_X86
+	_mm_sfence();
+#endif
+}
+
+/* ============ Runtime dispatch =========== */
+
+static paint_fill32_fn fill32_kernels[PAINT_ISA_MAX] = {
+	[PAINT_ISA_SCALAR] = fill32_scalar,
+#ifdef PAINT_X86
+	[PAINT_ISA_SSE2] = fill32_sse2,
+	[PAINT_ISA_AVX2] = fill32_avx2,
+	[PAINT_ISA_AVX512] = fill32_avx512,
+#endif
+#ifdef PAINT_NEON
+	[PAINT_ISA_NEON] = fill32_neon,
+#endif
+};
+
+/* NEON has no streaming stores worth having, it copies like scalar */
+static paint_copy_fn copy_kernels[PAINT_ISA_MAX] = {
+	[PAINT_ISA_SCALAR] = copy_scalar,
+#ifdef PAINT_X86
+	[PAINT_ISA_SSE2] = copy_nt_sse2,
+	[PAINT_ISA_AVX2] = copy_nt_avx2,
+	[PAINT_ISA_AVX512] = copy_nt_avx512,
+#endif
+#ifdef PAINT_NEON
+	[PAINT_ISA_NEON] = copy_scalar,
+#endif
+};
+
+/* AVX-512 CPUs blend with the AVX2 kernel */
+static paint_blend_fn blend_kernels[PAINT_ISA_MAX] = {
+	[PAINT_ISA_SCALAR] = blend_over_scalar,
+#ifdef PAINT_X86
+	[PAINT_ISA_SSE2] = blend_over_sse2,
+	[PAINT_ISA_AVX2] = blend_over_avx2,
+	[PAINT_ISA_AVX512] = blend_over_avx2,
+#endif
+#ifdef PAINT_NEON
+	[PAINT_ISA_NEON] = blend_over_neon,
+#endif
+};
+
+/* Gathers came with AVX2, SSE2 and NEON look up one pixel at a time */
+static paint_lookup32_fn lookup32_kernels[PAINT_ISA_MAX] = {
+	[PAINT_ISA_SCALAR] = lookup32_scalar,
+#ifdef PAINT_X86
+	[PAINT_ISA_SSE2] = lookup32_scalar,
+	[PAINT_ISA_AVX2] = lookup32_avx2,
+	[PAINT_ISA_AVX512] = lookup32_avx2,
+#endif
+#ifdef PAINT_NEON
+	[PAINT_ISA_NEON] = lookup32_scalar,
+#endif
+};
+
+/* SSE2 has no CRC instructions, ARM has them when built for ARMv8 CRC */
+static paint_crc32c_fn crc32c_kernels[PAINT_ISA_MAX] = {
+	[PAINT_ISA_SCALAR] = crc32c_scalar,
+#ifdef PAINT_X86
+	[PAINT_ISA_SSE2] = crc32c_scalar,
+	[PAINT_ISA_AVX2] = crc32c_sse42,
+	[PAINT_ISA_AVX512] = crc32c_sse42,
+#endif
+#ifdef PAINT_NEON
+#ifdef __ARM_FEATURE_CRC32
+	[PAINT_ISA_NEON] = crc32c_arm,
+#else
+	[PAINT_ISA_NEON] = crc32c_scalar,
+#endif
+#endif
+};
+
+/* SSE2 has no 32 bit packs with unsigned saturation, nor hadd */
+static paint_yuv_rows_fn yuv_rows_kernels[PAINT_ISA_MAX] = {
+	[PAINT_ISA_SCALAR] = yuv_rows_scalar,
+#ifdef PAINT_X86
+	[PAINT_ISA_SSE2] = yuv_rows_scalar,
+	[PAINT_ISA_AVX2] = yuv_rows_avx2,
+	[PAINT_ISA_AVX512] = yuv_rows_avx2,
+#endif
+#ifdef PAINT_NEON
+	[PAINT_ISA_NEON] = yuv_rows_neon,
+#endif
+};
+
+/* Gathers came with AVX2 */
+static paint_gather32_fn gather32_kernels[PAINT_ISA_MAX] = {
+	[PAINT_ISA_SCALAR] = gather32_scalar,
+#ifdef PAINT_X86
+	[PAINT_ISA_SSE2] = gather32_scalar,
+	[PAINT_ISA_AVX2] = gather32_avx2,
+	[PAINT_ISA_AVX512] = gather32_avx2,
+#endif
+#ifdef PAINT_NEON
+	[PAINT_ISA_NEON] = gather32_scalar,
+#endif
+};
+
+static paint_scale_vert_fn scale_vert_kernels[PAINT_ISA_MAX] = {
+	[PAINT_ISA_SCALAR] = scale_vert_scalar,
+#ifdef PAINT_X86
+	[PAINT_ISA_SSE2] = scale_vert_sse2,
+	[PAINT_ISA_AVX2] = scale_vert_avx2,
+	[PAINT_ISA_AVX512] = scale_vert_avx2,
+#endif
+#ifdef PAINT_NEON
+	[PAINT_ISA_NEON] = scale_vert_neon,
+#endif
+};
+
+static paint_span32_fn span32_kernels[PAINT_ISA_MAX] = {
+	[PAINT_ISA_SCALAR] = span32_scalar,
+#ifdef PAINT_X86
+	[PAINT_ISA_SSE2] = span32_sse2,
+	[PAINT_ISA_AVX2] = span32_avx2,
+	[PAINT_ISA_AVX512] = span32_avx2,
+#endif
+#ifdef PAINT_NEON
+	[PAINT_ISA_NEON] = span32_neon,
+#endif
+};
+
+/* A pixel's 4 channels fill an SSE2 vector, wider ones gain nothing */
+static paint_scale_horiz_fn scale_horiz_kernels[PAINT_ISA_MAX] = {
+	[PAINT_ISA_SCALAR] = scale_horiz_scalar,
+#ifdef PAINT_X86
+	[PAINT_ISA_SSE2] = scale_horiz_sse2,
+	[PAINT_ISA_AVX2] = scale_horiz_sse2,
+	[PAINT_ISA_AVX512] = scale_horiz_sse2,
+#endif
+#ifdef PAINT_NEON
+	[PAINT_ISA_NEON] = scale_horiz_neon,
+#endif
+};
+
+static int isa_supported(enum paint_isa isa)
+{
+	if (!fill32_kernels[isa])
+		return 0;
+
+#ifdef PAINT_X86
+	__builtin_cpu_init();
+	switch (isa) {
+	case PAINT_ISA_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case PAINT_ISA_AVX2:
+		return __builtin_cpu_supports("avx2");
+	case PAINT_ISA_AVX512:
+		return __builtin_cpu_supports("avx512f");
+	default:
+		break;
+	}
+#endif
+	return 1;
+}
+
+static enum paint_isa pick_best_isa(void)
+{
+	enum paint_isa isa;
+
+	for (isa = PAINT_ISA_MAX - 1; isa > PAINT_ISA_SCALAR; isa--)
+		if (isa_supported(isa))
+			return isa;
+
+	return PAINT_ISA_SCALAR;
+}
+
+/*
+ * Runs at library load time. PAINT_SIMD=<name> in environment can force a
+ * lower ISA, to compare the kernels against each other.
+ */
+__attribute__((constructor))
+static void paint_simd_init(void)
+{
+	const char *forced = getenv("PAINT_SIMD");
+	enum paint_isa isa = pick_best_isa();
+	int i;
+
+	crc32c_init_tables();
+
+	if (forced) {
+		for (i = 0; i < PAINT_ISA_MAX; i++) {
+			if (!strcmp(forced, isa_names[i]))
+				break;
+		}
+
+		if (i < PAINT_ISA_MAX && isa_supported(i))
+			isa = i;
+		else
+			printf("PAINT_SIMD=%s not supported, using %s\n", forced, isa_names[isa]);
+	}
+
+	paint_active_isa = isa;
+	paint_fill32 = fill32_kernels[isa];
+	paint_copy_nt = copy_kernels[isa];
+	paint_blend_over = blend_kernels[isa];
+	paint_lookup32 = lookup32_kernels[isa];
+	paint_crc32c = crc32c_kernels[isa];
+	paint_yuv_rows = yuv_rows_kernels[isa];
+	paint_gather32 = gather32_kernels[isa];
+	paint_scale_vert = scale_vert_kernels[isa];
+	paint_scale_horiz = scale_horiz_kernels[isa];
+	paint_span32 = span32_kernels[isa];
+}
+
+const char *paint_get_simd_isa(void)
+{
+	return isa_names[paint_active_isa];
+}
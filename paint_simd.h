@@ -0,0 +1,129 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Internal to libpaint: row fill kernels, picked once at library load
+ * time as per the CPU features. Not to be included by the tools.
+ */
+#ifndef __PAINT_SIMD_H__
+#define __PAINT_SIMD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum paint_isa {
+	PAINT_ISA_SCALAR = 0,
+	PAINT_ISA_SSE2,
+	PAINT_ISA_AVX2,
+	PAINT_ISA_AVX512,
+	PAINT_ISA_NEON,
+	PAINT_ISA_MAX,
+};
+
+/* Fill n 32 bit pixels starting at dst with val */
+typedef void (*paint_fill32_fn)(uint32_t *dst, uint32_t val, size_t n);
+
+extern paint_fill32_fn paint_fill32;
+extern enum paint_isa paint_active_isa;
+
+/* 16 bit pixels, done as 32 bit fills of pixel pairs */
+void paint_fill16(uint16_t *dst, uint16_t val, size_t n);
+
+/*
+ * Copy n bytes with non-temporal stores, for destinations which won't be
+ * read back soon (scanout). paint_stream_fence() orders them once a band
+ * of rows is done.
+ */
+typedef void (*paint_copy_fn)(void *dst, const void *src, size_t n);
+
+extern paint_copy_fn paint_copy_nt;
+void paint_stream_fence(void);
+
+/*
+ * Blend n premultiplied ARGB8888 pixels of src over dst (Porter-Duff over).
+ * Runs of fully transparent and fully opaque pixels skip the arithmetic.
+ */
+typedef void (*paint_blend_fn)(uint32_t *dst, const uint32_t *src, size_t n);
+
+extern paint_blend_fn paint_blend_over;
+
+/* dst[i] = lut[idx[i]] for n pixels, lut has 256 entries */
+typedef void (*paint_lookup32_fn)(uint32_t *dst, const uint8_t *idx,
+		const uint32_t *lut, size_t n);
+
+extern paint_lookup32_fn paint_lookup32;
+
+#define PAINT_CRC32C_POLY 0x82f63b78
+
+/* CRC32C of n more bytes, crc is the running value without inversions */
+typedef uint32_t (*paint_crc32c_fn)(uint32_t crc, const void *buf, size_t n);
+
+extern paint_crc32c_fn paint_crc32c;
+
+/*
+ * Fixed point RGB to YUV: a sample is (coef . (B, G, R) + round) >> shift,
+ * chroma is done on the sums of 2x2 blocks, so shifted by 2 more. The 4th
+ * coefficient is for the X byte, and always 0.
+ */
+struct paint_yuv_coefs {
+	int16_t y[4];
+	int16_t u[4];
+	int16_t v[4];
+	int32_t y_round;
+	int32_t c_round;
+	int shift;
+	int max;
+};
+
+typedef void (*paint_yuv_rows_fn)(const struct paint_yuv_coefs *c, const uint32_t *s0,
+		const uint32_t *s1, uint16_t *y0, uint16_t *y1, uint16_t *u, uint16_t *v, size_t n);
+
+extern paint_yuv_rows_fn paint_yuv_rows;
+
+/* dst[i] = src[idx[i]] for n pixels */
+typedef void (*paint_gather32_fn)(uint32_t *dst, const uint32_t *src, const int32_t *idx,
+		size_t n);
+
+extern paint_gather32_fn paint_gather32;
+
+/*
+ * Separable filter passes over the 4 bytes of each pixel, with coefficients
+ * of PAINT_SCALE_BITS fraction. Vertical: pixel i of dst is the sum of pixel
+ * i of the taps rows. Horizontal: pixel i of dst is the sum of the taps
+ * pixels of src from start[i] on, coef[i * taps] being the first's.
+ */
+#define PAINT_SCALE_BITS 14
+
+typedef void (*paint_scale_vert_fn)(uint32_t *dst, const uint32_t *const *rows,
+		const int16_t *coef, int taps, size_t n);
+typedef void (*paint_scale_horiz_fn)(uint32_t *dst, const uint32_t *src, const int32_t *start,
+		const int16_t *coef, int taps, size_t n);
+
+extern paint_scale_vert_fn paint_scale_vert;
+extern paint_scale_horiz_fn paint_scale_horiz;
+
+/* How many pixels from src on are val, n at most */
+typedef size_t (*paint_span32_fn)(const uint32_t *src, uint32_t val, size_t n);
+
+extern paint_span32_fn paint_span32;
+
+#endif
@@ -0,0 +1,340 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "paint_thread.h"
+
+#define MAX_PAINT_THREADS 256
+
+/*
+ * Each participant owns a contiguous range of bands [head, tail), packed
+ * in one word so that the owner (taking from head) and the thieves (taking
+ * from tail) can race on it with a single CAS.
+ */
+struct band_queue {
+	_Atomic uint64_t range;
+} __attribute__((aligned(64)));
+
+struct paint_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	pthread_t *workers;
+	struct band_queue *queues;
+	/* Participants, including the calling thread as 0 */
+	int nthreads;
+	int finished;
+	int quit;
+	unsigned long generation;
+
+	/* Current job */
+	paint_band_fn fn;
+	void *arg;
+	int rows;
+	int band_rows;
+};
+
+/* Serializes the jobs, and the thread count changes */
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct paint_pool *pool;
+/* 0 = not decided yet, picked from PAINT_THREADS or the online CPUs */
+static int requested_threads;
+static __thread int in_band;
+
+static inline uint64_t pack_range(uint32_t head, uint32_t tail)
+{
+	return (uint64_t)head << 32 | tail;
+}
+
+static int pop_band(struct band_queue *q, int *band)
+{
+	uint64_t r = atomic_load(&q->range);
+	uint32_t head, tail;
+
+	do {
+		head = r >> 32;
+		tail = (uint32_t)r;
+		if (head >= tail)
+			return 0;
+	} while (!atomic_compare_exchange_weak(&q->range, &r, pack_range(head + 1, tail)));
+
+	*band = head;
+	return 1;
+}
+
+static int steal_band(struct band_queue *q, int *band)
+{
+	uint64_t r = atomic_load(&q->range);
+	uint32_t head, tail;
+
+	do {
+		head = r >> 32;
+		tail = (uint32_t)r;
+		if (head >= tail)
+			return 0;
+	} while (!atomic_compare_exchange_weak(&q->range, &r, pack_range(head, tail - 1)));
+
+	*band = tail - 1;
+	return 1;
+}
+
+static void run_band(struct paint_pool *p, int band)
+{
+	int y0 = band * p->band_rows;
+	int y1 = y0 + p->band_rows;
+
+	if (y1 > p->rows)
+		y1 = p->rows;
+
+	p->fn(p->arg, y0, y1);
+}
+
+/* Drain own bands first, then go around the others and steal from their tail */
+static void participate(struct paint_pool *p, int id)
+{
+	int band, i;
+
+	in_band = 1;
+	while (pop_band(&p->queues[id], &band))
+		run_band(p, band);
+
+	for (i = 1; i < p->nthreads; i++) {
+		struct band_queue *victim = &p->queues[(id + i) % p->nthreads];
+
+		while (steal_band(victim, &band))
+			run_band(p, band);
+	}
+	in_band = 0;
+}
+
+struct worker_arg {
+	struct paint_pool *p;
+	int id;
+};
+
+static void *paint_worker(void *data)
+{
+	struct worker_arg *wa = data;
+	struct paint_pool *p = wa->p;
+	int id = wa->id;
+	unsigned long seen = 0;
+
+	free(wa);
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (!p->quit && p->generation == seen)
+			pthread_cond_wait(&p->wake, &p->lock);
+		if (p->quit)
+			break;
+		seen = p->generation;
+		pthread_mutex_unlock(&p->lock);
+
+		participate(p, id);
+
+		pthread_mutex_lock(&p->lock);
+		if (++p->finished == p->nthreads - 1)
+			pthread_cond_signal(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+static int pick_num_threads(void)
+{
+	const char *env = getenv("PAINT_THREADS");
+	long n = 0;
+
+	if (env)
+		n = atoi(env);
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n <= 0)
+		n = 1;
+	if (n > MAX_PAINT_THREADS)
+		n = MAX_PAINT_THREADS;
+	return n;
+}
+
+static void destroy_pool(struct paint_pool *p)
+{
+	int i;
+
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->wake);
+	pthread_mutex_unlock(&p->lock);
+
+	for (i = 0; i < p->nthreads - 1; i++)
+		pthread_join(p->workers[i], NULL);
+
+	pthread_cond_destroy(&p->wake);
+	pthread_cond_destroy(&p->done);
+	pthread_mutex_destroy(&p->lock);
+	free(p->workers);
+	free(p->queues);
+	free(p);
+}
+
+static struct paint_pool *create_pool(int nthreads)
+{
+	struct paint_pool *p;
+	struct worker_arg *wa;
+	int i;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	p->workers = calloc(nthreads, sizeof(*p->workers));
+	p->queues = aligned_alloc(64, nthreads * sizeof(*p->queues));
+	if (!p->workers || !p->queues) {
+		free(p->workers);
+		free(p->queues);
+		free(p);
+		return NULL;
+	}
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->wake, NULL);
+	pthread_cond_init(&p->done, NULL);
+	p->nthreads = 1;
+
+	for (i = 1; i < nthreads; i++) {
+		wa = malloc(sizeof(*wa));
+		if (!wa)
+			break;
+		wa->p = p;
+		wa->id = i;
+		if (pthread_create(&p->workers[i - 1], NULL, paint_worker, wa)) {
+			printf("Failed to create paint worker %d, continuing with %d\n", i, i);
+			free(wa);
+			break;
+		}
+		p->nthreads++;
+	}
+
+	return p;
+}
+
+/* ============ Exported functions =========== */
+
+int paint_set_threads(int n)
+{
+	if (n < 0 || n > MAX_PAINT_THREADS) {
+		printf("Invalid thread count %d\n", n);
+		return -1;
+	}
+
+	pthread_mutex_lock(&job_lock);
+	if (pool) {
+		destroy_pool(pool);
+		pool = NULL;
+	}
+	requested_threads = n ? n : pick_num_threads();
+	pthread_mutex_unlock(&job_lock);
+	return 0;
+}
+
+int paint_get_threads(void)
+{
+	int n;
+
+	pthread_mutex_lock(&job_lock);
+	if (!requested_threads)
+		requested_threads = pick_num_threads();
+	n = requested_threads;
+	pthread_mutex_unlock(&job_lock);
+	return n;
+}
+
+void paint_run_bands(int rows, int row_bytes, paint_band_fn fn, void *arg)
+{
+	int band_rows, nbands, per, extra, start, i;
+	struct paint_pool *p;
+
+	if (rows <= 0)
+		return;
+
+	band_rows = row_bytes > 0 ? PAINT_BAND_BYTES / row_bytes : rows;
+	if (band_rows < 1)
+		band_rows = 1;
+	nbands = (rows + band_rows - 1) / band_rows;
+
+	if (in_band || nbands < 2) {
+		fn(arg, 0, rows);
+		return;
+	}
+
+	pthread_mutex_lock(&job_lock);
+	if (!requested_threads)
+		requested_threads = pick_num_threads();
+
+	if (requested_threads == 1) {
+		pthread_mutex_unlock(&job_lock);
+		fn(arg, 0, rows);
+		return;
+	}
+
+	if (!pool)
+		pool = create_pool(requested_threads);
+	p = pool;
+	if (!p || p->nthreads == 1) {
+		pthread_mutex_unlock(&job_lock);
+		fn(arg, 0, rows);
+		return;
+	}
+
+	/* Hand out contiguous ranges of bands, so neighbours share pages */
+	per = nbands / p->nthreads;
+	extra = nbands % p->nthreads;
+	for (i = 0, start = 0; i < p->nthreads; i++) {
+		int cnt = per + (i < extra);
+
+		atomic_store(&p->queues[i].range, pack_range(start, start + cnt));
+		start += cnt;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->fn = fn;
+	p->arg = arg;
+	p->rows = rows;
+	p->band_rows = band_rows;
+	p->finished = 0;
+	p->generation++;
+	pthread_cond_broadcast(&p->wake);
+	pthread_mutex_unlock(&p->lock);
+
+	participate(p, 0);
+
+	pthread_mutex_lock(&p->lock);
+	while (p->finished < p->nthreads - 1)
+		pthread_cond_wait(&p->done, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+
+	pthread_mutex_unlock(&job_lock);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Internal to libpaint: a persistent worker pool which splits a job of
+ * 'rows' into cache sized bands of rows, and runs them on all the workers.
+ */
+#ifndef __PAINT_THREAD_H__
+#define __PAINT_THREAD_H__
+
+/* Bands are sized to stay in a core's L2 */
+#define PAINT_BAND_BYTES (256 * 1024)
+
+/* Paint rows [y0, y1) of the job */
+typedef void (*paint_band_fn)(void *arg, int y0, int y1);
+
+/*
+ * Runs fn over all the rows and returns when all of them are done. Small
+ * jobs, single threaded mode and calls from inside a band run inline.
+ */
+void paint_run_bands(int rows, int row_bytes, paint_band_fn fn, void *arg);
+
+#endif
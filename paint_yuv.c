@@ -0,0 +1,334 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * RGB to YUV: the SIMD kernel turns two rows of pixels into 16 bit Y, U
+ * and V samples of the output's depth, which then get packed the way the
+ * format lays them out. The samples stay in the cache in between.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "paint.h"
+#include "paint_simd.h"
+#include "paint_thread.h"
+
+struct yuv_format {
+	uint32_t fourcc;
+	int planes;
+	/* Bytes per sample, 2 for P010 */
+	int bps;
+	int depth;
+	/* Rows of chroma per row of luma: 2 for 4:2:0, 1 for 4:2:2 */
+	int v_sub;
+};
+
+static const struct yuv_format yuv_formats[] = {
+	{ DRM_FORMAT_NV12, 2, 1, 8, 2 },
+	{ DRM_FORMAT_YUV420, 3, 1, 8, 2 },
+	{ DRM_FORMAT_YUYV, 1, 1, 8, 1 },
+	{ DRM_FORMAT_P010, 2, 2, 10, 2 },
+};
+
+static const struct yuv_format *lookup_yuv_format(uint32_t fourcc)
+{
+	int i;
+
+	for (i = 0; i < sizeof(yuv_formats) / sizeof(yuv_formats[0]); i++) {
+		if (yuv_formats[i].fourcc == fourcc)
+			return &yuv_formats[i];
+	}
+
+	return NULL;
+}
+
+long paint_yuv_buf_init(struct paint_yuv_buf *buf, char *base, int width, int height,
+		int pitch, uint32_t format)
+{
+	const struct yuv_format *fmt = lookup_yuv_format(format);
+	int cw = (width + 1) / 2, ch = (height + 1) / 2;
+	int min_pitch = fmt ? cw * 2 * fmt->bps : 0;
+
+	if (!fmt || width <= 0 || height <= 0) {
+		printf("Can't lay out a %dx%d buffer of format 0x%x\n", width, height, format);
+		return -1;
+	}
+
+	/* Odd widths still have whole U V pairs, as wide as one more pixel */
+	if (format == DRM_FORMAT_YUYV)
+		min_pitch = cw * 4;
+	if (pitch && pitch < min_pitch) {
+		printf("Pitch %d too small for %d pixels, need %d\n", pitch, width, min_pitch);
+		return -1;
+	}
+
+	memset(buf, 0, sizeof(*buf));
+	buf->width = width;
+	buf->height = height;
+	buf->format = format;
+
+	if (format == DRM_FORMAT_YUYV) {
+		buf->pitches[0] = pitch ? pitch : min_pitch;
+		buf->planes[0] = base;
+		return (long)buf->pitches[0] * height;
+	}
+
+	buf->pitches[0] = pitch ? pitch : min_pitch;
+	buf->planes[0] = base;
+	buf->planes[1] = base + (long)buf->pitches[0] * height;
+
+	/* Interleaved U and V take as many bytes a row as Y does */
+	if (fmt->planes == 2) {
+		buf->pitches[1] = buf->pitches[0];
+		return (long)buf->pitches[0] * (height + ch);
+	}
+
+	buf->pitches[1] = buf->pitches[2] = (buf->pitches[0] + 1) / 2;
+	buf->planes[2] = buf->planes[1] + (long)buf->pitches[1] * ch;
+	return (long)buf->pitches[0] * height + 2L * buf->pitches[1] * ch;
+}
+
+/* ============ Coefficients =========== */
+
+/*
+ * Y = Kr R + Kg G + Kb B, U = (B - Y) / (2 (1 - Kb)), V = (R - Y) / (2 (1 - Kr))
+ * for RGB and Y in [0, 1], U and V in [-0.5, 0.5]. Then scaled to the range:
+ * limited is 16-235 for Y and 16-240 for U and V at 8 bits, times 4 at 10.
+ * Coefficients get as many bits of fraction as 16 bits have room for at
+ * full range: 15 at 8 bits, 13 at 10, where they are 4 times as large.
+ * Fewer bits put 10 bit luma more than half a code value off.
+ */
+static void yuv_coefs_init(struct paint_yuv_coefs *c, const struct yuv_format *fmt,
+		enum paint_yuv_encoding encoding, enum paint_yuv_range range)
+{
+	double kr = encoding == PAINT_YUV_BT709 ? 0.2126 : 0.299;
+	double kb = encoding == PAINT_YUV_BT709 ? 0.0722 : 0.114;
+	double kg = 1 - kr - kb, y_scale, c_scale, one;
+	int y_off, c_off = 128 << (fmt->depth - 8);
+
+	c->shift = 23 - fmt->depth;
+	c->max = (1 << fmt->depth) - 1;
+	one = 1 << c->shift;
+
+	if (range == PAINT_YUV_FULL) {
+		y_scale = c_scale = (double)c->max / 255;
+		y_off = 0;
+	} else {
+		y_scale = 219.0 * (1 << (fmt->depth - 8)) / 255;
+		c_scale = 224.0 * (1 << (fmt->depth - 8)) / 255;
+		y_off = 16 << (fmt->depth - 8);
+	}
+
+	/* B, G, R, the order of the bytes of an XRGB8888 pixel */
+	c->y[0] = lround(kb * y_scale * one);
+	c->y[1] = lround(kg * y_scale * one);
+	c->y[2] = lround(kr * y_scale * one);
+	c->u[0] = lround(0.5 * c_scale * one);
+	c->u[1] = lround(-kg / (2 * (1 - kb)) * c_scale * one);
+	c->u[2] = lround(-kr / (2 * (1 - kb)) * c_scale * one);
+	c->v[0] = lround(-kb / (2 * (1 - kr)) * c_scale * one);
+	c->v[1] = lround(-kg / (2 * (1 - kr)) * c_scale * one);
+	c->v[2] = lround(0.5 * c_scale * one);
+	c->y[3] = c->u[3] = c->v[3] = 0;
+
+	c->y_round = (y_off << c->shift) + (1 << (c->shift - 1));
+	c->c_round = (c_off << (c->shift + 2)) + (1 << (c->shift + 1));
+}
+
+/* ============ Conversion =========== */
+
+struct yuv_rows {
+	const struct paint_view *src;
+	struct paint_yuv_buf *dst;
+	const struct yuv_format *fmt;
+	struct paint_yuv_coefs coefs;
+	int width;
+	int height;
+};
+
+static void store8(uint8_t *dst, const uint16_t *s, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = s[i];
+}
+
+/* P010 keeps the 10 bits at the top of each 16 bit sample */
+static void store16(uint16_t *dst, const uint16_t *s, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = s[i] << 6;
+}
+
+static void store_uv8(uint8_t *dst, const uint16_t *u, const uint16_t *v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dst[2 * i] = u[i];
+		dst[2 * i + 1] = v[i];
+	}
+}
+
+static void store_uv16(uint16_t *dst, const uint16_t *u, const uint16_t *v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dst[2 * i] = u[i] << 6;
+		dst[2 * i + 1] = v[i] << 6;
+	}
+}
+
+/* An odd last pixel gets its Y repeated, to fill up the pair */
+static void store_yuyv(uint8_t *dst, const uint16_t *y, const uint16_t *u,
+		const uint16_t *v, int w)
+{
+	int i;
+
+	for (i = 0; i < w / 2; i++) {
+		dst[4 * i] = y[2 * i];
+		dst[4 * i + 1] = u[i];
+		dst[4 * i + 2] = y[2 * i + 1];
+		dst[4 * i + 3] = v[i];
+	}
+
+	if (w & 1) {
+		dst[4 * i] = dst[4 * i + 2] = y[2 * i];
+		dst[4 * i + 1] = u[i];
+		dst[4 * i + 3] = v[i];
+	}
+}
+
+static void store_luma(struct yuv_rows *r, int y, const uint16_t *samples)
+{
+	char *row = r->dst->planes[0] + (long)y * r->dst->pitches[0];
+
+	if (r->fmt->bps == 2)
+		store16((uint16_t *)row, samples, r->width);
+	else
+		store8((uint8_t *)row, samples, r->width);
+}
+
+static void store_chroma(struct yuv_rows *r, int cy, const uint16_t *u, const uint16_t *v)
+{
+	struct paint_yuv_buf *d = r->dst;
+	int cw = (r->width + 1) / 2;
+
+	switch (r->fmt->fourcc) {
+	case DRM_FORMAT_NV12:
+		store_uv8((uint8_t *)(d->planes[1] + (long)cy * d->pitches[1]), u, v, cw);
+		break;
+	case DRM_FORMAT_P010:
+		store_uv16((uint16_t *)(d->planes[1] + (long)cy * d->pitches[1]), u, v, cw);
+		break;
+	case DRM_FORMAT_YUV420:
+		store8((uint8_t *)(d->planes[1] + (long)cy * d->pitches[1]), u, cw);
+		store8((uint8_t *)(d->planes[2] + (long)cy * d->pitches[2]), v, cw);
+		break;
+	}
+}
+
+/* Rows here are chroma rows, each is one or two rows of pixels */
+static void yuv_rows_band(void *arg, int cy0, int cy1)
+{
+	struct yuv_rows *r = arg;
+	const struct paint_view *src = r->src;
+	int cw = (r->width + 1) / 2, cy, y;
+	const uint32_t *s0, *s1;
+	uint16_t *y0, *y1, *u, *v;
+
+	y0 = malloc(sizeof(*y0) * (2 * r->width + 2 * cw));
+	if (!y0) {
+		printf("Out of memory for %d YUV samples\n", 2 * r->width + 2 * cw);
+		return;
+	}
+	y1 = y0 + r->width;
+	u = y1 + r->width;
+	v = u + cw;
+
+	for (cy = cy0; cy < cy1; cy++) {
+		y = cy * r->fmt->v_sub;
+		s0 = (const uint32_t *)(src->base + (long)y * src->stride);
+
+		if (r->fmt->v_sub == 1) {
+			paint_yuv_rows(&r->coefs, s0, s0, y0, NULL, u, v, r->width);
+			store_yuyv((uint8_t *)(r->dst->planes[0] + (long)y * r->dst->pitches[0]),
+					y0, u, v, r->width);
+			continue;
+		}
+
+		/* An odd last row makes a block with itself */
+		if (y + 1 < r->height) {
+			s1 = (const uint32_t *)(src->base + (long)(y + 1) * src->stride);
+			paint_yuv_rows(&r->coefs, s0, s1, y0, y1, u, v, r->width);
+			store_luma(r, y + 1, y1);
+		} else {
+			paint_yuv_rows(&r->coefs, s0, s0, y0, NULL, u, v, r->width);
+		}
+
+		store_luma(r, y, y0);
+		store_chroma(r, cy, u, v);
+	}
+
+	free(y0);
+}
+
+int paint_convert_to_yuv(struct paint_yuv_buf *dst, const struct paint_view *src,
+		enum paint_yuv_encoding encoding, enum paint_yuv_range range)
+{
+	struct yuv_rows r;
+
+	if (!dst || !src || !src->base || !dst->planes[0]) {
+		printf("Invalid input, nothing to convert\n");
+		return -1;
+	}
+
+	if (src->format != DRM_FORMAT_XRGB8888 && src->format != DRM_FORMAT_ARGB8888) {
+		printf("Can't convert 0x%x to YUV\n", src->format);
+		return -1;
+	}
+
+	r.fmt = lookup_yuv_format(dst->format);
+	if (!r.fmt) {
+		printf("Unsupported YUV format 0x%x\n", dst->format);
+		return -1;
+	}
+
+	r.src = src;
+	r.dst = dst;
+	r.width = src->width < dst->width ? src->width : dst->width;
+	r.height = src->height < dst->height ? src->height : dst->height;
+	if (r.width <= 0 || r.height <= 0)
+		return 0;
+
+	yuv_coefs_init(&r.coefs, r.fmt, encoding, range);
+	paint_run_bands((r.height + r.fmt->v_sub - 1) / r.fmt->v_sub,
+			r.width * 4 * r.fmt->v_sub, yuv_rows_band, &r);
+	return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Bits shared by the tests: each one is a program which runs its checks,
+ * says which failed, and exits non zero if any did.
+ */
+#ifndef __TEST_H__
+#define __TEST_H__
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define CHECK(cond) do {							\
+	if (!(cond)) {								\
+		printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond);	\
+		test_failures++;						\
+	}									\
+} while (0)
+
+#define CHECK_EQ(a, b) do {							\
+	long long __a = (a), __b = (b);					\
+	if (__a != __b) {							\
+		printf("%s:%d: %s is %lld, not %lld\n", __FILE__, __LINE__,	\
+			#a, __a, __b);						\
+		test_failures++;						\
+	}									\
+} while (0)
+
+static inline int test_report(const char *name)
+{
+	printf("%s: %s\n", name, test_failures ? "FAILED" : "passed");
+	return test_failures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * The buffer pool on the headless backend, whose buffers are memfds: what
+ * a get is served from, and which idle buffers a put or a get evicts.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../drm_buffer_pool.h"
+#include "test.h"
+
+#define W 64
+#define H 48
+#define FMT DRM_FORMAT_XRGB8888
+
+static struct backend be;
+
+static void check_stats(struct buffer_pool *pool, unsigned long hits,
+		unsigned long misses, unsigned long evictions)
+{
+	CHECK_EQ(pool->hits, hits);
+	CHECK_EQ(pool->misses, misses);
+	CHECK_EQ(pool->evictions, evictions);
+}
+
+/* A put buffer comes back, as it was painted, for the same size only */
+static void test_reuse(void)
+{
+	struct buffer_pool pool;
+	struct fb *a, *b, *c;
+
+	CHECK_EQ(buffer_pool_init(&pool, &be, 4), 0);
+
+	a = buffer_pool_get(&pool, W, H, FMT);
+	CHECK(a && a->mapped_fb);
+	check_stats(&pool, 0, 1, 0);
+	memset(a->mapped_fb, 0x5a, a->size);
+
+	buffer_pool_put(&pool, a);
+	b = buffer_pool_get(&pool, W, H, FMT);
+	CHECK(b == a);
+	CHECK_EQ(((uint8_t *)b->mapped_fb)[0], 0x5a);
+	check_stats(&pool, 1, 1, 0);
+
+	/* In use, or of another size or format, is a miss */
+	c = buffer_pool_get(&pool, W, H, FMT);
+	CHECK(c && c != a);
+	buffer_pool_put(&pool, c);
+	c = buffer_pool_get(&pool, W * 2, H, FMT);
+	CHECK(c && c != a);
+	buffer_pool_put(&pool, c);
+	c = buffer_pool_get(&pool, W, H, DRM_FORMAT_RGB565);
+	CHECK(c && c != a);
+	check_stats(&pool, 1, 4, 0);
+
+	buffer_pool_put(&pool, c);
+	buffer_pool_put(&pool, b);
+	buffer_pool_fini(&pool);
+}
+
+/* Of the matches, the last one put is handed out first */
+static void test_most_recent(void)
+{
+	struct buffer_pool pool;
+	struct fb *a, *b;
+
+	CHECK_EQ(buffer_pool_init(&pool, &be, 4), 0);
+	a = buffer_pool_get(&pool, W, H, FMT);
+	b = buffer_pool_get(&pool, W, H, FMT);
+	buffer_pool_put(&pool, a);
+	buffer_pool_put(&pool, b);
+
+	CHECK(buffer_pool_get(&pool, W, H, FMT) == b);
+	CHECK(buffer_pool_get(&pool, W, H, FMT) == a);
+	check_stats(&pool, 2, 2, 0);
+	buffer_pool_fini(&pool);
+}
+
+/* Past max_idle, a put releases the least recently put ones */
+static void test_max_idle(void)
+{
+	struct buffer_pool pool;
+	struct fb *fbs[4];
+	int i;
+
+	CHECK_EQ(buffer_pool_init(&pool, &be, 2), 0);
+	for (i = 0; i < 4; i++)
+		fbs[i] = buffer_pool_get(&pool, W, H, FMT);
+	for (i = 0; i < 4; i++)
+		buffer_pool_put(&pool, fbs[i]);
+	check_stats(&pool, 0, 4, 2);
+
+	/* fbs[2] and fbs[3] are the ones left */
+	CHECK(buffer_pool_get(&pool, W, H, FMT) == fbs[3]);
+	CHECK(buffer_pool_get(&pool, W, H, FMT) == fbs[2]);
+	CHECK(buffer_pool_get(&pool, W, H, FMT) != NULL);
+	check_stats(&pool, 2, 5, 2);
+	buffer_pool_fini(&pool);
+}
+
+/* With every slot taken, a miss makes room by evicting the LRU idle buffer */
+static void test_full(void)
+{
+	struct buffer_pool pool;
+	struct fb *fbs[BUFFER_POOL_MAX];
+	struct fb *fb;
+	int i;
+
+	CHECK_EQ(buffer_pool_init(&pool, &be, BUFFER_POOL_MAX), 0);
+	for (i = 0; i < BUFFER_POOL_MAX; i++)
+		fbs[i] = buffer_pool_get(&pool, W, H, FMT);
+	CHECK(buffer_pool_get(&pool, W, H, FMT) == NULL);
+	check_stats(&pool, 0, BUFFER_POOL_MAX + 1, 0);
+
+	buffer_pool_put(&pool, fbs[1]);
+	buffer_pool_put(&pool, fbs[0]);
+	fb = buffer_pool_get(&pool, W * 2, H * 2, FMT);
+	CHECK(fb == fbs[1]);
+	CHECK(fb && fb->x == W * 2 && fb->y == H * 2);
+	check_stats(&pool, 0, BUFFER_POOL_MAX + 2, 1);
+
+	/* fbs[0] is still there */
+	CHECK(buffer_pool_get(&pool, W, H, FMT) == fbs[0]);
+	check_stats(&pool, 1, BUFFER_POOL_MAX + 2, 1);
+	buffer_pool_fini(&pool);
+}
+
+int main(void)
+{
+	struct headless_config cfg = { .width = W, .height = H, .refresh = 0, };
+
+	if (backend_headless_init(&be, &cfg, 0)) {
+		printf("Failed to init the headless backend\n");
+		return 1;
+	}
+
+	test_reuse();
+	test_most_recent();
+	test_max_idle();
+	test_full();
+
+	backend_fini(&be);
+	return test_report("buffer_pool");
+}
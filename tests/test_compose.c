@@ -0,0 +1,166 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Painting into compositor layers with the paint functions, then composing
+ * them: colors of an ARGB palette keep their alpha in ARGB8888 layers,
+ * those of other palettes are opaque.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../paint.h"
+#include "test.h"
+
+#define W 16
+#define H 16
+
+enum {
+	WHITE,
+	HALF_RED,
+	CLEAR,
+	NUM_COLORS,
+};
+
+static const uint32_t colors[NUM_COLORS] = {
+	[WHITE] = 0xFFFFFFFF,
+	[HALF_RED] = 0x80FF0000,
+	[CLEAR] = 0x00000000,
+};
+
+static uint32_t px_at(const struct paint_buf *buf, int x, int y)
+{
+	return ((uint32_t *)(buf->base + (long)y * buf->stride))[x] & 0xFFFFFF;
+}
+
+/* A translucent layer over white, with a fully transparent hole in it */
+static void test_translucent(struct paint_palette *pal)
+{
+	struct paint_compositor comp;
+	struct paint_buf target, *l;
+	char *pixels = calloc(W * H, 4);
+	int bg, top;
+
+	CHECK_EQ(paint_buf_init(&target, pixels, W, H, 0, DRM_FORMAT_XRGB8888), 0);
+	CHECK_EQ(paint_compositor_init(&comp, &target), 0);
+
+	paint_set_palette(pal);
+	bg = paint_compositor_add_layer(&comp, W, H, DRM_FORMAT_XRGB8888, 0);
+	paint_a_buffer_region_clr(paint_compositor_layer(&comp, bg), 0, 0, W, H, WHITE);
+
+	top = paint_compositor_add_layer(&comp, W / 2, H / 2, DRM_FORMAT_ARGB8888, 0);
+	l = paint_compositor_layer(&comp, top);
+	paint_a_buffer_region_clr(l, 0, 0, W / 2, H / 2, HALF_RED);
+	paint_a_buffer_region_clr(l, 0, 0, 2, 2, CLEAR);
+	paint_compositor_move_layer(&comp, top, 4, 4);
+
+	CHECK(paint_compositor_compose(&comp) > 0);
+
+	/* 0x80 of red, premultiplied to 0x80, plus 0x7F of white */
+	CHECK_EQ(px_at(&target, 8, 8), 0xFF7F7F);
+	CHECK_EQ(px_at(&target, 4, 4), 0xFFFFFF);
+	CHECK_EQ(px_at(&target, 2, 2), 0xFFFFFF);
+
+	/* Pixels read back from the layer still have the alpha painted */
+	CHECK_EQ(((uint32_t *)l->base)[W / 2 - 1] >> 24, 0x80);
+
+	paint_set_palette(NULL);
+	paint_compositor_fini(&comp);
+	free(pixels);
+}
+
+/* The same layer painted with a plain palette is opaque, as before */
+static void test_opaque(struct paint_palette *pal)
+{
+	struct paint_compositor comp;
+	struct paint_buf target;
+	char *pixels = calloc(W * H, 4);
+	int bg, top;
+
+	CHECK_EQ(paint_buf_init(&target, pixels, W, H, 0, DRM_FORMAT_XRGB8888), 0);
+	CHECK_EQ(paint_compositor_init(&comp, &target), 0);
+
+	paint_set_palette(pal);
+	bg = paint_compositor_add_layer(&comp, W, H, DRM_FORMAT_XRGB8888, 0);
+	paint_a_buffer_region_clr(paint_compositor_layer(&comp, bg), 0, 0, W, H, WHITE);
+	top = paint_compositor_add_layer(&comp, W / 2, H / 2, DRM_FORMAT_ARGB8888, 0);
+	paint_a_buffer_region_clr(paint_compositor_layer(&comp, top), 0, 0, W / 2, H / 2,
+			HALF_RED);
+
+	CHECK(paint_compositor_compose(&comp) > 0);
+	CHECK_EQ(px_at(&target, 0, 0), 0xFF0000);
+	CHECK_EQ(px_at(&target, W - 1, H - 1), 0xFFFFFF);
+
+	paint_set_palette(NULL);
+	paint_compositor_fini(&comp);
+	free(pixels);
+}
+
+/*
+ * XRGB8888 layers into an ARGB8888 target are opaque there too, whatever
+ * their X bytes: a plain palette packs those as 0.
+ */
+static void test_argb_target(void)
+{
+	static const uint32_t red[] = { 0x00FF0000 };
+	struct paint_palette *pal = paint_palette_create(1, red);
+	struct paint_compositor comp;
+	struct paint_buf target;
+	char *pixels = calloc(W * H, 4);
+	int bg;
+
+	CHECK_EQ(paint_buf_init(&target, pixels, W, H, 0, DRM_FORMAT_ARGB8888), 0);
+	CHECK_EQ(paint_compositor_init(&comp, &target), 0);
+
+	paint_set_palette(pal);
+	bg = paint_compositor_add_layer(&comp, W, H, DRM_FORMAT_XRGB8888, 0);
+	paint_a_buffer_region_clr(paint_compositor_layer(&comp, bg), 0, 0, W, H, 0);
+
+	CHECK(paint_compositor_compose(&comp) > 0);
+	CHECK_EQ(((uint32_t *)pixels)[0], 0xFFFF0000);
+	CHECK_EQ(((uint32_t *)pixels)[W * H - 1], 0xFFFF0000);
+
+	paint_set_palette(NULL);
+	paint_compositor_fini(&comp);
+	paint_palette_destroy(pal);
+	free(pixels);
+}
+
+int main(void)
+{
+	struct paint_palette *argb = paint_palette_create_argb(NUM_COLORS, colors);
+	struct paint_palette *xrgb = paint_palette_create(NUM_COLORS, colors);
+
+	if (!argb || !xrgb) {
+		printf("Failed to create the palettes\n");
+		return 1;
+	}
+
+	test_translucent(argb);
+	test_opaque(xrgb);
+	test_argb_target();
+
+	paint_palette_destroy(argb);
+	paint_palette_destroy(xrgb);
+	return test_report("compose");
+}
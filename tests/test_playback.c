@@ -0,0 +1,237 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Playback of a file of raw frames, each one filled with its number, so
+ * that what playback_show() copies says which frame it was.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../drm_playback.h"
+#include "test.h"
+
+#define WIDTH 64
+#define HEIGHT 48
+#define FRAMES 40
+
+static char path[] = "/tmp/test_playback.XXXXXX";
+static char still_path[] = "/tmp/test_playback_still.XXXXXX";
+
+/* Big enough that staging it takes a while, scaled down to WIDTH x HEIGHT */
+#define STILL_W 1920
+#define STILL_H 1080
+
+static int write_frames(void)
+{
+	static uint32_t px[WIDTH * HEIGHT];
+	int fd, f, i;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return -1;
+
+	for (f = 0; f < FRAMES; f++) {
+		for (i = 0; i < WIDTH * HEIGHT; i++)
+			px[i] = 0xff000000 | f;
+		if (write(fd, px, sizeof(px)) != sizeof(px)) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	close(fd);
+	return 0;
+}
+
+/* One PPM frame, all gray */
+static int write_still(void)
+{
+	static uint8_t px[STILL_W * STILL_H * 3];
+	char hdr[32];
+	int fd, len, ok;
+
+	fd = mkstemp(still_path);
+	if (fd < 0)
+		return -1;
+
+	memset(px, 0x80, sizeof(px));
+	len = snprintf(hdr, sizeof(hdr), "P6\n%d %d\n255\n", STILL_W, STILL_H);
+	ok = write(fd, hdr, len) == len && write(fd, px, sizeof(px)) == sizeof(px);
+	close(fd);
+	return ok ? 0 : -1;
+}
+
+static double cpu_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The frame in buf, -1 if it isn't all one */
+static long frame_in(const struct paint_buf *buf)
+{
+	const uint32_t *px = (const uint32_t *)buf->base;
+	int i;
+
+	for (i = 1; i < WIDTH * HEIGHT; i++) {
+		if (px[i] != px[0])
+			return -1;
+	}
+
+	return px[0] & 0xffffff;
+}
+
+/* The prefetch thread has had the time to fill every free slot */
+static void settle(void)
+{
+	usleep(200 * 1000);
+}
+
+/* In time, every frame is shown at its vblank */
+static void test_in_order(struct paint_buf *buf)
+{
+	struct playback_config cfg = { .path = path, .width = WIDTH, .height = HEIGHT };
+	struct playback_stats stats;
+	struct playback *pb;
+	long v;
+
+	pb = playback_open(&cfg, WIDTH, HEIGHT, DRM_FORMAT_XRGB8888);
+	CHECK(pb);
+	if (!pb)
+		return;
+
+	CHECK_EQ(playback_vblanks(pb), FRAMES);
+	for (v = 0; v < 8; v++) {
+		settle();
+		CHECK_EQ(playback_show(pb, v, buf), v);
+		CHECK_EQ(frame_in(buf), v);
+	}
+
+	playback_get_stats(pb, &stats);
+	CHECK_EQ(stats.shown, 8);
+	CHECK_EQ(stats.dropped, 0);
+	playback_close(pb);
+}
+
+/*
+ * Behind the display, the prefetch thread skips past the frame due. The
+ * frame it skips to can't go on screen before its vblank: the last one
+ * staged before it stays till then.
+ */
+static void test_skip_ahead(struct paint_buf *buf)
+{
+	struct playback_config cfg = { .path = path, .width = WIDTH, .height = HEIGHT };
+	struct playback_stats stats;
+	struct playback *pb;
+	long shown, v;
+
+	pb = playback_open(&cfg, WIDTH, HEIGHT, DRM_FORMAT_XRGB8888);
+	CHECK(pb);
+	if (!pb)
+		return;
+
+	/* Frames 1 to 3 are staged, all of them late for vblank 10 */
+	settle();
+	shown = playback_show(pb, 10, buf);
+	CHECK(shown >= 0 && shown < 10);
+	CHECK_EQ(frame_in(buf), shown);
+
+	/* The thread has staged from 12 on since, which isn't due yet */
+	settle();
+	for (v = 10; v < 12; v++) {
+		CHECK_EQ(playback_show(pb, v, buf), shown);
+		CHECK_EQ(frame_in(buf), shown);
+	}
+
+	for (v = 12; v < 16; v++) {
+		settle();
+		CHECK_EQ(playback_show(pb, v, buf), v);
+		CHECK_EQ(frame_in(buf), v);
+	}
+
+	/* 10 and 11 were late, the frames from 12 on weren't */
+	playback_get_stats(pb, &stats);
+	CHECK_EQ(stats.dropped, 2);
+	CHECK_EQ(stats.shown, 4);
+	playback_close(pb);
+}
+
+/*
+ * A still with a frame rate is staged once, as without one: the prefetch
+ * thread has nothing more to do. Showing it for 60 vblanks costs next to
+ * nothing then, next to staging it once (in playback_open()) each vblank.
+ */
+static void test_still_fps(struct paint_buf *buf)
+{
+	struct playback_config cfg = { .path = still_path, .fps = 30, .refresh = 60 };
+	struct playback *pb;
+	double t, open_cpu, show_cpu;
+	long v;
+
+	t = cpu_seconds();
+	pb = playback_open(&cfg, WIDTH, HEIGHT, DRM_FORMAT_XRGB8888);
+	open_cpu = cpu_seconds() - t;
+	CHECK(pb);
+	if (!pb)
+		return;
+
+	t = cpu_seconds();
+	for (v = 0; v < 60; v++) {
+		usleep(5 * 1000);
+		CHECK_EQ(playback_show(pb, v, buf), 0);
+	}
+	show_cpu = cpu_seconds() - t;
+
+	CHECK_EQ(frame_in(buf), 0x808080);
+	if (show_cpu > 5 * open_cpu)
+		printf("Still shown with %.3fs of CPU, staging it takes %.3fs\n",
+			show_cpu, open_cpu);
+	CHECK(show_cpu <= 5 * open_cpu);
+	playback_close(pb);
+}
+
+int main(void)
+{
+	static uint32_t px[WIDTH * HEIGHT];
+	struct paint_buf buf;
+
+	if (write_frames() || write_still()) {
+		printf("Can't write the frames to %s\n", path);
+		return 1;
+	}
+
+	paint_buf_init(&buf, (char *)px, WIDTH, HEIGHT, 0, DRM_FORMAT_XRGB8888);
+	test_in_order(&buf);
+	test_skip_ahead(&buf);
+	test_still_fps(&buf);
+
+	unlink(path);
+	unlink(still_path);
+	return test_report("playback");
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Snapshot files: one saved from a snapshot built by hand loads back, and
+ * one whose objects point outside the shared arrays is rejected.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../drm_snapshot.h"
+#include "test.h"
+
+static char path[] = "/tmp/test_snapshot.XXXXXX";
+
+static struct snap_connector conn;
+static struct snap_plane plane;
+static drmModeModeInfo modes[2];
+static struct snap_prop props[3];
+static uint32_t formats[2];
+static struct snap_modifier modifiers[1];
+static uint8_t blob[16];
+
+/* A connector with 2 modes, a plane, and a blob property, all in range */
+static void build(struct drm_snapshot *snap)
+{
+	memset(snap, 0, sizeof(*snap));
+	memset(props, 0, sizeof(props));
+	conn = (struct snap_connector) {
+		.id = 1,
+		.modes = { 0, 2 },
+		.props = { 0, 1 },
+	};
+	plane = (struct snap_plane) {
+		.id = 2,
+		.formats = { 0, 2 },
+		.modifiers = { 0, 1 },
+		.props = { 1, 2 },
+	};
+	strcpy(props[0].name, "EDID");
+	props[0].blob = (struct snap_range) { 0, sizeof(blob) };
+	strcpy(props[1].name, "type");
+	strcpy(props[2].name, "IN_FORMATS");
+
+	snap->connectors = &conn;
+	snap->count[SNAP_CONNECTORS] = 1;
+	snap->planes = &plane;
+	snap->count[SNAP_PLANES] = 1;
+	snap->modes = modes;
+	snap->count[SNAP_MODES] = 2;
+	snap->props = props;
+	snap->count[SNAP_PROPS] = 3;
+	snap->formats = formats;
+	snap->count[SNAP_FORMATS] = 2;
+	snap->modifiers = modifiers;
+	snap->count[SNAP_MODIFIERS] = 1;
+	snap->blob_data = blob;
+	snap->count[SNAP_BLOB_DATA] = sizeof(blob);
+}
+
+/* 0 if what was saved loads back */
+static int save_load(const struct drm_snapshot *snap)
+{
+	struct drm_snapshot loaded;
+
+	if (snapshot_save(snap, path))
+		return -2;
+	if (snapshot_load(&loaded, path))
+		return -1;
+
+	CHECK_EQ(loaded.count[SNAP_PROPS], 3);
+	CHECK_EQ(loaded.connectors[0].modes.count, 2);
+	snapshot_free(&loaded);
+	return 0;
+}
+
+static void test_valid(void)
+{
+	struct drm_snapshot snap;
+
+	build(&snap);
+	CHECK_EQ(save_load(&snap), 0);
+
+	/* Empty ranges, at the very end of their array too */
+	plane.modifiers = (struct snap_range) { 1, 0 };
+	props[0].blob = (struct snap_range) { sizeof(blob), 0 };
+	CHECK_EQ(save_load(&snap), 0);
+}
+
+static void test_out_of_range(void)
+{
+	struct drm_snapshot snap;
+
+	build(&snap);
+	conn.modes.count = 3;
+	CHECK_EQ(save_load(&snap), -1);
+
+	build(&snap);
+	conn.props.first = 3;
+	conn.props.count = 1;
+	CHECK_EQ(save_load(&snap), -1);
+
+	build(&snap);
+	plane.formats.first = 1;
+	CHECK_EQ(save_load(&snap), -1);
+
+	build(&snap);
+	plane.modifiers.first = 2;
+	plane.modifiers.count = 0;
+	CHECK_EQ(save_load(&snap), -1);
+
+	build(&snap);
+	props[0].blob.count = sizeof(blob) + 1;
+	CHECK_EQ(save_load(&snap), -1);
+}
+
+/* first + count wraps around to something small */
+static void test_overflow(void)
+{
+	struct drm_snapshot snap;
+
+	build(&snap);
+	plane.props = (struct snap_range) { UINT32_MAX, 2 };
+	CHECK_EQ(save_load(&snap), -1);
+
+	build(&snap);
+	props[0].blob = (struct snap_range) { 8, UINT32_MAX - 4 };
+	CHECK_EQ(save_load(&snap), -1);
+}
+
+static void test_unterminated_name(void)
+{
+	struct drm_snapshot snap;
+
+	build(&snap);
+	memset(props[1].enum_name, 'x', SNAP_NAME_LEN);
+	CHECK_EQ(save_load(&snap), -1);
+}
+
+int main(void)
+{
+	int fd = mkstemp(path);
+
+	if (fd < 0) {
+		printf("Can't create %s\n", path);
+		return 1;
+	}
+	close(fd);
+
+	test_valid();
+	test_out_of_range();
+	test_overflow();
+	test_unterminated_name();
+
+	unlink(path);
+	return test_report("snapshot");
+}
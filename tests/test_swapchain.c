@@ -0,0 +1,379 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * The swapchain against mock DRM ops, in process: flips are queued in
+ * the mock and their events come when the swapchain waits for one, unless
+ * the test holds them back. Every call goes in a log, to check the order.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "../drm_swapchain.h"
+#include "test.h"
+
+#define NUM_BUFS 3
+#define LOG_MAX 64
+
+enum mock_call {
+	CALL_SET_CRTC,
+	CALL_PAGE_FLIP,
+	CALL_EVENT,
+	CALL_DIRTY_FB,
+};
+
+struct mock {
+	/* Flip queued and not completed yet */
+	struct fb *queued;
+	/* Events don't come while set, like a hung display */
+	int stall;
+	unsigned int seq;
+	int fail_flip;
+
+	int calls;
+	enum mock_call log[LOG_MAX];
+	struct fb *log_fb[LOG_MAX];
+	int clips;
+};
+
+static void mock_log(struct mock *m, enum mock_call call, struct fb *fb)
+{
+	if (m->calls < LOG_MAX) {
+		m->log[m->calls] = call;
+		m->log_fb[m->calls] = fb;
+	}
+	m->calls++;
+}
+
+static int mock_set_crtc(struct swapchain *sc, struct fb *fb)
+{
+	mock_log(sc->priv, CALL_SET_CRTC, fb);
+	return 0;
+}
+
+static int mock_page_flip(struct swapchain *sc, struct fb *fb)
+{
+	struct mock *m = sc->priv;
+
+	if (m->fail_flip)
+		return -EBUSY;
+
+	/* The kernel takes one flip per CRTC at a time */
+	CHECK(!m->queued);
+	m->queued = fb;
+	mock_log(m, CALL_PAGE_FLIP, fb);
+	return 0;
+}
+
+static int mock_wait_event(struct swapchain *sc, int timeout_ms)
+{
+	struct mock *m = sc->priv;
+
+	return m->queued && !m->stall;
+}
+
+static int mock_handle_event(struct swapchain *sc)
+{
+	struct mock *m = sc->priv;
+	struct fb *fb = m->queued;
+
+	if (!fb)
+		return 0;
+
+	m->queued = NULL;
+	m->seq++;
+	mock_log(m, CALL_EVENT, fb);
+	sc->evctx.page_flip_handler(sc->drm_fd, m->seq, m->seq / 60,
+			m->seq % 60 * 16666, sc);
+	return 0;
+}
+
+static int mock_dirty_fb(struct swapchain *sc, struct fb *fb, drmModeClipPtr clips, int num_clips)
+{
+	struct mock *m = sc->priv;
+
+	mock_log(m, CALL_DIRTY_FB, fb);
+	m->clips = num_clips;
+	return 0;
+}
+
+static const struct swapchain_ops mock_ops = {
+	.set_crtc = mock_set_crtc,
+	.page_flip = mock_page_flip,
+	.wait_event = mock_wait_event,
+	.handle_event = mock_handle_event,
+	.dirty_fb = mock_dirty_fb,
+};
+
+/* Flips the callback saw, in order */
+struct flip_log {
+	int count;
+	struct fb *fbs[LOG_MAX];
+	unsigned int seqs[LOG_MAX];
+};
+
+static void on_flip(struct swapchain *sc, struct fb *fb, unsigned int seq,
+		unsigned int tv_sec, unsigned int tv_usec, void *data)
+{
+	struct flip_log *fl = data;
+
+	/* By the time it's called, the flip is done */
+	CHECK(sc->pending < 0);
+	CHECK(sc->bufs[sc->front] == fb);
+	if (fl->count < LOG_MAX) {
+		fl->fbs[fl->count] = fb;
+		fl->seqs[fl->count] = seq;
+	}
+	fl->count++;
+}
+
+static struct drm_display display;
+static struct fb fbs[NUM_BUFS];
+
+static void setup(struct swapchain *sc, struct mock *m, int count)
+{
+	struct fb *bufs[NUM_BUFS] = { &fbs[0], &fbs[1], &fbs[2] };
+
+	memset(m, 0, sizeof(*m));
+	memset(fbs, 0, sizeof(fbs));
+	CHECK_EQ(swapchain_init(sc, -1, &display, bufs, count, &mock_ops, m), 0);
+}
+
+static void states(struct swapchain *sc, enum sc_buf_state s0, enum sc_buf_state s1,
+		enum sc_buf_state s2)
+{
+	CHECK_EQ(sc->state[0], s0);
+	CHECK_EQ(sc->state[1], s1);
+	CHECK_EQ(sc->state[2], s2);
+}
+
+/* The first present is the modeset, the later ones are flips */
+static void test_present_order(void)
+{
+	struct flip_log fl = { 0, };
+	struct swapchain sc;
+	struct mock m;
+	struct fb *a, *b, *c;
+
+	setup(&sc, &m, NUM_BUFS);
+	swapchain_set_flip_cb(&sc, on_flip, &fl);
+	states(&sc, SC_BUF_FREE, SC_BUF_FREE, SC_BUF_FREE);
+
+	a = swapchain_acquire(&sc);
+	CHECK(a == &fbs[0]);
+	states(&sc, SC_BUF_ACQUIRED, SC_BUF_FREE, SC_BUF_FREE);
+
+	CHECK_EQ(swapchain_present(&sc, a), 0);
+	states(&sc, SC_BUF_SCANOUT, SC_BUF_FREE, SC_BUF_FREE);
+	CHECK_EQ(m.calls, 1);
+	CHECK_EQ(m.log[0], CALL_SET_CRTC);
+	CHECK_EQ(fl.count, 0);
+
+	b = swapchain_acquire(&sc);
+	CHECK(b == &fbs[1]);
+	CHECK_EQ(swapchain_present(&sc, b), 0);
+	states(&sc, SC_BUF_SCANOUT, SC_BUF_PENDING, SC_BUF_FREE);
+	CHECK_EQ(m.log[1], CALL_PAGE_FLIP);
+
+	/* A buffer is still free, so acquiring doesn't wait for the flip */
+	c = swapchain_acquire(&sc);
+	CHECK(c == &fbs[2]);
+	CHECK_EQ(m.calls, 2);
+	states(&sc, SC_BUF_SCANOUT, SC_BUF_PENDING, SC_BUF_ACQUIRED);
+
+	/* One flip at a time: b's has to land before c's is queued */
+	CHECK_EQ(swapchain_present(&sc, c), 0);
+	CHECK_EQ(m.calls, 4);
+	CHECK_EQ(m.log[2], CALL_EVENT);
+	CHECK(m.log_fb[2] == b);
+	CHECK_EQ(m.log[3], CALL_PAGE_FLIP);
+	CHECK(m.log_fb[3] == c);
+	states(&sc, SC_BUF_FREE, SC_BUF_SCANOUT, SC_BUF_PENDING);
+
+	CHECK_EQ(swapchain_wait_idle(&sc), 0);
+	states(&sc, SC_BUF_FREE, SC_BUF_FREE, SC_BUF_SCANOUT);
+	CHECK_EQ(sc.front, 2);
+	CHECK_EQ(sc.pending, -1);
+	CHECK_EQ(sc.flips, 2);
+	CHECK_EQ(sc.last_seq, 2);
+
+	CHECK_EQ(fl.count, 2);
+	CHECK(fl.fbs[0] == b && fl.fbs[1] == c);
+	CHECK(fl.seqs[0] == 1 && fl.seqs[1] == 2);
+
+	/* Nothing in flight: waiting returns right away */
+	CHECK_EQ(swapchain_wait_idle(&sc), 0);
+	CHECK_EQ(m.calls, 5);
+}
+
+/* With every buffer taken, acquiring waits for the flip which frees one */
+static void test_acquire_waits(void)
+{
+	struct swapchain sc;
+	struct mock m;
+	struct fb *a, *b;
+
+	setup(&sc, &m, 2);
+
+	a = swapchain_acquire(&sc);
+	swapchain_present(&sc, a);
+	b = swapchain_acquire(&sc);
+	swapchain_present(&sc, b);
+	CHECK_EQ(sc.state[0], SC_BUF_SCANOUT);
+	CHECK_EQ(sc.state[1], SC_BUF_PENDING);
+
+	CHECK(!swapchain_try_acquire(&sc));
+
+	/* The flip to b lands, and a is free again */
+	CHECK(swapchain_acquire(&sc) == a);
+	CHECK_EQ(m.log[m.calls - 1], CALL_EVENT);
+	CHECK_EQ(sc.state[0], SC_BUF_ACQUIRED);
+	CHECK_EQ(sc.state[1], SC_BUF_SCANOUT);
+
+	/* Nothing in flight and nothing free, acquiring can't wait for anything */
+	CHECK(!swapchain_acquire(&sc));
+}
+
+/* A flip whose event never comes makes wait_idle time out */
+static void test_wait_idle_timeout(void)
+{
+	struct swapchain sc;
+	struct mock m;
+	struct fb *a, *b;
+
+	setup(&sc, &m, 2);
+
+	a = swapchain_acquire(&sc);
+	swapchain_present(&sc, a);
+	b = swapchain_acquire(&sc);
+	swapchain_present(&sc, b);
+
+	m.stall = 1;
+	CHECK_EQ(swapchain_wait_idle(&sc), -ETIMEDOUT);
+	CHECK_EQ(sc.state[1], SC_BUF_PENDING);
+	CHECK(!swapchain_front(&sc));
+
+	m.stall = 0;
+	CHECK_EQ(swapchain_wait_idle(&sc), 0);
+	CHECK(swapchain_front(&sc) == b);
+}
+
+static void test_cancel_hold_release(void)
+{
+	struct swapchain sc;
+	struct mock m;
+	struct fb *a, *b;
+
+	setup(&sc, &m, NUM_BUFS);
+
+	a = swapchain_acquire(&sc);
+	swapchain_cancel(&sc, a);
+	states(&sc, SC_BUF_FREE, SC_BUF_FREE, SC_BUF_FREE);
+
+	/* Only acquired buffers go on screen */
+	CHECK_EQ(swapchain_present(&sc, a), -EINVAL);
+	CHECK_EQ(m.calls, 0);
+
+	CHECK_EQ(swapchain_hold(&sc, &fbs[0]), 0);
+	CHECK_EQ(swapchain_hold(&sc, &fbs[0]), -EINVAL);
+	b = swapchain_acquire(&sc);
+	CHECK(b == &fbs[1]);
+	states(&sc, SC_BUF_HELD, SC_BUF_ACQUIRED, SC_BUF_FREE);
+
+	/* A held buffer stays held through flips */
+	swapchain_present(&sc, b);
+	b = swapchain_acquire(&sc);
+	swapchain_present(&sc, b);
+	swapchain_wait_idle(&sc);
+	states(&sc, SC_BUF_HELD, SC_BUF_FREE, SC_BUF_SCANOUT);
+
+	swapchain_release(&sc, &fbs[0]);
+	CHECK_EQ(sc.state[0], SC_BUF_FREE);
+	CHECK(swapchain_acquire(&sc) == &fbs[0]);
+}
+
+/* A failed flip leaves the buffer acquired, for the caller to retry or cancel */
+static void test_flip_failure(void)
+{
+	struct swapchain sc;
+	struct mock m;
+	struct fb *a, *b;
+
+	setup(&sc, &m, 2);
+
+	a = swapchain_acquire(&sc);
+	swapchain_present(&sc, a);
+	b = swapchain_acquire(&sc);
+
+	m.fail_flip = 1;
+	CHECK_EQ(swapchain_present(&sc, b), -EBUSY);
+	CHECK_EQ(sc.state[1], SC_BUF_ACQUIRED);
+	CHECK_EQ(sc.pending, -1);
+
+	m.fail_flip = 0;
+	CHECK_EQ(swapchain_present(&sc, b), 0);
+	CHECK_EQ(sc.state[1], SC_BUF_PENDING);
+}
+
+/* Updates in place send the damage of the buffer on screen, after the flip to it */
+static void test_flush(void)
+{
+	struct swapchain sc;
+	struct mock m;
+	struct fb *a, *b;
+
+	setup(&sc, &m, 2);
+
+	CHECK(swapchain_flush(&sc) < 0);
+
+	a = swapchain_acquire(&sc);
+	swapchain_present(&sc, a);
+	b = swapchain_acquire(&sc);
+	swapchain_present(&sc, b);
+
+	paint_damage_add(&b->damage, 0, 0, 10, 10);
+	paint_damage_add(&b->damage, 100, 100, 10, 10);
+	CHECK_EQ(swapchain_flush(&sc), 0);
+	CHECK_EQ(m.log[m.calls - 2], CALL_EVENT);
+	CHECK_EQ(m.log[m.calls - 1], CALL_DIRTY_FB);
+	CHECK(m.log_fb[m.calls - 1] == b);
+	CHECK_EQ(m.clips, 2);
+	CHECK_EQ(b->damage.count, 0);
+
+	/* No damage, nothing to send */
+	CHECK_EQ(swapchain_flush(&sc), 0);
+	CHECK_EQ(m.calls, 4);
+}
+
+int main(void)
+{
+	test_present_order();
+	test_acquire_waits();
+	test_wait_idle_timeout();
+	test_cancel_hold_release();
+	test_flip_failure();
+	test_flush();
+
+	return test_report("swapchain");
+}
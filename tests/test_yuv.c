@@ -0,0 +1,185 @@
+/*
+ * Copyright 2022 Shashank Sharma (contactshashanksharma@gmail.com)
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * YUV conversion of every XRGB8888 color against a float reference, for
+ * all the formats, encodings and ranges: samples are as close as paint.h
+ * says. Blocks of 2x2 pixels have one color, so chroma is of that color.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "../paint.h"
+#include "test.h"
+
+/* 4096 x 4096 pixels, 2048 x 2048 blocks: a quarter of the colors per pass */
+#define W 4096
+#define H 4096
+
+/* What paint.h promises */
+#define BOUND_8 0.52
+#define BOUND_10 0.55
+
+struct reference {
+	double kr, kg, kb;
+	double y_scale, c_scale, y_off, c_off, max;
+};
+
+static void reference_init(struct reference *ref, int depth,
+		enum paint_yuv_encoding encoding, enum paint_yuv_range range)
+{
+	int mul = 1 << (depth - 8);
+
+	ref->kr = encoding == PAINT_YUV_BT709 ? 0.2126 : 0.299;
+	ref->kb = encoding == PAINT_YUV_BT709 ? 0.0722 : 0.114;
+	ref->kg = 1 - ref->kr - ref->kb;
+	ref->max = (1 << depth) - 1;
+	ref->c_off = 128 * mul;
+	if (range == PAINT_YUV_FULL) {
+		ref->y_scale = ref->c_scale = ref->max / 255;
+		ref->y_off = 0;
+	} else {
+		ref->y_scale = 219.0 * mul / 255;
+		ref->c_scale = 224.0 * mul / 255;
+		ref->y_off = 16 * mul;
+	}
+}
+
+static double clamp(const struct reference *ref, double v)
+{
+	return v < 0 ? 0 : v > ref->max ? ref->max : v;
+}
+
+static uint32_t color_at(int pass, int x, int y)
+{
+	return (uint32_t)pass << 22 | ((uint32_t)(y / 2) * (W / 2) + x / 2);
+}
+
+/* Y, U and V of block (bx, by), the top 10 bits of P010 samples */
+static void sample(const struct paint_yuv_buf *buf, int bx, int by, int *y, int *u, int *v)
+{
+	const char *yp = buf->planes[0] + (long)by * 2 * buf->pitches[0];
+	const char *cp = buf->planes[1] + (long)by * buf->pitches[1];
+
+	if (buf->format == DRM_FORMAT_P010) {
+		*y = ((const uint16_t *)yp)[bx * 2] >> 6;
+		*u = ((const uint16_t *)cp)[bx * 2] >> 6;
+		*v = ((const uint16_t *)cp)[bx * 2 + 1] >> 6;
+	} else {
+		*y = ((const uint8_t *)yp)[bx * 2];
+		*u = ((const uint8_t *)cp)[bx * 2];
+		*v = ((const uint8_t *)cp)[bx * 2 + 1];
+	}
+}
+
+/* The largest distance to the reference, of any sample */
+static double max_error(const struct paint_view *src, int pass, uint32_t format, int depth,
+		enum paint_yuv_encoding encoding, enum paint_yuv_range range)
+{
+	struct paint_yuv_buf buf;
+	struct reference ref;
+	double r, g, b, luma, err = 0;
+	long size = paint_yuv_buf_init(&buf, NULL, W, H, 0, format);
+	char *base = malloc(size);
+	int bx, by, y, u, v;
+	uint32_t c;
+
+	if (!base || paint_yuv_buf_init(&buf, base, W, H, 0, format) != size ||
+		paint_convert_to_yuv(&buf, src, encoding, range)) {
+		free(base);
+		return INFINITY;
+	}
+
+	reference_init(&ref, depth, encoding, range);
+	for (by = 0; by < H / 2; by++) {
+		for (bx = 0; bx < W / 2; bx++) {
+			c = color_at(pass, bx * 2, by * 2);
+			r = c >> 16 & 0xFF;
+			g = c >> 8 & 0xFF;
+			b = c & 0xFF;
+			luma = ref.kr * r + ref.kg * g + ref.kb * b;
+
+			sample(&buf, bx, by, &y, &u, &v);
+			err = fmax(err, fabs(y - clamp(&ref, ref.y_off + luma * ref.y_scale)));
+			err = fmax(err, fabs(u - clamp(&ref, ref.c_off +
+					(b - luma) / (2 * (1 - ref.kb)) * ref.c_scale)));
+			err = fmax(err, fabs(v - clamp(&ref, ref.c_off +
+					(r - luma) / (2 * (1 - ref.kr)) * ref.c_scale)));
+		}
+	}
+
+	free(base);
+	return err;
+}
+
+int main(void)
+{
+	static const struct {
+		uint32_t format;
+		int depth;
+		double bound;
+	} formats[] = {
+		{ DRM_FORMAT_NV12, 8, BOUND_8 },
+		{ DRM_FORMAT_P010, 10, BOUND_10 },
+	};
+	uint32_t *px = malloc((size_t)W * H * 4);
+	struct paint_view src = {
+		.base = (char *)px,
+		.width = W,
+		.height = H,
+		.stride = W * 4,
+		.format = DRM_FORMAT_XRGB8888,
+	};
+	double err[2] = { 0, 0 };
+	int pass, f, e, r, x, y;
+
+	if (!px) {
+		printf("Out of memory\n");
+		return 1;
+	}
+
+	for (pass = 0; pass < 4; pass++) {
+		for (y = 0; y < H; y++) {
+			for (x = 0; x < W; x++)
+				px[(size_t)y * W + x] = color_at(pass, x, y);
+		}
+
+		for (f = 0; f < 2; f++) {
+			for (e = PAINT_YUV_BT601; e <= PAINT_YUV_BT709; e++) {
+				for (r = PAINT_YUV_LIMITED; r <= PAINT_YUV_FULL; r++)
+					err[f] = fmax(err[f], max_error(&src, pass, formats[f].format,
+							formats[f].depth, e, r));
+			}
+		}
+	}
+
+	for (f = 0; f < 2; f++) {
+		printf("%d bit: %.3f of a code value off at most\n", formats[f].depth, err[f]);
+		CHECK(err[f] <= formats[f].bound);
+	}
+
+	free(px);
+	return test_report("yuv");
+}